@@ -0,0 +1,889 @@
+//
+// Fs 多线程读写性能测试
+//
+
+#include "FileType.h"
+#include "utility.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "pool.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// 测试目录规模
+#define BENCH_DIRS 16
+#define BENCH_FILES 32
+// 压力测试中共享的文件夹、文件和子文件夹数量
+#define BENCH_STRESS_DIRS 8
+#define BENCH_STRESS_FILES 16
+#define BENCH_STRESS_SUBDIRS 4
+// 大文件测试中每个文件的大小和每次读写的字节数
+#define BENCH_BIG_SIZE (4 * 1024 * 1024)
+#define BENCH_BIG_BLOCK 4096
+// 压力测试写入的内容，追加之后长到足以被压缩
+#define BENCH_STRESS_CONTENT                                                   \
+  "stress-content\nstress-content\nstress-content\nstress-content\n"
+// 压力测试中后台压缩的空闲时间（毫秒）
+#define BENCH_COMPACT_IDLE 1
+// 压力测试中的内存预算（字节），使内容不断溢出和读回
+#define BENCH_BUDGET (64 * 1024)
+// 批量移动、复制测试的文件数
+#define BENCH_BATCH_FILES 4096
+// FsBuildFromPaths 一次创建的路径数量
+#define BENCH_LOAD_PATHS (1 << 20)
+// 逐个创建作为对比的路径数量，只取前一部分，文件夹的大小相同
+#define BENCH_LOAD_SAMPLE (1 << 18)
+// 导入测试在宿主机上生成的文件夹数、每个文件夹中的小文件数和大小，
+// 以及大文件的数量和大小
+#define BENCH_IMPORT_DIRS 32
+#define BENCH_IMPORT_FILES 64
+#define BENCH_IMPORT_SMALL (16 * 1024)
+#define BENCH_IMPORT_BIGS 4
+#define BENCH_IMPORT_BIG (8 * 1024 * 1024)
+// 每轮测试的最大线程数
+#define BENCH_MAX_THREADS 32
+// 每轮测试时长（秒）
+#define BENCH_SECONDS 0.5
+
+typedef struct {
+  Fs fs;
+  // 测试的操作
+  void (*op)(Fs fs, unsigned int *seed, int id);
+  // 所有线程同时开始、同时结束
+  atomic_bool *running;
+  pthread_barrier_t *barrier;
+  // 完成的操作数
+  unsigned long ops;
+  unsigned int seed;
+  int id;
+} BenchWorker;
+
+static double BenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// 路径解析：cd 到随机目录后读取 cwd，不产生输出
+static void BenchOpLookup(Fs fs, unsigned int *seed, int id) {
+  char path[64];
+  char cwd[PATH_MAX + 1];
+  snprintf(path, sizeof(path), "/d%02d/s/f%02d/../../s",
+           rand_r(seed) % BENCH_DIRS, rand_r(seed) % BENCH_FILES);
+  FsCd(fs, path);
+  FsGetCwd(fs, cwd);
+}
+
+/// 读取随机文件的内容
+static void BenchOpCat(Fs fs, unsigned int *seed, int id) {
+  char path[64];
+  snprintf(path, sizeof(path), "/d%02d/f%02d", rand_r(seed) % BENCH_DIRS,
+           rand_r(seed) % BENCH_FILES);
+  FsCat(fs, path);
+}
+
+/// FsCatQuiet 的回调，只统计字节数
+static void BenchCatCount(const char *data, size_t length, void *ctx) {
+  *(size_t *)ctx += length;
+}
+
+/// 用静默接口读取随机文件的内容，没有格式化输出的开销
+static void BenchOpCatQuiet(Fs fs, unsigned int *seed, int id) {
+  char path[64];
+  size_t total = 0;
+  snprintf(path, sizeof(path), "/d%02d/f%02d", rand_r(seed) % BENCH_DIRS,
+           rand_r(seed) % BENCH_FILES);
+  FsCatQuiet(fs, path, BenchCatCount, &total, NULL);
+}
+
+/// 列出随机目录
+static void BenchOpLs(Fs fs, unsigned int *seed, int id) {
+  char path[64];
+  snprintf(path, sizeof(path), "/d%02d", rand_r(seed) % BENCH_DIRS);
+  FsLs(fs, path);
+}
+
+/// 从随机位置读取一页文件夹项
+static void BenchOpReaddir(Fs fs, unsigned int *seed, int id) {
+  char path[64];
+  char after[16];
+  FsDir *dir = NULL;
+  const FsDirent *entry = NULL;
+  snprintf(path, sizeof(path), "/d%02d/s", rand_r(seed) % BENCH_DIRS);
+  snprintf(after, sizeof(after), "f%02d", rand_r(seed) % BENCH_FILES);
+  FsOpendir(fs, path, after, &dir);
+  for (int i = 0; i < 8 && FsReaddir(dir, &entry) == FS_OK && entry; i++)
+    ;
+  FsClosedir(dir);
+}
+
+/// 每个线程写自己文件夹下的文件，互不冲突
+static void BenchOpPut(Fs fs, unsigned int *seed, int id) {
+  char path[64];
+  snprintf(path, sizeof(path), "/w%02d/f%02d", id, rand_r(seed) % BENCH_FILES);
+  FsPut(fs, path, "benchmark-content\n");
+}
+
+// 每个线程追加的文件达到这个大小后清空
+#define BENCH_APPEND_LIMIT (1 << 22)
+
+// 每个线程预先打开自己文件夹下的文件
+static FsHandle *benchHandles[BENCH_MAX_THREADS][BENCH_FILES];
+// 压力测试中每个线程跨操作持有的句柄，文件可能在此期间被移动、删除
+static FsHandle *benchStressHandles[BENCH_MAX_THREADS];
+// 大文件测试中每个线程的文件
+static FsHandle *benchBigHandles[BENCH_MAX_THREADS];
+// 压力测试中快照的内容是否发生过变化，撤销的事务是否没有还原
+static atomic_bool benchMismatch;
+
+/// 通过预先打开的句柄写入再读回，与 put 对比省去的路径解析
+static void BenchOpHandle(Fs fs, unsigned int *seed, int id) {
+  static const char content[] = "benchmark-content\n";
+  char buf[sizeof(content)];
+  size_t bytes;
+  FsHandle *handle = benchHandles[id][rand_r(seed) % BENCH_FILES];
+  FsWriteAt(handle, content, sizeof(content) - 1, 0);
+  FsReadAt(handle, buf, sizeof(buf), 0, &bytes);
+}
+
+/// 追加到自己的日志文件，每次的代价不随文件变大而增加
+static void BenchOpAppend(Fs fs, unsigned int *seed, int id) {
+  static const char line[] = "benchmark-log-line\n";
+  static size_t sizes[BENCH_MAX_THREADS];
+  char path[64];
+  snprintf(path, sizeof(path), "/w%02d/log", id);
+  FsAppend(fs, path, line, sizeof(line) - 1);
+  sizes[id] += sizeof(line) - 1;
+  if (sizes[id] >= BENCH_APPEND_LIMIT) {
+    FsPut(fs, path, "");
+    sizes[id] = 0;
+  }
+}
+
+/// 写入临时文件后在同一个文件夹中改名，即先写后改名的原子替换，
+/// 目标不存在，两个名字轮流使用
+static void BenchOpRename(Fs fs, unsigned int *seed, int id) {
+  static int flip[BENCH_MAX_THREADS];
+  char from[64];
+  char to[64];
+  char *src[] = {from, NULL};
+  snprintf(from, sizeof(from), "/w%02d/%s", id, flip[id] ? "ready" : "tmp");
+  snprintf(to, sizeof(to), "/w%02d/%s", id, flip[id] ? "tmp" : "ready");
+  FsPut(fs, from, "rename-content\n");
+  FsMv(fs, src, to);
+  flip[id] ^= 1;
+}
+
+/// 在大文件的随机位置覆盖写入一块再读回，代价只与块大小有关
+static void BenchOpBig(Fs fs, unsigned int *seed, int id) {
+  static const char block[BENCH_BIG_BLOCK];
+  char buf[BENCH_BIG_BLOCK];
+  size_t offset = (size_t)rand_r(seed) % (BENCH_BIG_SIZE - BENCH_BIG_BLOCK);
+  FsWriteAt(benchBigHandles[id], block, sizeof(block), offset);
+  FsReadAt(benchBigHandles[id], buf, sizeof(buf),
+           (size_t)rand_r(seed) % BENCH_BIG_SIZE, NULL);
+}
+
+/// 压力测试：在共享的文件夹间随机创建、写入、移动文件和文件夹。
+/// 文件夹只移动不新建，文件数量受同名检查限制，树的规模不会无限增长。
+/// 同时运行后台压缩，读写可能遇到刚被压缩的内容
+static void BenchOpStress(Fs fs, unsigned int *seed, int id) {
+  char path[64];
+  char dest[64];
+  int a = rand_r(seed) % BENCH_STRESS_DIRS;
+  int b = rand_r(seed) % BENCH_STRESS_DIRS;
+  int f = rand_r(seed) % BENCH_STRESS_FILES;
+  int d = rand_r(seed) % BENCH_STRESS_SUBDIRS;
+  char *src[] = {path, NULL};
+  snprintf(path, sizeof(path), "/s%d/f%02d", a, f);
+  switch (rand_r(seed) % 15) {
+  case 0:
+    // 逐层创建时其他线程可能同时移动、删除路径上的文件夹
+    if (rand_r(seed) % 2) {
+      FsMkfile(fs, path);
+    } else {
+      snprintf(dest, sizeof(dest), "/s%d/d%d/p%d/q", a, d, rand_r(seed) % 2);
+      FsMkdirP(fs, dest);
+    }
+    break;
+  case 1:
+    // 原地追加时可能有其他线程正在无锁读取同一个文件
+    if (rand_r(seed) % 2)
+      FsPut(fs, path, BENCH_STRESS_CONTENT);
+    else
+      FsAppend(fs, path, "stress-append\n", 14);
+    break;
+  case 2:
+    FsCat(fs, path);
+    break;
+  case 3: {
+    // 一次移动或复制多个文件，可能重名、不存在或已经在目标中；
+    // 不递归复制时跳过文件夹
+    char other[64];
+    char dir[64];
+    char *batch[] = {path, other, dir, NULL};
+    snprintf(other, sizeof(other), "/s%d/f%02d", a,
+             rand_r(seed) % BENCH_STRESS_FILES);
+    snprintf(dir, sizeof(dir), "/s%d/d%d", a, d);
+    snprintf(dest, sizeof(dest), "/s%d", b);
+    if (rand_r(seed) % 2)
+      FsMv(fs, batch, dest);
+    else
+      FsCp(fs, false, batch, dest);
+    break;
+  }
+  case 4:
+    // 文件夹之间互相移动，可能嵌套，也会尝试移动到自己里面
+    snprintf(path, sizeof(path), "/s%d/d%d", a, d);
+    snprintf(dest, sizeof(dest), "/s%d/d%d", b,
+             rand_r(seed) % BENCH_STRESS_SUBDIRS);
+    FsMv(fs, src, dest);
+    break;
+  case 5:
+    // 把嵌套的文件夹移回上层
+    snprintf(path, sizeof(path), "/s%d/d%d/d%d", a, d,
+             rand_r(seed) % BENCH_STRESS_SUBDIRS);
+    snprintf(dest, sizeof(dest), "/s%d", b);
+    FsMv(fs, src, dest);
+    break;
+  case 6: {
+    // 其他线程同时插入、删除时，迭代器读到的名字仍然严格递增
+    char last[64] = "";
+    FsDir *dir = NULL;
+    const FsDirent *entry = NULL;
+    snprintf(path, sizeof(path), "/s%d", a);
+    if (rand_r(seed) % 2 || FsOpendir(fs, path, NULL, &dir)) {
+      FsLs(fs, path);
+      break;
+    }
+    while (FsReaddir(dir, &entry) == FS_OK && entry) {
+      if (strcmp(last, entry->name) >= 0)
+        atomic_store(&benchMismatch, true);
+      snprintf(last, sizeof(last), "%s", entry->name);
+    }
+    FsClosedir(dir);
+    break;
+  }
+  case 7:
+    // 删除的文件可能正在被 FsCat / FsLs 无锁读取
+    FsDl(fs, false, path);
+    break;
+  case 8:
+    // 目标不存在时改名，存在时覆盖
+    snprintf(dest, sizeof(dest), "/s%d/f%02d", b,
+             rand_r(seed) % BENCH_STRESS_FILES);
+    FsMv(fs, src, dest);
+    break;
+  case 9:
+    // 轮流打开、关闭，句柄在其他线程移动、删除文件期间保持打开
+    if (benchStressHandles[id]) {
+      char buf[32];
+      FsWriteAt(benchStressHandles[id], "handle", 6, rand_r(seed) % 16);
+      FsReadAt(benchStressHandles[id], buf, sizeof(buf), 0, NULL);
+      FsClose(benchStressHandles[id]);
+      benchStressHandles[id] = NULL;
+    } else {
+      FsOpen(fs, path, FS_OPEN_READ | FS_OPEN_WRITE, &benchStressHandles[id]);
+    }
+    break;
+  case 10:
+    // 链接与删除、移动同时进行；符号链接可能悬空，也可能指向文件夹。
+    // 链接已经存在时删除它
+    snprintf(dest, sizeof(dest), "/s%d/l%02d", b,
+             rand_r(seed) % BENCH_STRESS_FILES);
+    if (FsLink(fs, rand_r(seed) % 2 ? path : "d0", dest, rand_r(seed) % 2))
+      FsDl(fs, true, dest);
+    else
+      FsCat(fs, dest);
+    break;
+  case 11: {
+    // 快照在其他线程修改期间保持不变，两次统计的结果相同
+    Fs snapshot = FsSnapshot(fs);
+    FsStatsInfo first;
+    FsStatsInfo second;
+    FsStatsGet(snapshot, "/", &first);
+    FsStatsGet(snapshot, "/", &second);
+    if (first.files != second.files ||
+        first.directories != second.directories ||
+        first.bytes != second.bytes)
+      atomic_store(&benchMismatch, true);
+    FsFree(snapshot);
+    break;
+  }
+  case 12: {
+    // 事务中修改自己的文件夹和共享的文件夹，随机提交或撤销。
+    // 其他线程不修改自己的文件夹，撤销之后它与开始时相同
+    char own[64];
+    FsStatsInfo before;
+    FsStatsInfo after;
+    snprintf(own, sizeof(own), "/w%02d", id);
+    if (FsTxBegin(fs))
+      break;
+    FsStatsGet(fs, own, &before);
+    snprintf(dest, sizeof(dest), "/s%d/d%d", b, d);
+    FsMv(fs, src, dest);
+    snprintf(path, sizeof(path), "/w%02d/f%02d", id, f % BENCH_FILES);
+    FsPut(fs, path, BENCH_STRESS_CONTENT);
+    FsAppend(fs, path, "tx-append\n", 10);
+    snprintf(dest, sizeof(dest), "/w%02d/t%d", id, rand_r(seed) % 4);
+    FsMv(fs, src, dest);
+    snprintf(path, sizeof(path), "/w%02d/t%d", id, rand_r(seed) % 4);
+    FsMkfile(fs, path);
+    FsAppend(fs, path, "tx-new\n", 7);
+    // 一次复制、移动多个文件，撤销时逐个还原
+    char other[64];
+    char *batch[] = {path, other, NULL};
+    snprintf(other, sizeof(other), "/w%02d/f%02d", id,
+             rand_r(seed) % BENCH_FILES);
+    snprintf(dest, sizeof(dest), "/s%d", b);
+    FsCp(fs, false, batch, dest);
+    snprintf(dest, sizeof(dest), "/s%d/d%d", a, d);
+    FsMv(fs, batch, dest);
+    // 批量创建的文件在撤销时一起删除
+    char built[2][64];
+    const char *builtPaths[] = {built[0], built[1]};
+    snprintf(built[0], sizeof(built[0]), "/w%02d/b%d/x/", id,
+             rand_r(seed) % 4);
+    snprintf(built[1], sizeof(built[1]), "/w%02d/b%d/y/z", id,
+             rand_r(seed) % 4);
+    FsBuildFromPaths(fs, builtPaths, 2, NULL);
+    snprintf(path, sizeof(path), "/w%02d/f%02d", id,
+             rand_r(seed) % BENCH_FILES);
+    FsDl(fs, false, path);
+    if (rand_r(seed) % 2) {
+      FsTxCommit(fs);
+      break;
+    }
+    FsTxAbort(fs);
+    FsStatsGet(fs, own, &after);
+    if (before.files != after.files ||
+        before.directories != after.directories ||
+        before.bytes != after.bytes)
+      atomic_store(&benchMismatch, true);
+    break;
+  }
+  case 13: {
+    // 导出正在被修改的文件夹再导入自己的文件夹，两边的统计相同
+    FILE *fp = tmpfile();
+    FsImportStats exported;
+    FsImportStats imported;
+    snprintf(path, sizeof(path), "/s%d", a);
+    snprintf(dest, sizeof(dest), "/w%02d", id);
+    if (!fp || FsTarWrite(fs, path, fileno(fp), &exported)) {
+      if (fp)
+        fclose(fp);
+      break;
+    }
+    rewind(fp);
+    if (FsTarRead(fs, fileno(fp), dest, &imported) ||
+        exported.files != imported.files ||
+        exported.directories != imported.directories ||
+        exported.symlinks != imported.symlinks ||
+        exported.bytes != imported.bytes)
+      atomic_store(&benchMismatch, true);
+    fclose(fp);
+    snprintf(path, sizeof(path), "/w%02d/s%d", id, a);
+    FsDl(fs, true, path);
+    break;
+  }
+  default:
+    snprintf(path, sizeof(path), "/s%d", a);
+    FsTree(fs, path);
+    break;
+  }
+}
+
+static void *BenchWorkerMain(void *arg) {
+  BenchWorker *w = arg;
+  pthread_barrier_wait(w->barrier);
+  while (atomic_load_explicit(w->running, memory_order_relaxed)) {
+    w->op(w->fs, &w->seed, w->id);
+    w->ops++;
+  }
+  return NULL;
+}
+
+/// 用 threads 个线程运行 op，返回每秒操作数
+static double BenchRun(Fs fs, void (*op)(Fs, unsigned int *, int),
+                       int threads) {
+  pthread_t tids[BENCH_MAX_THREADS];
+  BenchWorker workers[BENCH_MAX_THREADS];
+  pthread_barrier_t barrier;
+  atomic_bool running = true;
+  pthread_barrier_init(&barrier, NULL, threads + 1);
+  for (int i = 0; i < threads; i++) {
+    workers[i] =
+        (BenchWorker){fs, op, &running, &barrier, 0, i * 7919 + 1, i};
+    pthread_create(&tids[i], NULL, BenchWorkerMain, &workers[i]);
+  }
+  pthread_barrier_wait(&barrier);
+  double start = BenchNow();
+  struct timespec ts = {0, (long)(BENCH_SECONDS * 1e9)};
+  nanosleep(&ts, NULL);
+  atomic_store(&running, false);
+  unsigned long ops = 0;
+  for (int i = 0; i < threads; i++) {
+    pthread_join(tids[i], NULL);
+    ops += workers[i].ops;
+  }
+  double elapsed = BenchNow() - start;
+  pthread_barrier_destroy(&barrier);
+  return ops / elapsed;
+}
+
+// 按线程分别计数，避免共享同一个缓存行
+typedef struct {
+  size_t count;
+  char pad[64 - sizeof(size_t)];
+} BenchCounter;
+
+static FsWalkAction BenchWalkCount(const FsWalkEntry *entry, void *ctx) {
+  ((BenchCounter *)ctx)[entry->worker].count++;
+  return FS_WALK_CONTINUE;
+}
+
+/// 用不同线程数遍历整棵树，输出每秒访问的文件数
+static void BenchWalk(Fs fs, FILE *report) {
+  BenchCounter counters[FS_POOL_MAX_THREADS];
+  fprintf(report, "%-8s %8s %14s %8s\n", "walk", "threads", "files/s",
+          "speedup");
+  double base = 0;
+  for (int threads = 1; threads <= FS_POOL_MAX_THREADS; threads *= 2) {
+    size_t files = 0;
+    double start = BenchNow();
+    double elapsed = 0;
+    do {
+      memset(counters, 0, sizeof(counters));
+      FsWalk(fs, "/", BenchWalkCount, counters, threads);
+      for (int i = 0; i < threads; i++)
+        files += counters[i].count;
+      elapsed = BenchNow() - start;
+    } while (elapsed < BENCH_SECONDS);
+    double rate = files / elapsed;
+    if (threads == 1)
+      base = rate;
+    fprintf(report, "%-8s %8d %14.0f %7.2fx\n", "", threads, rate,
+            rate / base);
+    fflush(report);
+  }
+}
+
+/// dir 中 BENCH_BATCH_FILES 个文件的路径
+/// \param dir
+/// \param prefix 文件名前缀
+/// \return 以 NULL 结尾，用 BenchBatchFree 释放
+static char **BenchBatchPaths(const char *dir, char prefix) {
+  char **paths = malloc(sizeof(char *) * (BENCH_BATCH_FILES + 1));
+  char path[64];
+  for (int i = 0; i < BENCH_BATCH_FILES; i++) {
+    snprintf(path, sizeof(path), "%s/%c%05d", dir, prefix, i);
+    paths[i] = strdup(path);
+  }
+  paths[BENCH_BATCH_FILES] = NULL;
+  return paths;
+}
+
+static void BenchBatchFree(char **paths) {
+  for (char **p = paths; *p; p++)
+    free(*p);
+  free(paths);
+}
+
+/// 新建文件夹 dir，其中有 BENCH_BATCH_FILES 个文件
+static void BenchBatchDir(Fs fs, char *dir, char prefix) {
+  char **paths = BenchBatchPaths(dir, prefix);
+  FsMkdir(fs, dir);
+  for (char **p = paths; *p; p++)
+    FsMkfile(fs, *p);
+  BenchBatchFree(paths);
+}
+
+/// 把 BENCH_BATCH_FILES 个文件逐个或一次移动、复制到已有同样多文件的
+/// 文件夹中，输出两者的耗时
+static void BenchBatch(Fs fs, FILE *report) {
+  char *one[] = {NULL, NULL};
+  fprintf(report, "%-8s %8s %14s %14s %8s\n", "batch", "files",
+          "one-by-one", "batched", "speedup");
+  BenchBatchDir(fs, "/ba", 'a');
+  for (char prefix = 'b'; prefix <= 'e'; prefix++) {
+    char dir[8];
+    snprintf(dir, sizeof(dir), "/b%c", prefix);
+    BenchBatchDir(fs, dir, prefix);
+  }
+  // /ba 中的文件逐个移动到 /bb，再一次移动到 /bc
+  char **src = BenchBatchPaths("/ba", 'a');
+  double start = BenchNow();
+  for (char **p = src; *p; p++) {
+    one[0] = *p;
+    FsMv(fs, one, "/bb");
+  }
+  double single = BenchNow() - start;
+  BenchBatchFree(src);
+  src = BenchBatchPaths("/bb", 'a');
+  start = BenchNow();
+  FsMv(fs, src, "/bc");
+  double batched = BenchNow() - start;
+  BenchBatchFree(src);
+  fprintf(report, "%-8s %8d %13.3fs %13.3fs %7.2fx\n", "mv",
+          BENCH_BATCH_FILES, single, batched, single / batched);
+  // 再逐个复制到 /bd，一次复制到 /be
+  src = BenchBatchPaths("/bc", 'a');
+  start = BenchNow();
+  for (char **p = src; *p; p++) {
+    one[0] = *p;
+    FsCp(fs, false, one, "/bd");
+  }
+  single = BenchNow() - start;
+  start = BenchNow();
+  FsCp(fs, false, src, "/be");
+  batched = BenchNow() - start;
+  BenchBatchFree(src);
+  fprintf(report, "%-8s %8d %13.3fs %13.3fs %7.2fx\n", "cp",
+          BENCH_BATCH_FILES, single, batched, single / batched);
+  fflush(report);
+}
+
+/// 打乱顺序的 n 个路径：root/dd/dd/fdddd，每个最下层的文件夹 1024 个文件
+/// \param root
+/// \param n
+/// \return 用 BenchBatchFree 释放
+static char **BenchLoadPaths(const char *root, size_t n) {
+  char **paths = malloc(sizeof(char *) * (n + 1));
+  for (size_t i = 0; i < n; i++) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%02zu/%02zu/f%04zu", root, i >> 16,
+             (i >> 10) & 63, i & 1023);
+    paths[i] = strdup(path);
+  }
+  unsigned int seed = 1;
+  for (size_t i = n; i > 1; i--) {
+    size_t j = rand_r(&seed) % i;
+    char *t = paths[i - 1];
+    paths[i - 1] = paths[j];
+    paths[j] = t;
+  }
+  paths[n] = NULL;
+  return paths;
+}
+
+/// 逐个 FsMkdirP、FsMkfile 与 FsBuildFromPaths 创建同样形状的树，
+/// 比较每秒创建的路径数量
+static void BenchLoad(Fs fs, FILE *report) {
+  fprintf(report, "%-8s %8s %14s %14s %8s\n", "load", "paths", "one-by-one",
+          "batched", "speedup");
+  char **paths = BenchLoadPaths("/bm", BENCH_LOAD_SAMPLE);
+  double start = BenchNow();
+  for (char **p = paths; *p; p++) {
+    char *dir = FsPathStrShift(*p);
+    if (FsMkdirP(fs, dir) != FS_OK)
+      atomic_store(&benchMismatch, true);
+    free(dir);
+    FsMkfile(fs, *p);
+  }
+  double single = (BenchNow() - start) / BENCH_LOAD_SAMPLE;
+  BenchBatchFree(paths);
+  paths = BenchLoadPaths("/bl", BENCH_LOAD_PATHS);
+  start = BenchNow();
+  if (FsBuildFromPaths(fs, (const char **)paths, BENCH_LOAD_PATHS, NULL))
+    atomic_store(&benchMismatch, true);
+  double elapsed = BenchNow() - start;
+  double batched = elapsed / BENCH_LOAD_PATHS;
+  BenchBatchFree(paths);
+  fprintf(report, "%-8s %8d %11.0f/s %11.0f/s %7.2fx\n", "", BENCH_LOAD_PATHS,
+          1 / single, 1 / batched, single / batched);
+  fprintf(report, "%-8s %8s %13.3fs\n", "", "total", elapsed);
+  fflush(report);
+  FsDl(fs, true, "/bm");
+  FsDl(fs, true, "/bl");
+}
+
+/// 在宿主机的 root 中写入导入测试的文件，或者删除它们
+/// \param root
+/// \param create 为 false 时删除
+/// \return 写入失败时返回 false
+static bool BenchImportHost(const char *root, bool create) {
+  char path[256];
+  char *data = calloc(1, BENCH_IMPORT_BIG);
+  bool ok = data != NULL;
+  for (int i = 0; ok && i <= BENCH_IMPORT_DIRS; i++) {
+    // 最后一个文件夹放大文件
+    bool big = i == BENCH_IMPORT_DIRS;
+    int files = big ? BENCH_IMPORT_BIGS : BENCH_IMPORT_FILES;
+    size_t size = big ? BENCH_IMPORT_BIG : BENCH_IMPORT_SMALL;
+    snprintf(path, sizeof(path), "%s/d%02d", root, i);
+    if (create && mkdir(path, 0755) < 0)
+      ok = false;
+    for (int j = 0; ok && j < files; j++) {
+      snprintf(path, sizeof(path), "%s/d%02d/f%02d", root, i, j);
+      if (!create) {
+        unlink(path);
+        continue;
+      }
+      FILE *fp = fopen(path, "wb");
+      memset(data, 'a' + (i + j) % 26, size);
+      ok = fp && fwrite(data, 1, size, fp) == size;
+      if (fp)
+        fclose(fp);
+    }
+    snprintf(path, sizeof(path), "%s/d%02d", root, i);
+    if (!create)
+      rmdir(path);
+  }
+  free(data);
+  return ok;
+}
+
+/// 逐个 fread 宿主机文件再 FsPutQuiet，与 FsImportDir 比较吞吐量。
+/// 两次都从页缓存读取，比较的是文件系统一侧的开销
+static void BenchImport(Fs fs, FILE *report) {
+  char root[] = "/tmp/fs_bench_XXXXXX";
+  if (!mkdtemp(root) || !BenchImportHost(root, true)) {
+    fprintf(report, "import: cannot create host files\n");
+    BenchImportHost(root, false);
+    rmdir(root);
+    return;
+  }
+  fprintf(report, "%-8s %8s %14s %14s %8s\n", "import", "MB", "one-by-one",
+          "import", "speedup");
+  char host[256];
+  char path[64];
+  char *data = malloc(BENCH_IMPORT_BIG);
+  size_t bytes = 0;
+  double start = BenchNow();
+  FsMkdir(fs, "/im");
+  for (int i = 0; i <= BENCH_IMPORT_DIRS; i++) {
+    bool big = i == BENCH_IMPORT_DIRS;
+    snprintf(path, sizeof(path), "/im/d%02d", i);
+    FsMkdir(fs, path);
+    for (int j = 0; j < (big ? BENCH_IMPORT_BIGS : BENCH_IMPORT_FILES); j++) {
+      snprintf(host, sizeof(host), "%s/d%02d/f%02d", root, i, j);
+      snprintf(path, sizeof(path), "/im/d%02d/f%02d", i, j);
+      FILE *fp = fopen(host, "rb");
+      size_t n = fp ? fread(data, 1, BENCH_IMPORT_BIG, fp) : 0;
+      if (fp)
+        fclose(fp);
+      FsMkfile(fs, path);
+      FsPutQuiet(fs, path, data, n, NULL);
+      bytes += n;
+    }
+  }
+  double single = BenchNow() - start;
+  free(data);
+  FsImportStats stats;
+  start = BenchNow();
+  if (FsImportDir(fs, root, "/ib", &stats) || stats.bytes != bytes)
+    atomic_store(&benchMismatch, true);
+  double imported = BenchNow() - start;
+  fprintf(report, "%-8s %8.0f %11.0fMB/s %11.0fMB/s %7.2fx\n", "",
+          bytes / 1e6, bytes / single / 1e6, bytes / imported / 1e6,
+          single / imported);
+  fflush(report);
+  FsDl(fs, true, "/im");
+  FsDl(fs, true, "/ib");
+  BenchImportHost(root, false);
+  rmdir(root);
+}
+
+/// FsCatQuiet 的回调，写到宿主机的文件
+static void BenchTarCat(const char *data, size_t length, void *ctx) {
+  fwrite(data, 1, length, ctx);
+}
+
+/// 导出：逐个 FsCatQuiet 经 stdio 写到宿主机文件，与 FsTarWrite 比较；
+/// 导入：FsImportDir 从宿主机文件夹导入，与 FsTarRead 读入归档比较
+static void BenchTar(Fs fs, FILE *report) {
+  char root[] = "/tmp/fs_bench_XXXXXX";
+  char cat[64];
+  char tar[64];
+  if (!mkdtemp(root) || !BenchImportHost(root, true) ||
+      FsImportDir(fs, root, "/tb", NULL)) {
+    fprintf(report, "tar: cannot create host files\n");
+    BenchImportHost(root, false);
+    rmdir(root);
+    return;
+  }
+  snprintf(cat, sizeof(cat), "%s.cat", root);
+  snprintf(tar, sizeof(tar), "%s.tar", root);
+  fprintf(report, "%-8s %8s %14s %14s %8s\n", "tar", "", "one-by-one",
+          "tar", "speedup");
+  char path[64];
+  double start = BenchNow();
+  FILE *fp = fopen(cat, "wb");
+  for (int i = 0; fp && i <= BENCH_IMPORT_DIRS; i++) {
+    bool big = i == BENCH_IMPORT_DIRS;
+    for (int j = 0; j < (big ? BENCH_IMPORT_BIGS : BENCH_IMPORT_FILES); j++) {
+      snprintf(path, sizeof(path), "/tb/d%02d/f%02d", i, j);
+      FsCatQuiet(fs, path, BenchTarCat, fp, NULL);
+    }
+  }
+  if (fp)
+    fclose(fp);
+  double single = BenchNow() - start;
+  FsImportStats exported;
+  FsImportStats imported;
+  start = BenchNow();
+  int fd = open(tar, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || FsTarWrite(fs, "/tb", fd, &exported))
+    atomic_store(&benchMismatch, true);
+  if (fd >= 0)
+    close(fd);
+  double written = BenchNow() - start;
+  double mb = exported.bytes / 1e6;
+  fprintf(report, "%-8s %8s %11.0fMB/s %11.0fMB/s %7.2fx\n", "", "export",
+          mb / single, mb / written, single / written);
+  start = BenchNow();
+  if (FsImportDir(fs, root, "/td", NULL))
+    atomic_store(&benchMismatch, true);
+  single = BenchNow() - start;
+  FsMkdir(fs, "/tc");
+  start = BenchNow();
+  fd = open(tar, O_RDONLY);
+  if (fd < 0 || FsTarRead(fs, fd, "/tc", &imported) ||
+      imported.files != exported.files || imported.bytes != exported.bytes)
+    atomic_store(&benchMismatch, true);
+  if (fd >= 0)
+    close(fd);
+  double read = BenchNow() - start;
+  fprintf(report, "%-8s %8s %11.0fMB/s %11.0fMB/s %7.2fx\n", "", "import",
+          mb / single, mb / read, single / read);
+  fflush(report);
+  FsDl(fs, true, "/tb");
+  FsDl(fs, true, "/tc");
+  FsDl(fs, true, "/td");
+  unlink(cat);
+  unlink(tar);
+  BenchImportHost(root, false);
+  rmdir(root);
+}
+
+static Fs BenchBuild(void) {
+  Fs fs = FsNew();
+  char path[64];
+  for (int i = 0; i < BENCH_DIRS; i++) {
+    snprintf(path, sizeof(path), "/d%02d", i);
+    FsMkdir(fs, path);
+    snprintf(path, sizeof(path), "/d%02d/s", i);
+    FsMkdir(fs, path);
+    for (int j = 0; j < BENCH_FILES; j++) {
+      snprintf(path, sizeof(path), "/d%02d/f%02d", i, j);
+      FsMkfile(fs, path);
+      FsPut(fs, path, "benchmark-content\n");
+      snprintf(path, sizeof(path), "/d%02d/s/f%02d", i, j);
+      FsMkdir(fs, path);
+    }
+  }
+  for (int i = 0; i < BENCH_MAX_THREADS; i++) {
+    snprintf(path, sizeof(path), "/w%02d", i);
+    FsMkdir(fs, path);
+    for (int j = 0; j < BENCH_FILES; j++) {
+      snprintf(path, sizeof(path), "/w%02d/f%02d", i, j);
+      FsMkfile(fs, path);
+      FsOpen(fs, path, FS_OPEN_READ | FS_OPEN_WRITE, &benchHandles[i][j]);
+    }
+    snprintf(path, sizeof(path), "/w%02d/tmp", i);
+    FsMkfile(fs, path);
+    // 扩展出的部分是空洞，写入时才分配
+    snprintf(path, sizeof(path), "/w%02d/big", i);
+    FsOpen(fs, path, FS_OPEN_READ | FS_OPEN_WRITE | FS_OPEN_CREATE,
+           &benchBigHandles[i]);
+    FsTruncate(benchBigHandles[i], BENCH_BIG_SIZE);
+  }
+  for (int i = 0; i < BENCH_STRESS_DIRS; i++) {
+    snprintf(path, sizeof(path), "/s%d", i);
+    FsMkdir(fs, path);
+    for (int j = 0; j < BENCH_STRESS_SUBDIRS; j++) {
+      snprintf(path, sizeof(path), "/s%d/d%d", i, j);
+      FsMkdir(fs, path);
+    }
+  }
+  return fs;
+}
+
+int main(int argc, char **argv) {
+  struct {
+    const char *name;
+    void (*op)(Fs, unsigned int *, int);
+  } cases[] = {
+      {"lookup", BenchOpLookup},
+      {"cat", BenchOpCat},
+      {"catq", BenchOpCatQuiet},
+      {"ls", BenchOpLs},
+      {"readdir", BenchOpReaddir},
+      {"put", BenchOpPut},
+      {"handle", BenchOpHandle},
+      {"append", BenchOpAppend},
+      {"rename", BenchOpRename},
+      {"big", BenchOpBig},
+      {"stress", BenchOpStress},
+  };
+  Fs fs = BenchBuild();
+  // FsCat / FsLs 的输出丢弃，只测量读路径本身
+  FILE *report = fdopen(dup(fileno(stdout)), "w");
+  if (!freopen("/dev/null", "w", stdout)) {
+    perror("freopen");
+    return 1;
+  }
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    // 可以通过参数只运行指定的测试
+    if (argc > 1 && strcmp(argv[1], cases[c].name) != 0)
+      continue;
+    bool stress = cases[c].op == BenchOpStress;
+    if (stress) {
+      FsCompactStart(fs, BENCH_COMPACT_IDLE);
+      FsBudgetSet(fs, BENCH_BUDGET, NULL);
+      // 压力测试同时覆盖去重存储
+      FsDedupEnable(fs, true);
+    }
+    fprintf(report, "%-8s %8s %14s %8s\n", cases[c].name, "threads", "ops/s",
+            "speedup");
+    double base = 0;
+    for (int threads = 1; threads <= BENCH_MAX_THREADS; threads *= 2) {
+      double rate = BenchRun(fs, cases[c].op, threads);
+      if (threads == 1)
+        base = rate;
+      fprintf(report, "%-8s %8d %14.0f %7.2fx\n", "", threads, rate,
+              rate / base);
+      fflush(report);
+    }
+    if (stress) {
+      FsCompactStop(fs);
+      FsBudgetSet(fs, 0, NULL);
+      FsDedupEnable(fs, false);
+    }
+  }
+  if (argc <= 1 || strcmp(argv[1], "walk") == 0)
+    BenchWalk(fs, report);
+  if (argc <= 1 || strcmp(argv[1], "batch") == 0)
+    BenchBatch(fs, report);
+  if (argc <= 1 || strcmp(argv[1], "load") == 0)
+    BenchLoad(fs, report);
+  if (argc <= 1 || strcmp(argv[1], "import") == 0)
+    BenchImport(fs, report);
+  if (argc <= 1 || strcmp(argv[1], "tar") == 0)
+    BenchTar(fs, report);
+  for (int i = 0; i < BENCH_MAX_THREADS; i++) {
+    for (int j = 0; j < BENCH_FILES; j++)
+      FsClose(benchHandles[i][j]);
+    FsClose(benchStressHandles[i]);
+    FsClose(benchBigHandles[i]);
+  }
+  // 压力测试之后检查树结构的一致性
+  size_t count = 0;
+  FsErrors res = FsFilCheck(fs->root, &count);
+  if (atomic_load(&benchMismatch))
+    res = FS_ERROR;
+  fprintf(report, "check: %s, %zu files\n", res ? "FAILED" : "OK", count);
+  FsFree(fs);
+  fclose(report);
+  return res ? 1 : 0;
+}
@@ -0,0 +1,288 @@
+//
+// fs --serve 的压力测试：多个客户端同时以流水线方式发送请求，
+// 统计每秒完成的请求数和延迟分布
+//
+// 用法：fs_load [SOCK|-] [CLIENTS] [SECONDS] [DEPTH]
+// 没有 SOCK 或者为 - 时在本进程中启动服务端；没有 CLIENTS 时依次测试
+// 1、4、16、64 个客户端
+//
+
+#include "FileType.h"
+#include "utility.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "serve.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// 所有客户端共同读取的文件数和每个文件的大小
+#define LOAD_SHARED 64
+#define LOAD_SHARED_SIZE 1024
+// 每个客户端自己写入的文件数和每次写入的大小
+#define LOAD_OWN 16
+#define LOAD_PUT_SIZE 256
+// 默认的测试时长（秒）和每个客户端同时等待的请求数
+#define LOAD_SECONDS 2.0
+#define LOAD_DEPTH 16
+#define LOAD_MAX_CLIENTS 256
+
+typedef struct {
+  const char *sockPath;
+  int id;
+  int depth;
+  atomic_bool *running;
+  pthread_barrier_t *barrier;
+  // 每个请求的延迟（纳秒）
+  uint64_t *samples;
+  size_t count;
+  size_t capacity;
+  // 结果不是 FS_OK 的请求数
+  unsigned long errors;
+  bool failed;
+} LoadWorker;
+
+static uint64_t LoadNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/// 按读多写少的比例发送一个请求
+/// \param client
+/// \param seed
+/// \param content 写入的内容
+/// \return
+static FsErrors LoadSend(FsClient *client, unsigned int *seed,
+                         const char *content) {
+  char path[64];
+  const char *argv[] = {path, content};
+  int r = rand_r(seed) % 100;
+  if (r < 50) {
+    sprintf(path, "/load/shared/f%d", rand_r(seed) % LOAD_SHARED);
+    return FsClientSend(client, FS_SERVE_CAT, 0, argv, NULL, 1, NULL);
+  }
+  if (r < 70) {
+    strcpy(path, "/load/shared");
+    return FsClientSend(client, FS_SERVE_LS, 0, argv, NULL, 1, NULL);
+  }
+  if (r < 90) {
+    // 相对于 cd 之后的工作目录
+    sprintf(path, "f%d", rand_r(seed) % LOAD_OWN);
+    const size_t lengths[] = {strlen(path), LOAD_PUT_SIZE};
+    return FsClientSend(client, FS_SERVE_PUT, 0, argv, lengths, 2, NULL);
+  }
+  if (r < 95)
+    return FsClientSend(client, FS_SERVE_PWD, 0, NULL, NULL, 0, NULL);
+  strcpy(path, ".");
+  return FsClientSend(client, FS_SERVE_TREE, 0, argv, NULL, 1, NULL);
+}
+
+/// 接收最早的一个响应，记录它的延迟
+/// \param client
+/// \param w
+/// \param sent 发送时间的环形队列
+/// \param head 最早的请求在队列中的位置
+/// \return
+static bool LoadRecv(FsClient *client, LoadWorker *w, const uint64_t *sent,
+                     int head) {
+  FsReply reply;
+  if (FsClientRecv(client, &reply))
+    return false;
+  if (reply.status)
+    w->errors++;
+  if (w->count == w->capacity) {
+    w->capacity = w->capacity ? w->capacity * 2 : 4096;
+    w->samples = realloc(w->samples, sizeof(uint64_t) * w->capacity);
+  }
+  w->samples[w->count++] = LoadNow() - sent[head];
+  return true;
+}
+
+static void *LoadWorkerRun(void *arg) {
+  LoadWorker *w = arg;
+  unsigned int seed = w->id * 7919 + 1;
+  char content[LOAD_PUT_SIZE];
+  memset(content, 'a' + w->id % 26, sizeof(content));
+  FsClient *client = FsClientConnect(w->sockPath);
+  if (client) {
+    char dir[64];
+    sprintf(dir, "/load/c%d", w->id);
+    FsClientMkdir(client, dir);
+    w->failed = FsClientCd(client, dir) != FS_OK;
+    for (int i = 0; i < LOAD_OWN; i++) {
+      char name[16];
+      sprintf(name, "f%d", i);
+      FsClientMkfile(client, name);
+    }
+  } else {
+    w->failed = true;
+  }
+  pthread_barrier_wait(w->barrier);
+  if (w->failed) {
+    FsClientClose(client);
+    return NULL;
+  }
+  uint64_t sent[w->depth];
+  int head = 0;
+  int inflight = 0;
+  while (atomic_load_explicit(w->running, memory_order_relaxed)) {
+    // 补满流水线，FsClientRecv 时一起写出
+    while (inflight < w->depth) {
+      if (LoadSend(client, &seed, content))
+        goto fail;
+      sent[(head + inflight) % w->depth] = LoadNow();
+      inflight++;
+    }
+    if (!LoadRecv(client, w, sent, head))
+      goto fail;
+    head = (head + 1) % w->depth;
+    inflight--;
+  }
+  while (inflight--) {
+    if (!LoadRecv(client, w, sent, head))
+      goto fail;
+    head = (head + 1) % w->depth;
+  }
+  FsClientClose(client);
+  return NULL;
+fail:
+  w->failed = true;
+  FsClientClose(client);
+  return NULL;
+}
+
+static int LoadCompare(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/// 创建所有客户端共同读取的文件
+/// \param sockPath
+/// \return
+static bool LoadSetup(const char *sockPath) {
+  FsClient *client = FsClientConnect(sockPath);
+  if (!client)
+    return false;
+  char content[LOAD_SHARED_SIZE];
+  memset(content, 's', sizeof(content));
+  // 服务端已有这些文件夹时忽略 FS_FILE_EXISTS
+  FsClientMkdir(client, "/load");
+  FsClientMkdir(client, "/load/shared");
+  bool ok = true;
+  for (int i = 0; ok && i < LOAD_SHARED; i++) {
+    char path[64];
+    sprintf(path, "/load/shared/f%d", i);
+    FsClientMkfile(client, path);
+    ok = FsClientPut(client, path, content, sizeof(content)) == FS_OK;
+  }
+  FsClientClose(client);
+  return ok;
+}
+
+/// 运行一轮测试并打印一行结果
+/// \param sockPath
+/// \param clients
+/// \param seconds
+/// \param depth
+/// \return 有客户端连接失败时返回 false
+static bool LoadRun(const char *sockPath, int clients, double seconds,
+                    int depth) {
+  pthread_t tids[LOAD_MAX_CLIENTS];
+  LoadWorker workers[LOAD_MAX_CLIENTS];
+  pthread_barrier_t barrier;
+  atomic_bool running = true;
+  pthread_barrier_init(&barrier, NULL, clients + 1);
+  for (int i = 0; i < clients; i++) {
+    workers[i] = (LoadWorker){sockPath, i, depth, &running, &barrier};
+    pthread_create(&tids[i], NULL, LoadWorkerRun, &workers[i]);
+  }
+  pthread_barrier_wait(&barrier);
+  uint64_t start = LoadNow();
+  struct timespec ts = {(time_t)seconds,
+                        (long)((seconds - (time_t)seconds) * 1e9)};
+  nanosleep(&ts, NULL);
+  atomic_store(&running, false);
+  size_t total = 0;
+  unsigned long errors = 0;
+  bool failed = false;
+  for (int i = 0; i < clients; i++) {
+    pthread_join(tids[i], NULL);
+    total += workers[i].count;
+    errors += workers[i].errors;
+    failed |= workers[i].failed;
+  }
+  double elapsed = (LoadNow() - start) / 1e9;
+  pthread_barrier_destroy(&barrier);
+  uint64_t *samples = malloc(sizeof(uint64_t) * (total ? total : 1));
+  size_t n = 0;
+  for (int i = 0; i < clients; i++) {
+    memcpy(samples + n, workers[i].samples,
+           sizeof(uint64_t) * workers[i].count);
+    n += workers[i].count;
+    free(workers[i].samples);
+  }
+  qsort(samples, n, sizeof(uint64_t), LoadCompare);
+  // 百分位数（微秒）
+#define LOAD_PCT(q) (n ? samples[(size_t)((q) * (n - 1))] / 1e3 : 0)
+  printf("%8d %6d %12.0f %9.1f %9.1f %9.1f %9.1f %8lu\n", clients, depth,
+         n / elapsed, LOAD_PCT(0.5), LOAD_PCT(0.99), LOAD_PCT(0.999),
+         LOAD_PCT(1.0), errors);
+#undef LOAD_PCT
+  fflush(stdout);
+  free(samples);
+  return !failed;
+}
+
+int main(int argc, char **argv) {
+  const char *sockPath = argc > 1 ? argv[1] : "-";
+  int clients = argc > 2 ? atoi(argv[2]) : 0;
+  double seconds = argc > 3 ? atof(argv[3]) : LOAD_SECONDS;
+  int depth = argc > 4 ? atoi(argv[4]) : LOAD_DEPTH;
+  if (clients > LOAD_MAX_CLIENTS)
+    clients = LOAD_MAX_CLIENTS;
+  if (depth < 1)
+    depth = 1;
+  Fs fs = NULL;
+  FsServer *server = NULL;
+  char localPath[64];
+  if (strcmp(sockPath, "-") == 0) {
+    sprintf(localPath, "/tmp/fs_load.%d.sock", (int)getpid());
+    fs = FsNew();
+    if (FsServerStart(fs, localPath, 0, &server)) {
+      printf("fs_load: '%s': %s\n", localPath, strerror(errno));
+      FsFree(fs);
+      return 1;
+    }
+    sockPath = localPath;
+  }
+  int code = 0;
+  if (!LoadSetup(sockPath)) {
+    printf("fs_load: '%s': cannot set up\n", sockPath);
+    code = 1;
+  } else {
+    printf("%8s %6s %12s %9s %9s %9s %9s %8s\n", "clients", "depth",
+           "ops/s", "p50(us)", "p99(us)", "p999(us)", "max(us)", "errors");
+    for (int c = clients ? clients : 1; c <= (clients ? clients : 64);
+         c *= 4) {
+      if (!LoadRun(sockPath, c, seconds, depth)) {
+        printf("fs_load: '%s': client failed\n", sockPath);
+        code = 1;
+        break;
+      }
+    }
+  }
+  FsServerStop(server);
+  if (fs)
+    FsFree(fs);
+  return code;
+}
@@ -8,9 +8,235 @@
 #undef PATH_MAX
 #endif
 #include "Fs.h"
+#include "pool.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+static void FindPrint(const FsWalkEntry *entry, void *ctx) {
+  puts(entry->path);
+}
+
+/// find [PATH] [-name GLOB] [-type f|d] [-maxdepth N] [-size [+-]N]
+/// \param fs
+/// \param arg
+static void FindCommand(Fs fs, char *arg) {
+  char *pathStr = NULL;
+  char *pattern = NULL;
+  FsFindFlags flags = FS_FIND_FLAGS_ANY;
+  char *token = arg ? strtok(arg, " ") : NULL;
+  if (token && *token != '-') {
+    pathStr = token;
+    token = strtok(NULL, " ");
+  }
+  while (token) {
+    char *value = strtok(NULL, " ");
+    if (!value) {
+      printf("find: missing argument to '%s'\n", token);
+      return;
+    }
+    if (strcmp(token, "-name") == 0) {
+      pattern = value;
+    } else if (strcmp(token, "-type") == 0 && strcmp(value, "f") == 0) {
+      flags.type = REGULAR_FILE;
+    } else if (strcmp(token, "-type") == 0 && strcmp(value, "d") == 0) {
+      flags.type = DIRECTORY;
+    } else if (strcmp(token, "-maxdepth") == 0) {
+      flags.maxDepth = atoi(value);
+    } else if (strcmp(token, "-size") == 0) {
+      // +N 大于 N 字节，-N 小于 N 字节，N 恰好 N 字节
+      size_t size = strtoul(value + (*value == '+' || *value == '-'), NULL, 10);
+      if (*value == '+') {
+        flags.minSize = size + 1;
+      } else if (*value == '-') {
+        flags.maxSize = size ? size - 1 : 0;
+      } else {
+        flags.minSize = flags.maxSize = size;
+      }
+    } else {
+      printf("find: unknown predicate '%s %s'\n", token, value);
+      return;
+    }
+    token = strtok(NULL, " ");
+  }
+  FsErrors res = FsFind(fs, pathStr, pattern, &flags, FindPrint, NULL);
+  if (res) {
+    PERRORD(res, "find: '%s'", pathStr ? pathStr : ".");
+  }
+}
+
+static void GrepPrint(const char *path, size_t line, const char *text,
+                      size_t length, void *ctx) {
+  printf("%s:%zu:%.*s\n", path, line, (int)length, text);
+}
+
+/// grep PATTERN [PATH]
+/// \param fs
+/// \param arg
+static void GrepCommand(Fs fs, char *arg) {
+  char *pattern = arg ? strtok(arg, " ") : NULL;
+  if (!pattern) {
+    printf("grep: missing pattern\n");
+    return;
+  }
+  char *pathStr = strtok(NULL, " ");
+  FsErrors res =
+      FsGrep(fs, pathStr, pattern, GrepPrint, NULL, FsPoolThreads());
+  if (res) {
+    PERRORD(res, "grep: '%s'", pathStr ? pathStr : ".");
+  }
+}
+
+/// 把 cp、mv 的参数 SRC... DEST 拆成以 NULL 结尾的源路径数组和目标路径
+/// \param arg 可以为 NULL
+/// \param dest 只有一个参数时为空字符串
+/// \return 源路径数组，用 free 释放
+static char **SplitPaths(char *arg, char **dest) {
+  if (!arg)
+    arg = "";
+  char **paths = malloc(sizeof(char *) * (strlen(arg) / 2 + 2));
+  size_t n = 0;
+  for (char *token = strtok(arg, " "); token; token = strtok(NULL, " "))
+    paths[n++] = token;
+  if (!n)
+    paths[n++] = arg;
+  *dest = n > 1 ? paths[--n] : "";
+  paths[n] = NULL;
+  return paths;
+}
+
+// Tab 补全的候选文件名
+typedef struct {
+  char **names;
+  bool *dirs;
+  size_t count;
+  size_t capacity;
+} Completion;
+
+static void CompleteCollect(FIL *file, const char *name, void *ctx) {
+  Completion *c = ctx;
+  if (c->count == c->capacity) {
+    c->capacity = c->capacity ? c->capacity * 2 : 16;
+    c->names = realloc(c->names, sizeof(char *) * c->capacity);
+    c->dirs = realloc(c->dirs, sizeof(bool) * c->capacity);
+  }
+  c->names[c->count] = strdup(name);
+  c->dirs[c->count] = file->type == DIRECTORY;
+  c->count++;
+}
+
+/// 补全输入行的最后一个单词：唯一候选时补全整个名字，
+/// 否则补全到公共前缀，没有可补全的部分时列出所有候选
+/// \param fs
+/// \param prompt
+/// \param line
+/// \param length
+/// \param capacity
+static void Complete(Fs fs, const char *prompt, char *line, size_t *length,
+                     size_t capacity) {
+  char *word = line + *length;
+  while (word > line && word[-1] != ' ')
+    word--;
+  // 拆分成文件夹和文件名前缀
+  char dir[PATH_MAX];
+  const char *prefix = word;
+  char *split = strrchr(word, FS_SPLIT);
+  dir[0] = '\0';
+  if (split) {
+    size_t n = split - word + 1;
+    memcpy(dir, word, n);
+    dir[n] = '\0';
+    prefix = split + 1;
+  }
+  Completion c = {NULL, NULL, 0, 0};
+  if (FsPrefix(fs, dir, prefix, CompleteCollect, &c) != FS_OK || !c.count) {
+    putchar('\a');
+    return;
+  }
+  size_t prefixLength = strlen(prefix);
+  size_t common = strlen(c.names[0]);
+  for (size_t i = 1; i < c.count; i++) {
+    size_t j = prefixLength;
+    while (j < common && c.names[i][j] == c.names[0][j])
+      j++;
+    common = j;
+  }
+  for (size_t i = prefixLength; i < common && *length + 2 < capacity; i++) {
+    line[(*length)++] = c.names[0][i];
+    putchar(c.names[0][i]);
+  }
+  if (c.count == 1) {
+    // 命令把整行剩余部分当作参数，文件名后不补空格
+    if (c.dirs[0] && *length + 2 < capacity) {
+      line[(*length)++] = FS_SPLIT;
+      putchar(FS_SPLIT);
+    }
+  } else if (c.count > 1 && common == prefixLength) {
+    putchar('\n');
+    for (size_t i = 0; i < c.count; i++)
+      printf("%s%s", c.names[i], i + 1 == c.count ? "\n" : "  ");
+    line[*length] = '\0';
+    printf("%s > %s", prompt, line);
+  }
+  line[*length] = '\0';
+  for (size_t i = 0; i < c.count; i++)
+    free(c.names[i]);
+  free(c.names);
+  free(c.dirs);
+}
+
+/// 从终端读取一行，支持退格和 Tab 补全
+/// \param fs
+/// \param prompt 当前目录，补全后重新打印提示符时使用
+/// \param line
+/// \param capacity
+static void ReadLine(Fs fs, const char *prompt, char *line, size_t capacity) {
+  struct termios saved, raw;
+  tcgetattr(STDIN_FILENO, &saved);
+  raw = saved;
+  raw.c_lflag &= ~(ICANON | ECHO);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+  size_t length = 0;
+  line[0] = '\0';
+  for (;;) {
+    fflush(stdout);
+    int ch = getchar();
+    if (ch == EOF || (ch == 4 && length == 0)) {
+      // Ctrl-D 退出
+      strcpy(line, "exit");
+      putchar('\n');
+      break;
+    }
+    if (ch == '\n' || ch == '\r') {
+      putchar('\n');
+      break;
+    }
+    if (ch == 127 || ch == '\b') {
+      if (length) {
+        line[--length] = '\0';
+        fputs("\b \b", stdout);
+      }
+    } else if (ch == '\t') {
+      Complete(fs, prompt, line, &length, capacity);
+    } else if (ch == 27) {
+      // 忽略方向键等转义序列
+      if (getchar() == '[')
+        getchar();
+    } else if (ch >= ' ' && length + 1 < capacity) {
+      line[length++] = (char)ch;
+      line[length] = '\0';
+      putchar(ch);
+    }
+  }
+  fflush(stdout);
+  tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+}
 
 void bash(Fs fs_) {
   Fs fs = fs_;
@@ -18,14 +244,23 @@ void bash(Fs fs_) {
   if (!fs) {
     fs = FsNew();
   }
+  // snap cd 之后 fs 是快照，退出时释放当前的文件系统
+  Fs live = fs;
   char input[PATH_MAX];
-  char cwd[PATH_MAX];
+  // FsGetCwd 最多写入 PATH_MAX + 1 字节
+  char cwd[PATH_MAX + 1];
   int to_exit = 0;
   while (!to_exit) {
     FsGetCwd(fs, cwd);
     printf("\n%s > ", cwd);
     fflush(stdout);
-    gets(input);
+    if (isatty(STDIN_FILENO))
+      ReadLine(fs, cwd, input, PATH_MAX);
+    else if (fgets(input, PATH_MAX, stdin))
+      input[strcspn(input, "\n")] = '\0';
+    else
+      // 输入结束时与 Ctrl-D 一样退出
+      strcpy(input, "exit");
     char *arg = input;
     if (!*input)
       continue;
@@ -43,7 +278,22 @@ void bash(Fs fs_) {
     if (strcmp(name, "exit") == 0) {
       to_exit = 1;
     } else if (strcmp(name, "mkdir") == 0) {
-      FsMkdir(fs, arg);
+      // mkdir -p PATH 创建路径上所有不存在的文件夹
+      if (arg && strncmp(arg, "-p ", 3) == 0) {
+        FsErrors res = FsMkdirP(fs, arg + 3);
+        if (res)
+          PERRORD(res, "mkdir: cannot create directory '%s'", arg + 3);
+      } else {
+        FsMkdir(fs, arg);
+      }
+    } else if (strcmp(name, "build") == 0) {
+      FsBuild(fs, arg);
+    } else if (strcmp(name, "import") == 0) {
+      FsImport(fs, arg);
+    } else if (strcmp(name, "import-tar") == 0) {
+      FsImportTar(fs, arg);
+    } else if (strcmp(name, "export") == 0) {
+      FsExport(fs, arg);
     } else if (strcmp(name, "cd") == 0) {
       FsCd(fs, arg);
     } else if (strcmp(name, "pwd") == 0) {
@@ -51,10 +301,37 @@ void bash(Fs fs_) {
     } else if (strcmp(name, "tree") == 0) {
       FsTree(fs, arg);
     } else if (strcmp(name, "ls") == 0) {
-      FsLs(fs, arg);
+      // ls [--limit N] [--after NAME] [PATH] 分页列出
+      if (arg && (strncmp(arg, "--", 2) == 0 || strstr(arg, " --")))
+        FsLsPage(fs, arg);
+      else
+        FsLs(fs, arg);
+    } else if (strcmp(name, "lsp") == 0) {
+      // lsp PREFIX [PATH]
+      char *prefix = arg ? strtok(arg, " ") : NULL;
+      FsLsPrefix(fs, prefix ? strtok(NULL, " ") : NULL, prefix ? prefix : "");
+    } else if (strcmp(name, "find") == 0) {
+      FindCommand(fs, arg);
+    } else if (strcmp(name, "grep") == 0) {
+      GrepCommand(fs, arg);
+    } else if (strcmp(name, "compress") == 0) {
+      FsCompress(fs, arg);
+    } else if (strcmp(name, "budget") == 0) {
+      FsBudget(fs, arg);
+    } else if (strcmp(name, "ln") == 0) {
+      FsLn(fs, arg);
+    } else if (strcmp(name, "snap") == 0) {
+      fs = FsSnap(fs, arg);
+    } else if (strcmp(name, "tx") == 0) {
+      FsTx(fs, arg);
+    } else if (strcmp(name, "stats") == 0) {
+      FsStats(fs, arg);
+    } else if (strcmp(name, "dedup") == 0) {
+      FsDedup(fs, arg);
     } else if (strcmp(name, "cat") == 0) {
       FsCat(fs, arg);
-    } else if (strcmp(name, "put") == 0) {
+    } else if (strcmp(name, "put") == 0 || strcmp(name, "append") == 0) {
+      // put / append PATH CONTENT
       char *content = arg;
       while (*content && *content != ' ')
         content++;
@@ -64,7 +341,10 @@ void bash(Fs fs_) {
       } else {
         content = "";
       }
-      FsPut(fs, arg, content);
+      if (name[0] == 'p')
+        FsPut(fs, arg, content);
+      else
+        FsAppend(fs, arg, content, strlen(content));
     } else if (strcmp(name, "rmdir") == 0) {
       FsDldir(fs, arg);
     } else if (strcmp(name, "mkfile") == 0) {
@@ -78,31 +358,27 @@ void bash(Fs fs_) {
       FsDl(fs, recursive, arg);
     } else if (strcmp(name, "cp") == 0) {
       bool recursive = false;
-      if (*arg == '-' && *(arg + 1) == 'r' && *(arg + 2) == ' ' && *(arg + 3)) {
+      if (arg && *arg == '-' && *(arg + 1) == 'r' && *(arg + 2) == ' ' &&
+          *(arg + 3)) {
         recursive = true;
         arg += 3;
       }
-      char *arg2 = arg;
-      while (*arg && *arg != ' ')
-        arg++;
-      if (*arg == ' ')
-        *(arg++) = '\0';
-      char *srcFiles[] = {arg2, NULL};
-      FsCp(fs, recursive, srcFiles, arg);
+      // 多个源文件时最后一个参数为目标文件夹
+      char *dest;
+      char **srcFiles = SplitPaths(arg, &dest);
+      FsCp(fs, recursive, srcFiles, dest);
+      free(srcFiles);
     } else if (strcmp(name, "mv") == 0) {
-      char *arg2 = arg;
-      while (*arg && *arg != ' ')
-        arg++;
-      if (*arg == ' ')
-        *(arg++) = '\0';
-      char *srcFiles[] = {arg2, NULL};
-      FsMv(fs, srcFiles, arg);
+      char *dest;
+      char **srcFiles = SplitPaths(arg, &dest);
+      FsMv(fs, srcFiles, dest);
+      free(srcFiles);
     } else {
       printf("Unknown command: %s\n", name);
     }
   }
   if (!fs_)
-    FsFree(fs);
+    FsFree(live);
   puts("======= BYE ========");
 }
 
@@ -796,6 +1072,13 @@ void TestExamples() {
 }
 
 int main(int argc, char **argv) {
+  // fs --serve SOCK [THREADS]：不启动交互程序，通过 SOCK 共享文件系统
+  if (argc >= 3 && strcmp(argv[1], "--serve") == 0) {
+    Fs fs = FsNew();
+    int code = FsServe(fs, argv[2], argc > 3 ? atoi(argv[3]) : 0);
+    FsFree(fs);
+    return code;
+  }
   // 启动测试
   TestExamples();
   // 启动交互程序
@@ -2,9 +2,14 @@
 // Written by:
 // Date:
 
+// pthread_rwlockattr_setkind_np
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,13 +22,16 @@
 #include "utility.h"
 
 /// 错误码 -> 错误描述
-const char FsErrorMessages[8][64] = {"Fs OK",
+const char FsErrorMessages[10][64] = {"Fs OK",
                                      "Fs Error",
                                      "File exists",
                                      "No such file or directory",
                                      "Is a directory",
                                      "Not a directory",
-                                     "Directory not empty"};
+                                     "Directory not empty",
+                                     "Bad file descriptor",
+                                     "Too many levels of symbolic links",
+                                     "Read-only file system"};
 
 // 此功能应分配和初始化新的 struct FsRep，创建文件系统的根目录，
 // 使根目录成为当前的工作目录。然后，它应返回指
@@ -37,17 +45,31 @@ Fs FsNew(void) {
   // 根目录的 parent 是 NULL
   FsInitDir(NULL, &(fs->root), FS_SPLIT_STR);
   // 把 `/../` -> `/`
-  fs->root->children[1]->link = fs->root;
-  // 初始化当前访问路径
-  // 指向根目录
-  fs->pathRoot = malloc(sizeof(PATH));
-  assert(fs->pathRoot);
-  memset(fs->pathRoot, 0, sizeof(PATH));
-  fs->current = fs->pathRoot;
-  fs->current->file = fs->root;
+  fs->root->children->items[1].file->link = fs->root;
+  // 之后创建的文件从上层文件夹继承
+  fs->root->fs = fs;
+  FsInitRep(fs);
   return fs;
 }
 
+/// 初始化 struct FsRep 中的锁，FsNew 和 FsSnapshot 共用
+/// \param fs
+void FsInitRep(Fs fs) {
+  // 初始化锁
+  // 大部分操作都持有整棵树的读锁，需要写优先，否则加写锁的操作会饿死
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr,
+                                PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&fs->lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  pthread_mutex_init(&fs->renameLock, NULL);
+  pthread_mutex_init(&fs->compactLock, NULL);
+  pthread_cond_init(&fs->compactCond, NULL);
+  pthread_mutex_init(&fs->spillLock, NULL);
+  pthread_mutex_init(&fs->snapLock, NULL);
+}
+
 // 这个函数应该在给定的 cwd 数组中存储当前工作目录的规范路径。
 // 它可以假设当前工作目录的规范路径不超过
 // PATH_MAX 字符。
@@ -55,7 +77,9 @@ Fs FsNew(void) {
 /// \param fs
 /// \param cwd
 void FsGetCwd(Fs fs, char cwd[PATH_MAX + 1]) {
-  char *pathAbs = FsPathGetStr(fs->pathRoot);
+  FsTreeRdlock(fs);
+  char *pathAbs = FsPathGetStr(FsCwdGet(fs)->pathRoot);
+  FsTreeUnlock(fs);
   strcpy(cwd, pathAbs);
   free(pathAbs);
 }
@@ -64,10 +88,87 @@ void FsGetCwd(Fs fs, char cwd[PATH_MAX + 1]) {
 // 您可能需要更新这个函数，以释放您创建的任何新数
 // 据结构。
 void FsFree(Fs fs) {
-  FsFilFree(fs->root);
+  // 调用线程没有提交的事务先撤销
+  FsTxAbort(fs);
+  // 快照只释放自身；文件系统先释放它的所有快照
+  if (fs->live)
+    FsSnapshotDrop(fs);
+  while (fs->snapshots)
+    FsFree(fs->snapshots);
+  // 此时不应再有其他线程访问 fs，后台压缩和溢出线程先退出
+  FsCompactStop(fs);
+  FsBudgetSet(fs, 0, NULL);
+  pthread_cond_destroy(&fs->compactCond);
+  pthread_mutex_destroy(&fs->compactLock);
+  FsCwdDetach(fs);
+  pthread_mutex_destroy(&fs->renameLock);
+  pthread_rwlock_destroy(&fs->lock);
+  // 溢出的内容释放后才关闭溢出文件
+  if (!fs->live)
+    FsFilFree(fs->root);
+  pthread_mutex_destroy(&fs->spillLock);
+  pthread_mutex_destroy(&fs->snapLock);
+  free(fs->txLog);
   free(fs);
 }
 
+/// 开始一次静默调用，清空错误详情
+/// \param info 可以为 NULL
+/// \param src 以 NULL 结尾的源路径，info->results 中对应的项置为 FS_OK
+static void FsInfoReset(FsErrorInfo *info, char *src[]) {
+  if (!info)
+    return;
+  info->path = NULL;
+  info->last = false;
+  for (size_t i = 0; src && info->results && src[i]; i++)
+    info->results[i] = FS_OK;
+}
+
+/// 记录出错的路径，只保留第一个错误
+/// \param info 可以为 NULL
+/// \param res
+/// \param path
+/// \param last 见 FsErrorInfo
+/// \return res
+static FsErrors FsFail(FsErrorInfo *info, FsErrors res, const char *path,
+                       bool last) {
+  if (res && info && !info->path) {
+    info->path = path;
+    info->last = last;
+  }
+  return res;
+}
+
+/// 记录第 i 个源路径的错误
+/// \param info 可以为 NULL
+/// \param res
+/// \param src
+/// \param i
+/// \return res
+static FsErrors FsFailSource(FsErrorInfo *info, FsErrors res, char *src[],
+                             size_t i) {
+  if (res && info && info->results)
+    info->results[i] = res;
+  return FsFail(info, res, src[i], false);
+}
+
+/// 空路径不指向任何文件，所有静默接口对它都返回 FS_NO_SUCH_FILE
+/// \param info 可以为 NULL
+/// \param src 以 NULL 结尾的源路径，可以为 NULL
+/// \param dest 可以为 NULL
+/// \return 有空路径时返回 FS_NO_SUCH_FILE，空的源路径填入 info->results
+static FsErrors FsCheckEmpty(FsErrorInfo *info, char *src[],
+                             const char *dest) {
+  FsErrors res = FS_OK;
+  for (size_t i = 0; src && src[i]; i++) {
+    if (!*src[i])
+      res = FsFailSource(info, FS_NO_SUCH_FILE, src, i);
+  }
+  if (dest && !*dest)
+    res = FsFail(info, FS_NO_SUCH_FILE, dest, false);
+  return res;
+}
+
 // 该函数接受一个路径，并在给定文件系统中的该路径上创建一个新目录。
 // FsMkdir 执行的功能与Linux 中的mkdir 命令 大致相同。
 // 文件已存在于指定路径
@@ -80,88 +181,110 @@ void FsFree(Fs fs) {
 // 错误消息(包括其余函数中的错误消息)都应该打印到标准输出，这意味着应该使用printf
 // 打印它们。还要注意，当出现这些错误之一时，程序不应该退出—函数应该简单地返回
 // 文件系统，保持不变。
-void FsMkdir(Fs fs, char *pathStr) {
+/// 在 pathStr 创建文件夹或空文件，调用者需持有整棵树的读锁，
+/// 插入时只锁住上层文件夹
+/// \param fs
+/// \param pathStr
+/// \param type
+/// \param info
+/// \return
+static FsErrors FsCreateUnlocked(Fs fs, const char *pathStr, FileType type,
+                                 FsErrorInfo *info) {
   PATH *path = NULL;
-  char *pathParentStr = FsPathStrShift(pathStr);
-  char *name = FsPathStrGetName(pathStr);
-  FsErrors res = FsPathParse(fs->pathRoot, pathParentStr, &path);
-  if (res != FS_OK) {
-    free(name);
-    FsPathFree(path);
-    free(pathParentStr);
-    PERRORD(res, "mkdir: cannot create directory '%s'", pathStr);
-    return;
-  }
-  PATH *targetPath = FsPathGetTail(path);
-  if (targetPath->file->type == REGULAR_FILE) {
-    free(name);
-    FsPathFree(path);
-    free(pathParentStr);
-    PERRORD(FS_NOT_A_DIRECTORY, "mkfile: cannot create file '%s'", pathStr);
-    return;
-  }
-  PATH *findingPath = NULL;
-  FsErrors resFinding = FsPathParse(fs->pathRoot, pathStr, &findingPath);
-  if (resFinding == FS_OK) {
-    // 找到了文件，错误。
-    PERRORD(FS_FILE_EXISTS, "mkdir: cannot create directory '%s'", pathStr);
-  } else {
-    // 正常情况
-    FIL *dirFile = NULL;
-    FsInitDir(targetPath->file, &dirFile, name);
-    targetPath->file->children[targetPath->file->size_children++] = dirFile;
-    if (targetPath->file->size_children == FS_MAX_CHILDREN) {
-      PERROR(FS_ERROR, "Children pool full!");
+  char *pathParentStr = FsPathStrShift((char *)pathStr);
+  char *name = FsPathStrGetName((char *)pathStr);
+  // 成功时持有上层文件夹的写锁
+  FsErrors res = FsPathParseLocked(FsCwdGet(fs)->pathRoot, pathParentStr,
+                                   &path, FS_LOCK_WRITE);
+  bool last = res == FS_OK;
+  if (res == FS_OK) {
+    PATH *targetPath = FsPathGetTail(path);
+    if (targetPath->file->type == REGULAR_FILE) {
+      pthread_rwlock_unlock(&FsFilTarget(targetPath->file)->lock);
+      res = FS_NOT_A_DIRECTORY;
+    } else {
+      if (!*name || FsFilFindByName(targetPath->file, name)) {
+        // 找到了文件，错误。
+        res = FS_FILE_EXISTS;
+      } else {
+        // 正常情况
+        FIL *file = NULL;
+        if (type == DIRECTORY)
+          FsInitDir(targetPath->file, &file, name);
+        else
+          FsInitFile(targetPath->file, &file, name);
+        FsFilAddChild(targetPath->file, file);
+      }
+      pthread_rwlock_unlock(&targetPath->file->lock);
     }
-    FsFilSort(targetPath->file, 0);
   }
-  FsPathFree(findingPath);
   FsPathFree(path);
   free(name);
   free(pathParentStr);
+  return FsFail(info, res, pathStr, last);
+}
+
+/// 在 pathStr 创建文件夹，不打印错误
+/// \param fs
+/// \param pathStr
+/// \param info 可以为 NULL
+/// \return
+FsErrors FsMkdirQuiet(Fs fs, const char *pathStr, FsErrorInfo *info) {
+  FsInfoReset(info, NULL);
+  if (!fs || !pathStr)
+    return FsFail(info, FS_ERROR, pathStr, false);
+  if (!*pathStr)
+    return FsFail(info, FS_NO_SUCH_FILE, pathStr, false);
+  if (fs->snapshot)
+    return FsFail(info, FS_READ_ONLY, pathStr, false);
+  FsTreeRdlock(fs);
+  FsErrors res = FsCreateUnlocked(fs, pathStr, DIRECTORY, info);
+  FsTreeUnlock(fs);
+  return res;
+}
+
+/// 打印 FsMkdirQuiet 的错误
+void FsMkdir(Fs fs, char *pathStr) {
+  FsErrorInfo info;
+  FsErrors res = FsMkdirQuiet(fs, pathStr, &info);
+  if (res == FS_NOT_A_DIRECTORY && info.last) {
+    // 上层是普通文件时与 FsMkfile 的消息相同
+    PERRORD(res, "mkfile: cannot create file '%s'", pathStr);
+  } else if (res) {
+    PERRORD(res, "mkdir: cannot create directory '%s'", pathStr);
+  }
 }
 
 // 该函数接受一个路径，并在给定文件系统中的该路径上创建一个新的空常规文件。
 // 这个函数在Linux 中没有直接等效的命令，但最接近的命令是touch，它可以用来创建空
 // 的常规文件，但也有其他用途，如更新时间戳。
+/// 在 pathStr 创建空文件，不打印错误
+/// \param fs
+/// \param pathStr
+/// \param info 可以为 NULL
+/// \return
+FsErrors FsMkfileQuiet(Fs fs, const char *pathStr, FsErrorInfo *info) {
+  FsInfoReset(info, NULL);
+  if (!fs || !pathStr)
+    return FsFail(info, FS_ERROR, pathStr, false);
+  if (!*pathStr)
+    return FsFail(info, FS_NO_SUCH_FILE, pathStr, false);
+  if (fs->snapshot)
+    return FsFail(info, FS_READ_ONLY, pathStr, false);
+  FsTreeRdlock(fs);
+  FsErrors res = FsCreateUnlocked(fs, pathStr, REGULAR_FILE, info);
+  FsTreeUnlock(fs);
+  return res;
+}
+
+/// 打印 FsMkfileQuiet 的错误
 void FsMkfile(Fs fs, char *pathStr) {
-  PATH *path = NULL;
-  char *pathParentStr = FsPathStrShift(pathStr);
-  char *name = FsPathStrGetName(pathStr);
-  FsErrors res = FsPathParse(fs->pathRoot, pathParentStr, &path);
-  if (res != FS_OK) {
-    free(name);
-    FsPathFree(path);
-    free(pathParentStr);
+  FsErrors res = FsMkfileQuiet(fs, pathStr, NULL);
+  if (res == FS_FILE_EXISTS) {
+    PERRORD(res, "mkfile: cannot create directory '%s'", pathStr);
+  } else if (res) {
     PERRORD(res, "mkfile: cannot create file '%s'", pathStr);
-    return;
   }
-  PATH *targetPath = FsPathGetTail(path);
-  if (targetPath->file->type == REGULAR_FILE) {
-    FsPathFree(path);
-    free(name);
-    free(pathParentStr);
-    PERRORD(FS_NOT_A_DIRECTORY, "mkfile: cannot create file '%s'", pathStr);
-    return;
-  }
-  PATH *findingPath = NULL;
-  FsErrors resFinding = FsPathParse(fs->pathRoot, pathStr, &findingPath);
-  if (resFinding == FS_OK) {
-    // 找到了文件，错误。
-    PERRORD(FS_FILE_EXISTS, "mkfile: cannot create directory '%s'", pathStr);
-  } else {
-    // 正常情况
-    FIL *file = NULL;
-    FsInitFile(targetPath->file, &file, name);
-    targetPath->file->children[targetPath->file->size_children++] = file;
-    if (targetPath->file->size_children == FS_MAX_CHILDREN) {
-      PERROR(FS_ERROR, "Children pool full!");
-    }
-    FsFilSort(targetPath->file, 0);
-  }
-  FsPathFree(path);
-  free(pathParentStr);
-  free(name);
 }
 
 // 该函数的路径可能为 NULL。
@@ -170,30 +293,42 @@ void FsMkfile(Fs fs, char *pathStr) {
 // 因为在这次任务中我们没有主目录)。 该函数大致相当于 Linux 中的 cd 命令。
 // 路径的前缀是一个常规文件 cd: 'path': Not a directory
 // 路径的前缀不存在 cd: 'path': No such file or directory
-void FsCd(Fs fs, char *pathStr) {
-  if (!pathStr || !*pathStr) {
-    FsPathFree(fs->pathRoot->next);
-    fs->pathRoot->file = fs->root;
-    fs->pathRoot->next = NULL;
-    fs->current = fs->pathRoot;
-    return;
+/// 修改当前线程的工作目录，不打印错误
+/// \param fs
+/// \param pathStr 为 NULL 时回到根目录
+/// \param info 可以为 NULL
+/// \return 空路径返回 FS_NO_SUCH_FILE
+FsErrors FsCdQuiet(Fs fs, const char *pathStr, FsErrorInfo *info) {
+  FsInfoReset(info, NULL);
+  if (!fs)
+    return FsFail(info, FS_ERROR, pathStr, false);
+  if (pathStr && !*pathStr)
+    return FsFail(info, FS_NO_SUCH_FILE, pathStr, false);
+  // 只修改当前线程的工作目录，因此读锁即可
+  FsTreeRdlock(fs);
+  FsCwd *cwd = FsCwdGet(fs);
+  FsErrors res = FS_OK;
+  if (!pathStr) {
+    FsCwdSet(cwd, NULL);
+  } else {
+    PATH *path = NULL;
+    res = FsPathParse(cwd->pathRoot, pathStr, &path);
+    if (res == FS_OK && FsPathGetTail(path)->file->type == REGULAR_FILE)
+      res = FS_NOT_A_DIRECTORY;
+    if (res == FS_OK)
+      FsCwdSet(cwd, FsPathClone(path));
+    FsPathFree(path);
   }
-  PATH *path = NULL;
-  FsErrors res = FsPathParse(fs->pathRoot, pathStr, &path);
+  FsTreeUnlock(fs);
+  return FsFail(info, res, pathStr, false);
+}
+
+/// 打印 FsCdQuiet 的错误
+void FsCd(Fs fs, char *pathStr) {
+  FsErrors res = FsCdQuiet(fs, pathStr, NULL);
   if (res) {
     PERRORD(res, "cd: '%s'", pathStr);
-  } else {
-    PATH *pathTail = FsPathGetTail(path);
-    if (pathTail->file->type == REGULAR_FILE) {
-      PERRORD(FS_NOT_A_DIRECTORY, "cd: '%s'", pathStr);
-    } else {
-      FsPathFree(fs->pathRoot);
-      fs->pathRoot = FsPathClone(path);
-      fs->current = FsPathGetTail(fs->pathRoot);
-    }
   }
-
-  FsPathFree(path);
 }
 
 // 该函数的路径可能为NULL。
@@ -207,59 +342,197 @@ void FsCd(Fs fs, char *pathStr) {
 // ls: cannot access 'path': Not a directory
 // 路径的前缀不存在 ls: cannot access 'path': No such file or
 // directory
-void FsLs(Fs fs, char *pathStr) {
-  FIL *target = NULL;
-  if (!pathStr || !*pathStr) {
-    target = fs->current->file;
-  } else {
-    PATH *path = NULL;
-    FsErrors res = FsPathParse(fs->pathRoot, pathStr, &path);
-    if (res) {
-      PERRORD(res, "ls: cannot access '%s'", pathStr);
-      FsPathFree(path);
-      return;
-    }
-    target = FsPathGetTail(path)->file;
-    FsPathFree(path);
-    if (target->type == REGULAR_FILE) {
-      // ls 到一个文件，则输出这个文件~~的绝对路径~~
-      // char *pathStrAbs = FsPathGetStr(path);
-      // puts(pathStrAbs);
-      // free(pathStrAbs);
-      // 输出这个文件的输入参数
-      puts(pathStr);
-      return;
-    }
-  }
-  for (int i = 0; i < target->size_children; i++) {
-    FIL *f = target->children[i];
-    if (f->link)
-      continue;
+/// 打印 ls 的一行
+/// \param type
+/// \param name 列表中的文件名
+static void FsLsPrint(FileType type, const char *name) {
 #ifdef COLORED
-    printf("%s%s%s", (f->type == REGULAR_FILE ? RESET_COLOR : BLUE), f->name,
-           RESET_COLOR);
+  printf("%s%s%s", (type == REGULAR_FILE ? RESET_COLOR : BLUE), name,
+         RESET_COLOR);
 #else
-    printf("%s", f->name);
+  printf("%s", name);
 #endif
 #ifdef FS_SHOW_DIR_SPLIT
-    if (f->type == DIRECTORY)
-      printf(FS_SPLIT_STR "\n");
-    else
-      printf("\n");
+  if (type == DIRECTORY)
+    printf(FS_SPLIT_STR "\n");
+  else
+    printf("\n");
 #else
-    puts("");
+  puts("");
 #endif
+}
+
+/// 按字典序对文件夹中的每个文件调用 callback，不打印错误。
+/// pathStr 是文件时只对它调用一次，name 为 pathStr 本身。
+/// 不加锁，callback 在 epoch 临界区中执行
+/// \param fs
+/// \param pathStr 为 NULL 时是当前目录，空路径返回 FS_NO_SUCH_FILE
+/// \param callback 为 NULL 时只检查路径是否存在
+/// \param ctx 传给 callback
+/// \param info 可以为 NULL
+/// \return
+FsErrors FsLsQuiet(Fs fs, const char *pathStr, FsPrefixCallback callback,
+                   void *ctx, FsErrorInfo *info) {
+  FsInfoReset(info, NULL);
+  if (!fs)
+    return FsFail(info, FS_ERROR, pathStr, false);
+  if (pathStr && !*pathStr)
+    return FsFail(info, FS_NO_SUCH_FILE, pathStr, false);
+  FsErrors res = FS_OK;
+  PATH *path = NULL;
+  FsEpochEnter();
+  FIL *target = FsCwdGet(fs)->current->file;
+  if (pathStr) {
+    res = FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path);
+    if (res == FS_OK)
+      target = FsPathGetTail(path)->file;
+  }
+  if (res == FS_OK && callback) {
+    if (target->type == REGULAR_FILE) {
+      callback(target, pathStr, ctx);
+    } else {
+      // 列表发布后不会再被修改，遍历的是某一时刻的快照
+      FIL_LIST *children = FsFilChildren(target);
+      for (size_t i = 0; i < children->size; i++) {
+        if (FS_IS_DOT(children->items[i].file))
+          continue;
+        callback(children->items[i].file, children->items[i].name, ctx);
+      }
+    }
+  }
+  FsEpochExit();
+  FsPathFree(path);
+  return FsFail(info, res, pathStr, false);
+}
+
+/// FsLs 的回调
+/// \param file
+/// \param name
+/// \param ctx FsLs 的路径参数
+static void FsLsVisit(FIL *file, const char *name, void *ctx) {
+  // ls 到一个文件，则输出这个文件的输入参数
+  if (name == ctx)
+    puts(name);
+  else
+    FsLsPrint(file->type, name);
+}
+
+/// 打印 FsLsQuiet 列出的文件和错误
+void FsLs(Fs fs, char *pathStr) {
+  FsErrors res = FsLsQuiet(fs, pathStr, FsLsVisit, pathStr, NULL);
+  if (res) {
+    PERRORD(res, "ls: cannot access '%s'", pathStr);
+  }
+}
+
+/// 按字典序对文件夹中以 prefix 开头的每个文件调用 callback，
+/// 二分查找到范围后只访问匹配的文件，时间复杂度 O(log n + k)。
+/// 不加锁，callback 在 epoch 临界区中执行
+/// \param fs
+/// \param pathStr 文件夹路径，为空时是当前目录
+/// \param prefix
+/// \param callback
+/// \param ctx 传给 callback
+/// \return
+FsErrors FsPrefix(Fs fs, const char *pathStr, const char *prefix,
+                  FsPrefixCallback callback, void *ctx) {
+  FsErrors res = FS_OK;
+  PATH *path = NULL;
+  FsEpochEnter();
+  FIL *target = FsCwdGet(fs)->current->file;
+  if (pathStr && *pathStr) {
+    res = FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path);
+    if (res == FS_OK)
+      target = FsPathGetTail(path)->file;
+  }
+  if (res == FS_OK && target->type != DIRECTORY)
+    res = FS_NOT_A_DIRECTORY;
+  if (res == FS_OK) {
+    FIL_LIST *children = FsFilChildren(target);
+    size_t end = 0;
+    for (size_t i = FsFilPrefixRange(children, prefix ? prefix : "", &end);
+         i < end; i++)
+      callback(children->items[i].file, children->items[i].name, ctx);
+  }
+  FsEpochExit();
+  FsPathFree(path);
+  return res;
+}
+
+static void FsLsPrefixPrint(FIL *file, const char *name, void *ctx) {
+  FsLsPrint(file->type, name);
+}
+
+/// 列出文件夹中以 prefix 开头的文件，格式与 FsLs 相同
+/// \param fs
+/// \param pathStr
+/// \param prefix
+void FsLsPrefix(Fs fs, char *pathStr, const char *prefix) {
+  FsErrors res = FsPrefix(fs, pathStr, prefix, FsLsPrefixPrint, NULL);
+  if (res) {
+    PERRORD(res, "ls: cannot access '%s'", pathStr ? pathStr : "");
+  }
+}
+
+// 该函数对应 shell 中的 ls --limit N --after NAME [PATH]：
+// 用 FsOpendir 分页列出文件夹，从 NAME 之后开始最多列出 N 项，
+// 格式与 FsLs 相同
+void FsLsPage(Fs fs, char *arg) {
+  char *pathStr = NULL;
+  const char *after = NULL;
+  size_t limit = SIZE_MAX;
+  for (char *token = arg ? strtok(arg, " ") : NULL; token;
+       token = strtok(NULL, " ")) {
+    if (strcmp(token, "--limit") != 0 && strcmp(token, "--after") != 0) {
+      pathStr = token;
+      continue;
+    }
+    char *value = strtok(NULL, " ");
+    if (!value) {
+      printf("ls: option '%s' requires an argument\n", token);
+      return;
+    }
+    if (strcmp(token, "--after") == 0) {
+      after = value;
+      continue;
+    }
+    char *end;
+    limit = strtoul(value, &end, 10);
+    if (*end) {
+      printf("ls: invalid limit '%s'\n", value);
+      return;
+    }
+  }
+  FsDir *dir = NULL;
+  FsErrors res = FsOpendir(fs, pathStr, after, &dir);
+  const FsDirent *entry = NULL;
+  for (size_t n = 0; res == FS_OK && n < limit; n++) {
+    res = FsReaddir(dir, &entry);
+    if (res || !entry)
+      break;
+    FsLsPrint(entry->type, entry->name);
+  }
+  FsClosedir(dir);
+  if (res) {
+    PERRORD(res, "ls: cannot access '%s'", pathStr ? pathStr : "");
   }
 }
 
 // 该函数打印当前工作目录的规范路径。
 // 该函数大致相当于 Linux 下的 pwd 命令。
-void FsPwd(Fs fs) {
-  char *pathStrAbs = FsPathGetStr(fs->pathRoot);
+static void FsPwdUnlocked(Fs fs) {
+  char *pathStrAbs = FsPathGetStr(FsCwdGet(fs)->pathRoot);
   printf("%s\n", pathStrAbs);
   free(pathStrAbs);
 }
 
+/// 加读锁执行 FsPwdUnlocked
+void FsPwd(Fs fs) {
+  FsTreeRdlock(fs);
+  FsPwdUnlocked(fs);
+  FsTreeUnlock(fs);
+}
+
 // 该函数的路径可能为 NULL。
 // 如果路径为 NULL，则默认为根目录。
 // 该函数以结构化的方式打印给定路径的目录层次结构(见下面)。
@@ -270,85 +543,178 @@ void FsPwd(Fs fs) {
 // 每一级缩进增加 4 个空格。请参阅用法示例。
 // 路径的前缀是一个常规文件 tree: 'path': Not a directory
 // 路径的前缀不存在 tree: 'path': No such file or directory
-void FsTree(Fs fs, char *pathStr) {
-  if (!pathStr) {
-    // 根目录
-    FsTree(fs, "/");
-    return;
+/// FsTree 的访问者：按深度缩进打印文件名
+/// \param entry
+/// \param ctx
+/// \return
+static FsWalkAction FsTreeVisit(const FsWalkEntry *entry, void *ctx) {
+  if (entry->depth == 0) {
+    printf("%s\n", entry->path);
+    return FS_WALK_CONTINUE;
   }
+  // 列表中的文件名，在快照中是改名之前的名字
+  const char *name = strrchr(entry->path, FS_SPLIT) + 1;
+  for (int j = 0; j < entry->depth; j++)
+    printf("    ");
+#ifdef COLORED
+  printf("%s%s%s",
+         (entry->file->type == REGULAR_FILE ? RESET_COLOR : BLUE), name,
+         RESET_COLOR);
+#else
+  printf("%s", name);
+#endif
+#ifdef FS_SHOW_DIR_SPLIT
+  if (entry->file->type == DIRECTORY)
+    puts(FS_SPLIT_STR);
+  else
+    puts("");
+#else
+  puts("");
+#endif
+  return FS_WALK_CONTINUE;
+}
+
+/// 按先序、字典序遍历 pathStr 下的文件树，不打印错误
+/// \param fs
+/// \param pathStr 为 NULL 时是根目录
+/// \param visitor 见 FsWalkFil
+/// \param ctx
+/// \param info 可以为 NULL
+/// \return pathStr 不是文件夹时返回 FS_NOT_A_DIRECTORY
+FsErrors FsTreeQuiet(Fs fs, const char *pathStr, FsWalkVisitor visitor,
+                     void *ctx, FsErrorInfo *info) {
+  FsInfoReset(info, NULL);
+  if (!fs || !visitor)
+    return FsFail(info, FS_ERROR, pathStr, false);
+  if (pathStr && !*pathStr)
+    return FsFail(info, FS_NO_SUCH_FILE, pathStr, false);
+  if (!pathStr)
+    pathStr = FS_SPLIT_STR;
+  FsTreeRdlock(fs);
   PATH *path = NULL;
-  FsErrors res = FsPathParse(fs->pathRoot, pathStr, &path);
-  if (res) {
-    FsPathFree(path);
-    PERRORD(res, "tree: '%s'", pathStr);
-    return;
-  }
-  char *pathStrAbs = FsPathGetStr(path);
-  PATH *pathTail = FsPathGetTail(path);
-  // printf("tree %s:\n", pathStrAbs);
-  res = FsTreeInner(pathTail->file, 0, pathStr);
+  FsErrors res = FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path);
+  if (res == FS_OK && FsPathGetTail(path)->file->type == REGULAR_FILE)
+    res = FS_NOT_A_DIRECTORY;
+  // 有序遍历，输出与逐层递归打印相同
+  if (res == FS_OK)
+    FsWalkFil(FsPathGetTail(path)->file, pathStr, visitor, ctx,
+              FS_WALK_ORDERED);
+  FsPathFree(path);
+  FsTreeUnlock(fs);
+  return FsFail(info, res, pathStr, false);
+}
+
+/// 打印 FsTreeQuiet 遍历的文件树和错误
+void FsTree(Fs fs, char *pathStr) {
+  FsErrors res = FsTreeQuiet(fs, pathStr, FsTreeVisit, NULL, NULL);
   if (res) {
-    FsPathFree(path);
     PERRORD(res, "tree: '%s'", pathStr);
-    return;
   }
-  FsPathFree(path);
-  free(pathStrAbs);
 }
 
 // ========== Task 1 ↑ | ↓ Task 2 ==========
 
 // 该函数接受一个路径和一个字符串，并将该路径上的常规文件的内容设置为
 // 给定的字符串。如果文件已经有一些内容，那么它将被覆盖。
-void FsPut(Fs fs, char *pathStr, char *content) {
+/// 把文件的内容替换为 content，不打印错误。
+/// 加读锁，文件内容由文件自身的写锁保护
+/// \param fs
+/// \param pathStr
+/// \param content
+/// \param length content 的字节数
+/// \param info 可以为 NULL
+/// \return
+FsErrors FsPutQuiet(Fs fs, const char *pathStr, const char *content,
+                    size_t length, FsErrorInfo *info) {
+  FsInfoReset(info, NULL);
+  if (!fs || !pathStr || (!content && length))
+    return FsFail(info, FS_ERROR, pathStr, false);
+  if (!*pathStr)
+    return FsFail(info, FS_NO_SUCH_FILE, pathStr, false);
+  if (fs->snapshot)
+    return FsFail(info, FS_READ_ONLY, pathStr, false);
+  FsTreeRdlock(fs);
   PATH *path = NULL;
-  FsErrors res = FsPathParse(fs->pathRoot, pathStr, &path);
+  FsErrors res = FsPathParseLocked(FsCwdGet(fs)->pathRoot, pathStr, &path,
+                                   FS_LOCK_WRITE);
+  if (res == FS_OK) {
+    PATH *pathTail = FsPathGetTail(path);
+    if (pathTail->file->type != REGULAR_FILE) {
+      pthread_rwlock_unlock(&pathTail->file->lock);
+      res = FS_IS_A_DIRECTORY;
+    } else {
+      FIL *target = FsFilTarget(pathTail->file);
+      // 写好新内容后整体替换，正在无锁读取旧内容的线程不受影响
+      FsFilReplace(target, content, length);
+      pthread_rwlock_unlock(&target->lock);
+    }
+  }
+  FsPathFree(path);
+  FsTreeUnlock(fs);
+  return FsFail(info, res, pathStr, false);
+}
+
+/// 打印 FsPutQuiet 的错误
+void FsPut(Fs fs, char *pathStr, char *content) {
+  FsErrors res = FsPutQuiet(fs, pathStr, content, strlen(content), NULL);
   if (res) {
     PERRORD(res, "put: '%s'", pathStr);
-    FsPathFree(path);
-    return;
   }
-  PATH *pathTail = FsPathGetTail(path);
-  if (pathTail->file->type != REGULAR_FILE) {
-    PERRORD(FS_IS_A_DIRECTORY, "put: '%s'", pathStr);
-    FsPathFree(path);
-    return;
-  }
-  FIL *target = pathTail->file;
-  if (target->size_file) {
-    if (target->content)
-      free(target->content);
-    target->content = NULL;
-    target->size_file = 0;
-  }
-  size_t length = strlen(content) + 1;
-  target->content = malloc(sizeof(char) * length);
-  memcpy(target->content, content, length);
-  target->size_file = length;
-  FsPathFree(path);
 }
 
 // 该函数接受一个路径，并在该路径上打印常规文件的内容。
 // 这个函数大致相当于Linux 中的cat 命令。
-void FsCat(Fs fs, char *pathStr) {
+/// 把文件的内容逐段交给 callback，不打印错误。
+/// 不加锁，callback 在 epoch 临界区中执行
+/// \param fs
+/// \param pathStr
+/// \param callback
+/// \param ctx 传给 callback
+/// \param info 可以为 NULL
+/// \return
+FsErrors FsCatQuiet(Fs fs, const char *pathStr, FsDataCallback callback,
+                    void *ctx, FsErrorInfo *info) {
+  FsInfoReset(info, NULL);
+  if (!fs || !pathStr || !callback)
+    return FsFail(info, FS_ERROR, pathStr, false);
+  if (!*pathStr)
+    return FsFail(info, FS_NO_SUCH_FILE, pathStr, false);
   PATH *path = NULL;
-  FsErrors res = FsPathParse(fs->pathRoot, pathStr, &path);
+  FsEpochEnter();
+  FsErrors res = FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path);
+  if (res == FS_OK && FsPathGetTail(path)->file->type != REGULAR_FILE)
+    res = FS_IS_A_DIRECTORY;
+  if (res == FS_OK) {
+    // 逐段输出，大文件不需要拼接成连续的内容
+    size_t length;
+    FIL_CONTENT *content =
+        FsFilContentLoad(fs, FsFilTarget(FsPathGetTail(path)->file), &length);
+    for (size_t offset = 0; content && offset < length;) {
+      const char *data;
+      size_t n = FsContentSegment(content, length, offset, &data);
+      callback(data, n, ctx);
+      offset += n;
+    }
+  }
+  FsEpochExit();
+  FsPathFree(path);
+  return FsFail(info, res, pathStr, false);
+}
+
+/// FsCat 的回调
+/// \param data
+/// \param length
+/// \param ctx
+static void FsCatWrite(const char *data, size_t length, void *ctx) {
+  fwrite(data, sizeof(char), length, stdout);
+}
+
+/// 打印 FsCatQuiet 读到的内容和错误
+void FsCat(Fs fs, char *pathStr) {
+  FsErrors res = FsCatQuiet(fs, pathStr, FsCatWrite, NULL, NULL);
   if (res) {
     PERRORD(res, "put: '%s'", pathStr);
-    FsPathFree(path);
-    return;
-  }
-  PATH *pathTail = FsPathGetTail(path);
-  if (pathTail->file->type != REGULAR_FILE) {
-    PERRORD(FS_IS_A_DIRECTORY, "put: '%s'", pathStr);
-    FsPathFree(path);
-    return;
   }
-  FIL *target = pathTail->file;
-  if (target->size_file) {
-    printf("%s", target->content);
-  }
-  FsPathFree(path);
 }
 
 // 该函数接受一个指向目录的路径，当且仅当该路径为空时删除该目录。
@@ -356,28 +722,44 @@ void FsCat(Fs fs, char *pathStr) {
 // 为简单起见，可以假设给定路径不包含当前工作目录。
 // 注意，这意味着给定的路径永远不会是根目录。如果您愿意(为了
 // 完整性起见)，您可以处理这种情况，但是不会对它进行测试。
-void FsDldir(Fs fs, char *pathStr) {
+/// 删除空文件夹，不打印错误。加写锁
+/// \param fs
+/// \param pathStr
+/// \param info 可以为 NULL
+/// \return
+FsErrors FsDldirQuiet(Fs fs, const char *pathStr, FsErrorInfo *info) {
+  FsInfoReset(info, NULL);
+  if (!fs || !pathStr)
+    return FsFail(info, FS_ERROR, pathStr, false);
+  if (!*pathStr)
+    return FsFail(info, FS_NO_SUCH_FILE, pathStr, false);
+  if (fs->snapshot)
+    return FsFail(info, FS_READ_ONLY, pathStr, false);
+  FsTreeWrlock(fs);
   PATH *path = NULL;
-  FsErrors res = FsPathParse(fs->pathRoot, pathStr, &path);
+  FsErrors res = FsPathParseLink(FsCwdGet(fs)->pathRoot, pathStr, &path);
+  if (res == FS_OK) {
+    FIL *dirFile = FsPathGetTail(path)->file;
+    if (dirFile->type != DIRECTORY) {
+      res = FS_NOT_A_DIRECTORY;
+    } else if (dirFile->children->size > 2) {
+      res = FS_DIRECTORY_NOT_EMPTY;
+    } else {
+      // TODO: check root
+      FsFilDlTree(dirFile);
+    }
+  }
+  FsPathFree(path);
+  FsTreeUnlock(fs);
+  return FsFail(info, res, pathStr, false);
+}
+
+/// 打印 FsDldirQuiet 的错误
+void FsDldir(Fs fs, char *pathStr) {
+  FsErrors res = FsDldirQuiet(fs, pathStr, NULL);
   if (res) {
     PERRORD(res, "dldir: failed to remove '%s'", pathStr);
-    FsPathFree(path);
-    return;
   }
-  PATH *pathTail = FsPathGetTail(path);
-  if (pathTail->file->type != DIRECTORY) {
-    PERRORD(FS_NOT_A_DIRECTORY, "dldir: failed to remove '%s'", pathStr);
-    FsPathFree(path);
-    return;
-  }
-  FIL *dirFile = pathTail->file;
-  if (dirFile->size_children > 2) {
-    PERRORD(FS_DIRECTORY_NOT_EMPTY, "dldir: failed to remove '%s'", pathStr);
-  } else {
-    // TODO: check root
-    FsFilDlTree(dirFile);
-  }
-  FsPathFree(path);
 }
 
 // 该功能采取路径并删除该路径上的文件。
@@ -385,31 +767,105 @@ void FsDldir(Fs fs, char *pathStr) {
 // 果递归是真实的。如果路径指常规文件，则递归参数无关紧要。
 // 此函数大致对应于 Linux 中的 rm 命令，递归真实性与 rm 命令中使用的 -r
 // 选项相对应。
-void FsDl(Fs fs, bool recursive, char *pathStr) {
+/// 删除文件，不打印错误。加写锁
+/// \param fs
+/// \param recursive 是否删除文件夹
+/// \param pathStr
+/// \param info 可以为 NULL，找到文件之后的错误 last 为 true
+/// \return
+FsErrors FsDlQuiet(Fs fs, bool recursive, const char *pathStr,
+                   FsErrorInfo *info) {
+  FsInfoReset(info, NULL);
+  if (!fs || !pathStr)
+    return FsFail(info, FS_ERROR, pathStr, false);
+  if (!*pathStr)
+    return FsFail(info, FS_NO_SUCH_FILE, pathStr, false);
+  if (fs->snapshot)
+    return FsFail(info, FS_READ_ONLY, pathStr, false);
+  FsTreeWrlock(fs);
   PATH *path = NULL;
-  FsErrors res = FsPathParse(fs->pathRoot, pathStr, &path);
-  if (res) {
+  // 删除符号链接本身，而不是它指向的文件
+  FsErrors res = FsPathParseLink(FsCwdGet(fs)->pathRoot, pathStr, &path);
+  bool last = res == FS_OK;
+  if (res == FS_OK) {
+    FIL *target = FsPathGetTail(path)->file;
+    if (target->type == DIRECTORY && !recursive)
+      res = FS_IS_A_DIRECTORY;
+    else
+      FsFilDlTree(target);
+  }
+  FsPathFree(path);
+  FsTreeUnlock(fs);
+  return FsFail(info, res, pathStr, last);
+}
+
+/// 打印 FsDlQuiet 的错误
+void FsDl(Fs fs, bool recursive, char *pathStr) {
+  FsErrorInfo info;
+  FsErrors res = FsDlQuiet(fs, recursive, pathStr, &info);
+  if (res && info.last) {
+    PERRORD(res, "dl: failed to remove '%s'", pathStr);
+  } else if (res) {
     PERRORD(res, "dl: cannot remove '%s'", pathStr);
-    FsPathFree(path);
-    return;
   }
-  PATH *pathTail = FsPathGetTail(path);
-  FIL *target = pathTail->file;
-  if (target->type == DIRECTORY && !recursive) {
-    PERRORD(FS_IS_A_DIRECTORY, "dl: failed to remove '%s'", pathStr);
+}
+
+/// 把多个路径的文件一起移动或复制到文件夹中，调用者需持有整棵树的写锁。
+/// 先解析所有路径，解析失败的路径记录错误后跳过，其余的交给
+/// FsFilMoveBatch 或 FsFilCopyBatch，目标文件夹的子文件列表只重建一次
+/// \param fs
+/// \param src
+/// \param dst 目标文件夹
+/// \param move 为 true 时移动，否则复制
+/// \param recursive 复制时是否复制文件夹
+/// \param info 可以为 NULL，每个源路径的结果填入 info->results
+/// \return 第一个出错的源路径的错误
+static FsErrors FsBatchUnlocked(Fs fs, char *src[], FIL *dst, bool move,
+                                bool recursive, FsErrorInfo *info) {
+  size_t n = 0;
+  while (src[n])
+    n++;
+  FIL **files = malloc(sizeof(FIL *) * n);
+  size_t *index = malloc(sizeof(size_t) * n);
+  FsErrors *results = malloc(sizeof(FsErrors) * n);
+  FsErrors *all = malloc(sizeof(FsErrors) * n);
+  assert(files && index && results && all);
+  size_t k = 0;
+  for (size_t i = 0; i < n; i++) {
+    PATH *path = NULL;
+    // 移动符号链接本身，复制链接指向的文件
+    FsErrors res =
+        move ? FsPathParseLink(FsCwdGet(fs)->pathRoot, src[i], &path)
+             : FsPathParse(FsCwdGet(fs)->pathRoot, src[i], &path);
+    // 不recursive 的时候不复制目录
+    if (res == FS_OK && !move && !recursive &&
+        FsPathGetTail(path)->file->type == DIRECTORY)
+      res = FS_IS_A_DIRECTORY;
+    all[i] = res;
+    if (res == FS_OK) {
+      files[k] = FsPathGetTail(path)->file;
+      index[k++] = i;
+    }
     FsPathFree(path);
-    return;
   }
-  if (target->type == REGULAR_FILE) {
-    FsFilDlTree(target);
-  } else {
-    if (!recursive && target->size_children > 2) {
-      PERRORD(FS_DIRECTORY_NOT_EMPTY, "dl: failed to remove '%s'", pathStr)
-    } else {
-      FsFilDlTree(target);
-    }
+  if (move)
+    FsFilMoveBatch(files, k, dst, results);
+  else
+    FsFilCopyBatch(files, k, dst, results);
+  for (size_t i = 0; i < k; i++)
+    all[index[i]] = results[i];
+  // 按源路径的顺序记录，第一个出错的源路径作为 info->path
+  FsErrors first = FS_OK;
+  for (size_t i = 0; i < n; i++) {
+    FsFailSource(info, all[i], src, i);
+    if (!first)
+      first = all[i];
   }
-  FsPathFree(path);
+  free(all);
+  free(results);
+  free(index);
+  free(files);
+  return first;
 }
 
 // 该函数接受一个以NULL 结尾的路径数组src 和路径dest。
@@ -418,53 +874,50 @@ void FsDl(Fs fs, bool recursive, char *pathStr) {
 // 函数应该将src 数组中所有路径下的文 件复制到dest 目录下。
 // 默认情况下，函数不复制目录-只有当递归为true 时，它才应该复制目录。
 // 这个函数大致相当于Linux 中的cp 命令。
-void FsCp(Fs fs, bool recursive, char *src[], char *dest) {
+static FsErrors FsCpUnlocked(Fs fs, bool recursive, char *src[],
+                             const char *dest, FsErrorInfo *info) {
   // TODO: 检查路径包含
   char **pathStrPointer = src;
-  if (!*pathStrPointer) {
-    PERROR(FS_NO_SUCH_FILE, "cp");
-    return;
-  }
+  if (!*pathStrPointer)
+    return FsFail(info, FS_NO_SUCH_FILE, NULL, false);
   PATH *pathDst = NULL;
-  FsErrors resDst = FsPathParse(fs->pathRoot, dest, &pathDst);
+  FsErrors resDst = FsPathParse(FsCwdGet(fs)->pathRoot, dest, &pathDst);
   if (resDst) {
+    FsErrors res = resDst;
     if (resDst == FS_NO_SUCH_FILE) {
       // 找不到 Dist 则新建这个文件
       // 取 dst 的上层parent
       PATH *dstPathParent = NULL;
-      char *pathParentStr = FsPathStrShift(dest);
-      FsErrors res = FsPathParse(fs->pathRoot, pathParentStr, &dstPathParent);
+      char *pathParentStr = FsPathStrShift((char *)dest);
+      res = FsPathParse(FsCwdGet(fs)->pathRoot, pathParentStr, &dstPathParent);
       if (res != FS_OK) {
-        PERRORD(res, "cp: '%s'", dest);
+        FsFail(info, res, dest, false);
       } else {
         PATH *pathParent = NULL;
-        res = FsPathParse(fs->pathRoot, *pathStrPointer, &pathParent);
+        res = FsPathParse(FsCwdGet(fs)->pathRoot, *pathStrPointer, &pathParent);
         if (res) {
-          PERRORD(res, "cp: '%s'", *pathStrPointer);
+          FsFailSource(info, res, src, 0);
         } else {
           PATH *dstPathParentTail = FsPathGetTail(dstPathParent);
           PATH *pathParentTail = FsPathGetTail(pathParent);
           if (pathParentTail->file->type == DIRECTORY && !recursive) {
-            PERRORD(FS_IS_A_DIRECTORY, "cp: '%s'", *pathStrPointer);
+            res = FsFailSource(info, FS_IS_A_DIRECTORY, src, 0);
           } else {
             if (pathParentTail->file->type == DIRECTORY) {
-              // 建立对应名字文件夹，然后按文件夹内复制
-              FIL *newDir = NULL;
-              char *name = FsPathStrGetName(dest);
-              FsInitDir(dstPathParentTail->file, &newDir, name);
+              // 复制出对应名字的整个文件夹，建好之后再插入
+              FIL *dstDir = dstPathParentTail->file;
+              char *name = FsPathStrGetName((char *)dest);
+              FIL *newDir = FsFilClone(pathParentTail->file, dstDir, name);
               free(name);
-              for (int i = 0; i < pathParentTail->file->size_children; i++) {
-                FsFilCopy(pathParentTail->file->children[i], newDir);
-              }
-              dstPathParentTail->file
-                  ->children[dstPathParentTail->file->size_children++] = newDir;
-              FsFilSort(dstPathParentTail->file, 0);
+              FsFilAddChild(dstDir, newDir);
               // FsFilCopy(pathParentTail->file, dstPathParentTail->file);
             } else {
               FIL *newFile = NULL;
-              char *name = FsPathStrGetName(dest);
+              char *name = FsPathStrGetName((char *)dest);
               FsInitFile(dstPathParentTail->file, &newFile, name);
               free(name);
+              newFile->content = FsContentClone(
+                  fs, FsFilTarget(pathParentTail->file)->content);
               FsFilCopy(newFile, dstPathParentTail->file);
               FsFilFree(newFile);
             }
@@ -472,13 +925,15 @@ void FsCp(Fs fs, bool recursive, char *src[], char *dest) {
         }
         FsPathFree(pathParent);
       }
+      FsPathFree(dstPathParent);
       free(pathParentStr);
     } else {
-      PERRORD(resDst, "cp: '%s'", dest);
+      FsFail(info, resDst, dest, false);
     }
     FsPathFree(pathDst);
-    return;
+    return res;
   }
+  FsErrors res = FS_OK;
   PATH *pathDstTail = FsPathGetTail(pathDst);
   if (pathDstTail->file->type != DIRECTORY) {
     // 目标是个文件，则覆盖这个文件
@@ -486,36 +941,27 @@ void FsCp(Fs fs, bool recursive, char *src[], char *dest) {
     FIL *dstParent = pathDstTail->file->parent;
     // 只取最上面的文件
     PATH *pathParent = NULL;
-    FsErrors res = FsPathParse(fs->pathRoot, *pathStrPointer, &pathParent);
+    res = FsPathParse(FsCwdGet(fs)->pathRoot, *pathStrPointer, &pathParent);
     if (res) {
-      PERRORD(res, "cp: '%s'", *pathStrPointer);
       FsPathFree(pathParent);
-      return;
+      FsPathFree(pathDst);
+      return FsFailSource(info, res, src, 0);
     }
     char *nameOld = malloc(sizeof(char) * (pathDstTail->file->name_length + 1));
     strcpy(nameOld, pathDstTail->file->name);
     FsFilDlTree(pathDstTail->file);
 
     PATH *pathParentTail = FsPathGetTail(pathParent);
-    if (pathParentTail->file->link) {
-      PERRORD(FS_NO_SUCH_FILE, "cp: '%s'", *pathStrPointer);
+    if (FS_IS_DOT(pathParentTail->file)) {
+      res = FsFailSource(info, FS_NO_SUCH_FILE, src, 0);
     } else {
       // 复制到内存
       FIL *newFile = NULL;
       FsInitFile(pathParentTail->file->parent, &newFile, nameOld);
-      newFile->size_file = pathParentTail->file->size_file;
-      newFile->content = malloc(sizeof(char) * newFile->size_file);
-      memcpy(newFile->content, pathParentTail->file->content,
-             sizeof(char) * newFile->size_file);
+      newFile->content =
+          FsContentClone(fs, FsFilTarget(pathParentTail->file)->content);
       // 复制该文件
-      if (pathParentTail->file->link) {
-        PERRORD(FS_NO_SUCH_FILE, "cp: '%s'", *pathStrPointer);
-      } else {
-        res = FsFilCopy(newFile, dstParent);
-        if (res) {
-          PERRORD(res, "cp: '%s'", *pathStrPointer);
-        }
-      }
+      res = FsFailSource(info, FsFilCopy(newFile, dstParent), src, 0);
       FsFilFree(newFile);
     }
     free(nameOld);
@@ -525,118 +971,139 @@ void FsCp(Fs fs, bool recursive, char *src[], char *dest) {
     // 源文件仅包含一个路径
     if (*pathStrPointer && !*(pathStrPointer + 1)) {
       PATH *pathParent = NULL;
-      FsErrors res = FsPathParse(fs->pathRoot, *pathStrPointer, &pathParent);
+      res = FsPathParse(FsCwdGet(fs)->pathRoot, *pathStrPointer, &pathParent);
       if (res) {
-        PERRORD(res, "cp: '%s'", *pathStrPointer);
         FsPathFree(pathParent);
-        return;
+        FsPathFree(pathDst);
+        return FsFailSource(info, res, src, 0);
       }
       PATH *pathParentTail = FsPathGetTail(pathParent);
-      if (pathParentTail->file->link) {
-        PERRORD(FS_NO_SUCH_FILE, "cp: '%s'", *pathStrPointer);
+      if (FS_IS_DOT(pathParentTail->file)) {
+        res = FsFailSource(info, FS_NO_SUCH_FILE, src, 0);
       } else {
-        if (pathParentTail->file->type == REGULAR_FILE) {
-          // 仅仅复制该文件
-          if (pathParentTail->file->link) {
-            PERRORD(FS_NO_SUCH_FILE, "cp: '%s'", *pathStrPointer);
-          } else {
-            res = FsFilCopy(pathParentTail->file, pathDstTail->file);
-            if (res) {
-              PERRORD(res, "cp: '%s'", *pathStrPointer);
-            }
-          }
-        } else {
-          // 目标是个文件夹，则复制到文件夹内部
-          if (pathDstTail->file->type == DIRECTORY) {
-            // 复制文件到该文件夹下
-            res = FsFilCopy(pathParentTail->file, pathDstTail->file);
-            if (res) {
-              PERRORD(res, "cp: '%s'", pathParentTail->file->name);
-            }
-          } else {
-            // 错误，不能 文件夹到文件
-            PERRORD(FS_NOT_A_DIRECTORY, "cp: '%s'", *pathStrPointer);
-          }
-        }
+        // 复制文件或者整个文件夹到该文件夹下
+        res = FsFilCopy(pathParentTail->file, pathDstTail->file);
+        FsFailSource(info, res, src, 0);
       }
       FsPathFree(pathParent);
     } else {
-      // 包含多个路径，则复制这些路径的文件
-      while (*pathStrPointer) {
-        PATH *path = NULL;
-        FsErrors res = FsPathParse(fs->pathRoot, *pathStrPointer, &path);
-        if (res) {
-          PERRORD(res, "cp: '%s'", *pathStrPointer);
-          FsPathFree(path);
-          continue;
-        }
-        PATH *pathTargetTail = FsPathGetTail(path);
-        // 不recursive 的时候不复制目录
-        if (!recursive && pathTargetTail->file->type == DIRECTORY) {
-          PERRORD(FS_IS_A_DIRECTORY, "cp: '%s'", *pathStrPointer);
-        } else {
-          FsFilCopy(pathTargetTail->file, pathDstTail->file);
-        }
-        FsPathFree(path);
-        pathStrPointer++;
-      }
+      // 包含多个路径，则一起复制这些路径的文件
+      res = FsBatchUnlocked(fs, src, pathDstTail->file, false, recursive,
+                            info);
     }
   }
 
   FsPathFree(pathDst);
+  return res;
+}
+
+/// 加写锁执行 FsCpUnlocked，不打印错误
+/// \param fs
+/// \param recursive 是否复制文件夹
+/// \param src 以 NULL 结尾的源路径
+/// \param dest
+/// \param info 可以为 NULL；源路径的错误填入 info->results
+/// \return 第一个错误
+FsErrors FsCpQuiet(Fs fs, bool recursive, char *src[], const char *dest,
+                   FsErrorInfo *info) {
+  FsInfoReset(info, src);
+  if (!fs || !src || !dest)
+    return FsFail(info, FS_ERROR, NULL, false);
+  if (FsCheckEmpty(info, src, dest))
+    return FS_NO_SUCH_FILE;
+  if (fs->snapshot)
+    return FsFail(info, FS_READ_ONLY, NULL, false);
+  FsTreeWrlock(fs);
+  FsErrors res = FsCpUnlocked(fs, recursive, src, dest, info);
+  FsTreeUnlock(fs);
+  return res;
+}
+
+/// 打印 FsCpQuiet、FsMvQuiet 的错误：每个出错的源路径一行，
+/// 没有源路径出错时打印出错的路径
+/// \param command
+/// \param res
+/// \param src
+/// \param info
+static void FsPrintErrors(const char *command, FsErrors res, char *src[],
+                          const FsErrorInfo *info) {
+  bool printed = false;
+  for (size_t i = 0; src[i]; i++) {
+    if (info->results[i]) {
+      PERRORD(info->results[i], "%s: '%s'", command, src[i]);
+      printed = true;
+    }
+  }
+  if (printed || !res)
+    return;
+  if (info->path) {
+    PERRORD(res, "%s: '%s'", command, info->path);
+  } else {
+    PERRORD(res, "%s", command);
+  }
+}
+
+/// 打印 FsCpQuiet 的错误
+void FsCp(Fs fs, bool recursive, char *src[], char *dest) {
+  size_t n = 0;
+  while (src[n])
+    n++;
+  FsErrorInfo info;
+  info.results = malloc(sizeof(FsErrors) * (n + 1));
+  assert(info.results);
+  FsErrors res = FsCpQuiet(fs, recursive, src, dest, &info);
+  FsPrintErrors("cp", res, src, &info);
+  free(info.results);
 }
 
 // 该函数接受以null 结尾的src 路径数组和dest 路径。
 // 它应该将src 中所有路径所指向的文件移动到dest。
 // 该函数大致相当于Linux 中的mv 命令。
-void FsMv(Fs fs, char *src[], char *dest) {
+static FsErrors FsMvUnlocked(Fs fs, char *src[], const char *dest,
+                             FsErrorInfo *info) {
   // TODO: 检查路径包含
   char **pathStrPointer = src;
-  if (!*pathStrPointer) {
-    PERROR(FS_NO_SUCH_FILE, "mv");
-    return;
-  }
+  if (!*pathStrPointer)
+    return FsFail(info, FS_NO_SUCH_FILE, NULL, false);
   PATH *pathDst = NULL;
-  FsErrors resDst = FsPathParse(fs->pathRoot, dest, &pathDst);
+  FsErrors resDst = FsPathParse(FsCwdGet(fs)->pathRoot, dest, &pathDst);
   if (resDst) {
+    FsErrors res = resDst;
     if (resDst == FS_NO_SUCH_FILE) {
       // 找不到 dist 则新建文件
       // 取 dst 的上层parent
       PATH *dstPathParent = NULL;
-      char *pathParentStr = FsPathStrShift(dest);
-      FsErrors res = FsPathParse(fs->pathRoot, pathParentStr, &dstPathParent);
+      char *pathParentStr = FsPathStrShift((char *)dest);
+      res = FsPathParse(FsCwdGet(fs)->pathRoot, pathParentStr, &dstPathParent);
       if (res != FS_OK) {
-        PERRORD(res, "mv: '%s'", dest);
+        FsFail(info, res, dest, false);
       } else {
         PATH *pathParent = NULL;
-        res = FsPathParse(fs->pathRoot, *pathStrPointer, &pathParent);
+        res = FsPathParseLink(FsCwdGet(fs)->pathRoot, *pathStrPointer,
+                              &pathParent);
         if (res) {
-          PERRORD(res, "mv: '%s'", *pathStrPointer);
+          FsFailSource(info, res, src, 0);
         } else {
-          // 改名字然后移动
+          // 移动的同时改名字
           PATH *dstPathParentTail = FsPathGetTail(dstPathParent);
           PATH *pathParentTail = FsPathGetTail(pathParent);
-          free(pathParentTail->file->name);
-          char *name = FsPathStrGetName(dest);
-          size_t length = strlen(name);
-          pathParentTail->file->name = malloc(sizeof(char) * (length + 1));
-          strcpy(pathParentTail->file->name, name);
-          pathParentTail->file->name_length = length;
+          char *name = FsPathStrGetName((char *)dest);
+          res = FsFilMoveAs(pathParentTail->file, dstPathParentTail->file,
+                            name);
           free(name);
-          res = FsFilMove(pathParentTail->file, dstPathParentTail->file);
-          if (res) {
-            PERRORD(res, "mv: '%s'", dest);
-          }
+          FsFail(info, res, dest, false);
         }
         FsPathFree(pathParent);
       }
+      FsPathFree(dstPathParent);
       free(pathParentStr);
     } else {
-      PERRORD(resDst, "mv: '%s'", dest);
+      FsFail(info, resDst, dest, false);
     }
     FsPathFree(pathDst);
-    return;
+    return res;
   }
+  FsErrors res = FS_OK;
   PATH *pathDstTail = FsPathGetTail(pathDst);
   if (pathDstTail->file->type != DIRECTORY) {
     // 目标是个文件，则覆盖这个文件
@@ -644,33 +1111,151 @@ void FsMv(Fs fs, char *src[], char *dest) {
     FIL *dstParent = pathDstTail->file->parent;
     // 只取最上面的文件
     PATH *pathParent = NULL;
-    FsErrors res = FsPathParse(fs->pathRoot, *pathStrPointer, &pathParent);
+    res = FsPathParseLink(FsCwdGet(fs)->pathRoot, *pathStrPointer, &pathParent);
     if (res) {
-      PERRORD(res, "mv: '%s'", *pathStrPointer);
       FsPathFree(pathParent);
-      return;
+      FsPathFree(pathDst);
+      return FsFailSource(info, res, src, 0);
     }
-    FsFilDlTree(pathDstTail->file);
-
     PATH *pathParentTail = FsPathGetTail(pathParent);
-    // 移动到目标处
-    FsFilMove(pathParentTail->file, dstParent);
+    // 移动到自己时什么也不做，否则会先把自己删除
+    if (pathParentTail->file != pathDstTail->file) {
+      char *name = strdup(pathDstTail->file->name);
+      assert(name);
+      FsFilDlTree(pathDstTail->file);
+      // 移动到目标处，使用被覆盖的文件的名字
+      res = FsFilMoveAs(pathParentTail->file, dstParent, name);
+      FsFailSource(info, res, src, 0);
+      free(name);
+    }
     FsPathFree(pathParent);
   } else {
-    // 移动这些路径的文件
-    while (*pathStrPointer) {
-      PATH *path = NULL;
-      FsErrors res = FsPathParse(fs->pathRoot, *pathStrPointer, &path);
-      if (res) {
-        PERRORD(res, "mv: '%s'", *pathStrPointer);
-        FsPathFree(path);
-        continue;
+    // 一起移动这些路径的文件
+    res = FsBatchUnlocked(fs, src, pathDstTail->file, true, false, info);
+  }
+  FsPathFree(pathDst);
+  return res;
+}
+
+/// 目标不存在时调用：只有一个源文件且与目标在同一个文件夹中时，
+/// 在整棵树的读锁下只锁住这个文件夹改名
+/// \param fs
+/// \param src
+/// \param dest
+/// \param res 返回 true 时为结果
+/// \param info
+/// \return 不满足条件时返回 false，需要改用 FsMvUnlocked
+static bool FsMvRename(Fs fs, char *src[], const char *dest, FsErrors *res,
+                       FsErrorInfo *info) {
+  if (!*src || *(src + 1))
+    return false;
+  bool done = false;
+  char *pathParentStr = FsPathStrShift((char *)dest);
+  char *name = FsPathStrGetName((char *)dest);
+  char *srcName = FsPathStrGetName(*src);
+  PATH *pathParent = NULL;
+  PATH *path = NULL;
+  if (FsPathParse(FsCwdGet(fs)->pathRoot, pathParentStr, &pathParent) ==
+          FS_OK &&
+      FsPathParseLink(FsCwdGet(fs)->pathRoot, *src, &path) == FS_OK) {
+    FIL *dir = FsPathGetTail(pathParent)->file;
+    FIL *file = FsPathGetTail(path)->file;
+    if (dir->type == DIRECTORY) {
+      pthread_rwlock_wrlock(&dir->lock);
+      // 加锁之前源文件可能已经被移动到其他文件夹；
+      // 目标可能刚被创建，这时与覆盖一样加写锁处理
+      if (FsFilFindByName(dir, srcName) == file) {
+        *res = FsFilRename(dir, file, name);
+        done = *res != FS_FILE_EXISTS;
+        if (done)
+          FsFail(info, *res, dest, false);
       }
-      PATH *pathTargetTail = FsPathGetTail(path);
-      FsFilMove(pathTargetTail->file, pathDstTail->file);
-      FsPathFree(path);
-      pathStrPointer++;
+      pthread_rwlock_unlock(&dir->lock);
     }
   }
+  FsPathFree(path);
+  FsPathFree(pathParent);
+  free(srcName);
+  free(name);
+  free(pathParentStr);
+  return done;
+}
+
+/// 只有一个源文件且目标是已存在的文件夹时，在整棵树的读锁下把它移动进去；
+/// 目标不存在时尝试 FsMvRename。
+/// 多个源文件在写锁下一起移动，见 FsBatchUnlocked
+/// \param fs
+/// \param src
+/// \param dest
+/// \param res 返回 true 时为结果
+/// \param info
+/// \return 不满足条件时返回 false，需要改用 FsMvUnlocked
+static bool FsMvIntoDir(Fs fs, char *src[], const char *dest, FsErrors *res,
+                        FsErrorInfo *info) {
+  if (!*src || *(src + 1))
+    return false;
+  PATH *pathDst = NULL;
+  FsErrors resDst = FsPathParse(FsCwdGet(fs)->pathRoot, dest, &pathDst);
+  if (resDst == FS_NO_SUCH_FILE) {
+    FsPathFree(pathDst);
+    return FsMvRename(fs, src, dest, res, info);
+  }
+  if (resDst || FsPathGetTail(pathDst)->file->type != DIRECTORY) {
+    FsPathFree(pathDst);
+    return false;
+  }
+  FIL *dstDir = FsPathGetTail(pathDst)->file;
+  PATH *path = NULL;
+  *res = FsPathParseLink(FsCwdGet(fs)->pathRoot, *src, &path);
+  if (*res == FS_OK) {
+    // 跨文件夹移动先持有 renameLock，再按祖先优先的顺序锁住两个文件夹
+    pthread_mutex_lock(&fs->renameLock);
+    *res = FsFilMove(FsPathGetTail(path)->file, dstDir);
+    pthread_mutex_unlock(&fs->renameLock);
+  }
+  FsFailSource(info, *res, src, 0);
+  FsPathFree(path);
   FsPathFree(pathDst);
+  return true;
+}
+
+/// 把一个文件移动到已存在的文件夹或在同一个文件夹中改名时加读锁，
+/// 移动多个文件、移动并改名或覆盖文件时加写锁执行 FsMvUnlocked。
+/// 不打印错误
+/// \param fs
+/// \param src 以 NULL 结尾的源路径
+/// \param dest
+/// \param info 可以为 NULL；源路径的错误填入 info->results
+/// \return 第一个错误
+FsErrors FsMvQuiet(Fs fs, char *src[], const char *dest, FsErrorInfo *info) {
+  FsInfoReset(info, src);
+  if (!fs || !src || !dest)
+    return FsFail(info, FS_ERROR, NULL, false);
+  if (FsCheckEmpty(info, src, dest))
+    return FS_NO_SUCH_FILE;
+  if (fs->snapshot)
+    return FsFail(info, FS_READ_ONLY, NULL, false);
+  FsErrors res = FS_OK;
+  FsTreeRdlock(fs);
+  bool done = FsMvIntoDir(fs, src, dest, &res, info);
+  FsTreeUnlock(fs);
+  if (done)
+    return res;
+  FsTreeWrlock(fs);
+  res = FsMvUnlocked(fs, src, dest, info);
+  FsTreeUnlock(fs);
+  return res;
+}
+
+/// 打印 FsMvQuiet 的错误
+void FsMv(Fs fs, char *src[], char *dest) {
+  size_t n = 0;
+  while (src[n])
+    n++;
+  FsErrorInfo info;
+  info.results = malloc(sizeof(FsErrors) * (n + 1));
+  assert(info.results);
+  FsErrors res = FsMvQuiet(fs, src, dest, &info);
+  FsPrintErrors("mv", res, src, &info);
+  free(info.results);
 }
@@ -0,0 +1,360 @@
+// 批量创建
+//
+// FsMkdirP 创建路径上所有不存在的文件夹，只从头到尾走一遍路径，
+// 逐层 FsMkdir 每一层都要重新解析整条路径。
+// FsBuildFromPaths 一次创建一组路径：先把所有路径规范化为绝对路径并排序，
+// 排序之后同一个文件夹中的文件相邻，并且按名字排列，之后一趟递归建出整棵树。
+// 新的文件夹在发布之前按子文件的数量一次分配好列表，依次填入；
+// 已经存在的文件夹只合并一次新的子文件，见 FsFilAddChildren。
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "utility.h"
+
+/// 创建路径上所有不存在的文件夹，已经存在的文件夹不报错。
+/// 路径中间的符号链接展开后继续
+/// \param fs
+/// \param pathStr
+/// \return 路径上有普通文件时返回 FS_NOT_A_DIRECTORY，
+/// 路径本身是普通文件时返回 FS_FILE_EXISTS
+FsErrors FsMkdirP(Fs fs, const char *pathStr) {
+  if (!fs || !pathStr)
+    return FS_ERROR;
+  if (fs->snapshot)
+    return FS_READ_ONLY;
+  char *names = strdup(pathStr);
+  assert(names);
+  FsErrors res = FS_OK;
+  PATH *path = NULL;
+  FsTreeRdlock(fs);
+  FsEpochEnter();
+  // 与 FsPathParseAt 相同，相对路径从当前目录开始
+  res = FsPathParse(FsCwdGet(fs)->pathRoot,
+                    *pathStr == FS_SPLIT ? FS_SPLIT_STR : "", &path);
+  PATH *tail = FsPathGetTail(path);
+  char *save = NULL;
+  for (char *name = strtok_r(names, FS_SPLIT_STR, &save); res == FS_OK && name;
+       name = strtok_r(NULL, FS_SPLIT_STR, &save)) {
+    if (strcmp(name, ".") == 0)
+      continue;
+    if (strcmp(name, "..") == 0) {
+      // 根目录的上层是自己
+      if (tail->forward) {
+        tail = tail->forward;
+        FsPathFree(tail->next);
+        tail->next = NULL;
+      }
+      continue;
+    }
+    FIL *dir = tail->file;
+    FIL *target = FsFilFindByName(dir, name);
+    if (!target) {
+      pthread_rwlock_wrlock(&dir->lock);
+      // 加锁之前其他线程可能已经创建
+      target = FsFilFindByName(dir, name);
+      if (!target) {
+        FsInitDir(dir, &target, name);
+        FsFilAddChild(dir, target);
+      }
+      pthread_rwlock_unlock(&dir->lock);
+    }
+    if (target->symlink) {
+      PATH *resolved = NULL;
+      res = FsPathParse(path, target->symlink, &resolved);
+      FsPathFree(path);
+      path = resolved;
+      if (res == FS_OK) {
+        tail = FsPathGetTail(path);
+        if (tail->file->type != DIRECTORY)
+          res = FS_NOT_A_DIRECTORY;
+      }
+    } else if (target->type != DIRECTORY) {
+      res = strtok_r(NULL, FS_SPLIT_STR, &save) ? FS_NOT_A_DIRECTORY
+                                                : FS_FILE_EXISTS;
+    } else {
+      tail = FsPathInsert(tail, target);
+    }
+  }
+  FsEpochExit();
+  FsTreeUnlock(fs);
+  FsPathFree(path);
+  free(names);
+  return res;
+}
+
+// 规范化之后的路径中名字之间的分隔符，排在所有字符之前，
+// 按 strcmp 排序时同一个文件夹中的路径相邻，并且与子文件列表的顺序一致
+#define FS_BUILD_SPLIT '\1'
+#define FS_BUILD_SPLIT_STR "\1"
+
+// FsBuildFromPaths 中的一个路径
+typedef struct {
+  // 规范化之后的绝对路径，去掉开头的 '/'，名字之间用 FS_BUILD_SPLIT 分隔
+  char *path;
+  // 在参数中的下标
+  size_t index;
+  // 以 '/' 结尾，创建文件夹
+  bool dir;
+} FsBuildItem;
+
+/// 按路径排序，完全相同时按参数的顺序
+/// \param a
+/// \param b
+/// \return
+static int FsBuildCompare(const void *a, const void *b) {
+  const FsBuildItem *x = a;
+  const FsBuildItem *y = b;
+  int c = strcmp(x->path, y->path);
+  if (c)
+    return c;
+  // 同一个路径中文件夹在前，之后的文件报 FS_FILE_EXISTS
+  if (x->dir != y->dir)
+    return x->dir ? -1 : 1;
+  return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/// 把 pathStr 规范化：相对路径接在 cwd 之后，按字面去掉 `.`、`..`
+/// 和多余的 '/'，名字之间改用 FS_BUILD_SPLIT 分隔。
+/// 路径中不能有符号链接，按字面处理 `..` 与实际的一致
+/// \param cwd 当前目录的绝对路径
+/// \param pathStr
+/// \param dir 是否以 '/' 结尾
+/// \return 去掉开头的 '/'，根目录为空串
+static char *FsBuildNormalize(const char *cwd, const char *pathStr,
+                              bool *dir) {
+  size_t cwdLength = *pathStr == FS_SPLIT ? 0 : strlen(cwd);
+  size_t length = strlen(pathStr);
+  char *path = malloc(cwdLength + length + 2);
+  assert(path);
+  memcpy(path, cwd, cwdLength);
+  path[cwdLength] = FS_SPLIT;
+  memcpy(path + cwdLength + 1, pathStr, length + 1);
+  *dir = length && pathStr[length - 1] == FS_SPLIT;
+  // 在原地逐个名字复制，out 之前是已经规范化的部分
+  char *out = path;
+  char *p = path;
+  while (*p) {
+    while (*p == FS_SPLIT)
+      p++;
+    char *name = p;
+    while (*p && *p != FS_SPLIT)
+      p++;
+    size_t n = p - name;
+    if (!n || (n == 1 && name[0] == '.'))
+      continue;
+    if (n == 2 && name[0] == '.' && name[1] == '.') {
+      while (out > path && *--out != FS_BUILD_SPLIT)
+        ;
+      continue;
+    }
+    if (out > path)
+      *out++ = FS_BUILD_SPLIT;
+    memmove(out, name, n);
+    out += n;
+  }
+  *out = '\0';
+  return path;
+}
+
+/// 名字的长度，到 FS_BUILD_SPLIT 或者结尾为止
+/// \param item
+/// \param offset
+/// \return
+static size_t FsBuildNameLength(const FsBuildItem *item, size_t offset) {
+  return strcspn(item->path + offset, FS_BUILD_SPLIT_STR);
+}
+
+/// items 中的下一个名字与 items[first] 相同的最后位置
+/// \param items
+/// \param first
+/// \param n
+/// \param offset
+/// \return 名字不同的第一个位置
+static size_t FsBuildGroupEnd(FsBuildItem *items, size_t first, size_t n,
+                              size_t offset) {
+  const char *name = items[first].path + offset;
+  size_t length = FsBuildNameLength(&items[first], offset);
+  size_t i = first + 1;
+  while (i < n && FsBuildNameLength(&items[i], offset) == length &&
+         memcmp(items[i].path + offset, name, length) == 0)
+    i++;
+  return i;
+}
+
+/// 在 dir 中创建 items 中的路径，items 已经排好序，
+/// 每个路径在 offset 之后都至少还有一个名字
+/// \param dir
+/// \param fresh dir 是新建的文件夹，还没有发布，
+/// 子文件列表已经按名字的数量分配好
+/// \param items
+/// \param n
+/// \param offset 下一个名字在路径中的位置
+/// \param results 每个路径的结果，按参数的下标
+static void FsBuildDir(FIL *dir, bool fresh, FsBuildItem *items, size_t n,
+                       size_t offset, FsErrors *results) {
+  size_t groups = 0;
+  for (size_t i = 0; i < n; i = FsBuildGroupEnd(items, i, n, offset))
+    groups++;
+  FIL **created = NULL;
+  size_t count = 0;
+  if (!fresh) {
+    created = malloc(sizeof(FIL *) * (groups ? groups : 1));
+    assert(created);
+  }
+  for (size_t i = 0, end; i < n; i = end) {
+    end = FsBuildGroupEnd(items, i, n, offset);
+    size_t length = FsBuildNameLength(&items[i], offset);
+    // 排序之后以这个名字结尾的路径在前，[i, mid) 结尾，[mid, end) 继续向下
+    size_t mid = i;
+    while (mid < end && !items[mid].path[offset + length])
+      mid++;
+    bool needDir = mid < end || items[i].dir;
+    char *name = items[i].path + offset;
+    char saved = name[length];
+    name[length] = '\0';
+    FIL *file = fresh ? NULL : FsFilFindByName(dir, name);
+    // 已经存在的普通文件或者符号链接挡住了这个名字
+    bool blocked = file && (file->symlink || file->type != DIRECTORY);
+    bool isDir = !blocked && (needDir || file);
+    if (blocked) {
+      for (size_t j = mid; j < end; j++)
+        results[items[j].index] = FS_NOT_A_DIRECTORY;
+    } else if (isDir) {
+      bool exists = file != NULL;
+      if (!exists) {
+        size_t subgroups = 0;
+        for (size_t j = mid; j < end;
+             j = FsBuildGroupEnd(items, j, end, offset + length + 1))
+          subgroups++;
+        FsInitDirSized(dir, &file, name, subgroups);
+      }
+      FsBuildDir(file, !exists, items + mid, end - mid, offset + length + 1,
+                 results);
+      if (!exists) {
+        if (fresh)
+          dir->children->items[dir->children->size++] =
+              (FIL_ENTRY){file->name, file};
+        else
+          created[count++] = file;
+      }
+    } else {
+      FsInitFile(dir, &file, name);
+      if (fresh)
+        dir->children->items[dir->children->size++] =
+            (FIL_ENTRY){file->name, file};
+      else
+        created[count++] = file;
+    }
+    name[length] = saved;
+    // 以这个名字结尾的路径：文件夹都成功，普通文件只有新建它的第一个路径成功
+    for (size_t j = i; j < mid; j++) {
+      bool ok = !blocked && (isDir ? items[j].dir : j == i);
+      results[items[j].index] = ok ? FS_OK : FS_FILE_EXISTS;
+    }
+  }
+  if (!fresh) {
+    FsFilAddChildren(dir, created, count);
+    free(created);
+  }
+}
+
+/// 一次创建一组路径。以 '/' 结尾的路径创建文件夹，其他路径创建空文件，
+/// 路径上不存在的文件夹一起创建，已经存在的文件夹直接使用。
+/// 路径按字面规范化，不能经过符号链接。
+/// 先排序再一趟建树，时间复杂度为 O(L log n)，L 为路径的总长度；
+/// 逐个 FsMkdir、FsMkfile 每次都要解析整条路径并复制上层文件夹的子文件列表
+/// \param fs
+/// \param paths
+/// \param n
+/// \param info 可以为 NULL；每个路径的结果填入 info->results：
+/// 普通文件已经存在或者与文件夹重名时为 FS_FILE_EXISTS，
+/// 路径上有普通文件或者符号链接时为 FS_NOT_A_DIRECTORY
+/// \return 第一个出错的路径的错误
+FsErrors FsBuildFromPaths(Fs fs, const char *paths[], size_t n,
+                          FsErrorInfo *info) {
+  if (info) {
+    info->path = NULL;
+    info->last = false;
+  }
+  if (!fs || (!paths && n))
+    return FS_ERROR;
+  if (fs->snapshot) {
+    if (info && info->results) {
+      for (size_t i = 0; i < n; i++)
+        info->results[i] = FS_READ_ONLY;
+    }
+    return FS_READ_ONLY;
+  }
+  FsBuildItem *items = malloc(sizeof(FsBuildItem) * (n ? n : 1));
+  FsErrors *results = malloc(sizeof(FsErrors) * (n ? n : 1));
+  assert(items && results);
+  FsTreeWrlock(fs);
+  char *cwd = FsPathGetStr(FsCwdGet(fs)->pathRoot);
+  for (size_t i = 0; i < n; i++) {
+    items[i].path = FsBuildNormalize(cwd, paths[i], &items[i].dir);
+    items[i].index = i;
+  }
+  free(cwd);
+  qsort(items, n, sizeof(FsBuildItem), FsBuildCompare);
+  // 根目录本身排在最前面，已经存在
+  size_t first = 0;
+  for (; first < n && !*items[first].path; first++)
+    results[items[first].index] = items[first].dir ? FS_OK : FS_FILE_EXISTS;
+  FsBuildDir(fs->root, false, items + first, n - first, 0, results);
+  FsTreeUnlock(fs);
+  FsErrors res = FS_OK;
+  for (size_t i = 0; i < n; i++) {
+    free(items[i].path);
+    if (info && info->results)
+      info->results[i] = results[i];
+    if (results[i] && !res) {
+      res = results[i];
+      if (info)
+        info->path = paths[i];
+    }
+  }
+  free(results);
+  free(items);
+  return res;
+}
+
+// 该函数对应 shell 中的 build 命令：
+// build PATH... 一次创建所有路径，以 '/' 结尾的路径创建文件夹
+void FsBuild(Fs fs, char *arg) {
+  size_t n = 0;
+  for (char *p = arg; p && *p;) {
+    while (*p == ' ')
+      p++;
+    if (*p)
+      n++;
+    while (*p && *p != ' ')
+      p++;
+  }
+  if (!n) {
+    printf("build: missing operand\n");
+    return;
+  }
+  const char **paths = malloc(sizeof(char *) * n);
+  FsErrorInfo info = {NULL, false, malloc(sizeof(FsErrors) * n)};
+  assert(paths && info.results);
+  size_t i = 0;
+  for (char *path = strtok(arg, " "); path; path = strtok(NULL, " "))
+    paths[i++] = path;
+  FsBuildFromPaths(fs, paths, n, &info);
+  for (i = 0; i < n; i++) {
+    if (info.results[i])
+      PERRORD(info.results[i], "build: cannot create '%s'", paths[i]);
+  }
+  free(info.results);
+  free(paths);
+}
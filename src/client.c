@@ -0,0 +1,445 @@
+// 文件系统服务端的客户端，协议见 serve.h
+//
+// 请求先写入发送缓冲区，FsClientFlush 或 FsClientRecv 时一次写出，
+// 多个请求可以连续发送再依次接收响应。写出时同时接收响应，
+// 服务端因为响应积压暂停读取时也不会互相等待。
+// FsClientMkdir 等同步接口发送一个请求并等待它的响应，
+// 调用时不能还有没有接收的响应。
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "utility.h"
+#include "serve.h"
+
+// 每次读取的最小空间
+#define FS_CLIENT_READ (64 * 1024)
+
+struct FsClient_t {
+  int fd;
+  // 发送缓冲区
+  char *out;
+  size_t outLength;
+  size_t outCapacity;
+  // 接收缓冲区，[inStart, inEnd) 是还没有解析的字节
+  char *in;
+  size_t inStart;
+  size_t inEnd;
+  size_t inCapacity;
+  uint32_t nextId;
+  // 已经发送、还没有接收的响应数
+  size_t pending;
+};
+
+/// 连接到服务端
+/// \param sockPath 服务端的套接字路径
+/// \return 失败时返回 NULL，errno 为失败的原因
+FsClient *FsClientConnect(const char *sockPath) {
+  struct sockaddr_un addr;
+  if (!sockPath || strlen(sockPath) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, sockPath);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return NULL;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return NULL;
+  }
+  FsClient *client = malloc(sizeof(FsClient));
+  assert(client);
+  memset(client, 0, sizeof(FsClient));
+  client->fd = fd;
+  client->nextId = 1;
+  return client;
+}
+
+/// 关闭连接，没有发送的请求被丢弃
+/// \param client 可以为 NULL
+void FsClientClose(FsClient *client) {
+  if (!client)
+    return;
+  close(client->fd);
+  free(client->out);
+  free(client->in);
+  free(client);
+}
+
+/// 把 length 字节追加到发送缓冲区
+/// \param client
+/// \param data
+/// \param length
+static void FsClientAppend(FsClient *client, const void *data,
+                           size_t length) {
+  if (client->outLength + length > client->outCapacity) {
+    client->outCapacity = (client->outLength + length) * 2;
+    client->out = realloc(client->out, client->outCapacity);
+    assert(client->out);
+  }
+  memcpy(client->out + client->outLength, data, length);
+  client->outLength += length;
+}
+
+/// 从套接字读取一次，追加到接收缓冲区
+/// \param client
+/// \param need 缓冲区中至少要能放下的未解析字节数
+/// \return 连接断开或出错时返回 false
+static bool FsClientFill(FsClient *client, size_t need) {
+  // 已经解析的部分不再需要，先移到开头
+  if (client->inStart) {
+    memmove(client->in, client->in + client->inStart,
+            client->inEnd - client->inStart);
+    client->inEnd -= client->inStart;
+    client->inStart = 0;
+  }
+  if (need < client->inEnd + FS_CLIENT_READ)
+    need = client->inEnd + FS_CLIENT_READ;
+  if (need > client->inCapacity) {
+    client->inCapacity = need;
+    client->in = realloc(client->in, client->inCapacity);
+    assert(client->in);
+  }
+  ssize_t n;
+  do {
+    n = recv(client->fd, client->in + client->inEnd,
+             client->inCapacity - client->inEnd, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0)
+    return false;
+  client->inEnd += n;
+  return true;
+}
+
+/// 把一个请求追加到发送缓冲区，直到 FsClientFlush 或 FsClientRecv
+/// 才写出
+/// \param client
+/// \param op
+/// \param flags FS_SERVE_RECURSIVE 或 0
+/// \param argv 参数
+/// \param lengths 每个参数的字节数，为 NULL 时参数以 '\0' 结尾
+/// \param argc
+/// \param id 可以为 NULL，请求的编号，与响应的编号相同
+/// \return 请求超过 FS_SERVE_MAX_FRAME 时返回 FS_ERROR
+FsErrors FsClientSend(FsClient *client, FsServeOp op, uint8_t flags,
+                      const char *argv[], const size_t lengths[],
+                      uint16_t argc, uint32_t *id) {
+  if (!client || (argc && !argv))
+    return FS_ERROR;
+  uint64_t total = FS_SERVE_REQUEST_HEAD;
+  for (uint16_t i = 0; i < argc; i++)
+    total += 4 + (lengths ? lengths[i] : strlen(argv[i]));
+  if (total > FS_SERVE_MAX_FRAME)
+    return FS_ERROR;
+  uint32_t length = total;
+  uint32_t reqId = client->nextId++;
+  uint8_t opByte = op;
+  FsClientAppend(client, &length, 4);
+  FsClientAppend(client, &reqId, 4);
+  FsClientAppend(client, &opByte, 1);
+  FsClientAppend(client, &flags, 1);
+  FsClientAppend(client, &argc, 2);
+  for (uint16_t i = 0; i < argc; i++) {
+    uint32_t argLength = lengths ? lengths[i] : strlen(argv[i]);
+    FsClientAppend(client, &argLength, 4);
+    FsClientAppend(client, argv[i], argLength);
+  }
+  client->pending++;
+  if (id)
+    *id = reqId;
+  return FS_OK;
+}
+
+/// 写出发送缓冲区中的所有请求。等待套接字可写的同时接收响应，
+/// 避免双方都在等待对方读取
+/// \param client
+/// \return 连接断开时返回 FS_ERROR
+FsErrors FsClientFlush(FsClient *client) {
+  if (!client)
+    return FS_ERROR;
+  size_t sent = 0;
+  while (sent < client->outLength) {
+    ssize_t n = send(client->fd, client->out + sent,
+                     client->outLength - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n > 0) {
+      sent += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+      return FS_ERROR;
+    struct pollfd pfd = {client->fd, POLLIN | POLLOUT, 0};
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+      return FS_ERROR;
+    if ((pfd.revents & POLLIN) && !FsClientFill(client, 0))
+      return FS_ERROR;
+  }
+  client->outLength = 0;
+  return FS_OK;
+}
+
+/// 写出所有请求，然后接收下一个响应
+/// \param client
+/// \param reply 响应，reply->data 在下一次 FsClientRecv 之前有效
+/// \return 连接断开或响应格式错误时返回 FS_ERROR，
+/// 否则返回 FS_OK，操作的结果在 reply->status 中
+FsErrors FsClientRecv(FsClient *client, FsReply *reply) {
+  if (!client || !reply || !client->pending)
+    return FS_ERROR;
+  if (FsClientFlush(client))
+    return FS_ERROR;
+  for (;;) {
+    size_t available = client->inEnd - client->inStart;
+    const char *p = client->in + client->inStart;
+    uint32_t length = 0;
+    if (available >= 4) {
+      memcpy(&length, p, 4);
+      if (length < FS_SERVE_REPLY_HEAD)
+        return FS_ERROR;
+      if (available >= 4 + (size_t)length) {
+        memcpy(&reply->id, p + 4, 4);
+        reply->status = (uint8_t)p[8];
+        reply->data = p + 4 + FS_SERVE_REPLY_HEAD;
+        reply->length = length - FS_SERVE_REPLY_HEAD;
+        client->inStart += 4 + (size_t)length;
+        client->pending--;
+        return FS_OK;
+      }
+    }
+    if (!FsClientFill(client, 4 + (size_t)length))
+      return FS_ERROR;
+  }
+}
+
+/// 发送一个请求并等待它的响应
+/// \param client
+/// \param op
+/// \param flags
+/// \param argv
+/// \param lengths 为 NULL 时参数以 '\0' 结尾
+/// \param argc
+/// \param reply
+/// \return 连接出错，或者还有没有接收的响应时返回 FS_ERROR，
+/// 否则返回操作的结果
+static FsErrors FsClientCall(FsClient *client, FsServeOp op, uint8_t flags,
+                             const char *argv[], const size_t lengths[],
+                             uint16_t argc, FsReply *reply) {
+  if (!client || client->pending)
+    return FS_ERROR;
+  uint32_t id;
+  if (FsClientSend(client, op, flags, argv, lengths, argc, &id) ||
+      FsClientRecv(client, reply) || reply->id != id)
+    return FS_ERROR;
+  return reply->status;
+}
+
+/// 发送只有一个可选路径参数的请求
+/// \param client
+/// \param op
+/// \param flags
+/// \param pathStr 为 NULL 时没有参数
+/// \param reply
+/// \return
+static FsErrors FsClientCallPath(FsClient *client, FsServeOp op,
+                                 uint8_t flags, const char *pathStr,
+                                 FsReply *reply) {
+  const char *argv[] = {pathStr};
+  return FsClientCall(client, op, flags, argv, NULL, pathStr ? 1 : 0,
+                      reply);
+}
+
+/// 逐项解析 FS_SERVE_LS、FS_SERVE_TREE 的结果
+/// \param reply
+/// \param callback
+/// \param ctx
+/// \return 格式错误时返回 FS_ERROR
+static FsErrors FsClientEntries(const FsReply *reply,
+                                FsClientEntryCallback callback, void *ctx) {
+  const char *p = reply->data;
+  const char *end = reply->data + reply->length;
+  while (p < end) {
+    const char *name = p + 5;
+    const char *nameEnd = name < end ? memchr(name, '\0', end - name) : NULL;
+    if (!nameEnd)
+      return FS_ERROR;
+    uint32_t depth;
+    memcpy(&depth, p + 1, 4);
+    if (callback)
+      callback((FileType)(uint8_t)*p, depth, name, ctx);
+    p = nameEnd + 1;
+  }
+  return FS_OK;
+}
+
+/// 对应 FsMkdir
+FsErrors FsClientMkdir(FsClient *client, const char *pathStr) {
+  FsReply reply;
+  if (!pathStr)
+    return FS_ERROR;
+  return FsClientCallPath(client, FS_SERVE_MKDIR, 0, pathStr, &reply);
+}
+
+/// 对应 FsMkfile
+FsErrors FsClientMkfile(FsClient *client, const char *pathStr) {
+  FsReply reply;
+  if (!pathStr)
+    return FS_ERROR;
+  return FsClientCallPath(client, FS_SERVE_MKFILE, 0, pathStr, &reply);
+}
+
+/// 修改这个连接的工作目录，对应 FsCd
+/// \param client
+/// \param pathStr 为 NULL 时回到根目录
+/// \return
+FsErrors FsClientCd(FsClient *client, const char *pathStr) {
+  FsReply reply;
+  return FsClientCallPath(client, FS_SERVE_CD, 0, pathStr, &reply);
+}
+
+/// 按字典序对文件夹中的每个文件调用 callback，对应 FsLsQuiet。
+/// pathStr 是文件时只对它调用一次，name 为 pathStr 本身
+/// \param client
+/// \param pathStr 为 NULL 时是工作目录
+/// \param callback depth 总为 0
+/// \param ctx
+/// \return
+FsErrors FsClientLs(FsClient *client, const char *pathStr,
+                    FsClientEntryCallback callback, void *ctx) {
+  FsReply reply;
+  FsErrors res = FsClientCallPath(client, FS_SERVE_LS, 0, pathStr, &reply);
+  return res ? res : FsClientEntries(&reply, callback, ctx);
+}
+
+/// 这个连接的工作目录，对应 FsGetCwd
+/// \param client
+/// \return 用 free 释放，连接出错时返回 NULL
+char *FsClientPwd(FsClient *client) {
+  FsReply reply;
+  if (FsClientCallPath(client, FS_SERVE_PWD, 0, NULL, &reply))
+    return NULL;
+  char *cwd = malloc(reply.length + 1);
+  assert(cwd);
+  memcpy(cwd, reply.data, reply.length);
+  cwd[reply.length] = '\0';
+  return cwd;
+}
+
+/// 按先序、字典序对文件树中的每个文件调用 callback，对应 FsTreeQuiet
+/// \param client
+/// \param pathStr 为 NULL 时是根目录
+/// \param callback 起点的深度为 0，名字为 pathStr；其余为文件名
+/// \param ctx
+/// \return
+FsErrors FsClientTree(FsClient *client, const char *pathStr,
+                      FsClientEntryCallback callback, void *ctx) {
+  FsReply reply;
+  FsErrors res = FsClientCallPath(client, FS_SERVE_TREE, 0, pathStr, &reply);
+  return res ? res : FsClientEntries(&reply, callback, ctx);
+}
+
+/// 对应 FsPutQuiet
+FsErrors FsClientPut(FsClient *client, const char *pathStr,
+                     const char *content, size_t length) {
+  FsReply reply;
+  if (!pathStr || (!content && length))
+    return FS_ERROR;
+  const char *argv[] = {pathStr, content ? content : ""};
+  const size_t lengths[] = {strlen(pathStr), length};
+  return FsClientCall(client, FS_SERVE_PUT, 0, argv, lengths, 2, &reply);
+}
+
+/// 对应 FsCatQuiet，内容一次传给 callback
+FsErrors FsClientCat(FsClient *client, const char *pathStr,
+                     FsDataCallback callback, void *ctx) {
+  FsReply reply;
+  if (!pathStr)
+    return FS_ERROR;
+  FsErrors res = FsClientCallPath(client, FS_SERVE_CAT, 0, pathStr, &reply);
+  if (res == FS_OK && callback && reply.length)
+    callback(reply.data, reply.length, ctx);
+  return res;
+}
+
+/// 对应 FsDldir
+FsErrors FsClientDldir(FsClient *client, const char *pathStr) {
+  FsReply reply;
+  if (!pathStr)
+    return FS_ERROR;
+  return FsClientCallPath(client, FS_SERVE_DLDIR, 0, pathStr, &reply);
+}
+
+/// 对应 FsDl
+FsErrors FsClientDl(FsClient *client, bool recursive, const char *pathStr) {
+  FsReply reply;
+  if (!pathStr)
+    return FS_ERROR;
+  return FsClientCallPath(client, FS_SERVE_DL,
+                          recursive ? FS_SERVE_RECURSIVE : 0, pathStr,
+                          &reply);
+}
+
+/// 发送 FS_SERVE_CP、FS_SERVE_MV 请求
+/// \param client
+/// \param op
+/// \param flags
+/// \param src 以 NULL 结尾
+/// \param dest
+/// \param results 可以为 NULL，每个源路径一项
+/// \return
+static FsErrors FsClientTransfer(FsClient *client, FsServeOp op,
+                                 uint8_t flags, const char *src[],
+                                 const char *dest, FsErrors *results) {
+  if (!src || !dest)
+    return FS_ERROR;
+  size_t n = 0;
+  while (src[n])
+    n++;
+  if (n >= UINT16_MAX)
+    return FS_ERROR;
+  const char **argv = malloc(sizeof(char *) * (n + 1));
+  assert(argv);
+  memcpy(argv, src, sizeof(char *) * n);
+  argv[n] = dest;
+  FsReply reply = {0};
+  FsErrors res = FsClientCall(client, op, flags, argv, NULL, n + 1, &reply);
+  free(argv);
+  // 连接出错时没有每个源路径的结果
+  if (results && reply.length == n) {
+    for (size_t i = 0; i < n; i++)
+      results[i] = (uint8_t)reply.data[i];
+  }
+  return res;
+}
+
+/// 对应 FsCpQuiet
+FsErrors FsClientCp(FsClient *client, bool recursive, const char *src[],
+                    const char *dest, FsErrors *results) {
+  return FsClientTransfer(client, FS_SERVE_CP,
+                          recursive ? FS_SERVE_RECURSIVE : 0, src, dest,
+                          results);
+}
+
+/// 对应 FsMvQuiet
+FsErrors FsClientMv(FsClient *client, const char *src[], const char *dest,
+                    FsErrors *results) {
+  return FsClientTransfer(client, FS_SERVE_MV, 0, src, dest, results);
+}
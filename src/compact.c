@@ -0,0 +1,157 @@
+// 后台压缩
+//
+// 压缩线程定期遍历整棵树，把一段时间没有读写的文件内容用 lz.c 压缩。
+// 读写压缩的文件时先解压，见 content.c。遍历持有整棵树的读锁，
+// 每个文件只在压缩时短暂持有它的写锁，不阻塞其他文件的读写。
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "utility.h"
+
+// 两次遍历之间的最短间隔（毫秒）
+#define FS_COMPACT_MIN_PERIOD 10
+
+typedef struct {
+  uint64_t now;
+  unsigned int idle;
+  size_t count;
+} FsCompactState;
+
+/// FsCompactRun 的访问者
+/// \param entry
+/// \param ctx FsCompactState
+/// \return
+static FsWalkAction FsCompactVisit(const FsWalkEntry *entry, void *ctx) {
+  FsCompactState *state = ctx;
+  // 硬链接压缩链接到的文件
+  FIL *file = FsFilTarget(entry->file);
+  if (file->type != REGULAR_FILE)
+    return FS_WALK_CONTINUE;
+  // 访问时间可能晚于 now；compacted 为访问时间 + 1，0 表示没有处理过
+  uint64_t accessed = __atomic_load_n(&file->accessed, __ATOMIC_RELAXED);
+  if (accessed + state->idle > state->now ||
+      __atomic_load_n(&file->compacted, __ATOMIC_RELAXED) == accessed + 1)
+    return FS_WALK_CONTINUE;
+  pthread_rwlock_wrlock(&file->lock);
+  // 加锁期间可能刚被读写过
+  accessed = __atomic_load_n(&file->accessed, __ATOMIC_RELAXED);
+  if (accessed + state->idle <= state->now) {
+    __atomic_store_n(&file->compacted, accessed + 1, __ATOMIC_RELAXED);
+    if (FsFilCompress(file))
+      state->count++;
+  }
+  pthread_rwlock_unlock(&file->lock);
+  return FS_WALK_CONTINUE;
+}
+
+/// 压缩所有超过 idle 毫秒没有读写的文件。
+/// 压缩失败的文件在下次读写之前不再尝试
+/// \param fs
+/// \param idle 为 0 时压缩所有文件
+/// \return 压缩的文件数量
+size_t FsCompactRun(Fs fs, unsigned int idle) {
+  // 与 FsCat 等读者相同，时间在加锁之后读取，不会早于文件的访问时间
+  FsCompactState state = {0, idle, 0};
+  FsTreeRdlock(fs);
+  state.now = FsClockMs();
+  // 从根目录开始，不使用调用线程的工作目录和视图
+  FsViewSet(0);
+  FsWalkFil(fs->root, FS_SPLIT_STR, FsCompactVisit, &state, FS_WALK_ORDERED);
+  FsTreeUnlock(fs);
+  return state.count;
+}
+
+/// 压缩线程：每隔 compactIdle 的一半遍历一次
+/// \param arg Fs
+/// \return
+static void *FsCompactMain(void *arg) {
+  Fs fs = arg;
+  pthread_mutex_lock(&fs->compactLock);
+  while (fs->compacting) {
+    unsigned int period = fs->compactIdle / 2;
+    if (period < FS_COMPACT_MIN_PERIOD)
+      period = FS_COMPACT_MIN_PERIOD;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += period / 1000;
+    deadline.tv_nsec += (long)(period % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    int res = pthread_cond_timedwait(&fs->compactCond, &fs->compactLock,
+                                     &deadline);
+    if (res != ETIMEDOUT || !fs->compacting)
+      continue;
+    unsigned int idle = fs->compactIdle;
+    pthread_mutex_unlock(&fs->compactLock);
+    FsCompactRun(fs, idle);
+    pthread_mutex_lock(&fs->compactLock);
+  }
+  pthread_mutex_unlock(&fs->compactLock);
+  return NULL;
+}
+
+/// 启动后台压缩，已经启动时只修改间隔
+/// \param fs
+/// \param idle 超过这么多毫秒没有读写的文件被压缩
+void FsCompactStart(Fs fs, unsigned int idle) {
+  pthread_mutex_lock(&fs->compactLock);
+  fs->compactIdle = idle;
+  if (!fs->compacting) {
+    fs->compacting = true;
+    int res = pthread_create(&fs->compactor, NULL, FsCompactMain, fs);
+    if (res)
+      fs->compacting = false;
+  } else {
+    // 按新的间隔重新计时
+    pthread_cond_signal(&fs->compactCond);
+  }
+  pthread_mutex_unlock(&fs->compactLock);
+}
+
+/// 停止后台压缩并等待压缩线程退出，已经压缩的文件保持压缩
+/// \param fs
+void FsCompactStop(Fs fs) {
+  pthread_mutex_lock(&fs->compactLock);
+  bool running = fs->compacting;
+  fs->compacting = false;
+  pthread_cond_signal(&fs->compactCond);
+  pthread_mutex_unlock(&fs->compactLock);
+  if (running)
+    pthread_join(fs->compactor, NULL);
+}
+
+// 该函数对应 shell 中的 compress 命令：
+// compress MS 启动后台压缩，压缩 MS 毫秒没有读写的文件；
+// compress off 停止后台压缩；没有参数时立即压缩所有文件
+void FsCompress(Fs fs, char *arg) {
+  if (fs->snapshot) {
+    PERROR(FS_READ_ONLY, "compress");
+    return;
+  }
+  if (!arg) {
+    printf("compressed %zu files\n", FsCompactRun(fs, 0));
+  } else if (strcmp(arg, "off") == 0) {
+    FsCompactStop(fs);
+  } else {
+    char *end;
+    unsigned long idle = strtoul(arg, &end, 10);
+    if (end == arg || *end) {
+      printf("compress: invalid interval '%s'\n", arg);
+      return;
+    }
+    FsCompactStart(fs, (unsigned int)idle);
+  }
+}
@@ -0,0 +1,775 @@
+// 文件内容的存储
+//
+// 小文件连续存储在按容量分配的缓冲区中，容量不足时按两倍扩容；
+// 超过 FS_CHUNK_THRESHOLD 后改为固定大小的块，块索引是按偏移排列的
+// 数组，定位任意偏移只需一次除法。块可以被多个文件共享，复制大文件时
+// 只复制索引；修改共享的块之前先复制一份。
+//
+// 读者不加锁，只访问已经发布的前 length 个字节：写到 length 之后的追加
+// 可以原地进行，写好后再发布新的 length；覆盖已经发布的字节时，连续存储
+// 复制整个缓冲区，分块存储只复制涉及的块，旧的缓冲区和块延迟释放。
+// 所有修改都需持有文件的写锁。去重存储中的共享内容不原地修改。
+//
+// 长时间没有读写的连续存储内容可以被压缩，超过内存预算时最久没有读写的
+// 内容溢出到文件，内存中只保留偏移。这两种内容都不能直接读取：读者和
+// 写者先把它解压、读回后重新发布，文件重新变为普通的状态。
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "lz.h"
+#include "utility.h"
+
+// FsContentFromFd 每次 readv 读入的块数
+#define FS_CONTENT_READ_CHUNKS 16
+
+// 索引中为 NULL 的块读作全 0
+static const char FsZeroChunk[FS_CHUNK_SIZE];
+// 整个进程中解压的次数和总耗时（纳秒）
+static size_t fsDecompressions;
+static uint64_t fsDecompressNs;
+// 整个进程中文件内容和块占用的内存
+static size_t fsResidentBytes;
+
+/// 分配内容，除 data 以外的字段全部为 0
+/// \param size data 的字节数
+/// \return
+static FIL_CONTENT *FsContentAlloc(size_t size) {
+  FIL_CONTENT *content = malloc(sizeof(FIL_CONTENT) + size);
+  assert(content);
+  memset(content, 0, sizeof(FIL_CONTENT));
+  __atomic_add_fetch(&fsResidentBytes, sizeof(FIL_CONTENT) + size,
+                     __ATOMIC_RELAXED);
+  return content;
+}
+
+/// 内容本身占用的内存，不包括块
+/// \param content
+/// \return
+static size_t FsContentSize(FIL_CONTENT *content) {
+  if (content->spill)
+    return sizeof(FIL_CONTENT);
+  if (content->compressed)
+    return sizeof(FIL_CONTENT) + content->compressed;
+  if (content->chunks)
+    return sizeof(FIL_CONTENT) + sizeof(FIL_CHUNK *) * content->capacity;
+  return sizeof(FIL_CONTENT) + content->capacity + 1;
+}
+
+/// 释放 FsContentAlloc 分配的内存
+/// \param content
+static void FsContentDealloc(FIL_CONTENT *content) {
+  __atomic_sub_fetch(&fsResidentBytes, FsContentSize(content),
+                     __ATOMIC_RELAXED);
+  free(content);
+}
+
+/// 整个进程中文件内容占用的内存
+/// \return
+size_t FsContentResident(void) {
+  return __atomic_load_n(&fsResidentBytes, __ATOMIC_RELAXED);
+}
+
+/// 内容是否在去重存储中被共享。其他文件可能同时增加引用，需原子读取
+/// \param content
+/// \return
+static bool FsContentShared(FIL_CONTENT *content) {
+  return __atomic_load_n(&content->refs, __ATOMIC_RELAXED) != 0;
+}
+
+/// 分块存储时保存 length 个字节需要的块数
+/// \param length
+/// \return
+static size_t FsChunkCount(size_t length) {
+  return (length + FS_CHUNK_SIZE - 1) / FS_CHUNK_SIZE;
+}
+
+/// 分配一个块，内容未初始化
+/// \return
+static FIL_CHUNK *FsChunkNew(void) {
+  FIL_CHUNK *chunk = malloc(sizeof(FIL_CHUNK));
+  assert(chunk);
+  chunk->refs = 1;
+  __atomic_add_fetch(&fsResidentBytes, sizeof(FIL_CHUNK), __ATOMIC_RELAXED);
+  return chunk;
+}
+
+/// 作为 FsEpochRetire 的回调释放块
+/// \param chunk
+static void FsChunkFree(void *chunk) {
+  __atomic_sub_fetch(&fsResidentBytes, sizeof(FIL_CHUNK), __ATOMIC_RELAXED);
+  free(chunk);
+}
+
+/// 增加块的引用
+/// \param chunk 可以为 NULL
+/// \return chunk
+static FIL_CHUNK *FsChunkRef(FIL_CHUNK *chunk) {
+  if (chunk)
+    __atomic_add_fetch(&chunk->refs, 1, __ATOMIC_RELAXED);
+  return chunk;
+}
+
+/// 释放块的引用。其他文件的读者可能仍在读取这一块，最后一个引用也延迟释放
+/// \param chunk 可以为 NULL
+static void FsChunkRelease(FIL_CHUNK *chunk) {
+  if (chunk && __atomic_sub_fetch(&chunk->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    FsEpochRetire(chunk, FsChunkFree);
+}
+
+/// 分配分块存储的内容，索引全部为 NULL
+/// \param capacity 索引的项数
+/// \return
+static FIL_CONTENT *FsContentNewChunked(size_t capacity) {
+  FIL_CONTENT *content = FsContentAlloc(sizeof(FIL_CHUNK *) * capacity);
+  content->capacity = capacity;
+  // data 紧跟在指针之后，满足指针的对齐要求
+  content->chunks = (FIL_CHUNK **)content->data;
+  memset(content->chunks, 0, sizeof(FIL_CHUNK *) * capacity);
+  return content;
+}
+
+/// 把 data 的 [offset, offset + size) 写入分块存储的内容，data 为 NULL 时写 0。
+/// 只写入 length 之后且没有共享的块时原地写入，否则复制出新的块
+/// \param content
+/// \param data
+/// \param size
+/// \param offset
+static void FsChunkedWrite(FIL_CONTENT *content, const char *data, size_t size,
+                           size_t offset) {
+  size_t length = content->length;
+  size_t end = offset + size;
+  if (!size)
+    return;
+  for (size_t i = offset / FS_CHUNK_SIZE; i < FsChunkCount(end); i++) {
+    size_t start = i * FS_CHUNK_SIZE;
+    size_t from = offset > start ? offset - start : 0;
+    size_t to = end - start < FS_CHUNK_SIZE ? end - start : FS_CHUNK_SIZE;
+    // 这一块中读者可能看到的字节数
+    size_t valid = length > start ? length - start : 0;
+    if (valid > FS_CHUNK_SIZE)
+      valid = FS_CHUNK_SIZE;
+    FIL_CHUNK *old = valid ? content->chunks[i] : NULL;
+    if (!data && !old)
+      continue;
+    FIL_CHUNK *chunk = old;
+    // 共享的块可能正在被其他线程释放引用
+    if (!old || __atomic_load_n(&old->refs, __ATOMIC_ACQUIRE) > 1 ||
+        from < valid) {
+      chunk = FsChunkNew();
+      memcpy(chunk->data, old ? old->data : FsZeroChunk, valid);
+      // 写入位置之前、valid 之后的部分补 0
+      if (from > valid)
+        memset(chunk->data + valid, 0, from - valid);
+    }
+    if (data)
+      memcpy(chunk->data + from, data + (start + from - offset), to - from);
+    else
+      memset(chunk->data + from, 0, to - from);
+    if (chunk != old) {
+      FS_STORE(content->chunks[i], chunk);
+      FsChunkRelease(old);
+    }
+  }
+}
+
+/// 复制内容的前 length 个字节到新的分块存储内容中，与原内容共享块。
+/// 截短时复制最后不满的一块：新内容会在它的末尾原地追加，
+/// 而原内容的读者仍可能读取那些字节
+/// \param src 连续存储或分块存储
+/// \param length
+/// \param capacity 索引的最小项数
+/// \return
+static FIL_CONTENT *FsContentToChunked(FIL_CONTENT *src, size_t length,
+                                       size_t capacity) {
+  size_t count = FsChunkCount(length);
+  if (capacity < count)
+    capacity = count;
+  FIL_CONTENT *content = FsContentNewChunked(capacity);
+  if (src && src->chunks) {
+    for (size_t i = 0; i < count; i++)
+      content->chunks[i] = FsChunkRef(src->chunks[i]);
+    size_t tail = length % FS_CHUNK_SIZE;
+    if (tail && length < src->length && content->chunks[count - 1]) {
+      FIL_CHUNK *chunk = FsChunkNew();
+      memcpy(chunk->data, content->chunks[count - 1]->data, tail);
+      FsChunkRelease(content->chunks[count - 1]);
+      content->chunks[count - 1] = chunk;
+    }
+    content->length = length;
+  } else if (src) {
+    FsChunkedWrite(content, src->data, length, 0);
+    content->length = length;
+  }
+  return content;
+}
+
+/// 分配内容，复制 data 的前 length 个字节，超过 FS_CHUNK_THRESHOLD 时分块存储
+/// \param data 为 NULL 时内容为空
+/// \param length
+/// \param capacity 连续存储时的容量，小于 length 时取 length
+/// \return
+FIL_CONTENT *FsContentNew(const char *data, size_t length, size_t capacity) {
+  if (data && length > FS_CHUNK_THRESHOLD) {
+    FIL_CONTENT *content = FsContentNewChunked(FsChunkCount(length));
+    FsChunkedWrite(content, data, length, 0);
+    content->length = length;
+    return content;
+  }
+  if (capacity < length)
+    capacity = length;
+  FIL_CONTENT *content = FsContentAlloc(sizeof(char) * (capacity + 1));
+  content->capacity = capacity;
+  content->length = data ? length : 0;
+  if (data)
+    memcpy(content->data, data, length);
+  content->data[content->length] = '\0';
+  return content;
+}
+
+/// 从 fd 的当前位置顺序读取最多 length 个字节作为新的内容，
+/// 直接读入内容的缓冲区或者块中，不经过中间缓冲区。
+/// 分块存储时每次 readv 读入 FS_CONTENT_READ_CHUNKS 个块
+/// \param fd
+/// \param length 通常是文件的大小；文件在读取期间变短时只保留读到的部分
+/// \return 读取失败时返回 NULL 并保留 errno
+FIL_CONTENT *FsContentFromFd(int fd, size_t length) {
+  if (length <= FS_CHUNK_THRESHOLD) {
+    FIL_CONTENT *content = FsContentNew(NULL, 0, length);
+    size_t done = 0;
+    while (done < length) {
+      ssize_t n = read(fd, content->data + done, length - done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0) {
+        FsContentDealloc(content);
+        return NULL;
+      }
+      if (!n)
+        break;
+      done += n;
+    }
+    content->length = done;
+    content->data[done] = '\0';
+    return content;
+  }
+  size_t count = FsChunkCount(length);
+  FIL_CONTENT *content = FsContentNewChunked(count);
+  struct iovec iov[FS_CONTENT_READ_CHUNKS];
+  size_t done = 0;
+  while (done < length) {
+    // 从 done 所在的块开始，done 总是块的整数倍，除非文件变短
+    size_t first = done / FS_CHUNK_SIZE;
+    int n = 0;
+    for (size_t i = first; i < count && n < FS_CONTENT_READ_CHUNKS; i++) {
+      if (!content->chunks[i])
+        content->chunks[i] = FsChunkNew();
+      size_t start = i == first ? done - i * FS_CHUNK_SIZE : 0;
+      size_t end = length - i * FS_CHUNK_SIZE < FS_CHUNK_SIZE
+                       ? length - i * FS_CHUNK_SIZE
+                       : FS_CHUNK_SIZE;
+      iov[n++] = (struct iovec){content->chunks[i]->data + start, end - start};
+    }
+    ssize_t r = readv(fd, iov, n);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0) {
+      int saved = errno;
+      // 已经分配的块都在 length 之内，一起释放
+      content->length = length;
+      FsContentFree(content);
+      errno = saved;
+      return NULL;
+    }
+    if (!r)
+      break;
+    done += r;
+  }
+  // 文件变短时释放没有读到的块
+  for (size_t i = FsChunkCount(done); i < count; i++) {
+    FsChunkRelease(content->chunks[i]);
+    content->chunks[i] = NULL;
+  }
+  content->length = done;
+  return content;
+}
+
+/// 内容是否可以直接读取：既没有压缩也没有溢出到文件
+/// \param content
+/// \return
+static bool FsContentReadable(FIL_CONTENT *content) {
+  return !content->compressed && !content->spill;
+}
+
+/// 把溢出到文件的内容读回内存，压缩的内容仍然保持压缩
+/// \param content 溢出到文件的内容
+/// \return 新的内容
+static FIL_CONTENT *FsContentUnspill(FIL_CONTENT *content) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  FIL_CONTENT *resident;
+  bool ok;
+  if (content->compressed) {
+    resident = FsContentAlloc(sizeof(char) * content->compressed);
+    resident->length = content->length;
+    resident->capacity = content->compressed;
+    resident->compressed = content->compressed;
+    ok = FsSpillRead(content->spill, resident->data, content->compressed,
+                     content->offset);
+  } else if (content->length > FS_CHUNK_THRESHOLD) {
+    char *buf = malloc(sizeof(char) * content->length);
+    assert(buf);
+    ok = FsSpillRead(content->spill, buf, content->length, content->offset);
+    resident = FsContentNew(buf, content->length, content->length);
+    free(buf);
+  } else {
+    resident = FsContentNew(NULL, 0, content->length);
+    ok = FsSpillRead(content->spill, resident->data, content->length,
+                     content->offset);
+    resident->length = content->length;
+    resident->data[content->length] = '\0';
+  }
+  // 溢出文件只由本进程读写，读取失败说明宿主文件系统出错
+  assert(ok);
+  (void)ok;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  FsSpillFault((uint64_t)(end.tv_sec - start.tv_sec) * 1000000000 +
+               end.tv_nsec - start.tv_nsec);
+  return resident;
+}
+
+/// 复制内容。连续存储时共享去重存储中的内容，分块存储时只复制索引、
+/// 共享所有的块，溢出到文件的内容读回内存
+/// \param fs 副本所属的文件系统，没有开启去重时连续存储的内容复制一份
+/// \param src 可以为 NULL
+/// \return
+FIL_CONTENT *FsContentClone(Fs fs, FIL_CONTENT *src) {
+  if (!src)
+    return NULL;
+  size_t length = FS_LOAD(src->length);
+  if (src->spill)
+    return FsContentUnspill(src);
+  if (src->chunks)
+    return FsContentToChunked(src, length, 0);
+  if (src->compressed) {
+    FIL_CONTENT *content = FsContentAlloc(sizeof(char) * src->compressed);
+    memcpy(content, src, sizeof(FIL_CONTENT) + src->compressed);
+    return content;
+  }
+  // 调用者持有 src 的一个引用，src 不会在此期间离开存储
+  if (FsContentShared(src)) {
+    __atomic_add_fetch(&src->refs, 1, __ATOMIC_RELAXED);
+    return src;
+  }
+  return FsContentIntern(fs, src->data, length);
+}
+
+/// 释放内容及其持有的块引用，内容必须已经不可能通过这个文件读取。
+/// 共享的内容只释放一个引用。也作为 FsEpochRetire 的回调
+/// \param content 可以为 NULL
+void FsContentFree(void *content) {
+  FIL_CONTENT *c = content;
+  if (!c)
+    return;
+  if (FsContentShared(c) && !FsContentRelease(c))
+    return;
+  if (c->spill)
+    FsSpillRelease(c->spill, c->offset, c->capacity);
+  if (c->chunks) {
+    for (size_t i = 0; i < FsChunkCount(c->length); i++)
+      FsChunkRelease(c->chunks[i]);
+  }
+  FsContentDealloc(c);
+}
+
+/// 无锁读取文件内容，调用者需处于 epoch 临界区或持有文件的锁。
+/// 内容可能是压缩的，只需要长度时使用
+/// \param file
+/// \param length 内容的字节数
+/// \return 没有内容时返回 NULL
+FIL_CONTENT *FsFilContent(FIL *file, size_t *length) {
+  FIL_CONTENT *content = FS_LOAD(file->content);
+  *length = content ? FS_LOAD(content->length) : 0;
+  // 写者先保存旧版本再修改，读到修改之后的长度时一定能找到旧版本
+  FsVersion *version = FsVersionGet(file);
+  if (version) {
+    *length = version->length;
+    return version->content;
+  }
+  return content;
+}
+
+/// 发布新的内容，旧内容可能正在被读取，延迟释放
+/// \param file
+/// \param content
+static void FsFilPublish(FIL *file, FIL_CONTENT *content) {
+  FIL_CONTENT *old = file->content;
+  FS_STORE(file->content, content);
+  FsEpochRetire(old, FsContentFree);
+}
+
+/// 当前时间（毫秒），只用于比较先后，精度约为一个时钟周期
+/// \return
+uint64_t FsClockMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/// 记录文件的访问时间。同一时钟周期内的多次访问只写一次，减少缓存行争用
+/// \param file
+void FsFilTouch(FIL *file) {
+  uint64_t now = FsClockMs();
+  if (__atomic_load_n(&file->accessed, __ATOMIC_RELAXED) != now)
+    __atomic_store_n(&file->accessed, now, __ATOMIC_RELAXED);
+}
+
+/// 把溢出到文件的内容读回内存并解压
+/// \param content 不能直接读取的内容
+/// \return 新的内容
+static FIL_CONTENT *FsContentThaw(FIL_CONTENT *content) {
+  FIL_CONTENT *resident =
+      content->spill ? FsContentUnspill(content) : content;
+  if (!resident->compressed)
+    return resident;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  FIL_CONTENT *plain = FsContentNew(NULL, 0, resident->length);
+  bool ok = FsLzDecompress(resident->data, resident->compressed, plain->data,
+                           resident->length);
+  assert(ok);
+  (void)ok;
+  plain->data[resident->length] = '\0';
+  plain->length = resident->length;
+  if (resident != content)
+    FsContentDealloc(resident);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  __atomic_add_fetch(&fsDecompressions, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&fsDecompressNs,
+                     (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000 +
+                         end.tv_nsec - start.tv_nsec,
+                     __ATOMIC_RELAXED);
+  return plain;
+}
+
+/// 把溢出到文件的内容读回内存、解压后重新发布，调用者需持有文件的写锁
+/// \param file
+static void FsFilThawLocked(FIL *file) {
+  FIL_CONTENT *content = file->content;
+  if (!content || FsContentReadable(content))
+    return;
+  __atomic_store_n(&file->compacted, 0, __ATOMIC_RELAXED);
+  FsFilPublish(file, FsContentThaw(content));
+}
+
+/// 写入之前调用：记录访问时间，内容改变之后后台压缩需要重新尝试。
+/// 时钟精度有限，不能只依靠访问时间判断。
+/// 快照之后第一次修改时保存一份可以直接读取的旧内容，
+/// 事务中第一次修改时为撤销保存旧内容。
+/// 调用者需持有文件的写锁
+/// \param file
+static void FsFilModify(FIL *file) {
+  FsFilTouch(file);
+  __atomic_store_n(&file->compacted, 0, __ATOMIC_RELAXED);
+  FsTxLog(FS_TX_CONTENT, file, NULL, NULL);
+  if (FsSnapNeeded(file)) {
+    FsFilThawLocked(file);
+    FIL_CONTENT *content = file->content;
+    FsSnapSave(file, NULL, FsContentClone(file->fs, content),
+               content ? content->length : 0);
+  }
+}
+
+/// 读者获取可以直接读取的文件内容并记录访问时间。
+/// 内容被压缩或者溢出到文件时加锁解压、读回后重新发布；
+/// 在快照中读取时不修改文件，只解压出一份临时的副本。
+/// 调用者需处于 epoch 临界区
+/// \param fs 调用者没有持有整棵树的锁时用于加读锁；已经持有时为 NULL
+/// \param file
+/// \param length 内容的字节数
+/// \return 没有内容时返回 NULL
+FIL_CONTENT *FsFilContentLoad(Fs fs, FIL *file, size_t *length) {
+  FIL_CONTENT *content;
+  if (FsViewGet()) {
+    // 副本在当前的临界区结束之后释放
+    content = FsFilContent(file, length);
+    if (content && !FsContentReadable(content)) {
+      content = FsContentThaw(content);
+      FsEpochRetire(content, FsContentFree);
+    }
+    return content;
+  }
+  FsFilTouch(file);
+  content = FsFilContent(file, length);
+  if (!content || FsContentReadable(content))
+    return content;
+  // 与写者相同的加锁顺序：FsCp 等独占操作读取内容时不会被替换
+  if (fs)
+    FsTreeRdlock(fs);
+  pthread_rwlock_wrlock(&file->lock);
+  FsFilThawLocked(file);
+  pthread_rwlock_unlock(&file->lock);
+  if (fs)
+    FsTreeUnlock(fs);
+  return FsFilContent(file, length);
+}
+
+/// 压缩文件内容，只处理连续存储、没有被其他文件共享、压缩后至少
+/// 节省八分之一的内容。调用者需持有整棵树的读锁和文件的写锁
+/// \param file
+/// \return 是否压缩
+bool FsFilCompress(FIL *file) {
+  FIL_CONTENT *content = file->content;
+  if (!content || content->chunks || !FsContentReadable(content) ||
+      content->length < FS_CONTENT_MIN_CAPACITY ||
+      __atomic_load_n(&content->refs, __ATOMIC_RELAXED) > 1)
+    return false;
+  size_t length = content->length;
+  size_t capacity = length - length / 8;
+  char *buf = malloc(sizeof(char) * capacity);
+  assert(buf);
+  size_t size = FsLzCompress(content->data, length, buf, capacity);
+  if (size) {
+    FIL_CONTENT *packed = FsContentAlloc(sizeof(char) * size);
+    packed->length = length;
+    packed->capacity = size;
+    packed->compressed = size;
+    memcpy(packed->data, buf, size);
+    FsFilPublish(file, packed);
+  }
+  free(buf);
+  return size != 0;
+}
+
+/// 把文件内容写入溢出文件，内存中只保留偏移，压缩的内容写入压缩后的字节。
+/// 调用者需持有整棵树的读锁和文件的写锁
+/// \param file
+/// \param spill
+/// \return 预计释放的内存，共享的内容按共享的文件数均摊；没有溢出时为 0
+size_t FsFilSpill(FIL *file, FsSpill *spill) {
+  FIL_CONTENT *content = file->content;
+  if (!content || content->spill || !content->length)
+    return 0;
+  size_t size = content->compressed ? content->compressed : content->length;
+  uint64_t offset = FsSpillAlloc(spill, size);
+  bool ok = true;
+  if (content->compressed) {
+    ok = FsSpillWrite(spill, content->data, size, offset);
+  } else {
+    for (size_t pos = 0; ok && pos < size;) {
+      const char *data;
+      size_t n = FsContentSegment(content, size, pos, &data);
+      ok = FsSpillWrite(spill, data, n, offset + pos);
+      pos += n;
+    }
+  }
+  FsSpillRef(spill);
+  if (!ok) {
+    // 宿主文件系统空间不足等，内容留在内存中
+    FsSpillRelease(spill, offset, size);
+    return 0;
+  }
+  size_t freed = FsContentSize(content);
+  if (content->chunks) {
+    for (size_t i = 0; i < FsChunkCount(content->length); i++) {
+      if (content->chunks[i])
+        freed += sizeof(FIL_CHUNK);
+    }
+  }
+  size_t refs = __atomic_load_n(&content->refs, __ATOMIC_RELAXED);
+  if (refs > 1)
+    freed /= refs;
+  FIL_CONTENT *stub = FsContentAlloc(0);
+  stub->length = content->length;
+  stub->capacity = size;
+  stub->compressed = content->compressed;
+  stub->spill = spill;
+  stub->offset = offset;
+  FsFilPublish(file, stub);
+  return freed;
+}
+
+/// 获取整个进程中解压的次数和总耗时
+/// \param count
+/// \param ns 纳秒
+void FsDecompressStats(size_t *count, uint64_t *ns) {
+  *count = __atomic_load_n(&fsDecompressions, __ATOMIC_RELAXED);
+  *ns = __atomic_load_n(&fsDecompressNs, __ATOMIC_RELAXED);
+}
+
+/// 获取 offset 处的一段连续内容，分块存储时不超过所在的块
+/// \param content FsFilContentLoad 的返回值，不能是压缩的
+/// \param length FsFilContentLoad 得到的长度
+/// \param offset 小于 length
+/// \param data 这一段的起始位置
+/// \return 这一段的字节数
+size_t FsContentSegment(FIL_CONTENT *content, size_t length, size_t offset,
+                        const char **data) {
+  if (!content->chunks) {
+    *data = content->data + offset;
+    return length - offset;
+  }
+  size_t in = offset % FS_CHUNK_SIZE;
+  FIL_CHUNK *chunk = FS_LOAD(content->chunks[offset / FS_CHUNK_SIZE]);
+  *data = (chunk ? chunk->data : FsZeroChunk) + in;
+  size_t n = FS_CHUNK_SIZE - in;
+  return n < length - offset ? n : length - offset;
+}
+
+/// 从 offset 处复制最多 size 个字节到 buf
+/// \param content 可以为 NULL
+/// \param length
+/// \param offset
+/// \param buf
+/// \param size
+/// \return 复制的字节数
+size_t FsContentRead(FIL_CONTENT *content, size_t length, size_t offset,
+                     void *buf, size_t size) {
+  size_t copied = 0;
+  while (content && copied < size && offset < length) {
+    const char *data;
+    size_t n = FsContentSegment(content, length, offset, &data);
+    if (n > size - copied)
+      n = size - copied;
+    memcpy((char *)buf + copied, data, n);
+    copied += n;
+    offset += n;
+  }
+  return copied;
+}
+
+/// 用 data 替换文件的全部内容，与其他文件相同的内容只保存一份
+/// \param file
+/// \param data
+/// \param length
+void FsFilReplace(FIL *file, const char *data, size_t length) {
+  FsFilModify(file);
+  FsFilPublish(file, FsContentIntern(file->fs, data, length));
+}
+
+/// 撤销事务时恢复文件的内容，调用者需持有文件的写锁
+/// \param file
+/// \param content 事务中第一次修改之前的内容
+void FsFilRestore(FIL *file, FIL_CONTENT *content) {
+  FsFilModify(file);
+  FsFilPublish(file, content);
+}
+
+/// 扩容时的新容量：至少翻倍
+/// \param capacity 原来的容量
+/// \param need 需要的容量
+/// \param min 最小容量
+/// \return
+static size_t FsContentGrow(size_t capacity, size_t need, size_t min) {
+  capacity *= 2;
+  if (capacity < min)
+    capacity = min;
+  return capacity < need ? need : capacity;
+}
+
+/// 在 offset 处写入 size 个字节，超过末尾时扩展文件，空洞补 0。
+/// 只写在末尾之后且容量足够时原地写入
+/// \param file
+/// \param data
+/// \param size
+/// \param offset
+void FsFilWrite(FIL *file, const void *data, size_t size, size_t offset) {
+  FsFilModify(file);
+  FsFilThawLocked(file);
+  FIL_CONTENT *content = file->content;
+  size_t length = content ? content->length : 0;
+  size_t end = offset + size;
+  size_t newLength = end > length ? end : length;
+  if (newLength > FS_CHUNK_THRESHOLD ||
+      (content && content->chunks)) {
+    // 索引容量不足或者需要从连续存储转换时，在新的内容上修改后整体发布
+    FIL_CONTENT *target = content;
+    if (!content || !content->chunks ||
+        FsChunkCount(newLength) > content->capacity) {
+      size_t capacity = content && content->chunks ? content->capacity : 0;
+      target = FsContentToChunked(
+          content, length,
+          FsContentGrow(capacity, FsChunkCount(newLength), 1));
+    }
+    if (offset > length)
+      FsChunkedWrite(target, NULL, offset - length, length);
+    FsChunkedWrite(target, data, size, offset);
+    if (target != content) {
+      target->length = newLength;
+      FsFilPublish(file, target);
+    } else {
+      FS_STORE(content->length, newLength);
+    }
+    return;
+  }
+  if (content && !FsContentShared(content) && offset >= length &&
+      end <= content->capacity) {
+    // 这些字节还没有发布，读者不会访问
+    memset(content->data + length, 0, offset - length);
+    memcpy(content->data + offset, data, size);
+    content->data[end] = '\0';
+    FS_STORE(content->length, end);
+    return;
+  }
+  size_t capacity =
+      end > length ? FsContentGrow(content ? content->capacity : 0, end,
+                                   FS_CONTENT_MIN_CAPACITY)
+                   : length;
+  FIL_CONTENT *newContent = FsContentNew(NULL, 0, capacity);
+  if (length)
+    memcpy(newContent->data, content->data, length);
+  if (offset > length)
+    memset(newContent->data + length, 0, offset - length);
+  memcpy(newContent->data + offset, data, size);
+  newContent->data[newLength] = '\0';
+  newContent->length = newLength;
+  FsFilPublish(file, newContent);
+}
+
+/// 把文件截断或扩展到 length 个字节，扩展的部分补 0。
+/// 分块存储时扩展出的整块不分配内存
+/// \param file
+/// \param length
+void FsFilResize(FIL *file, size_t length) {
+  FsFilModify(file);
+  FsFilThawLocked(file);
+  FIL_CONTENT *content = file->content;
+  size_t oldLength = content ? content->length : 0;
+  if (length > oldLength) {
+    if (length > FS_CHUNK_THRESHOLD || (content && content->chunks)) {
+      FsFilWrite(file, NULL, 0, length);
+      return;
+    }
+    if (content && !FsContentShared(content) &&
+        length <= content->capacity) {
+      memset(content->data + oldLength, 0, length - oldLength);
+      content->data[length] = '\0';
+      FS_STORE(content->length, length);
+      return;
+    }
+  }
+  // 缩短时旧的末尾可能正在被读取，之后的追加不能原地覆盖它
+  FIL_CONTENT *newContent;
+  if (length > FS_CHUNK_THRESHOLD) {
+    newContent = FsContentToChunked(content, length, 0);
+  } else {
+    newContent = FsContentNew(NULL, 0, length);
+    size_t keep = oldLength < length ? oldLength : length;
+    FsContentRead(content, oldLength, 0, newContent->data, keep);
+    memset(newContent->data + keep, 0, length - keep);
+    newContent->data[length] = '\0';
+    newContent->length = length;
+  }
+  FsFilPublish(file, newContent);
+}
@@ -0,0 +1,194 @@
+// 文件夹迭代器
+//
+// FsOpendir / FsReaddir / FsClosedir 逐项返回文件夹中的文件，不打印。
+// 子文件列表按名字排序，名字本身就是游标：从某个名字之后继续时二分查找
+// 它的位置，其他线程同时插入、删除文件也不会跳过或重复已经读过的名字。
+// 迭代器不持有文件夹，每次取一页时重新解析打开时的绝对路径，
+// 在 epoch 临界区中复制这一页的名字，之后的 FsReaddir 不再访问文件树；
+// 取一页的时间复杂度为 O(log n + k)，名字的缓冲区反复使用。
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "utility.h"
+
+// 每页的项数
+#define FS_DIR_PAGE 64
+
+struct FsDir_t {
+  Fs fs;
+  // 文件夹的绝对路径
+  char *path;
+  // 当前页，entries[i].name 指向 names 中的名字
+  FsDirent entries[FS_DIR_PAGE];
+  size_t count;
+  size_t next;
+  char *names;
+  size_t namesCapacity;
+  // 上一页最后一项的名字，为空时从头开始
+  char *cursor;
+  size_t cursorCapacity;
+  // 已经读到文件夹末尾
+  bool end;
+};
+
+/// 把 name 复制到按需扩大的缓冲区
+/// \param buf
+/// \param capacity
+/// \param name
+/// \param length 名字的字节数
+static void FsDirCopy(char **buf, size_t *capacity, const char *name,
+                      size_t length) {
+  if (length + 1 > *capacity) {
+    *capacity = (length + 1) * 2;
+    *buf = realloc(*buf, *capacity);
+    assert(*buf);
+  }
+  memcpy(*buf, name, length);
+  (*buf)[length] = '\0';
+}
+
+/// 文件夹项的大小：普通文件为内容的字节数，符号链接为指向的路径的长度，
+/// 文件夹为子文件的数量。调用者需处于 epoch 临界区
+/// \param file
+/// \return
+static size_t FsDirSize(FIL *file) {
+  if (file->type == DIRECTORY)
+    return FsFilChildren(file)->size - 2;
+  if (file->symlink)
+    return strlen(file->symlink);
+  size_t length;
+  FsFilContent(FsFilTarget(file), &length);
+  return length;
+}
+
+/// 取游标之后的一页
+/// \param dir
+/// \return 文件夹已被删除或者不再是文件夹时返回错误
+static FsErrors FsDirFill(FsDir *dir) {
+  PATH *path = NULL;
+  dir->count = 0;
+  dir->next = 0;
+  FsEpochEnter();
+  FsErrors res = FsPathParse(FsCwdGet(dir->fs)->pathRoot, dir->path, &path);
+  FIL *target = res == FS_OK ? FsPathGetTail(path)->file : NULL;
+  if (res == FS_OK && target->type != DIRECTORY)
+    res = FS_NOT_A_DIRECTORY;
+  if (res == FS_OK) {
+    FIL_LIST *children = FsFilChildren(target);
+    size_t i = FsFilLowerBound(children, dir->cursor);
+    if (i < children->size && strcmp(children->items[i].name, dir->cursor) == 0)
+      i++;
+    size_t end = i + FS_DIR_PAGE < children->size ? i + FS_DIR_PAGE
+                                                   : children->size;
+    // 先统计这一页名字的总长度，一次扩大缓冲区，
+    // 之后 entries 中的指针不会因为扩大而失效
+    size_t total = 0;
+    for (size_t j = i; j < end; j++)
+      total += strlen(children->items[j].name) + 1;
+    if (total > dir->namesCapacity) {
+      dir->namesCapacity = total * 2;
+      dir->names = realloc(dir->names, dir->namesCapacity);
+      assert(dir->names);
+    }
+    char *p = dir->names;
+    for (size_t j = i; j < end; j++) {
+      FIL *file = children->items[j].file;
+      size_t length = strlen(children->items[j].name);
+      memcpy(p, children->items[j].name, length + 1);
+      dir->entries[dir->count++] =
+          (FsDirent){p, file->type, file->symlink != NULL, FsDirSize(file)};
+      p += length + 1;
+    }
+    dir->end = end == children->size;
+  }
+  FsEpochExit();
+  FsPathFree(path);
+  return res;
+}
+
+/// 打开文件夹，用 FsReaddir 逐项读取
+/// \param fs
+/// \param pathStr 为 NULL 或空字符串时是当前目录
+/// \param after 为 NULL 时从头开始，否则从这个名字之后开始，
+/// 通常是上一次读到的最后一项的名字；这个名字不需要仍然存在
+/// \param dir 成功时为新的迭代器，用 FsClosedir 关闭
+/// \return
+FsErrors FsOpendir(Fs fs, const char *pathStr, const char *after,
+                   FsDir **dir) {
+  if (!fs || !dir)
+    return FS_ERROR;
+  *dir = NULL;
+  PATH *path = NULL;
+  FsErrors res = FS_OK;
+  char *pathAbs = NULL;
+  FsEpochEnter();
+  if (pathStr && *pathStr) {
+    res = FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path);
+    if (res == FS_OK && FsPathGetTail(path)->file->type != DIRECTORY)
+      res = FS_NOT_A_DIRECTORY;
+    if (res == FS_OK)
+      pathAbs = FsPathGetStr(path);
+  } else {
+    pathAbs = FsPathGetStr(FsCwdGet(fs)->pathRoot);
+  }
+  FsEpochExit();
+  FsPathFree(path);
+  if (res)
+    return res;
+  FsDir *d = malloc(sizeof(FsDir));
+  assert(d);
+  memset(d, 0, sizeof(FsDir));
+  d->fs = fs;
+  d->path = pathAbs;
+  const char *cursor = after ? after : "";
+  FsDirCopy(&d->cursor, &d->cursorCapacity, cursor, strlen(cursor));
+  *dir = d;
+  return FS_OK;
+}
+
+/// 读取下一项，不包括 `.`、`..`
+/// \param dir
+/// \param entry 读到末尾时为 NULL；否则在下一次 FsReaddir 或 FsClosedir
+/// 之前有效，entry->name 可以作为之后 FsOpendir 的 after
+/// \return 文件夹在读取期间被删除时返回 FS_NO_SUCH_FILE
+FsErrors FsReaddir(FsDir *dir, const FsDirent **entry) {
+  if (!dir || !entry)
+    return FS_ERROR;
+  *entry = NULL;
+  if (dir->next == dir->count) {
+    if (dir->end)
+      return FS_OK;
+    // 这一页的名字即将被覆盖，先记下最后一项作为游标
+    if (dir->count) {
+      const char *last = dir->entries[dir->count - 1].name;
+      FsDirCopy(&dir->cursor, &dir->cursorCapacity, last, strlen(last));
+    }
+    FsErrors res = FsDirFill(dir);
+    if (res)
+      return res;
+    if (!dir->count)
+      return FS_OK;
+  }
+  *entry = &dir->entries[dir->next++];
+  return FS_OK;
+}
+
+/// 关闭迭代器
+/// \param dir 可以为 NULL
+void FsClosedir(FsDir *dir) {
+  if (!dir)
+    return;
+  free(dir->path);
+  free(dir->names);
+  free(dir->cursor);
+  free(dir);
+}
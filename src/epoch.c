@@ -0,0 +1,194 @@
+// 基于 epoch 的延迟回收
+//
+// 全局 epoch 只有在所有处于临界区中的线程都已经观察到当前 epoch 时
+// 才能前进。某个 epoch e 中 retire 的内存，在全局 epoch 到达 e + 2 之后
+// 就不可能再被任何读者引用，可以安全释放。
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "epoch.h"
+
+// 每个线程按 epoch 轮转的待释放链表数量
+#define FS_EPOCH_LISTS 3
+// 每 retire 多少次尝试推进一次全局 epoch
+#define FS_EPOCH_BATCH 32
+
+typedef struct FsRetired_t {
+  void *ptr;
+  void (*freeFn)(void *);
+  struct FsRetired_t *next;
+} FsRetired;
+
+typedef struct FsEpochRecord_t {
+  // (观察到的 epoch << 1) | 是否在临界区中
+  atomic_uint_fast64_t local;
+  // 是否被某个线程占用，线程退出后记录留给下一个线程复用
+  atomic_bool used;
+  // 临界区嵌套层数
+  int nest;
+  // 待释放链表及其 retire 时的 epoch
+  FsRetired *limbo[FS_EPOCH_LISTS];
+  uint64_t limboEpoch[FS_EPOCH_LISTS];
+  size_t retired;
+  // 记录只增不减，组成单向链表
+  struct FsEpochRecord_t *next;
+} FsEpochRecord;
+
+static atomic_uint_fast64_t globalEpoch = 1;
+static _Atomic(FsEpochRecord *) records = NULL;
+static pthread_key_t recordKey;
+static pthread_once_t recordKeyOnce = PTHREAD_ONCE_INIT;
+static __thread FsEpochRecord *self = NULL;
+
+/// 线程退出时归还记录
+/// \param record
+static void FsEpochRelease(void *record) {
+  FsEpochRecord *r = record;
+  r->nest = 0;
+  atomic_store(&r->local, 0);
+  atomic_store(&r->used, false);
+}
+
+static void FsEpochKeyInit(void) {
+  int res = pthread_key_create(&recordKey, FsEpochRelease);
+  assert(res == 0);
+}
+
+/// 获取当前线程的记录，第一次调用时复用空闲记录或新建一个
+/// \return
+static FsEpochRecord *FsEpochSelf(void) {
+  if (self)
+    return self;
+  pthread_once(&recordKeyOnce, FsEpochKeyInit);
+  FsEpochRecord *r = atomic_load(&records);
+  for (; r; r = r->next) {
+    bool expected = false;
+    if (!atomic_load(&r->used) &&
+        atomic_compare_exchange_strong(&r->used, &expected, true))
+      break;
+  }
+  if (!r) {
+    r = malloc(sizeof(FsEpochRecord));
+    assert(r);
+    memset(r, 0, sizeof(FsEpochRecord));
+    atomic_init(&r->local, 0);
+    atomic_init(&r->used, true);
+    r->next = atomic_load(&records);
+    while (!atomic_compare_exchange_weak(&records, &r->next, r))
+      ;
+  }
+  pthread_setspecific(recordKey, r);
+  self = r;
+  return r;
+}
+
+/// 释放一个待释放链表
+/// \param list
+static void FsEpochFreeList(FsRetired *list) {
+  while (list) {
+    FsRetired *next = list->next;
+    list->freeFn(list->ptr);
+    free(list);
+    list = next;
+  }
+}
+
+/// 释放当前线程所有已经安全的待释放链表。
+/// 先摘下链表再释放，freeFn 中可以再调用 FsEpochRetire
+/// \param r
+/// \param epoch 当前全局 epoch
+static void FsEpochCollect(FsEpochRecord *r, uint64_t epoch) {
+  for (int i = 0; i < FS_EPOCH_LISTS; i++) {
+    if (r->limbo[i] && r->limboEpoch[i] + 2 <= epoch) {
+      FsRetired *list = r->limbo[i];
+      r->limbo[i] = NULL;
+      FsEpochFreeList(list);
+    }
+  }
+}
+
+/// 所有在临界区中的线程都观察到当前 epoch 时推进全局 epoch
+/// \param epoch
+static void FsEpochTryAdvance(uint64_t epoch) {
+  for (FsEpochRecord *r = atomic_load(&records); r; r = r->next) {
+    uint_fast64_t local = atomic_load(&r->local);
+    if ((local & 1) && (local >> 1) != epoch)
+      return;
+  }
+  uint_fast64_t expected = epoch;
+  atomic_compare_exchange_strong(&globalEpoch, &expected, epoch + 1);
+}
+
+/// 进入读临界区，可以嵌套
+void FsEpochEnter(void) {
+  FsEpochRecord *r = FsEpochSelf();
+  if (r->nest++ > 0)
+    return;
+  uint64_t epoch = atomic_load(&globalEpoch);
+  atomic_store(&r->local, (epoch << 1) | 1);
+  // 保证之后对共享数据的读取不会被重排到发布 local 之前
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+/// 离开读临界区
+void FsEpochExit(void) {
+  FsEpochRecord *r = self;
+  assert(r && r->nest > 0);
+  if (--r->nest > 0)
+    return;
+  atomic_store_explicit(&r->local, 0, memory_order_release);
+}
+
+/// 尽量释放当前线程 retire 的内存：推进全局 epoch 并回收已经安全的链表。
+/// 其他线程停留在临界区中时可能只释放一部分。调用者不能处于临界区中
+void FsEpochFlush(void) {
+  FsEpochRecord *r = FsEpochSelf();
+  assert(r->nest == 0);
+  for (int i = 0; i < FS_EPOCH_LISTS; i++) {
+    FsEpochTryAdvance(atomic_load(&globalEpoch));
+    FsEpochCollect(r, atomic_load(&globalEpoch));
+  }
+}
+
+/// 等待当前所有处于临界区中的读者离开，之后进入临界区的读者能看到
+/// 调用之前发布的修改。调用者不能处于临界区中
+void FsEpochSynchronize(void) {
+  assert(!self || self->nest == 0);
+  // 全局 epoch 前进两次之后，调用时处于临界区中的线程都已经离开
+  uint64_t target = atomic_load(&globalEpoch) + 2;
+  uint64_t epoch;
+  while ((epoch = atomic_load(&globalEpoch)) < target) {
+    FsEpochTryAdvance(epoch);
+    if (atomic_load(&globalEpoch) == epoch)
+      sched_yield();
+  }
+}
+
+/// 延迟释放已经从共享结构中摘除的内存
+/// \param ptr
+/// \param freeFn 安全之后调用 freeFn(ptr)
+void FsEpochRetire(void *ptr, void (*freeFn)(void *)) {
+  if (!ptr)
+    return;
+  FsEpochRecord *r = FsEpochSelf();
+  FsRetired *item = malloc(sizeof(FsRetired));
+  assert(item);
+  item->ptr = ptr;
+  item->freeFn = freeFn;
+  uint64_t epoch = atomic_load(&globalEpoch);
+  FsEpochCollect(r, epoch);
+  int i = epoch % FS_EPOCH_LISTS;
+  // 同一位置上更早的链表已经在 FsEpochCollect 中释放
+  item->next = r->limbo[i];
+  r->limbo[i] = item;
+  r->limboEpoch[i] = epoch;
+  if (++r->retired % FS_EPOCH_BATCH == 0)
+    FsEpochTryAdvance(epoch);
+}
@@ -0,0 +1,25 @@
+// 基于 epoch 的延迟回收（Epoch-Based Reclamation）
+//
+// 无锁读者在 FsEpochEnter / FsEpochExit 之间访问共享数据；
+// 写者把不再可达的内存交给 FsEpochRetire，等所有可能看到它的读者
+// 都离开临界区之后才真正释放。
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+// 原子读写普通字段：发布指针用 release，读取用 acquire
+#define FS_LOAD(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define FS_STORE(field, value)                                                 \
+  __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
+
+void FsEpochEnter(void);
+
+void FsEpochExit(void);
+
+void FsEpochRetire(void *ptr, void (*freeFn)(void *));
+
+void FsEpochFlush(void);
+
+void FsEpochSynchronize(void);
+
+#endif
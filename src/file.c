@@ -0,0 +1,204 @@
+// 文件句柄
+//
+// FsOpen 只解析一次路径，之后的读写直接访问句柄绑定的 FIL。
+// FsMv 移动、改名时不会重建 FIL，句柄仍然有效。
+// 句柄持有 FIL 的一个引用：文件被删除后仍可读写，最后一个 FsClose 时释放。
+// 通过硬链接打开时绑定到链接到的文件。
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "utility.h"
+
+struct FsHandle_t {
+  Fs fs;
+  FIL *file;
+  int flags;
+};
+
+/// 查找要打开的文件，需要时在上层文件夹中创建。
+/// 调用者需持有整棵树的读锁
+/// \param fs
+/// \param pathStr
+/// \param create
+/// \param file
+/// \return
+static FsErrors FsOpenFind(Fs fs, const char *pathStr, bool create,
+                           FIL **file) {
+  PATH *path = NULL;
+  FsErrors res;
+  if (!create) {
+    res = FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path);
+    if (res == FS_OK)
+      *file = FsFilTarget(FsPathGetTail(path)->file);
+  } else {
+    char *pathParentStr = FsPathStrShift((char *)pathStr);
+    char *name = FsPathStrGetName((char *)pathStr);
+    // 成功时持有上层文件夹的写锁
+    res = FsPathParseLocked(FsCwdGet(fs)->pathRoot, pathParentStr, &path,
+                            FS_LOCK_WRITE);
+    if (res == FS_OK) {
+      FIL *dir = FsFilTarget(FsPathGetTail(path)->file);
+      if (dir->type != DIRECTORY) {
+        res = FS_NOT_A_DIRECTORY;
+      } else if (!*name) {
+        res = FS_IS_A_DIRECTORY;
+      } else if (!(*file = FsFilFindByName(dir, name))) {
+        FsInitFile(dir, file, name);
+        FsFilAddChild(dir, *file);
+      }
+      pthread_rwlock_unlock(&dir->lock);
+    }
+    free(pathParentStr);
+    free(name);
+    // 已经存在的链接按路径展开，指向不存在的文件时不创建
+    if (res == FS_OK && ((*file)->link || (*file)->symlink)) {
+      FsPathFree(path);
+      path = NULL;
+      res = FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path);
+      if (res == FS_OK)
+        *file = FsFilTarget(FsPathGetTail(path)->file);
+    }
+  }
+  FsPathFree(path);
+  if (res == FS_OK && (*file)->type != REGULAR_FILE)
+    res = FS_IS_A_DIRECTORY;
+  return res;
+}
+
+/// 打开文件，返回绑定到文件本身的句柄
+/// \param fs
+/// \param pathStr
+/// \param flags FsOpenFlags 的组合，至少包含 FS_OPEN_READ、FS_OPEN_WRITE
+/// 之一
+/// \param handle 成功时为新的句柄，用 FsClose 关闭
+/// \return
+FsErrors FsOpen(Fs fs, const char *pathStr, int flags, FsHandle **handle) {
+  if (!fs || !pathStr || !handle)
+    return FS_ERROR;
+  *handle = NULL;
+  if (!(flags & (FS_OPEN_READ | FS_OPEN_WRITE)))
+    return FS_ERROR;
+  if ((flags & (FS_OPEN_CREATE | FS_OPEN_TRUNCATE)) &&
+      !(flags & FS_OPEN_WRITE))
+    return FS_ERROR;
+  if ((flags & FS_OPEN_WRITE) && fs->snapshot)
+    return FS_READ_ONLY;
+  FIL *file = NULL;
+  FsTreeRdlock(fs);
+  FsErrors res = FsOpenFind(fs, pathStr, flags & FS_OPEN_CREATE, &file);
+  // 持有树的读锁时文件不会被删除，可以安全地增加引用
+  if (res == FS_OK)
+    __atomic_add_fetch(&file->refs, 1, __ATOMIC_RELAXED);
+  FsTreeUnlock(fs);
+  if (res != FS_OK)
+    return res;
+  FsHandle *h = malloc(sizeof(FsHandle));
+  assert(h);
+  h->fs = fs;
+  h->file = file;
+  h->flags = flags;
+  if (flags & FS_OPEN_TRUNCATE)
+    FsTruncate(h, 0);
+  *handle = h;
+  return FS_OK;
+}
+
+/// 从 offset 处读取最多 size 个字节，不加锁
+/// \param handle 需以 FS_OPEN_READ 打开
+/// \param buf
+/// \param size
+/// \param offset
+/// \param bytes 实际读取的字节数，offset 超过文件末尾时为 0
+/// \return
+FsErrors FsReadAt(FsHandle *handle, void *buf, size_t size, size_t offset,
+                  size_t *bytes) {
+  if (!handle || !(handle->flags & FS_OPEN_READ))
+    return FS_BAD_FILE_DESCRIPTOR;
+  // 已发布的字节不会被原地修改；分块存储时同时进行的写入可能只有
+  // 部分块可见
+  FsEpochEnter();
+  // 快照的句柄读取快照时刻的内容，其他线程的事务中读取事务开始时的内容
+  FsViewSet(FsViewOf(handle->fs));
+  size_t length;
+  FIL_CONTENT *content =
+      FsFilContentLoad(handle->fs, handle->file, &length);
+  size_t n = FsContentRead(content, length, offset, buf, size);
+  FsEpochExit();
+  if (bytes)
+    *bytes = n;
+  return FS_OK;
+}
+
+/// 在 offset 处写入 size 个字节，超过文件末尾时扩展文件，空洞补 0。
+/// 以 FS_OPEN_APPEND 打开时总是写到文件末尾
+/// \param handle 需以 FS_OPEN_WRITE 打开
+/// \param buf
+/// \param size
+/// \param offset
+/// \return
+FsErrors FsWriteAt(FsHandle *handle, const void *buf, size_t size,
+                   size_t offset) {
+  if (!handle || !(handle->flags & FS_OPEN_WRITE))
+    return FS_BAD_FILE_DESCRIPTOR;
+  if (!size)
+    return FS_OK;
+  FIL *file = handle->file;
+  // 与 FsPut 相同：树的读锁防止 FsCp 等独占操作读到一半的修改
+  FsTreeRdlock(handle->fs);
+  pthread_rwlock_wrlock(&file->lock);
+  if (handle->flags & FS_OPEN_APPEND)
+    offset = file->content ? file->content->length : 0;
+  FsFilWrite(file, buf, size, offset);
+  pthread_rwlock_unlock(&file->lock);
+  FsTreeUnlock(handle->fs);
+  return FS_OK;
+}
+
+/// 把文件截断或扩展到 size 个字节，扩展的部分补 0
+/// \param handle 需以 FS_OPEN_WRITE 打开
+/// \param size
+/// \return
+FsErrors FsTruncate(FsHandle *handle, size_t size) {
+  if (!handle || !(handle->flags & FS_OPEN_WRITE))
+    return FS_BAD_FILE_DESCRIPTOR;
+  FIL *file = handle->file;
+  FsTreeRdlock(handle->fs);
+  pthread_rwlock_wrlock(&file->lock);
+  FsFilResize(file, size);
+  pthread_rwlock_unlock(&file->lock);
+  FsTreeUnlock(handle->fs);
+  return FS_OK;
+}
+
+/// 关闭句柄。文件已被删除且这是最后一个句柄时释放文件
+/// \param handle
+void FsClose(FsHandle *handle) {
+  if (!handle)
+    return;
+  FsFilRelease(handle->file);
+  free(handle);
+}
+
+// 该函数把 data 的前 length 个字节追加到文件末尾，文件不存在时创建，
+// 相当于 shell 中的 `>>`。追加的均摊代价只与 length 有关
+void FsAppend(Fs fs, char *pathStr, const char *data, size_t length) {
+  FsHandle *handle = NULL;
+  FsErrors res = FsOpen(fs, pathStr,
+                        FS_OPEN_WRITE | FS_OPEN_CREATE | FS_OPEN_APPEND,
+                        &handle);
+  if (res) {
+    PERRORD(res, "append: '%s'", pathStr);
+    return;
+  }
+  FsWriteAt(handle, data, length, 0);
+  FsClose(handle);
+}
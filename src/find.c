@@ -0,0 +1,168 @@
+// 按文件名模式、类型、深度和大小查找文件
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "utility.h"
+
+typedef struct {
+  const char *pattern;
+  const FsFindFlags *flags;
+  FsFindCallback callback;
+  void *ctx;
+} FsFindState;
+
+/// 匹配 `[...]` 字符集合
+/// \param p 指向 `[` 之后
+/// \param c 待匹配的字符
+/// \param matched 是否匹配
+/// \return 指向 `]` 之后，集合没有闭合时返回 NULL
+static const char *FsGlobClass(const char *p, char c, bool *matched) {
+  bool negate = false;
+  bool found = false;
+  if (*p == '!' || *p == '^') {
+    negate = true;
+    p++;
+  }
+  const char *start = p;
+  // 紧跟在开头的 `]` 是普通字符
+  while (*p && (*p != ']' || p == start)) {
+    char low = *p;
+    if (low == '\\' && p[1])
+      low = *++p;
+    if (p[1] == '-' && p[2] && p[2] != ']') {
+      char high = p[2];
+      p += 3;
+      if (high == '\\' && *p)
+        high = *p++;
+      if ((unsigned char)c >= (unsigned char)low &&
+          (unsigned char)c <= (unsigned char)high)
+        found = true;
+    } else {
+      if (c == low)
+        found = true;
+      p++;
+    }
+  }
+  if (*p != ']')
+    return NULL;
+  *matched = found != negate;
+  return p + 1;
+}
+
+/// 用 glob 模式匹配文件名，支持 `*`、`?`、`[...]` 和 `\` 转义。
+/// 不分配内存，遇到 `*` 时只记录最后一个回溯点，时间复杂度 O(模式长度 *
+/// 文件名长度)
+/// \param pattern
+/// \param name
+/// \return
+bool FsGlobMatch(const char *pattern, const char *name) {
+  const char *p = pattern;
+  const char *n = name;
+  // 最后一个 `*` 之后的位置，以及它当前匹配到的文件名位置
+  const char *starPattern = NULL;
+  const char *starName = NULL;
+  while (*n) {
+    if (*p == '*') {
+      while (*p == '*')
+        p++;
+      if (!*p)
+        return true;
+      starPattern = p;
+      starName = n;
+      continue;
+    }
+    bool matched = false;
+    const char *next = p + 1;
+    if (*p == '?') {
+      matched = true;
+    } else if (*p == '[') {
+      next = FsGlobClass(p + 1, *n, &matched);
+      if (!next) {
+        // 没有闭合的 `[` 按普通字符处理
+        matched = *n == '[';
+        next = p + 1;
+      }
+    } else if (*p == '\\' && p[1]) {
+      matched = p[1] == *n;
+      next = p + 2;
+    } else if (*p) {
+      matched = *p == *n;
+    }
+    if (matched) {
+      p = next;
+      n++;
+      continue;
+    }
+    if (!starPattern)
+      return false;
+    // 让上一个 `*` 多匹配一个字符
+    p = starPattern;
+    n = ++starName;
+  }
+  while (*p == '*')
+    p++;
+  return !*p;
+}
+
+/// 文件内容的字节数，文件夹为 0
+/// \param file
+/// \return
+size_t FsFilSize(FIL *file) {
+  if (file->type != REGULAR_FILE)
+    return 0;
+  size_t length;
+  FsFilContent(FsFilTarget(file), &length);
+  return length;
+}
+
+/// FsFind 的访问者：检查各项条件，到达最大深度时不再进入文件夹
+/// \param entry
+/// \param ctx FsFindState
+/// \return
+static FsWalkAction FsFindVisit(const FsWalkEntry *entry, void *ctx) {
+  FsFindState *state = ctx;
+  const FsFindFlags *flags = state->flags;
+  FIL *file = entry->file;
+  bool matched = true;
+  if (flags->type != FS_FIND_ANY_TYPE && (int)file->type != flags->type)
+    matched = false;
+  if (matched && (flags->minSize > 0 || flags->maxSize != SIZE_MAX)) {
+    // 有大小条件时只匹配文件
+    size_t size = FsFilSize(file);
+    matched = file->type == REGULAR_FILE && size >= flags->minSize &&
+              size <= flags->maxSize;
+  }
+  // 按列表中的文件名匹配，在快照中是改名之前的名字
+  if (matched && state->pattern)
+    matched = FsGlobMatch(state->pattern,
+                          entry->depth ? strrchr(entry->path, FS_SPLIT) + 1
+                                       : FS_LOAD(file->name));
+  if (matched)
+    state->callback(entry, state->ctx);
+  if (flags->maxDepth >= 0 && entry->depth >= flags->maxDepth)
+    return FS_WALK_PRUNE;
+  return FS_WALK_CONTINUE;
+}
+
+/// 查找 pathStr 下所有满足条件的文件，按先序、字典序调用 callback
+/// \param fs
+/// \param pathStr 为空时从当前目录开始
+/// \param pattern 文件名的 glob 模式，为 NULL 时不限
+/// \param flags 为 NULL 时不限
+/// \param callback
+/// \param ctx 传给 callback
+/// \return
+FsErrors FsFind(Fs fs, const char *pathStr, const char *pattern,
+                const FsFindFlags *flags, FsFindCallback callback, void *ctx) {
+  FsFindFlags any = FS_FIND_FLAGS_ANY;
+  FsFindState state = {pattern, flags ? flags : &any, callback, ctx};
+  return FsWalk(fs, pathStr, FsFindVisit, &state, FS_WALK_ORDERED);
+}
@@ -0,0 +1,367 @@
+// 在文件内容中查找字符串
+//
+// 子串查找先用 SIMD 同时比较候选位置的首字节和末字节，两者都相同的位置
+// 才逐字节比较，AVX2 / SSE2 不可用时退化为 memchr + memcmp。
+// 文件按先序收集后由线程池并行扫描，最后按顺序回调结果。
+// 分块存储的文件逐块扫描，跨越块边界的行复制出来单独匹配。
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "pool.h"
+#include "utility.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FS_GREP_X86
+#endif
+
+// 一处匹配：所在行
+typedef struct {
+  size_t line;
+  const char *text;
+  size_t length;
+  // text 是跨越块边界的行的副本，需要释放
+  bool owned;
+} FsGrepMatch;
+
+// 待扫描的文件及其结果
+typedef struct {
+  char *path;
+  FIL_CONTENT *content;
+  size_t length;
+  FsGrepMatch *matches;
+  size_t count;
+  size_t capacity;
+} FsGrepFile;
+
+typedef struct {
+  const char *pattern;
+  size_t patternLength;
+  FsGrepFile *files;
+  size_t count;
+  size_t capacity;
+} FsGrepState;
+
+// 派生给线程池的扫描任务
+typedef struct {
+  FsGrepState *state;
+  FsGrepFile *file;
+} FsGrepTask;
+
+/// 逐字节查找，也用于处理 SIMD 循环剩下的尾部
+/// \param haystack
+/// \param n
+/// \param needle
+/// \param m 至少为 1
+/// \return
+static const char *FsMemFindScalar(const char *haystack, size_t n,
+                                   const char *needle, size_t m) {
+  if (n < m)
+    return NULL;
+  const char *end = haystack + n - m + 1;
+  for (const char *p = haystack; p < end; p++) {
+    p = memchr(p, needle[0], end - p);
+    if (!p)
+      return NULL;
+    if (memcmp(p + 1, needle + 1, m - 1) == 0)
+      return p;
+  }
+  return NULL;
+}
+
+#ifdef FS_GREP_X86
+/// 每次比较 16 个候选位置的首字节和末字节
+__attribute__((target("sse2"))) static const char *
+FsMemFindSse2(const char *haystack, size_t n, const char *needle, size_t m) {
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[m - 1]);
+  size_t i = 0;
+  for (; i + m - 1 + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(haystack + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(haystack + i + m - 1));
+    unsigned mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+    while (mask) {
+      size_t offset = i + __builtin_ctz(mask);
+      if (memcmp(haystack + offset + 1, needle + 1, m - 2) == 0)
+        return haystack + offset;
+      mask &= mask - 1;
+    }
+  }
+  return FsMemFindScalar(haystack + i, n - i, needle, m);
+}
+
+/// 每次比较 32 个候选位置的首字节和末字节
+__attribute__((target("avx2"))) static const char *
+FsMemFindAvx2(const char *haystack, size_t n, const char *needle, size_t m) {
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+  size_t i = 0;
+  for (; i + m - 1 + 32 <= n; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(haystack + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(haystack + i + m - 1));
+    __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                  _mm256_cmpeq_epi8(b, last));
+    unsigned mask = _mm256_movemask_epi8(eq);
+    while (mask) {
+      size_t offset = i + __builtin_ctz(mask);
+      if (memcmp(haystack + offset + 1, needle + 1, m - 2) == 0)
+        return haystack + offset;
+      mask &= mask - 1;
+    }
+  }
+  return FsMemFindScalar(haystack + i, n - i, needle, m);
+}
+#endif
+
+/// 在 haystack 的前 n 个字节中查找 needle 第一次出现的位置
+/// \param haystack
+/// \param n
+/// \param needle
+/// \param m needle 的长度
+/// \return 找不到时返回 NULL
+const char *FsMemFind(const char *haystack, size_t n, const char *needle,
+                      size_t m) {
+  if (m == 0)
+    return haystack;
+  if (m == 1)
+    return memchr(haystack, needle[0], n);
+#ifdef FS_GREP_X86
+  if (__builtin_cpu_supports("avx2"))
+    return FsMemFindAvx2(haystack, n, needle, m);
+  return FsMemFindSse2(haystack, n, needle, m);
+#else
+  return FsMemFindScalar(haystack, n, needle, m);
+#endif
+}
+
+/// 记录一处匹配
+/// \param file
+/// \param line
+/// \param text
+/// \param length
+/// \param copy text 之后会被覆盖时复制一份
+static void FsGrepAdd(FsGrepFile *file, size_t line, const char *text,
+                      size_t length, bool copy) {
+  if (file->count == file->capacity) {
+    file->capacity = file->capacity ? file->capacity * 2 : 8;
+    file->matches =
+        realloc(file->matches, sizeof(FsGrepMatch) * file->capacity);
+    assert(file->matches);
+  }
+  if (copy) {
+    char *owned = malloc(sizeof(char) * (length + 1));
+    assert(owned);
+    memcpy(owned, text, length);
+    text = owned;
+  }
+  file->matches[file->count++] = (FsGrepMatch){line, text, length, copy};
+}
+
+/// 扫描一段连续的内容，每行最多记录一次
+/// \param file
+/// \param state
+/// \param p 行首
+/// \param end 最后一行的行尾
+/// \param line p 所在的行号
+/// \param copy 匹配的行是否需要复制
+/// \return end 所在的行号
+static size_t FsGrepScanRange(FsGrepFile *file, FsGrepState *state,
+                              const char *p, const char *end, size_t line,
+                              bool copy) {
+  // 已经数过换行的位置和当前行首
+  const char *counted = p;
+  const char *lineStart = p;
+  while (p < end) {
+    const char *hit = FsMemFind(p, end - p, state->pattern,
+                                state->patternLength);
+    if (!hit)
+      break;
+    for (const char *q; (q = memchr(counted, '\n', hit - counted));
+         counted = q + 1) {
+      line++;
+      lineStart = q + 1;
+    }
+    const char *lineEnd = memchr(hit, '\n', end - hit);
+    if (!lineEnd)
+      lineEnd = end;
+    FsGrepAdd(file, line, lineStart, lineEnd - lineStart, copy);
+    if (lineEnd == end)
+      return line;
+    // 从下一行开始继续查找
+    p = counted = lineStart = lineEnd + 1;
+    line++;
+  }
+  for (const char *q; (q = memchr(counted, '\n', end - counted));
+       counted = q + 1)
+    line++;
+  return line;
+}
+
+/// 把 [p, end) 追加到跨越块边界的行中
+/// \param carry
+/// \param length
+/// \param capacity
+/// \param p
+/// \param end
+static void FsGrepCarry(char **carry, size_t *length, size_t *capacity,
+                        const char *p, const char *end) {
+  size_t n = end - p;
+  if (*length + n > *capacity) {
+    *capacity = (*length + n) * 2;
+    *carry = realloc(*carry, sizeof(char) * *capacity);
+    assert(*carry);
+  }
+  memcpy(*carry + *length, p, n);
+  *length += n;
+}
+
+/// 线程池任务：逐段扫描一个文件。连续存储的文件只有一段
+/// \param pool
+/// \param worker
+/// \param arg FsGrepTask
+static void FsGrepScan(FsPool *pool, int worker, void *arg) {
+  FsGrepTask *task = arg;
+  FsGrepFile *file = task->file;
+  FsGrepState *state = task->state;
+  free(task);
+  size_t line = 1;
+  // 上一段末尾没有结束的行
+  char *carry = NULL;
+  size_t carryLength = 0;
+  size_t carryCapacity = 0;
+  for (size_t offset = 0; offset < file->length;) {
+    const char *p;
+    size_t n = FsContentSegment(file->content, file->length, offset, &p);
+    const char *end = p + n;
+    offset += n;
+    if (carryLength) {
+      const char *newline = memchr(p, '\n', n);
+      if (!newline) {
+        FsGrepCarry(&carry, &carryLength, &carryCapacity, p, end);
+        continue;
+      }
+      FsGrepCarry(&carry, &carryLength, &carryCapacity, p, newline);
+      FsGrepScanRange(file, state, carry, carry + carryLength, line, true);
+      carryLength = 0;
+      line++;
+      p = newline + 1;
+    }
+    if (offset == file->length) {
+      FsGrepScanRange(file, state, p, end, line, false);
+      break;
+    }
+    // 这一段中最后一个完整的行之后的部分留给下一段
+    const char *last = end;
+    while (last > p && last[-1] != '\n')
+      last--;
+    if (last > p)
+      line = FsGrepScanRange(file, state, p, last - 1, line, false) + 1;
+    FsGrepCarry(&carry, &carryLength, &carryCapacity, last, end);
+  }
+  if (carryLength)
+    FsGrepScanRange(file, state, carry, carry + carryLength, line, true);
+  free(carry);
+}
+
+/// 线程池的第一个任务：为每个文件派生扫描任务
+/// \param pool
+/// \param worker
+/// \param arg FsGrepState
+static void FsGrepSpawn(FsPool *pool, int worker, void *arg) {
+  FsGrepState *state = arg;
+  for (size_t i = 0; i < state->count; i++) {
+    FsGrepTask *task = malloc(sizeof(FsGrepTask));
+    assert(task);
+    task->state = state;
+    task->file = &state->files[i];
+    FsPoolSpawn(pool, worker, FsGrepScan, task);
+  }
+}
+
+/// 按先序收集所有非空文件
+/// \param entry
+/// \param ctx FsGrepState
+/// \return
+static FsWalkAction FsGrepCollect(const FsWalkEntry *entry, void *ctx) {
+  FsGrepState *state = ctx;
+  if (entry->file->type != REGULAR_FILE)
+    return FS_WALK_CONTINUE;
+  size_t length;
+  // 已经持有整棵树的读锁
+  FIL_CONTENT *content =
+      FsFilContentLoad(NULL, FsFilTarget(entry->file), &length);
+  if (!content || !length)
+    return FS_WALK_CONTINUE;
+  if (state->count == state->capacity) {
+    state->capacity = state->capacity ? state->capacity * 2 : 64;
+    state->files = realloc(state->files, sizeof(FsGrepFile) * state->capacity);
+    assert(state->files);
+  }
+  FsGrepFile *file = &state->files[state->count++];
+  memset(file, 0, sizeof(FsGrepFile));
+  file->path = strdup(entry->path);
+  assert(file->path);
+  file->content = content;
+  file->length = length;
+  return FS_WALK_CONTINUE;
+}
+
+/// 在 pathStr 下所有文件的内容中查找 pattern，
+/// 按文件的先序、行号的顺序对每个匹配的行调用 callback。
+/// 扫描期间持有整棵树的读锁，callback 中不能修改文件系统
+/// \param fs
+/// \param pathStr 为空时从当前目录开始
+/// \param pattern
+/// \param callback
+/// \param ctx 传给 callback
+/// \param nthreads 并行扫描的线程数
+/// \return
+FsErrors FsGrep(Fs fs, const char *pathStr, const char *pattern,
+                FsGrepCallback callback, void *ctx, int nthreads) {
+  if (!pattern || !callback)
+    return FS_ERROR;
+  if (!pathStr || !*pathStr)
+    pathStr = ".";
+  FsGrepState state;
+  memset(&state, 0, sizeof(FsGrepState));
+  state.pattern = pattern;
+  state.patternLength = strlen(pattern);
+  PATH *path = NULL;
+  FsTreeRdlock(fs);
+  // 在整个过程中处于 epoch 临界区，收集到的内容不会被释放
+  FsEpochEnter();
+  FsErrors res = FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path);
+  if (res == FS_OK) {
+    FsWalkFil(FsPathGetTail(path)->file, pathStr, FsGrepCollect, &state,
+              FS_WALK_ORDERED);
+    FsPoolRun(nthreads, FsGrepSpawn, &state);
+    for (size_t i = 0; i < state.count; i++) {
+      FsGrepFile *file = &state.files[i];
+      for (size_t j = 0; j < file->count; j++)
+        callback(file->path, file->matches[j].line, file->matches[j].text,
+                 file->matches[j].length, ctx);
+    }
+  }
+  FsEpochExit();
+  FsTreeUnlock(fs);
+  for (size_t i = 0; i < state.count; i++) {
+    for (size_t j = 0; j < state.files[i].count; j++) {
+      if (state.files[i].matches[j].owned)
+        free((char *)state.files[i].matches[j].text);
+    }
+    free(state.files[i].path);
+    free(state.files[i].matches);
+  }
+  free(state.files);
+  FsPathFree(path);
+  return res;
+}
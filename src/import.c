@@ -0,0 +1,451 @@
+// 从宿主机导入文件夹
+//
+// FsImportDir 把宿主机上的一个文件夹整个复制进文件系统。每个宿主机文件夹
+// 是线程池中的一个任务：用 getdents64 一次读出所有目录项，排序后
+// 按数量一次分配好子文件列表，普通文件用 openat 打开后直接顺序读入内容的
+// 缓冲区（见 FsContentFromFd），子文件夹派生为新的任务，可被其他线程窃取。
+// 读取期间新的节点都没有发布，也不属于任何文件系统，不需要任何锁；
+// 全部读完之后在当前线程中补上所属的文件系统，把整棵树一次插入目标文件夹。
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "pool.h"
+#include "utility.h"
+
+// getdents64 每次读取的缓冲区大小
+#define FS_IMPORT_DENTS_SIZE (64 * 1024)
+// 读取宿主机文件主要在等待磁盘，线程数至少为这么多
+#define FS_IMPORT_MIN_THREADS 4
+
+// getdents64 返回的目录项
+struct FsDirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+// 一次导入中所有任务共享的状态
+typedef struct {
+  // 与 FsImportStats 相同的计数，各个线程原子地累加
+  size_t files;
+  size_t directories;
+  size_t symlinks;
+  uint64_t bytes;
+  size_t skipped;
+} FsImportState;
+
+// 读取一个宿主机文件夹的任务
+typedef struct {
+  FsImportState *state;
+  // 宿主机上的路径
+  char *host;
+  // 尚未发布的文件夹，只有 `.`、`..`
+  FIL *dst;
+} FsImportTask;
+
+// 文件夹中的一项，name 为名字缓冲区中的偏移
+typedef struct {
+  size_t name;
+  unsigned char type;
+} FsImportEntry;
+
+static void FsImportDirTask(FsPool *pool, int worker, void *arg);
+
+/// 宿主机的 errno 对应的错误
+/// \param err
+/// \return
+static FsErrors FsImportError(int err) {
+  switch (err) {
+  case ENOENT:
+    return FS_NO_SUCH_FILE;
+  case ENOTDIR:
+    return FS_NOT_A_DIRECTORY;
+  case ELOOP:
+    return FS_TOO_MANY_LINKS;
+  default:
+    return FS_ERROR;
+  }
+}
+
+/// 读出文件夹中除 `.`、`..` 以外的所有目录项
+/// \param fd
+/// \param names 所有名字依次以 '\0' 结尾存放，由调用者释放
+/// \param count 目录项的数量
+/// \return 目录项，由调用者释放；读取失败时返回 NULL
+static FsImportEntry *FsImportReadDir(int fd, char **names, size_t *count) {
+  char *buf = malloc(FS_IMPORT_DENTS_SIZE);
+  size_t capacity = 64;
+  size_t namesCapacity = 1024;
+  size_t namesLength = 0;
+  FsImportEntry *entries = malloc(sizeof(FsImportEntry) * capacity);
+  *names = malloc(namesCapacity);
+  *count = 0;
+  assert(buf && entries && *names);
+  for (;;) {
+    long n = syscall(SYS_getdents64, fd, buf, FS_IMPORT_DENTS_SIZE);
+    if (n < 0) {
+      free(entries);
+      entries = NULL;
+      break;
+    }
+    if (!n)
+      break;
+    for (long off = 0; off < n;) {
+      struct FsDirent64 *d = (struct FsDirent64 *)(buf + off);
+      off += d->d_reclen;
+      if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+        continue;
+      size_t length = strlen(d->d_name) + 1;
+      if (namesLength + length > namesCapacity) {
+        namesCapacity = (namesLength + length) * 2;
+        *names = realloc(*names, namesCapacity);
+        assert(*names);
+      }
+      memcpy(*names + namesLength, d->d_name, length);
+      if (*count == capacity) {
+        capacity *= 2;
+        entries = realloc(entries, sizeof(FsImportEntry) * capacity);
+        assert(entries);
+      }
+      entries[(*count)++] = (FsImportEntry){namesLength, d->d_type};
+      namesLength += length;
+    }
+  }
+  free(buf);
+  return entries;
+}
+
+// FsImportCompare 使用的名字缓冲区，每个线程各自设置
+static __thread const char *fsImportNames;
+
+/// 按名字排序，与子文件列表的顺序一致
+/// \param a
+/// \param b
+/// \return
+static int FsImportCompare(const void *a, const void *b) {
+  const FsImportEntry *x = a;
+  const FsImportEntry *y = b;
+  return strcmp(fsImportNames + x->name, fsImportNames + y->name);
+}
+
+/// 读入文件夹 dirFd 中的一项，子文件夹派生为新的任务
+/// \param pool
+/// \param worker
+/// \param task 所在文件夹的任务
+/// \param dirFd
+/// \param name
+/// \param type getdents64 给出的类型，DT_UNKNOWN 时用 fstatat 确定
+/// \return 新的节点，跳过时返回 NULL
+static FIL *FsImportEntryRead(FsPool *pool, int worker, FsImportTask *task,
+                              int dirFd, const char *name,
+                              unsigned char type) {
+  FsImportState *state = task->state;
+  if (type == DT_UNKNOWN) {
+    struct stat st;
+    if (fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+      type = S_ISDIR(st.st_mode)   ? DT_DIR
+             : S_ISREG(st.st_mode) ? DT_REG
+             : S_ISLNK(st.st_mode) ? DT_LNK
+                                   : DT_UNKNOWN;
+  }
+  FIL *file = NULL;
+  if (type == DT_DIR) {
+    size_t length = strlen(task->host);
+    FsImportTask *sub = malloc(sizeof(FsImportTask));
+    assert(sub);
+    sub->state = state;
+    sub->host = malloc(length + strlen(name) + 2);
+    assert(sub->host);
+    sprintf(sub->host, "%s/%s", task->host, name);
+    FsInitDir(task->dst, &file, name);
+    sub->dst = file;
+    FsPoolSpawn(pool, worker, FsImportDirTask, sub);
+  } else if (type == DT_REG) {
+    int fd = openat(dirFd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+      if (fd >= 0)
+        close(fd);
+      __atomic_add_fetch(&state->skipped, 1, __ATOMIC_RELAXED);
+      return NULL;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    FIL_CONTENT *content = NULL;
+    if (st.st_size > 0)
+      content = FsContentFromFd(fd, (size_t)st.st_size);
+    close(fd);
+    if (st.st_size > 0 && !content) {
+      __atomic_add_fetch(&state->skipped, 1, __ATOMIC_RELAXED);
+      return NULL;
+    }
+    FsInitFile(task->dst, &file, name);
+    file->content = content;
+    __atomic_add_fetch(&state->files, 1, __ATOMIC_RELAXED);
+    if (content)
+      __atomic_add_fetch(&state->bytes, content->length, __ATOMIC_RELAXED);
+  } else if (type == DT_LNK) {
+    char target[PATH_MAX + 1];
+    ssize_t n = readlinkat(dirFd, name, target, PATH_MAX);
+    if (n <= 0) {
+      __atomic_add_fetch(&state->skipped, 1, __ATOMIC_RELAXED);
+      return NULL;
+    }
+    target[n] = '\0';
+    FsInitFile(task->dst, &file, name);
+    file->symlink = strdup(target);
+    assert(file->symlink);
+    __atomic_add_fetch(&state->symlinks, 1, __ATOMIC_RELAXED);
+  } else {
+    // 设备、管道、套接字等特殊文件
+    __atomic_add_fetch(&state->skipped, 1, __ATOMIC_RELAXED);
+  }
+  return file;
+}
+
+/// 读入一个宿主机文件夹的所有目录项，填入 task->dst 的子文件列表
+/// \param pool
+/// \param worker
+/// \param arg FsImportTask
+static void FsImportDirTask(FsPool *pool, int worker, void *arg) {
+  FsImportTask *task = arg;
+  FsImportState *state = task->state;
+  int fd = open(task->host, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  char *names = NULL;
+  size_t count = 0;
+  FsImportEntry *entries = fd < 0 ? NULL : FsImportReadDir(fd, &names, &count);
+  if (!entries) {
+    // 读不出的文件夹导入为空文件夹
+    __atomic_add_fetch(&state->skipped, 1, __ATOMIC_RELAXED);
+  } else {
+    fsImportNames = names;
+    qsort(entries, count, sizeof(FsImportEntry), FsImportCompare);
+    // 一次分配好整个列表，按顺序填入即可
+    FIL_LIST *list = FsFilListNew(2 + count);
+    list->size = 0;
+    for (size_t i = 0; i < task->dst->children->size; i++)
+      list->items[list->size++] = task->dst->children->items[i];
+    free(task->dst->children);
+    task->dst->children = list;
+    for (size_t i = 0; i < count; i++) {
+      FIL *file = FsImportEntryRead(pool, worker, task, fd,
+                                    names + entries[i].name, entries[i].type);
+      if (file)
+        list->items[list->size++] = (FIL_ENTRY){file->name, file};
+    }
+  }
+  __atomic_add_fetch(&state->directories, 1, __ATOMIC_RELAXED);
+  if (fd >= 0)
+    close(fd);
+  free(entries);
+  free(names);
+  free(task->host);
+  free(task);
+}
+
+/// 把导入的文件树归入 fs：读取期间的节点不属于任何文件系统，
+/// 不读取快照编号，插入之前在持有整棵树的锁时补上。
+/// 只处理 dir 中的文件，dir 本身由调用者设置
+/// \param dir
+/// \param fs
+void FsImportAdopt(FIL *dir, Fs fs) {
+  for (size_t i = 0; i < dir->children->size; i++) {
+    FIL *file = dir->children->items[i].file;
+    file->fs = fs;
+    file->born = fs->snapClock;
+    if (file->type == DIRECTORY && !FS_IS_DOT(file))
+      FsImportAdopt(file, fs);
+  }
+}
+
+/// 在 pathStr 插入导入的文件树，调用者需持有整棵树的读锁
+/// \param fs
+/// \param pathStr
+/// \param root
+/// \return
+static FsErrors FsImportLink(Fs fs, const char *pathStr, FIL *root) {
+  PATH *path = NULL;
+  char *pathParentStr = FsPathStrShift((char *)pathStr);
+  // 成功时持有上层文件夹的写锁
+  FsErrors res = FsPathParseLocked(FsCwdGet(fs)->pathRoot, pathParentStr,
+                                   &path, FS_LOCK_WRITE);
+  if (res == FS_OK) {
+    FIL *dir = FsFilTarget(FsPathGetTail(path)->file);
+    if (dir->type != DIRECTORY) {
+      res = FS_NOT_A_DIRECTORY;
+    } else if (FsFilFindByName(dir, root->name)) {
+      res = FS_FILE_EXISTS;
+    } else {
+      root->parent = dir;
+      root->fs = fs;
+      root->born = fs->snapClock;
+      // `..` 在列表的第二项
+      root->children->items[1].file->link = dir;
+      FsImportAdopt(root, fs);
+      FsFilAddChild(dir, root);
+    }
+    pthread_rwlock_unlock(&dir->lock);
+  }
+  FsPathFree(path);
+  free(pathParentStr);
+  return res;
+}
+
+/// 把宿主机上的文件夹 hostDir 整个导入到 pathStr。pathStr 是已经存在的
+/// 文件夹时导入为其中与 hostDir 同名的文件夹，否则导入为 pathStr。
+/// 普通文件、文件夹和符号链接原样导入，特殊文件和读取失败的文件跳过
+/// \param fs
+/// \param hostDir
+/// \param pathStr
+/// \param stats 可以为 NULL
+/// \return hostDir 不是文件夹或者无法读取时返回对应的错误
+FsErrors FsImportDir(Fs fs, const char *hostDir, const char *pathStr,
+                     FsImportStats *stats) {
+  if (stats)
+    memset(stats, 0, sizeof(FsImportStats));
+  if (!fs || !hostDir || !pathStr)
+    return FS_ERROR;
+  if (fs->snapshot)
+    return FS_READ_ONLY;
+  char *host = realpath(hostDir, NULL);
+  if (!host)
+    return FsImportError(errno);
+  struct stat st;
+  if (stat(host, &st) < 0 || !S_ISDIR(st.st_mode)) {
+    free(host);
+    return FS_NOT_A_DIRECTORY;
+  }
+  // 先确定插入的位置，目标已经存在时不读取宿主机
+  PATH *path = NULL;
+  char *dest = NULL;
+  FsTreeRdlock(fs);
+  FsErrors res = FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path);
+  if (res == FS_OK && FsPathGetTail(path)->file->type == DIRECTORY) {
+    const char *name = strrchr(host, '/') + 1;
+    dest = malloc(strlen(pathStr) + strlen(name) + 2);
+    assert(dest);
+    sprintf(dest, "%s/%s", pathStr, name);
+    res = *name ? FS_OK : FS_FILE_EXISTS;
+  } else if (res == FS_OK) {
+    res = FS_FILE_EXISTS;
+  } else if (res == FS_NO_SUCH_FILE) {
+    dest = strdup(pathStr);
+    assert(dest);
+    res = FS_OK;
+  }
+  FsPathFree(path);
+  path = NULL;
+  // 上层文件夹必须存在，dest 本身必须不存在
+  char *pathParentStr = dest ? FsPathStrShift(dest) : NULL;
+  if (res == FS_OK)
+    res = FsPathParse(FsCwdGet(fs)->pathRoot, pathParentStr, &path);
+  if (res == FS_OK && FsPathGetTail(path)->file->type != DIRECTORY)
+    res = FS_NOT_A_DIRECTORY;
+  FsPathFree(path);
+  path = NULL;
+  if (res == FS_OK && FsPathParse(FsCwdGet(fs)->pathRoot, dest, &path) == FS_OK)
+    res = FS_FILE_EXISTS;
+  FsPathFree(path);
+  FsTreeUnlock(fs);
+  free(pathParentStr);
+  char *name = dest ? FsPathStrGetName(dest) : NULL;
+  if (res == FS_OK && (!*name || !strcmp(name, ".") || !strcmp(name, "..")))
+    res = FS_FILE_EXISTS;
+  if (res) {
+    free(name);
+    free(dest);
+    free(host);
+    return res;
+  }
+  FsImportState state;
+  memset(&state, 0, sizeof(FsImportState));
+  FIL *root = NULL;
+  FsInitDir(NULL, &root, name);
+  // 插入之前 `..` 先指向自身，插入失败时可以直接 FsFilFree
+  root->children->items[1].file->link = root;
+  FsImportTask *task = malloc(sizeof(FsImportTask));
+  assert(task);
+  task->state = &state;
+  task->host = host;
+  task->dst = root;
+  int nthreads = FsPoolThreads();
+  if (nthreads < FS_IMPORT_MIN_THREADS)
+    nthreads = FS_IMPORT_MIN_THREADS;
+  FsPoolRun(nthreads, FsImportDirTask, task);
+  FsTreeRdlock(fs);
+  res = FsImportLink(fs, dest, root);
+  FsTreeUnlock(fs);
+  if (res)
+    FsFilFree(root);
+  if (stats && res == FS_OK) {
+    stats->files = state.files;
+    stats->directories = state.directories;
+    stats->symlinks = state.symlinks;
+    stats->bytes = state.bytes;
+    stats->skipped = state.skipped;
+  }
+  free(name);
+  free(dest);
+  return res;
+}
+
+/// 打印导入、导出的统计结果和吞吐量
+/// \param verb
+/// \param stats
+/// \param seconds 耗时
+void FsImportReport(const char *verb, const FsImportStats *stats,
+                    double seconds) {
+  printf("%s %zu files, %zu directories, %zu symlinks, "
+         "%llu bytes in %.3fs (%.1f MB/s)",
+         verb, stats->files, stats->directories, stats->symlinks,
+         (unsigned long long)stats->bytes, seconds,
+         seconds > 0 ? stats->bytes / seconds / 1e6 : 0.0);
+  if (stats->skipped)
+    printf(", %zu skipped", stats->skipped);
+  printf("\n");
+}
+
+// 该函数对应 shell 中的 import 命令：
+// import HOSTDIR FSPATH 把宿主机上的文件夹导入到 FSPATH
+void FsImport(Fs fs, char *arg) {
+  char *host = arg ? strtok(arg, " ") : NULL;
+  char *pathStr = host ? strtok(NULL, " ") : NULL;
+  if (!pathStr) {
+    printf("import: missing operand\n");
+    return;
+  }
+  FsImportStats stats;
+  struct timespec start;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  FsErrors res = FsImportDir(fs, host, pathStr, &stats);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (res) {
+    PERRORD(res, "import: cannot import '%s' to '%s'", host, pathStr);
+    return;
+  }
+  FsImportReport("imported", &stats,
+                 (end.tv_sec - start.tv_sec) +
+                     (end.tv_nsec - start.tv_nsec) / 1e9);
+}
@@ -0,0 +1,132 @@
+// 硬链接和符号链接
+//
+// 硬链接是文件夹中的一个新名字，link 指向共享内容的文件，
+// 创建时只增加该文件的引用和名字数量，不复制内容；删除任何一个名字
+// 都不影响其他名字，最后一个引用释放时才释放内容。
+// 符号链接只保存指向的路径，解析路径时才展开，见 FsPathParseLocked。
+// 两者的创建都只需要 O(1) 的时间和内存，与文件大小无关。
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "utility.h"
+
+/// 在 dirStr 中插入名为 name 的链接，调用者需持有整棵树的读锁
+/// \param fs
+/// \param dirStr
+/// \param name
+/// \param target 硬链接链接到的文件，为 NULL 时创建符号链接
+/// \param symlink 符号链接指向的路径
+/// \return
+static FsErrors FsLinkInsert(Fs fs, const char *dirStr, const char *name,
+                             FIL *target, const char *symlink) {
+  PATH *path = NULL;
+  // 成功时持有上层文件夹的写锁
+  FsErrors res = FsPathParseLocked(FsCwdGet(fs)->pathRoot, dirStr, &path,
+                                   FS_LOCK_WRITE);
+  if (res) {
+    FsPathFree(path);
+    return res;
+  }
+  FIL *dir = FsFilTarget(FsPathGetTail(path)->file);
+  if (dir->type != DIRECTORY) {
+    res = FS_NOT_A_DIRECTORY;
+  } else if (!*name || FsFilFindByName(dir, name)) {
+    res = FS_FILE_EXISTS;
+  } else {
+    FIL *file = NULL;
+    FsInitFile(dir, &file, name);
+    if (target) {
+      // 持有树的读锁时 target 不会被删除，可以安全地增加引用
+      file->link = target;
+      __atomic_add_fetch(&target->refs, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&target->links, 1, __ATOMIC_RELAXED);
+    } else {
+      file->symlink = strdup(symlink);
+      assert(file->symlink);
+    }
+    FsFilAddChild(dir, file);
+  }
+  pthread_rwlock_unlock(&dir->lock);
+  FsPathFree(path);
+  return res;
+}
+
+/// 创建链接，linkPath 是已经存在的文件夹时在其中创建与 target 同名的链接
+/// \param fs
+/// \param target 硬链接时为已经存在的文件，不能是文件夹；
+/// 符号链接时为任意非空路径，相对路径从链接所在的文件夹开始
+/// \param linkPath
+/// \param symbolic 是否创建符号链接
+/// \return
+FsErrors FsLink(Fs fs, const char *target, const char *linkPath,
+                bool symbolic) {
+  if (!fs || !target || !linkPath)
+    return FS_ERROR;
+  if (!*target)
+    return FS_NO_SUCH_FILE;
+  if (fs->snapshot)
+    return FS_READ_ONLY;
+  FsErrors res = FS_OK;
+  FIL *file = NULL;
+  PATH *path = NULL;
+  FsTreeRdlock(fs);
+  if (!symbolic) {
+    // 硬链接总是链接到共享内容的文件本身，不会形成链接的链
+    res = FsPathParse(FsCwdGet(fs)->pathRoot, target, &path);
+    if (res == FS_OK) {
+      file = FsFilTarget(FsPathGetTail(path)->file);
+      if (file->type == DIRECTORY)
+        res = FS_IS_A_DIRECTORY;
+    }
+    FsPathFree(path);
+    path = NULL;
+  }
+  if (res == FS_OK) {
+    char *dirStr;
+    char *name;
+    if (FsPathParse(FsCwdGet(fs)->pathRoot, linkPath, &path) == FS_OK &&
+        FsPathGetTail(path)->file->type == DIRECTORY) {
+      dirStr = strdup(linkPath);
+      assert(dirStr);
+      name = FsPathStrGetName((char *)target);
+    } else {
+      dirStr = FsPathStrShift((char *)linkPath);
+      name = FsPathStrGetName((char *)linkPath);
+    }
+    FsPathFree(path);
+    res = FsLinkInsert(fs, dirStr, name, file, target);
+    free(dirStr);
+    free(name);
+  }
+  FsTreeUnlock(fs);
+  return res;
+}
+
+// 该函数对应 shell 中的 ln 命令：
+// ln TARGET LINK 创建硬链接，ln -s TARGET LINK 创建符号链接
+void FsLn(Fs fs, char *arg) {
+  char *target = arg ? strtok(arg, " ") : NULL;
+  bool symbolic = target && strcmp(target, "-s") == 0;
+  if (symbolic)
+    target = strtok(NULL, " ");
+  char *linkPath = target ? strtok(NULL, " ") : NULL;
+  if (!linkPath) {
+    printf("ln: missing file operand\n");
+    return;
+  }
+  FsErrors res = FsLink(fs, target, linkPath, symbolic);
+  if (res) {
+    PERRORD(res, "ln: failed to create %s link '%s'",
+            symbolic ? "symbolic" : "hard", linkPath);
+  }
+}
@@ -0,0 +1,183 @@
+// LZ77 系列的快速压缩算法
+//
+// 压缩时用一个 4 字节前缀的哈希表记录最近出现的位置，只找一个候选匹配，
+// 速度优先于压缩率。解压时检查所有长度和距离，损坏的数据不会越界。
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+// 哈希表的位数
+#define FS_LZ_HASH_BITS 12
+// 最短匹配长度
+#define FS_LZ_MIN_MATCH 4
+// 最大匹配距离
+#define FS_LZ_MAX_OFFSET 65535
+// 末尾的这些字节只作为字面量
+#define FS_LZ_LAST_LITERALS 5
+// 距离末尾不足这些字节时不再查找匹配
+#define FS_LZ_MATCH_LIMIT 12
+
+static uint32_t FsLzRead32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t FsLzHash(uint32_t v) {
+  return (v * 2654435761U) >> (32 - FS_LZ_HASH_BITS);
+}
+
+/// 写入一个序列
+/// \param op 输出位置，成功时前进
+/// \param oend 输出末尾
+/// \param literals 字面量
+/// \param literalLength
+/// \param offset 匹配距离，为 0 时是只有字面量的最后一个序列
+/// \param matchLength
+/// \return 输出空间不足时返回 false
+static bool FsLzEmit(unsigned char **op, unsigned char *oend,
+                     const unsigned char *literals, size_t literalLength,
+                     size_t offset, size_t matchLength) {
+  unsigned char *p = *op;
+  size_t matchCode = offset ? matchLength - FS_LZ_MIN_MATCH : 0;
+  // 标记、扩展长度、字面量和距离所需空间的上界
+  size_t need = 1 + literalLength / 255 + 1 + literalLength + 2 +
+                matchCode / 255 + 1;
+  if (need > (size_t)(oend - p))
+    return false;
+  unsigned char *token = p++;
+  *token = (literalLength < 15 ? literalLength : 15) << 4;
+  if (literalLength >= 15) {
+    size_t n = literalLength - 15;
+    for (; n >= 255; n -= 255)
+      *p++ = 255;
+    *p++ = (unsigned char)n;
+  }
+  memcpy(p, literals, literalLength);
+  p += literalLength;
+  if (offset) {
+    *p++ = (unsigned char)offset;
+    *p++ = (unsigned char)(offset >> 8);
+    *token |= matchCode < 15 ? matchCode : 15;
+    if (matchCode >= 15) {
+      size_t n = matchCode - 15;
+      for (; n >= 255; n -= 255)
+        *p++ = 255;
+      *p++ = (unsigned char)n;
+    }
+  }
+  *op = p;
+  return true;
+}
+
+/// 压缩 src 的前 length 个字节
+/// \param src
+/// \param length
+/// \param dst
+/// \param capacity dst 的字节数
+/// \return 压缩后的字节数，超过 capacity 时返回 0
+size_t FsLzCompress(const void *src, size_t length, void *dst,
+                    size_t capacity) {
+  const unsigned char *base = src;
+  const unsigned char *ip = base;
+  const unsigned char *anchor = base;
+  const unsigned char *iend = base + length;
+  unsigned char *op = dst;
+  unsigned char *oend = op + capacity;
+  // 位置 + 1，0 表示空
+  uint32_t table[1 << FS_LZ_HASH_BITS];
+  memset(table, 0, sizeof(table));
+  if (length > FS_LZ_MATCH_LIMIT) {
+    const unsigned char *mlimit = iend - FS_LZ_MATCH_LIMIT;
+    const unsigned char *limit = iend - FS_LZ_LAST_LITERALS;
+    while (ip < mlimit) {
+      uint32_t v = FsLzRead32(ip);
+      uint32_t h = FsLzHash(v);
+      const unsigned char *match = table[h] ? base + table[h] - 1 : NULL;
+      table[h] = (uint32_t)(ip - base) + 1;
+      if (!match || ip - match > FS_LZ_MAX_OFFSET ||
+          FsLzRead32(match) != v) {
+        ip++;
+        continue;
+      }
+      size_t matchLength = FS_LZ_MIN_MATCH;
+      while (ip + matchLength < limit && ip[matchLength] == match[matchLength])
+        matchLength++;
+      if (!FsLzEmit(&op, oend, anchor, ip - anchor, ip - match, matchLength))
+        return 0;
+      ip += matchLength;
+      anchor = ip;
+    }
+  }
+  if (!FsLzEmit(&op, oend, anchor, iend - anchor, 0, 0))
+    return 0;
+  return op - (unsigned char *)dst;
+}
+
+/// 读取扩展长度
+/// \param ip 成功时前进
+/// \param iend
+/// \param n 标记中的长度，为 15 时加上扩展长度
+/// \return 数据不完整时返回 false
+static bool FsLzLength(const unsigned char **ip, const unsigned char *iend,
+                       size_t *n) {
+  if (*n != 15)
+    return true;
+  unsigned char b;
+  do {
+    if (*ip >= iend)
+      return false;
+    b = *(*ip)++;
+    *n += b;
+  } while (b == 255);
+  return true;
+}
+
+/// 解压 src 的前 size 个字节
+/// \param src
+/// \param size
+/// \param dst
+/// \param length 解压后的字节数
+/// \return 数据损坏或者解压后的字节数不等于 length 时返回 false
+bool FsLzDecompress(const void *src, size_t size, void *dst, size_t length) {
+  const unsigned char *ip = src;
+  const unsigned char *iend = ip + size;
+  unsigned char *op = dst;
+  unsigned char *oend = op + length;
+  while (ip < iend) {
+    unsigned char token = *ip++;
+    size_t literalLength = token >> 4;
+    if (!FsLzLength(&ip, iend, &literalLength) ||
+        literalLength > (size_t)(iend - ip) ||
+        literalLength > (size_t)(oend - op))
+      return false;
+    memcpy(op, ip, literalLength);
+    ip += literalLength;
+    op += literalLength;
+    if (ip == iend)
+      break;
+    if (iend - ip < 2)
+      return false;
+    size_t offset = ip[0] | (size_t)ip[1] << 8;
+    ip += 2;
+    size_t matchLength = token & 15;
+    if (!FsLzLength(&ip, iend, &matchLength))
+      return false;
+    matchLength += FS_LZ_MIN_MATCH;
+    if (!offset || offset > (size_t)(op - (unsigned char *)dst) ||
+        matchLength > (size_t)(oend - op))
+      return false;
+    const unsigned char *match = op - offset;
+    if (offset >= matchLength) {
+      memcpy(op, match, matchLength);
+      op += matchLength;
+    } else {
+      // 重叠的匹配逐字节复制，重复前面的内容
+      for (size_t i = 0; i < matchLength; i++)
+        *op++ = match[i];
+    }
+  }
+  return op == oend;
+}
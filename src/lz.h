@@ -0,0 +1,18 @@
+// LZ77 系列的快速压缩算法，格式与 LZ4 的 block 格式相同
+//
+// 压缩后的数据由若干序列组成：一个标记字节（高 4 位为字面量长度，
+// 低 4 位为匹配长度 - 4，为 15 时后面跟着扩展长度字节），字面量，
+// 2 字节小端序的匹配距离。最后一个序列只有字面量。
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+size_t FsLzCompress(const void *src, size_t length, void *dst,
+                    size_t capacity);
+
+bool FsLzDecompress(const void *src, size_t size, void *dst, size_t length);
+
+#endif
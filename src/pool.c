@@ -0,0 +1,205 @@
+// 带任务窃取的线程池
+//
+// 队列用互斥锁保护：队列只在派生和窃取时竞争，任务本身的执行时间
+// 远大于加锁的开销。空闲线程在条件变量上等待新任务或全部任务完成。
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+// 队列初始容量
+#define FS_POOL_DEQUE_CAPACITY 64
+
+typedef struct {
+  FsPoolTask task;
+  void *arg;
+} FsPoolItem;
+
+typedef struct {
+  pthread_mutex_t lock;
+  // 环形数组，[head, tail) 为有效任务，下标对 capacity 取模
+  FsPoolItem *items;
+  size_t head;
+  size_t tail;
+  size_t capacity;
+} FsPoolDeque;
+
+struct FsPool_t {
+  int nthreads;
+  FsPoolDeque *deques;
+  // 尚未执行完的任务数，归零时所有线程退出
+  atomic_size_t pending;
+  // 仍在队列中等待执行的任务数
+  atomic_size_t queued;
+  // 正在等待的线程数
+  atomic_int idle;
+  pthread_mutex_t idleLock;
+  pthread_cond_t idleCond;
+};
+
+typedef struct {
+  FsPool *pool;
+  int worker;
+} FsPoolWorker;
+
+/// 默认线程数：在线 CPU 数量，不超过 FS_POOL_MAX_THREADS
+/// \return
+int FsPoolThreads(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1)
+    return 1;
+  return n > FS_POOL_MAX_THREADS ? FS_POOL_MAX_THREADS : (int)n;
+}
+
+/// 放入队列尾部，满了则扩容
+/// \param deque
+/// \param item
+static void FsPoolDequePush(FsPoolDeque *deque, FsPoolItem item) {
+  pthread_mutex_lock(&deque->lock);
+  if (deque->tail - deque->head == deque->capacity) {
+    size_t capacity = deque->capacity * 2;
+    FsPoolItem *items = malloc(sizeof(FsPoolItem) * capacity);
+    assert(items);
+    for (size_t i = deque->head; i < deque->tail; i++)
+      items[i % capacity] = deque->items[i % deque->capacity];
+    free(deque->items);
+    deque->items = items;
+    deque->capacity = capacity;
+  }
+  deque->items[deque->tail++ % deque->capacity] = item;
+  pthread_mutex_unlock(&deque->lock);
+}
+
+/// 取出一个任务
+/// \param deque
+/// \param item
+/// \param steal 为 true 时从头部窃取，否则从尾部取出
+/// \return 队列为空时返回 0
+static int FsPoolDequeTake(FsPoolDeque *deque, FsPoolItem *item, int steal) {
+  pthread_mutex_lock(&deque->lock);
+  int found = deque->head != deque->tail;
+  if (found) {
+    if (steal)
+      *item = deque->items[deque->head++ % deque->capacity];
+    else
+      *item = deque->items[--deque->tail % deque->capacity];
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+/// 派生一个任务到 worker 自己的队列
+/// \param pool
+/// \param worker 当前线程编号
+/// \param task
+/// \param arg
+void FsPoolSpawn(FsPool *pool, int worker, FsPoolTask task, void *arg) {
+  atomic_fetch_add(&pool->pending, 1);
+  FsPoolDequePush(&pool->deques[worker], (FsPoolItem){task, arg});
+  atomic_fetch_add(&pool->queued, 1);
+  // 与等待线程中 idle、queued 的检查顺序相反，不会丢失唤醒
+  if (atomic_load(&pool->idle) > 0) {
+    pthread_mutex_lock(&pool->idleLock);
+    pthread_cond_signal(&pool->idleCond);
+    pthread_mutex_unlock(&pool->idleLock);
+  }
+}
+
+/// 先取自己队列尾部的任务，再依次从其他线程的队列头部窃取
+/// \param pool
+/// \param worker
+/// \param item
+/// \return
+static int FsPoolTake(FsPool *pool, int worker, FsPoolItem *item) {
+  for (int i = 0; i < pool->nthreads; i++) {
+    int victim = (worker + i) % pool->nthreads;
+    if (FsPoolDequeTake(&pool->deques[victim], item, victim != worker)) {
+      atomic_fetch_sub(&pool->queued, 1);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/// 工作线程主循环，所有任务完成后返回
+/// \param arg FsPoolWorker
+/// \return
+static void *FsPoolWorkerMain(void *arg) {
+  FsPool *pool = ((FsPoolWorker *)arg)->pool;
+  int worker = ((FsPoolWorker *)arg)->worker;
+  FsPoolItem item;
+  for (;;) {
+    if (FsPoolTake(pool, worker, &item)) {
+      item.task(pool, worker, item.arg);
+      if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+        // 最后一个任务完成，唤醒所有等待的线程退出
+        pthread_mutex_lock(&pool->idleLock);
+        pthread_cond_broadcast(&pool->idleCond);
+        pthread_mutex_unlock(&pool->idleLock);
+      }
+      continue;
+    }
+    pthread_mutex_lock(&pool->idleLock);
+    atomic_fetch_add(&pool->idle, 1);
+    while (atomic_load(&pool->queued) == 0 && atomic_load(&pool->pending) > 0)
+      pthread_cond_wait(&pool->idleCond, &pool->idleLock);
+    atomic_fetch_sub(&pool->idle, 1);
+    int done = atomic_load(&pool->pending) == 0;
+    pthread_mutex_unlock(&pool->idleLock);
+    if (done)
+      break;
+  }
+  return NULL;
+}
+
+/// 用 nthreads 个线程（包括当前线程）执行 task 及其派生的所有任务。
+/// nthreads <= 1 时不创建线程，按后进先出的顺序在当前线程中执行
+/// \param nthreads
+/// \param task
+/// \param arg
+void FsPoolRun(int nthreads, FsPoolTask task, void *arg) {
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > FS_POOL_MAX_THREADS)
+    nthreads = FS_POOL_MAX_THREADS;
+  FsPool pool;
+  memset(&pool, 0, sizeof(FsPool));
+  pool.nthreads = nthreads;
+  pool.deques = malloc(sizeof(FsPoolDeque) * nthreads);
+  assert(pool.deques);
+  for (int i = 0; i < nthreads; i++) {
+    FsPoolDeque *deque = &pool.deques[i];
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->capacity = FS_POOL_DEQUE_CAPACITY;
+    deque->items = malloc(sizeof(FsPoolItem) * deque->capacity);
+    assert(deque->items);
+    deque->head = deque->tail = 0;
+  }
+  atomic_init(&pool.pending, 0);
+  atomic_init(&pool.queued, 0);
+  atomic_init(&pool.idle, 0);
+  pthread_mutex_init(&pool.idleLock, NULL);
+  pthread_cond_init(&pool.idleCond, NULL);
+  FsPoolSpawn(&pool, 0, task, arg);
+  pthread_t tids[FS_POOL_MAX_THREADS];
+  FsPoolWorker workers[FS_POOL_MAX_THREADS];
+  for (int i = 0; i < nthreads; i++)
+    workers[i] = (FsPoolWorker){&pool, i};
+  for (int i = 1; i < nthreads; i++)
+    pthread_create(&tids[i], NULL, FsPoolWorkerMain, &workers[i]);
+  FsPoolWorkerMain(&workers[0]);
+  for (int i = 1; i < nthreads; i++)
+    pthread_join(tids[i], NULL);
+  for (int i = 0; i < nthreads; i++) {
+    pthread_mutex_destroy(&pool.deques[i].lock);
+    free(pool.deques[i].items);
+  }
+  free(pool.deques);
+  pthread_cond_destroy(&pool.idleCond);
+  pthread_mutex_destroy(&pool.idleLock);
+}
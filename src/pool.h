@@ -0,0 +1,27 @@
+// 带任务窃取（work stealing）的线程池
+//
+// 每个工作线程有自己的双端队列：自己从尾部存取任务（后进先出，
+// 保持局部性），空闲时从其他线程队列的头部窃取。任务可以继续派生子任务，
+// 所有任务完成后 FsPoolRun 返回。
+
+#ifndef POOL_H
+#define POOL_H
+
+// 线程池最大线程数
+#define FS_POOL_MAX_THREADS 32
+
+typedef struct FsPool_t FsPool;
+
+/// 任务函数
+/// \param pool 所在线程池，用于派生子任务
+/// \param worker 执行任务的线程编号，0 为调用 FsPoolRun 的线程
+/// \param arg
+typedef void (*FsPoolTask)(FsPool *pool, int worker, void *arg);
+
+int FsPoolThreads(void);
+
+void FsPoolRun(int nthreads, FsPoolTask task, void *arg);
+
+void FsPoolSpawn(FsPool *pool, int worker, FsPoolTask task, void *arg);
+
+#endif
@@ -0,0 +1,673 @@
+// 通过 Unix 域套接字共享文件系统的服务端，协议见 serve.h
+//
+// 每个事件循环线程有自己的 epoll，监听套接字以 EPOLLEXCLUSIVE 注册到所有
+// 循环中，新连接只唤醒其中一个循环，之后一直由它处理。连接是非阻塞的：
+// 每次可读时读取一次，执行缓冲区中所有完整的请求，响应追加到发送缓冲区
+// 后尽量写出，写不完时等待可写。发送缓冲区积压过多时暂停读取这个连接，
+// 直到客户端取走响应。
+// 请求通过静默接口执行。线程的工作目录由同一个循环的所有连接共用，
+// 因此每个连接只记录自己工作目录的绝对路径，相对路径在执行之前拼接成
+// 绝对路径；与 FsDir 相同，连接不持有文件夹。
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "utility.h"
+#include "pool.h"
+#include "serve.h"
+
+// 事件循环的最大线程数
+#define FS_SERVE_MAX_LOOPS 64
+// 每次读取的最小空间
+#define FS_SERVE_READ (64 * 1024)
+// 发送缓冲区超过这个字节数时暂停读取
+#define FS_SERVE_OUT_HIGH (4u << 20)
+// 每次 epoll_wait 最多取出的事件数
+#define FS_SERVE_EVENTS 64
+
+// 连接的收发缓冲区，[start, end) 是有效的字节
+typedef struct {
+  char *data;
+  size_t start;
+  size_t end;
+  size_t capacity;
+} FsServeBuf;
+
+typedef struct FsServeConn_t {
+  int fd;
+  FsServeBuf in;
+  FsServeBuf out;
+  // 工作目录的绝对路径
+  char *cwd;
+  // 注册到 epoll 的事件
+  uint32_t events;
+  // 客户端已经关闭写端，发完响应后关闭连接
+  bool eof;
+  // 同一个循环的所有连接组成链表，停止时统一关闭
+  struct FsServeConn_t *prev;
+  struct FsServeConn_t *next;
+} FsServeConn;
+
+typedef struct {
+  struct FsServer_t *server;
+  int epfd;
+  pthread_t thread;
+  FsServeConn *conns;
+  // 当前请求的参数，argv 以 NULL 结尾
+  const char **argv;
+  size_t *lengths;
+  size_t argvCapacity;
+  // 拼接好的绝对路径
+  char *paths;
+  size_t pathsCapacity;
+} FsServeLoop;
+
+struct FsServer_t {
+  Fs fs;
+  int listenFd;
+  // 已经创建了套接字文件，释放时删除
+  bool bound;
+  // 写入后所有循环退出
+  int stopFd;
+  char *sockPath;
+  int nloops;
+  FsServeLoop loops[FS_SERVE_MAX_LOOPS];
+};
+
+/// 保证缓冲区末尾至少还有 length 字节的空间，必要时先把有效的字节移到开头
+/// \param buf
+/// \param length
+static void FsServeReserve(FsServeBuf *buf, size_t length) {
+  if (buf->start && buf->end + length > buf->capacity) {
+    memmove(buf->data, buf->data + buf->start, buf->end - buf->start);
+    buf->end -= buf->start;
+    buf->start = 0;
+  }
+  if (buf->end + length > buf->capacity) {
+    buf->capacity = (buf->end + length) * 2;
+    buf->data = realloc(buf->data, buf->capacity);
+    assert(buf->data);
+  }
+}
+
+/// 把 length 字节追加到缓冲区
+/// \param buf
+/// \param data
+/// \param length
+static void FsServeAppend(FsServeBuf *buf, const void *data, size_t length) {
+  FsServeReserve(buf, length);
+  memcpy(buf->data + buf->end, data, length);
+  buf->end += length;
+}
+
+/// 追加 FS_SERVE_LS、FS_SERVE_TREE 结果中的一项
+/// \param buf
+/// \param type
+/// \param depth
+/// \param name
+/// \param length 名字的字节数
+static void FsServeEntry(FsServeBuf *buf, FileType type, uint32_t depth,
+                         const char *name, size_t length) {
+  uint8_t typeByte = type;
+  FsServeReserve(buf, 5 + length + 1);
+  FsServeAppend(buf, &typeByte, 1);
+  FsServeAppend(buf, &depth, 4);
+  FsServeAppend(buf, name, length);
+  FsServeAppend(buf, "", 1);
+}
+
+// FsServeLsVisit、FsServeTreeVisit 的参数
+typedef struct {
+  FsServeBuf *out;
+  // 传给静默接口的路径
+  const char *pathStr;
+  // 客户端传来的路径，作为结果中的名字
+  const char *name;
+  size_t length;
+} FsServeList;
+
+static void FsServeLsVisit(FIL *file, const char *name, void *ctx) {
+  FsServeList *list = ctx;
+  // 列出一个文件时名字为路径参数本身
+  if (name == list->pathStr)
+    FsServeEntry(list->out, file->type, 0, list->name, list->length);
+  else
+    FsServeEntry(list->out, file->type, 0, name, strlen(name));
+}
+
+static FsWalkAction FsServeTreeVisit(const FsWalkEntry *entry, void *ctx) {
+  FsServeList *list = ctx;
+  if (entry->depth == 0) {
+    FsServeEntry(list->out, entry->file->type, 0, list->name, list->length);
+  } else {
+    const char *name = strrchr(entry->path, FS_SPLIT) + 1;
+    FsServeEntry(list->out, entry->file->type, entry->depth, name,
+                 strlen(name));
+  }
+  return FS_WALK_CONTINUE;
+}
+
+static void FsServeCatVisit(const char *data, size_t length, void *ctx) {
+  FsServeAppend(ctx, data, length);
+}
+
+/// 把前 n 个参数拼接成以 '\0' 结尾的绝对路径，替换 loop->argv 中的参数
+/// \param loop
+/// \param conn
+/// \param n
+/// \return 有空路径时返回 FS_NO_SUCH_FILE，路径中含有 '\0' 时返回 FS_ERROR
+static FsErrors FsServeJoin(FsServeLoop *loop, FsServeConn *conn, size_t n) {
+  size_t cwdLength = strlen(conn->cwd);
+  size_t total = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!loop->lengths[i])
+      return FS_NO_SUCH_FILE;
+    if (memchr(loop->argv[i], '\0', loop->lengths[i]))
+      return FS_ERROR;
+    total += cwdLength + 1 + loop->lengths[i] + 1;
+  }
+  if (total > loop->pathsCapacity) {
+    loop->pathsCapacity = total * 2;
+    loop->paths = realloc(loop->paths, loop->pathsCapacity);
+    assert(loop->paths);
+  }
+  char *p = loop->paths;
+  for (size_t i = 0; i < n; i++) {
+    const char *arg = loop->argv[i];
+    size_t length = loop->lengths[i];
+    loop->argv[i] = p;
+    if (*arg != FS_SPLIT) {
+      memcpy(p, conn->cwd, cwdLength);
+      p += cwdLength;
+      // 根目录本身以 '/' 结尾
+      if (cwdLength > 1)
+        *p++ = FS_SPLIT;
+    }
+    memcpy(p, arg, length);
+    p += length;
+    *p++ = '\0';
+  }
+  return FS_OK;
+}
+
+/// 解析工作目录，与 FsOpendir 相同，不修改线程的工作目录
+/// \param fs
+/// \param conn
+/// \param pathStr 绝对路径
+/// \return
+static FsErrors FsServeCd(Fs fs, FsServeConn *conn, const char *pathStr) {
+  PATH *path = NULL;
+  char *pathAbs = NULL;
+  FsEpochEnter();
+  FsErrors res = FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path);
+  if (res == FS_OK && FsPathGetTail(path)->file->type != DIRECTORY)
+    res = FS_NOT_A_DIRECTORY;
+  if (res == FS_OK)
+    pathAbs = FsPathGetStr(path);
+  FsEpochExit();
+  FsPathFree(path);
+  if (res == FS_OK) {
+    free(conn->cwd);
+    conn->cwd = pathAbs;
+  }
+  return res;
+}
+
+// 每个操作的参数个数范围，下标为 FsServeOp
+static const struct {
+  uint16_t min;
+  uint16_t max;
+} fsServeArgc[] = {
+    [FS_SERVE_MKDIR] = {1, 1}, [FS_SERVE_MKFILE] = {1, 1},
+    [FS_SERVE_CD] = {0, 1},    [FS_SERVE_LS] = {0, 1},
+    [FS_SERVE_PWD] = {0, 0},   [FS_SERVE_TREE] = {0, 1},
+    [FS_SERVE_PUT] = {2, 2},   [FS_SERVE_CAT] = {1, 1},
+    [FS_SERVE_DLDIR] = {1, 1}, [FS_SERVE_DL] = {1, 1},
+    [FS_SERVE_CP] = {2, UINT16_MAX}, [FS_SERVE_MV] = {2, UINT16_MAX},
+};
+
+/// 执行一个请求，结果追加到 conn->out。参数在 loop->argv 中
+/// \param loop
+/// \param conn
+/// \param op
+/// \param flags
+/// \param argc
+/// \return 操作的结果，参数不符合操作时返回 FS_ERROR
+static FsErrors FsServeExecute(FsServeLoop *loop, FsServeConn *conn,
+                               uint8_t op, uint8_t flags, size_t argc) {
+  Fs fs = loop->server->fs;
+  const char **argv = loop->argv;
+  if (op < FS_SERVE_MKDIR || op > FS_SERVE_MV || argc < fsServeArgc[op].min ||
+      argc > fsServeArgc[op].max)
+    return FS_ERROR;
+  // 没有参数和参数为空时的路径
+  const char *empty = op == FS_SERVE_LS ? conn->cwd : FS_SPLIT_STR;
+  FsServeList list = {&conn->out, empty, empty, strlen(empty)};
+  if (argc == 1 && loop->lengths[0]) {
+    list.name = argv[0];
+    list.length = loop->lengths[0];
+  }
+  // 除了 PUT 的内容，参数都是路径。CD、LS、TREE 的参数可以省略，
+  // 为空时与没有参数相同，使用上面的 empty
+  size_t npaths = op == FS_SERVE_PUT ? 1 : argc;
+  bool optional = fsServeArgc[op].min == 0 && fsServeArgc[op].max == 1;
+  if (optional && argc == 1 && !loop->lengths[0])
+    npaths = 0;
+  FsErrors res = FsServeJoin(loop, conn, npaths);
+  if (res)
+    return res;
+  if (npaths == 1 && optional)
+    list.pathStr = argv[0];
+  bool recursive = flags & FS_SERVE_RECURSIVE;
+  switch (op) {
+  case FS_SERVE_MKDIR:
+    return FsMkdirQuiet(fs, argv[0], NULL);
+  case FS_SERVE_MKFILE:
+    return FsMkfileQuiet(fs, argv[0], NULL);
+  case FS_SERVE_CD:
+    res = FsServeCd(fs, conn, list.pathStr);
+    FsServeAppend(&conn->out, conn->cwd, strlen(conn->cwd));
+    return res;
+  case FS_SERVE_LS:
+    return FsLsQuiet(fs, list.pathStr, FsServeLsVisit, &list, NULL);
+  case FS_SERVE_PWD:
+    FsServeAppend(&conn->out, conn->cwd, strlen(conn->cwd));
+    return FS_OK;
+  case FS_SERVE_TREE:
+    return FsTreeQuiet(fs, list.pathStr, FsServeTreeVisit, &list, NULL);
+  case FS_SERVE_PUT:
+    return FsPutQuiet(fs, argv[0], argv[1], loop->lengths[1], NULL);
+  case FS_SERVE_CAT:
+    return FsCatQuiet(fs, argv[0], FsServeCatVisit, &conn->out, NULL);
+  case FS_SERVE_DLDIR:
+    return FsDldirQuiet(fs, argv[0], NULL);
+  case FS_SERVE_DL:
+    return FsDlQuiet(fs, recursive, argv[0], NULL);
+  case FS_SERVE_CP:
+  case FS_SERVE_MV: {
+    size_t n = argc - 1;
+    FsErrors results[n];
+    FsErrorInfo info = {NULL, false, results};
+    const char *dest = argv[n];
+    argv[n] = NULL;
+    res = op == FS_SERVE_CP
+              ? FsCpQuiet(fs, recursive, (char **)argv, dest, &info)
+              : FsMvQuiet(fs, (char **)argv, dest, &info);
+    FsServeReserve(&conn->out, n);
+    for (size_t i = 0; i < n; i++)
+      conn->out.data[conn->out.end++] = results[i];
+    return res;
+  }
+  default:
+    return FS_ERROR;
+  }
+}
+
+/// 解析并执行一个请求，追加它的响应
+/// \param loop
+/// \param conn
+/// \param frame 请求中长度之后的部分
+/// \param length
+/// \return 请求格式错误时返回 false
+static bool FsServeRequest(FsServeLoop *loop, FsServeConn *conn,
+                           const char *frame, uint32_t length) {
+  uint32_t id;
+  uint16_t argc;
+  memcpy(&id, frame, 4);
+  uint8_t op = frame[4];
+  uint8_t flags = frame[5];
+  memcpy(&argc, frame + 6, 2);
+  if (argc + 1 > loop->argvCapacity) {
+    loop->argvCapacity = (argc + 1) * 2;
+    loop->argv = realloc(loop->argv, sizeof(char *) * loop->argvCapacity);
+    loop->lengths =
+        realloc(loop->lengths, sizeof(size_t) * loop->argvCapacity);
+    assert(loop->argv && loop->lengths);
+  }
+  const char *p = frame + FS_SERVE_REQUEST_HEAD;
+  const char *end = frame + length;
+  for (uint16_t i = 0; i < argc; i++) {
+    uint32_t argLength;
+    if (end - p < 4)
+      return false;
+    memcpy(&argLength, p, 4);
+    p += 4;
+    if ((size_t)(end - p) < argLength)
+      return false;
+    loop->argv[i] = p;
+    loop->lengths[i] = argLength;
+    p += argLength;
+  }
+  if (p != end)
+    return false;
+  loop->argv[argc] = NULL;
+  // 先留出响应的头部，结果的长度确定之后再填写。追加结果时有效的字节
+  // 可能被移到开头，头部的位置相对于 start 记录
+  FsServeReserve(&conn->out, 4 + FS_SERVE_REPLY_HEAD);
+  size_t head = conn->out.end - conn->out.start;
+  conn->out.end += 4 + FS_SERVE_REPLY_HEAD;
+  uint8_t status = FsServeExecute(loop, conn, op, flags, argc);
+  char *reply = conn->out.data + conn->out.start + head;
+  uint32_t replyLength = conn->out.data + conn->out.end - reply - 4;
+  memcpy(reply, &replyLength, 4);
+  memcpy(reply + 4, &id, 4);
+  reply[8] = status;
+  return true;
+}
+
+/// 执行接收缓冲区中所有完整的请求，发送缓冲区积压过多时暂停
+/// \param loop
+/// \param conn
+/// \return 请求格式错误或者过大时返回 false
+static bool FsServeProcess(FsServeLoop *loop, FsServeConn *conn) {
+  FsServeBuf *in = &conn->in;
+  while (conn->out.end - conn->out.start < FS_SERVE_OUT_HIGH) {
+    size_t available = in->end - in->start;
+    if (available < 4)
+      break;
+    uint32_t length;
+    memcpy(&length, in->data + in->start, 4);
+    if (length < FS_SERVE_REQUEST_HEAD || length > FS_SERVE_MAX_FRAME)
+      return false;
+    if (available < 4 + (size_t)length) {
+      // 为这个请求的剩余部分留出空间
+      FsServeReserve(in, 4 + (size_t)length - available);
+      break;
+    }
+    if (!FsServeRequest(loop, conn, in->data + in->start + 4, length))
+      return false;
+    in->start += 4 + (size_t)length;
+  }
+  if (in->start == in->end)
+    in->start = in->end = 0;
+  return true;
+}
+
+/// 尽量写出发送缓冲区
+/// \param conn
+/// \return 连接出错时返回 false
+static bool FsServeFlush(FsServeConn *conn) {
+  FsServeBuf *out = &conn->out;
+  while (out->start < out->end) {
+    ssize_t n = send(conn->fd, out->data + out->start, out->end - out->start,
+                     MSG_NOSIGNAL);
+    if (n > 0) {
+      out->start += n;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else {
+      return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+  }
+  out->start = out->end = 0;
+  return true;
+}
+
+/// 关闭连接并从循环中摘除
+/// \param loop
+/// \param conn
+static void FsServeClose(FsServeLoop *loop, FsServeConn *conn) {
+  if (conn->prev)
+    conn->prev->next = conn->next;
+  else
+    loop->conns = conn->next;
+  if (conn->next)
+    conn->next->prev = conn->prev;
+  // 关闭后自动从 epoll 中删除
+  close(conn->fd);
+  free(conn->in.data);
+  free(conn->out.data);
+  free(conn->cwd);
+  free(conn);
+}
+
+/// 处理连接上的事件
+/// \param loop
+/// \param conn
+/// \param events
+static void FsServeEvent(FsServeLoop *loop, FsServeConn *conn,
+                         uint32_t events) {
+  if (events & EPOLLERR) {
+    FsServeClose(loop, conn);
+    return;
+  }
+  bool ok = FsServeFlush(conn);
+  if (ok && !conn->eof && (events & (EPOLLIN | EPOLLHUP)) &&
+      conn->out.end - conn->out.start < FS_SERVE_OUT_HIGH) {
+    FsServeReserve(&conn->in, FS_SERVE_READ);
+    ssize_t n = recv(conn->fd, conn->in.data + conn->in.end,
+                     conn->in.capacity - conn->in.end, 0);
+    if (n > 0)
+      conn->in.end += n;
+    else if (n == 0)
+      conn->eof = true;
+    else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      ok = false;
+  }
+  // 暂停读取之后缓冲区中可能还有完整的请求，每次都检查
+  ok = ok && FsServeProcess(loop, conn) && FsServeFlush(conn);
+  bool pending = conn->out.start < conn->out.end;
+  if (!ok || (conn->eof && !pending)) {
+    FsServeClose(loop, conn);
+    return;
+  }
+  uint32_t want = pending ? EPOLLOUT : 0;
+  if (!conn->eof && conn->out.end - conn->out.start < FS_SERVE_OUT_HIGH)
+    want |= EPOLLIN;
+  if (want != conn->events) {
+    struct epoll_event event = {want, {.ptr = conn}};
+    epoll_ctl(loop->epfd, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->events = want;
+  }
+}
+
+/// 接受所有等待中的连接，加入这个循环
+/// \param loop
+static void FsServeAccept(FsServeLoop *loop) {
+  for (;;) {
+    int fd = accept4(loop->server->listenFd, NULL, NULL,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+      return;
+    FsServeConn *conn = malloc(sizeof(FsServeConn));
+    assert(conn);
+    memset(conn, 0, sizeof(FsServeConn));
+    conn->fd = fd;
+    conn->cwd = strdup(FS_SPLIT_STR);
+    conn->events = EPOLLIN;
+    struct epoll_event event = {EPOLLIN, {.ptr = conn}};
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+      close(fd);
+      free(conn->cwd);
+      free(conn);
+      continue;
+    }
+    conn->next = loop->conns;
+    if (loop->conns)
+      loop->conns->prev = conn;
+    loop->conns = conn;
+  }
+}
+
+/// 事件循环线程
+/// \param arg 所属的 FsServeLoop
+/// \return
+static void *FsServeRun(void *arg) {
+  FsServeLoop *loop = arg;
+  FsServer *server = loop->server;
+  struct epoll_event events[FS_SERVE_EVENTS];
+  bool running = true;
+  while (running) {
+    int n = epoll_wait(loop->epfd, events, FS_SERVE_EVENTS, -1);
+    if (n < 0 && errno != EINTR)
+      break;
+    for (int i = 0; i < n; i++) {
+      void *ptr = events[i].data.ptr;
+      if (ptr == &server->stopFd)
+        running = false;
+      else if (ptr == &server->listenFd)
+        FsServeAccept(loop);
+      else
+        FsServeEvent(loop, ptr, events[i].events);
+    }
+  }
+  while (loop->conns)
+    FsServeClose(loop, loop->conns);
+  return NULL;
+}
+
+/// 释放服务端，只关闭已经创建的部分
+/// \param server
+static void FsServerRelease(FsServer *server) {
+  for (int i = 0; i < server->nloops; i++) {
+    FsServeLoop *loop = &server->loops[i];
+    close(loop->epfd);
+    free(loop->argv);
+    free(loop->lengths);
+    free(loop->paths);
+  }
+  if (server->listenFd >= 0)
+    close(server->listenFd);
+  if (server->bound)
+    unlink(server->sockPath);
+  if (server->stopFd >= 0)
+    close(server->stopFd);
+  free(server->sockPath);
+  free(server);
+}
+
+/// 在 sockPath 上监听，启动 nthreads 个事件循环线程处理 serve.h 中的请求，
+/// 直到 FsServerStop。fs 可以是快照，修改操作返回 FS_READ_ONLY
+/// \param fs
+/// \param sockPath Unix 域套接字的路径，不能已经存在
+/// \param nthreads 为 0 时使用 FsPoolThreads
+/// \param server 成功时为新的服务端
+/// \return sockPath 已经存在时返回 FS_FILE_EXISTS，其他失败返回
+/// FS_ERROR，errno 为失败的原因
+FsErrors FsServerStart(Fs fs, const char *sockPath, int nthreads,
+                       FsServer **server) {
+  struct sockaddr_un addr;
+  if (!fs || !sockPath || !server)
+    return FS_ERROR;
+  *server = NULL;
+  if (strlen(sockPath) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return FS_ERROR;
+  }
+  if (nthreads <= 0)
+    nthreads = FsPoolThreads();
+  if (nthreads > FS_SERVE_MAX_LOOPS)
+    nthreads = FS_SERVE_MAX_LOOPS;
+  FsServer *s = malloc(sizeof(FsServer));
+  assert(s);
+  memset(s, 0, sizeof(FsServer));
+  s->fs = fs;
+  s->sockPath = strdup(sockPath);
+  s->stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  s->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (s->stopFd < 0 || s->listenFd < 0) {
+    int err = errno;
+    FsServerRelease(s);
+    errno = err;
+    return FS_ERROR;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, sockPath);
+  if (bind(s->listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    int err = errno;
+    FsServerRelease(s);
+    errno = err;
+    return err == EADDRINUSE ? FS_FILE_EXISTS : FS_ERROR;
+  }
+  s->bound = true;
+  bool ok = listen(s->listenFd, SOMAXCONN) == 0;
+  for (int i = 0; ok && i < nthreads; i++) {
+    FsServeLoop *loop = &s->loops[i];
+    loop->server = s;
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0)
+      break;
+    s->nloops++;
+    struct epoll_event listenEvent = {EPOLLIN | EPOLLEXCLUSIVE,
+                                      {.ptr = &s->listenFd}};
+    struct epoll_event stopEvent = {EPOLLIN, {.ptr = &s->stopFd}};
+    ok = epoll_ctl(loop->epfd, EPOLL_CTL_ADD, s->listenFd, &listenEvent) ==
+             0 &&
+         epoll_ctl(loop->epfd, EPOLL_CTL_ADD, s->stopFd, &stopEvent) == 0;
+  }
+  if (!ok || s->nloops < nthreads) {
+    int err = errno;
+    FsServerRelease(s);
+    errno = err;
+    return FS_ERROR;
+  }
+  for (int i = 0; i < s->nloops; i++)
+    pthread_create(&s->loops[i].thread, NULL, FsServeRun, &s->loops[i]);
+  *server = s;
+  return FS_OK;
+}
+
+/// 停止所有事件循环，关闭所有连接并删除套接字文件。
+/// 之后才能释放服务端使用的文件系统
+/// \param server 可以为 NULL
+void FsServerStop(FsServer *server) {
+  if (!server)
+    return;
+  // eventfd 一直可读，所有循环都会被唤醒
+  uint64_t one = 1;
+  ssize_t n = write(server->stopFd, &one, sizeof(one));
+  (void)n;
+  for (int i = 0; i < server->nloops; i++)
+    pthread_join(server->loops[i].thread, NULL);
+  FsServerRelease(server);
+}
+
+/// 对应 fs --serve SOCK [THREADS]：在 SOCK 上提供服务，
+/// 直到收到 SIGINT 或 SIGTERM
+/// \param fs
+/// \param sockPath
+/// \param nthreads 为 0 时使用 FsPoolThreads
+/// \return 进程的退出码
+int FsServe(Fs fs, const char *sockPath, int nthreads) {
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  // 先屏蔽信号，之后创建的线程继承，信号只由 sigwait 接收
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  FsServer *server;
+  FsErrors res = FsServerStart(fs, sockPath, nthreads, &server);
+  if (res) {
+    if (res == FS_FILE_EXISTS) {
+      PERRORD(res, "serve: '%s'", sockPath);
+    } else {
+      printf("serve: '%s': %s\n", sockPath, strerror(errno));
+    }
+    return 1;
+  }
+  printf("serving on %s with %d threads\n", sockPath, server->nloops);
+  fflush(stdout);
+  int sig;
+  sigwait(&signals, &sig);
+  FsServerStop(server);
+  return 0;
+}
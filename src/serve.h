@@ -0,0 +1,117 @@
+// 通过 Unix 域套接字共享文件系统：请求/响应协议和客户端
+//
+// 服务端见 serve.c 的 FsServerStart，客户端见 client.c。
+// 同一台机器上的进程之间通信，整数使用本机字节序。
+// 请求：u32 长度（之后的字节数）、u32 编号、u8 操作、u8 标志、u16 参数个数，
+// 之后每个参数为 u32 字节数和参数本身，不以 '\0' 结尾。
+// 响应：u32 长度、u32 编号、u8 状态（FsErrors），之后是操作的结果。
+// 一个连接上可以连续发送多个请求而不等待响应（流水线），
+// 响应按请求的顺序返回。
+// 需在 utility.h 之后包含。
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// 请求、响应的固定部分的字节数，不含开头的长度
+#define FS_SERVE_REQUEST_HEAD 8
+#define FS_SERVE_REPLY_HEAD 5
+// 一个请求的最大字节数，超过时服务端关闭连接
+#define FS_SERVE_MAX_FRAME (64u << 20)
+
+// 请求的操作，对应 Fs.h 中的操作。参数都是路径，相对路径相对于
+// 连接自己的工作目录，每个连接的工作目录互不影响，初始为根目录。
+// 空路径返回 FS_NO_SUCH_FILE，含有 '\0' 的路径和个数不对的参数返回
+// FS_ERROR；可以省略的 [路径] 为空时与省略相同
+typedef enum {
+  // 参数：路径
+  FS_SERVE_MKDIR = 1,
+  FS_SERVE_MKFILE,
+  // 参数：[路径]，没有参数时回到根目录；结果：新的工作目录
+  FS_SERVE_CD,
+  // 参数：[路径]，没有参数时是工作目录；结果：每项为 u8 类型（FileType）、
+  // u32 深度（总为 0）和以 '\0' 结尾的文件名
+  FS_SERVE_LS,
+  // 结果：工作目录
+  FS_SERVE_PWD,
+  // 参数：[路径]，没有参数时是根目录；结果的格式与 FS_SERVE_LS 相同，
+  // 起点的深度为 0，名字为路径参数本身
+  FS_SERVE_TREE,
+  // 参数：路径、内容
+  FS_SERVE_PUT,
+  // 参数：路径；结果：文件内容
+  FS_SERVE_CAT,
+  // 参数：路径
+  FS_SERVE_DLDIR,
+  // 参数：路径，FS_SERVE_RECURSIVE 时删除整个文件夹
+  FS_SERVE_DL,
+  // 参数：源路径...、目标路径；结果：每个源路径一个 u8 状态
+  FS_SERVE_CP,
+  FS_SERVE_MV
+} FsServeOp;
+
+// 请求的标志
+#define FS_SERVE_RECURSIVE 1
+
+// 客户端的一个连接，不能同时在多个线程中使用
+typedef struct FsClient_t FsClient;
+
+// 收到的响应
+typedef struct {
+  uint32_t id;
+  FsErrors status;
+  // 操作的结果，在下一次 FsClientRecv 之前有效
+  const char *data;
+  size_t length;
+} FsReply;
+
+// FsClientLs、FsClientTree 对每一项调用一次
+typedef void (*FsClientEntryCallback)(FileType type, uint32_t depth,
+                                      const char *name, void *ctx);
+
+FsClient *FsClientConnect(const char *sockPath);
+
+void FsClientClose(FsClient *client);
+
+FsErrors FsClientSend(FsClient *client, FsServeOp op, uint8_t flags,
+                      const char *argv[], const size_t lengths[],
+                      uint16_t argc, uint32_t *id);
+
+FsErrors FsClientFlush(FsClient *client);
+
+FsErrors FsClientRecv(FsClient *client, FsReply *reply);
+
+FsErrors FsClientMkdir(FsClient *client, const char *pathStr);
+
+FsErrors FsClientMkfile(FsClient *client, const char *pathStr);
+
+FsErrors FsClientCd(FsClient *client, const char *pathStr);
+
+FsErrors FsClientLs(FsClient *client, const char *pathStr,
+                    FsClientEntryCallback callback, void *ctx);
+
+char *FsClientPwd(FsClient *client);
+
+FsErrors FsClientTree(FsClient *client, const char *pathStr,
+                      FsClientEntryCallback callback, void *ctx);
+
+FsErrors FsClientPut(FsClient *client, const char *pathStr,
+                     const char *content, size_t length);
+
+FsErrors FsClientCat(FsClient *client, const char *pathStr,
+                     FsDataCallback callback, void *ctx);
+
+FsErrors FsClientDldir(FsClient *client, const char *pathStr);
+
+FsErrors FsClientDl(FsClient *client, bool recursive, const char *pathStr);
+
+FsErrors FsClientCp(FsClient *client, bool recursive, const char *src[],
+                    const char *dest, FsErrors *results);
+
+FsErrors FsClientMv(FsClient *client, const char *src[], const char *dest,
+                    FsErrors *results);
+
+#endif
@@ -0,0 +1,281 @@
+// 快照
+//
+// FsSnapshot 在 O(1) 的时间内得到整棵树某一时刻的只读视图。快照与当前的
+// 文件系统共享所有节点：写者在快照之后第一次修改一个节点之前，把它的子文件
+// 列表或内容保存为旧版本（FsVersion），额外的内存只与修改过的节点有关。
+// 节点有上层指针、打开的句柄和各自的锁，不能像持久化的树那样复制整条路径，
+// 旧版本直接挂在节点上，读者按线程的视图取得快照时刻的版本，见
+// FsFilChildren、FsFilContent。视图在 FsCwdGet 时切换。
+// 有快照时删除的文件树和改名之前的名字保留到所有快照释放之后。
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "utility.h"
+
+// 所有快照释放之后才能释放的内存
+typedef struct FsSnapGarbage_t {
+  void *ptr;
+  void (*freeFn)(void *);
+  struct FsSnapGarbage_t *next;
+} FsSnapGarbage;
+
+// 当前线程读取的快照编号，0 表示当前的文件系统
+static __thread uint64_t fsView;
+
+/// 切换当前线程的视图
+/// \param view 快照编号，0 表示当前的文件系统
+void FsViewSet(uint64_t view) { fsView = view; }
+
+/// 当前线程的视图
+/// \return 快照编号，0 表示当前的文件系统
+uint64_t FsViewGet(void) { return fsView; }
+
+/// 当前线程的视图中 file 的旧版本：编号不小于视图的版本中最旧的一个。
+/// 调用者需处于 epoch 临界区或持有整棵树的锁
+/// \param file
+/// \return 读取当前的文件系统或者快照之后没有修改过时返回 NULL
+FsVersion *FsVersionGet(FIL *file) {
+  if (!fsView)
+    return NULL;
+  FsVersion *found = NULL;
+  for (FsVersion *v = FS_LOAD(file->versions); v && v->gen >= fsView;
+       v = v->next)
+    found = v;
+  return found;
+}
+
+/// 当前线程的视图中文件夹的子文件列表，读者用它代替 FS_LOAD(dir->children)
+/// \param dir
+/// \return
+FIL_LIST *FsFilChildren(FIL *dir) {
+  // 写者先保存旧版本再发布新列表，读到新列表时一定能找到旧版本
+  FIL_LIST *children = FS_LOAD(dir->children);
+  FsVersion *version = FsVersionGet(dir);
+  return version ? version->children : children;
+}
+
+/// 修改 file 之前是否需要保存旧版本：有快照能看到它，
+/// 并且最新的快照之后还没有保存过。调用者需持有整棵树的锁和文件的写锁
+/// \param file
+/// \return
+bool FsSnapNeeded(FIL *file) {
+  Fs fs = file->fs;
+  if (!fs || !fs->snapLatest)
+    return false;
+  return file->born < fs->snapLatest && file->saved < fs->snapLatest;
+}
+
+/// 为快照保存 file 修改之前的版本，在修改之前调用。
+/// 文件的旧版本持有文件的一个引用，文件被删除后仍然可以释放旧版本。
+/// 调用者需先用 FsSnapNeeded 判断
+/// \param file
+/// \param children 文件夹的子文件列表，之后由快照释放
+/// \param content 文件的内容，之后由快照释放
+/// \param length 内容的字节数
+void FsSnapSave(FIL *file, FIL_LIST *children, FIL_CONTENT *content,
+                size_t length) {
+  Fs fs = file->fs;
+  FsVersion *version = malloc(sizeof(FsVersion));
+  assert(version);
+  version->gen = fs->snapLatest;
+  version->children = children;
+  version->content = content;
+  version->length = length;
+  version->next = file->versions;
+  version->file = file;
+  if (file->type == REGULAR_FILE)
+    __atomic_add_fetch(&file->refs, 1, __ATOMIC_RELAXED);
+  file->saved = version->gen;
+  pthread_mutex_lock(&fs->snapLock);
+  version->all = fs->versions;
+  fs->versions = version;
+  pthread_mutex_unlock(&fs->snapLock);
+  FS_STORE(file->versions, version);
+}
+
+/// 与 FsEpochRetire 相同，但 file 所在的文件系统有快照时保留到所有快照
+/// 释放之后，快照可能仍然能访问 ptr。调用者需持有整棵树的锁
+/// \param file ptr 所属的文件
+/// \param ptr
+/// \param freeFn
+void FsSnapRetire(FIL *file, void *ptr, void (*freeFn)(void *)) {
+  Fs fs = file->fs;
+  if (!fs || !fs->snapLatest) {
+    FsEpochRetire(ptr, freeFn);
+    return;
+  }
+  FsSnapGarbage *garbage = malloc(sizeof(FsSnapGarbage));
+  assert(garbage);
+  garbage->ptr = ptr;
+  garbage->freeFn = freeFn;
+  pthread_mutex_lock(&fs->snapLock);
+  garbage->next = fs->garbage;
+  fs->garbage = garbage;
+  pthread_mutex_unlock(&fs->snapLock);
+}
+
+/// 释放旧版本，作为 FsEpochRetire 的回调
+/// \param version
+static void FsVersionFree(void *version) {
+  FsVersion *v = version;
+  // 文件夹的旧版本总有子文件列表，文件夹此时可能已经释放
+  if (!v->children)
+    FsFilRelease(v->file);
+  free(v->children);
+  FsContentFree(v->content);
+  free(v);
+}
+
+/// 创建 fs 当前时刻的只读快照，与 fs 共享所有节点，时间复杂度 O(1)。
+/// 快照也是一个 Fs，可以 cd、ls、cat、tree、find、grep，或者以只读方式
+/// 打开文件；修改操作返回 FS_READ_ONLY。
+/// 用 FsFree 释放，fs 释放时一起释放
+/// \param fs 不能是快照
+/// \return fs 是快照时返回 NULL
+Fs FsSnapshot(Fs fs) {
+  if (!fs || fs->live)
+    return NULL;
+  Fs snapshot = malloc(sizeof(struct FsRep));
+  assert(snapshot);
+  memset(snapshot, 0, sizeof(struct FsRep));
+  FsInitRep(snapshot);
+  snapshot->root = fs->root;
+  snapshot->live = fs;
+  // 等待正在进行的修改完成，之后的修改都会先保存旧版本
+  FsTreeWrlock(fs);
+  snapshot->snapshot = ++fs->snapClock;
+  fs->snapLatest = snapshot->snapshot;
+  pthread_mutex_lock(&fs->snapLock);
+  snapshot->snapNext = fs->snapshots;
+  fs->snapshots = snapshot;
+  pthread_mutex_unlock(&fs->snapLock);
+  FsTreeUnlock(fs);
+  return snapshot;
+}
+
+/// 从所属的文件系统中摘除快照。最后一个快照摘除时释放所有旧版本和
+/// 保留的内存。只由 FsFree 调用，此时不应再有其他线程读取这个快照
+/// \param snapshot
+void FsSnapshotDrop(Fs snapshot) {
+  Fs fs = snapshot->live;
+  FsTreeWrlock(fs);
+  pthread_mutex_lock(&fs->snapLock);
+  for (Fs *p = &fs->snapshots; *p; p = &(*p)->snapNext) {
+    if (*p == snapshot) {
+      *p = snapshot->snapNext;
+      break;
+    }
+  }
+  // 链表按编号从大到小排列
+  fs->snapLatest = fs->snapshots ? fs->snapshots->snapshot : 0;
+  FsVersion *versions = NULL;
+  FsSnapGarbage *garbage = NULL;
+  if (!fs->snapshots) {
+    versions = fs->versions;
+    garbage = fs->garbage;
+    fs->versions = NULL;
+    fs->garbage = NULL;
+  }
+  pthread_mutex_unlock(&fs->snapLock);
+  // 读取当前的文件系统时不访问旧版本，释放时只需等待无锁的读者
+  for (FsVersion *v = versions; v; v = v->all)
+    FS_STORE(v->file->versions, NULL);
+  while (versions) {
+    FsVersion *next = versions->all;
+    FsEpochRetire(versions, FsVersionFree);
+    versions = next;
+  }
+  while (garbage) {
+    FsSnapGarbage *next = garbage->next;
+    FsEpochRetire(garbage->ptr, garbage->freeFn);
+    free(garbage);
+    garbage = next;
+  }
+  FsTreeUnlock(fs);
+}
+
+/// 按编号查找快照
+/// \param fs 当前的文件系统
+/// \param id
+/// \return 不存在时返回 NULL
+static Fs FsSnapshotFind(Fs fs, uint64_t id) {
+  pthread_mutex_lock(&fs->snapLock);
+  Fs snapshot = fs->snapshots;
+  // 事务开始时的快照由事务释放
+  while (snapshot &&
+         (snapshot->snapshot != id || snapshot == fs->txSnapshot))
+    snapshot = snapshot->snapNext;
+  pthread_mutex_unlock(&fs->snapLock);
+  return snapshot;
+}
+
+/// 打印所有快照及其之后修改过的节点数量，当前所在的快照用 * 标出
+/// \param fs 当前的文件系统
+/// \param current shell 当前使用的文件系统
+static void FsSnapList(Fs fs, Fs current) {
+  pthread_mutex_lock(&fs->snapLock);
+  for (Fs s = fs->snapshots; s; s = s->snapNext) {
+    if (s == fs->txSnapshot)
+      continue;
+    size_t changed = 0;
+    for (FsVersion *v = fs->versions; v; v = v->all) {
+      if (v->gen >= s->snapshot)
+        changed++;
+    }
+    printf("%c %llu\t%zu changed\n", s == current ? '*' : ' ',
+           (unsigned long long)s->snapshot, changed);
+  }
+  pthread_mutex_unlock(&fs->snapLock);
+}
+
+// 该函数对应 shell 中的 snap 命令：
+// snap 创建快照；snap list 列出所有快照；snap cd ID 进入快照，
+// 没有 ID 时回到当前的文件系统；snap rm ID 释放快照。
+// 返回 shell 之后使用的文件系统
+Fs FsSnap(Fs fs, char *arg) {
+  Fs live = fs->live ? fs->live : fs;
+  char *command = arg ? strtok(arg, " ") : NULL;
+  char *idStr = command ? strtok(NULL, " ") : NULL;
+  if (!command) {
+    printf("snapshot %llu\n",
+           (unsigned long long)FsSnapshot(live)->snapshot);
+    return fs;
+  }
+  if (strcmp(command, "list") == 0) {
+    FsSnapList(live, fs);
+    return fs;
+  }
+  bool cd = strcmp(command, "cd") == 0;
+  if (!cd && strcmp(command, "rm") != 0) {
+    printf("snap: unknown command '%s'\n", command);
+    return fs;
+  }
+  if (!idStr) {
+    if (cd)
+      return live;
+    printf("snap: missing snapshot id\n");
+    return fs;
+  }
+  char *end;
+  unsigned long long id = strtoull(idStr, &end, 10);
+  Fs snapshot = *end ? NULL : FsSnapshotFind(live, id);
+  if (!snapshot) {
+    printf("snap: no such snapshot '%s'\n", idStr);
+    return fs;
+  }
+  if (cd)
+    return snapshot;
+  FsFree(snapshot);
+  return fs == snapshot ? live : fs;
+}
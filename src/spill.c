@@ -0,0 +1,341 @@
+// 内存预算和溢出文件
+//
+// 设置预算后，后台线程定期检查整个进程中文件内容占用的内存，超过预算时
+// 按最后一次读写的时间从旧到新把文件内容写入宿主机上的溢出文件，
+// 直到回到预算的 FS_SPILL_LOW_WATER 以内。读写溢出的文件时再读回内存，
+// 见 content.c。
+// 溢出文件创建后立即删除，进程退出时自动回收；空间只在末尾分配，
+// 内容释放时打洞归还磁盘空间。溢出的内容持有溢出文件的引用，
+// 关闭预算之后已经溢出的内容仍然可以读回。
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "utility.h"
+
+// 检查内存占用的间隔（毫秒）
+#define FS_SPILL_PERIOD 10
+// 超过预算时溢出到预算的这个比例（百分比）以内，避免频繁地来回溢出
+#define FS_SPILL_LOW_WATER 90
+
+struct FsSpill_t {
+  int fd;
+  // 文件中已经分配的字节数
+  uint64_t end;
+  // Fs 持有一个引用，每个溢出的内容持有一个引用
+  size_t refs;
+  // 预算（字节）
+  size_t budget;
+  // 后台线程，running 为 false 时退出
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+// 整个进程中溢出和读回的次数，读回的总耗时（纳秒）
+static size_t fsSpills;
+static size_t fsFaults;
+static uint64_t fsFaultNs;
+
+/// 增加溢出文件的引用
+/// \param spill
+/// \return spill
+FsSpill *FsSpillRef(FsSpill *spill) {
+  __atomic_add_fetch(&spill->refs, 1, __ATOMIC_RELAXED);
+  return spill;
+}
+
+/// 释放溢出文件中的一段空间和一个引用，最后一个引用关闭文件
+/// \param spill
+/// \param offset
+/// \param size 为 0 时只释放引用
+void FsSpillRelease(FsSpill *spill, uint64_t offset, size_t size) {
+  if (size)
+    fallocate(spill->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+              (off_t)offset, (off_t)size);
+  if (__atomic_sub_fetch(&spill->refs, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+  close(spill->fd);
+  pthread_cond_destroy(&spill->cond);
+  pthread_mutex_destroy(&spill->lock);
+  free(spill);
+}
+
+/// 在溢出文件末尾分配空间
+/// \param spill
+/// \param size
+/// \return 偏移
+uint64_t FsSpillAlloc(FsSpill *spill, size_t size) {
+  return __atomic_fetch_add(&spill->end, size, __ATOMIC_RELAXED);
+}
+
+/// 写入溢出文件
+/// \param spill
+/// \param data
+/// \param size
+/// \param offset
+/// \return 是否全部写入
+bool FsSpillWrite(FsSpill *spill, const void *data, size_t size,
+                  uint64_t offset) {
+  while (size) {
+    ssize_t n = pwrite(spill->fd, data, size, (off_t)offset);
+    if (n <= 0)
+      return false;
+    data = (const char *)data + n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+/// 读取溢出文件
+/// \param spill
+/// \param data
+/// \param size
+/// \param offset
+/// \return 是否全部读取
+bool FsSpillRead(FsSpill *spill, void *data, size_t size, uint64_t offset) {
+  while (size) {
+    ssize_t n = pread(spill->fd, data, size, (off_t)offset);
+    if (n <= 0)
+      return false;
+    data = (char *)data + n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+/// 记录一次读回
+/// \param ns 耗时（纳秒）
+void FsSpillFault(uint64_t ns) {
+  __atomic_add_fetch(&fsFaults, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&fsFaultNs, ns, __ATOMIC_RELAXED);
+}
+
+/// 获取整个进程中溢出和读回的次数，读回的总耗时
+/// \param spills
+/// \param faults
+/// \param faultNs 纳秒
+void FsSpillStats(size_t *spills, size_t *faults, uint64_t *faultNs) {
+  *spills = __atomic_load_n(&fsSpills, __ATOMIC_RELAXED);
+  *faults = __atomic_load_n(&fsFaults, __ATOMIC_RELAXED);
+  *faultNs = __atomic_load_n(&fsFaultNs, __ATOMIC_RELAXED);
+}
+
+// 溢出的候选文件
+typedef struct {
+  FIL *file;
+  uint64_t accessed;
+} FsSpillCandidate;
+
+typedef struct {
+  FsSpillCandidate *items;
+  size_t count;
+  size_t capacity;
+} FsSpillState;
+
+/// FsSpillRun 的访问者：收集内容在内存中的文件
+/// \param entry
+/// \param ctx FsSpillState
+/// \return
+static FsWalkAction FsSpillCollect(const FsWalkEntry *entry, void *ctx) {
+  FsSpillState *state = ctx;
+  FIL *file = FsFilTarget(entry->file);
+  if (file->type != REGULAR_FILE)
+    return FS_WALK_CONTINUE;
+  FIL_CONTENT *content = FS_LOAD(file->content);
+  if (!content || content->spill || !FS_LOAD(content->length))
+    return FS_WALK_CONTINUE;
+  if (state->count == state->capacity) {
+    state->capacity = state->capacity ? state->capacity * 2 : 64;
+    state->items =
+        realloc(state->items, sizeof(FsSpillCandidate) * state->capacity);
+    assert(state->items);
+  }
+  state->items[state->count++] = (FsSpillCandidate){
+      file, __atomic_load_n(&file->accessed, __ATOMIC_RELAXED)};
+  return FS_WALK_CONTINUE;
+}
+
+/// 按访问时间从旧到新排序
+static int FsSpillCompare(const void *a, const void *b) {
+  uint64_t x = ((const FsSpillCandidate *)a)->accessed;
+  uint64_t y = ((const FsSpillCandidate *)b)->accessed;
+  return x < y ? -1 : x > y;
+}
+
+/// 超过预算时把最久没有读写的文件内容溢出到 spill
+/// \param fs
+/// \param spill
+/// \return 溢出的文件数量
+static size_t FsSpillPass(Fs fs, FsSpill *spill) {
+  size_t resident = FsContentResident();
+  if (resident <= spill->budget)
+    return 0;
+  size_t target = spill->budget / 100 * FS_SPILL_LOW_WATER;
+  FsSpillState state = {NULL, 0, 0};
+  // 持有整棵树的读锁期间文件不会被删除
+  FsTreeRdlock(fs);
+  // 只处理当前的文件树，不使用调用线程的视图
+  FsViewSet(0);
+  FsWalkFil(fs->root, FS_SPLIT_STR, FsSpillCollect, &state, FS_WALK_ORDERED);
+  qsort(state.items, state.count, sizeof(FsSpillCandidate), FsSpillCompare);
+  size_t count = 0;
+  size_t freed = 0;
+  for (size_t i = 0; i < state.count && resident - freed > target; i++) {
+    FIL *file = state.items[i].file;
+    pthread_rwlock_wrlock(&file->lock);
+    size_t n = FsFilSpill(file, spill);
+    pthread_rwlock_unlock(&file->lock);
+    if (n) {
+      freed += n < resident - freed ? n : resident - freed;
+      count++;
+    }
+  }
+  FsTreeUnlock(fs);
+  free(state.items);
+  __atomic_add_fetch(&fsSpills, count, __ATOMIC_RELAXED);
+  // 被替换的内容由当前线程 retire，尽快释放
+  FsEpochFlush();
+  return count;
+}
+
+/// 立即检查一次内存占用，超过预算时溢出最久没有读写的文件内容
+/// \param fs
+/// \return 溢出的文件数量，没有设置预算时返回 0
+size_t FsSpillRun(Fs fs) {
+  pthread_mutex_lock(&fs->spillLock);
+  FsSpill *spill = fs->spill ? FsSpillRef(fs->spill) : NULL;
+  pthread_mutex_unlock(&fs->spillLock);
+  if (!spill)
+    return 0;
+  size_t count = FsSpillPass(fs, spill);
+  FsSpillRelease(spill, 0, 0);
+  return count;
+}
+
+/// 后台线程：每隔 FS_SPILL_PERIOD 检查一次内存占用
+/// \param arg Fs
+/// \return
+static void *FsSpillMain(void *arg) {
+  Fs fs = arg;
+  FsSpill *spill = fs->spill;
+  pthread_mutex_lock(&spill->lock);
+  while (spill->running) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += (long)FS_SPILL_PERIOD * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&spill->cond, &spill->lock, &deadline);
+    if (!spill->running)
+      break;
+    pthread_mutex_unlock(&spill->lock);
+    FsSpillPass(fs, spill);
+    pthread_mutex_lock(&spill->lock);
+  }
+  pthread_mutex_unlock(&spill->lock);
+  return NULL;
+}
+
+/// 停止后台线程并释放 Fs 持有的引用，调用者需持有 fs->spillLock
+/// \param fs
+static void FsSpillStop(Fs fs) {
+  FsSpill *spill = fs->spill;
+  if (!spill)
+    return;
+  pthread_mutex_lock(&spill->lock);
+  spill->running = false;
+  pthread_cond_signal(&spill->cond);
+  pthread_mutex_unlock(&spill->lock);
+  pthread_join(spill->thread, NULL);
+  fs->spill = NULL;
+  FsSpillRelease(spill, 0, 0);
+}
+
+/// 设置内存预算。整个进程中文件内容占用的内存超过预算时，把这个文件系统中
+/// 最久没有读写的内容溢出到 dir 下的临时文件
+/// \param fs
+/// \param budget 字节数，为 0 时关闭
+/// \param dir 溢出文件所在的文件夹，为 NULL 时使用系统的临时文件夹
+/// \return 无法创建溢出文件时返回 FS_ERROR
+FsErrors FsBudgetSet(Fs fs, size_t budget, const char *dir) {
+  pthread_mutex_lock(&fs->spillLock);
+  FsSpillStop(fs);
+  if (!budget) {
+    pthread_mutex_unlock(&fs->spillLock);
+    return FS_OK;
+  }
+  if (!dir)
+    dir = P_tmpdir;
+  char *path = malloc(sizeof(char) * (strlen(dir) + 32));
+  assert(path);
+  sprintf(path, "%s/fs-spill-XXXXXX", dir);
+  int fd = mkstemp(path);
+  if (fd >= 0)
+    unlink(path);
+  free(path);
+  if (fd < 0) {
+    pthread_mutex_unlock(&fs->spillLock);
+    return FS_ERROR;
+  }
+  FsSpill *spill = malloc(sizeof(FsSpill));
+  assert(spill);
+  memset(spill, 0, sizeof(FsSpill));
+  spill->fd = fd;
+  spill->refs = 1;
+  spill->budget = budget;
+  spill->running = true;
+  pthread_mutex_init(&spill->lock, NULL);
+  pthread_cond_init(&spill->cond, NULL);
+  fs->spill = spill;
+  if (pthread_create(&spill->thread, NULL, FsSpillMain, fs)) {
+    fs->spill = NULL;
+    FsSpillRelease(spill, 0, 0);
+    pthread_mutex_unlock(&fs->spillLock);
+    return FS_ERROR;
+  }
+  pthread_mutex_unlock(&fs->spillLock);
+  return FS_OK;
+}
+
+// 该函数对应 shell 中的 budget 命令：
+// budget BYTES [DIR] 设置内存预算，溢出文件放在 DIR 下；budget off 关闭
+void FsBudget(Fs fs, char *arg) {
+  if (fs->snapshot) {
+    PERROR(FS_READ_ONLY, "budget");
+    return;
+  }
+  char *bytes = arg ? strtok(arg, " ") : NULL;
+  char *dir = bytes ? strtok(NULL, " ") : NULL;
+  if (!bytes || strcmp(bytes, "off") == 0) {
+    FsBudgetSet(fs, 0, NULL);
+    return;
+  }
+  char *end;
+  unsigned long long budget = strtoull(bytes, &end, 10);
+  if (end == bytes || *end || !budget) {
+    printf("budget: invalid size '%s'\n", bytes);
+    return;
+  }
+  if (FsBudgetSet(fs, (size_t)budget, dir))
+    printf("budget: cannot create spill file in '%s'\n",
+           dir ? dir : P_tmpdir);
+}
@@ -0,0 +1,386 @@
+// 文件内容的去重存储
+//
+// 开启去重的 Fs 中，FsPut、cp 写入的内容按哈希值查找已有的相同内容，
+// 找到时增加引用计数直接共享，不同路径、不同 Fs 之间都可以共享。
+// 去重默认关闭，用 FsDedupEnable 或 shell 的 dedup 命令按 Fs 开启，
+// 关闭时写入不计算哈希。存储中的内容不再修改，
+// 写入共享的内容时复制出私有的缓冲区，见 content.c。
+// 存储按哈希值分成若干片，每片有自己的锁和哈希表，并发的 FsPut 很少竞争。
+// 只有连续存储的内容进入存储，分块存储的大文件在复制时共享块。
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "utility.h"
+
+// 分片数量
+#define FS_STORE_SHARDS 64
+// 每片哈希表的初始桶数
+#define FS_STORE_MIN_BUCKETS 16
+
+typedef struct {
+  pthread_mutex_t lock;
+  // 桶数为 2 的幂，同一个桶中的内容用 next 串起来
+  FIL_CONTENT **buckets;
+  size_t capacity;
+  size_t count;
+  size_t bytes;
+} FsStoreShard;
+
+static FsStoreShard fsStore[FS_STORE_SHARDS];
+static pthread_once_t fsStoreOnce = PTHREAD_ONCE_INIT;
+
+static void FsStoreInit(void) {
+  for (int i = 0; i < FS_STORE_SHARDS; i++)
+    pthread_mutex_init(&fsStore[i].lock, NULL);
+}
+
+// xxHash64 的常数
+#define FS_PRIME64_1 0x9E3779B185EBCA87ULL
+#define FS_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define FS_PRIME64_3 0x165667B19E3779F9ULL
+#define FS_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define FS_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t FsRotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t FsRead64(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t FsRead32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint64_t FsHashRound(uint64_t acc, uint64_t input) {
+  acc += input * FS_PRIME64_2;
+  acc = FsRotl64(acc, 31);
+  return acc * FS_PRIME64_1;
+}
+
+static uint64_t FsHashMerge(uint64_t acc, uint64_t val) {
+  acc ^= FsHashRound(0, val);
+  return acc * FS_PRIME64_1 + FS_PRIME64_4;
+}
+
+/// xxHash64，种子为 0
+/// \param data
+/// \param length
+/// \return
+static uint64_t FsHash64(const void *data, size_t length) {
+  const unsigned char *p = data;
+  const unsigned char *end = p + length;
+  uint64_t h;
+  if (length >= 32) {
+    uint64_t v1 = FS_PRIME64_1 + FS_PRIME64_2;
+    uint64_t v2 = FS_PRIME64_2;
+    uint64_t v3 = 0;
+    uint64_t v4 = -FS_PRIME64_1;
+    for (; p + 32 <= end; p += 32) {
+      v1 = FsHashRound(v1, FsRead64(p));
+      v2 = FsHashRound(v2, FsRead64(p + 8));
+      v3 = FsHashRound(v3, FsRead64(p + 16));
+      v4 = FsHashRound(v4, FsRead64(p + 24));
+    }
+    h = FsRotl64(v1, 1) + FsRotl64(v2, 7) + FsRotl64(v3, 12) +
+        FsRotl64(v4, 18);
+    h = FsHashMerge(h, v1);
+    h = FsHashMerge(h, v2);
+    h = FsHashMerge(h, v3);
+    h = FsHashMerge(h, v4);
+  } else {
+    h = FS_PRIME64_5;
+  }
+  h += length;
+  for (; p + 8 <= end; p += 8) {
+    h ^= FsHashRound(0, FsRead64(p));
+    h = FsRotl64(h, 27) * FS_PRIME64_1 + FS_PRIME64_4;
+  }
+  if (p + 4 <= end) {
+    h ^= (uint64_t)FsRead32(p) * FS_PRIME64_1;
+    h = FsRotl64(h, 23) * FS_PRIME64_2 + FS_PRIME64_3;
+    p += 4;
+  }
+  for (; p < end; p++) {
+    h ^= *p * FS_PRIME64_5;
+    h = FsRotl64(h, 11) * FS_PRIME64_1;
+  }
+  h ^= h >> 33;
+  h *= FS_PRIME64_2;
+  h ^= h >> 29;
+  h *= FS_PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+/// 内容所在的分片
+/// \param hash
+/// \return
+static FsStoreShard *FsStoreShardOf(uint64_t hash) {
+  return &fsStore[hash % FS_STORE_SHARDS];
+}
+
+/// 内容在分片中的桶，调用者需持有分片的锁
+/// \param shard
+/// \param hash
+/// \return
+static FIL_CONTENT **FsStoreBucket(FsStoreShard *shard, uint64_t hash) {
+  return &shard->buckets[(hash / FS_STORE_SHARDS) & (shard->capacity - 1)];
+}
+
+/// 桶数翻倍，调用者需持有分片的锁
+/// \param shard
+static void FsStoreGrow(FsStoreShard *shard) {
+  FIL_CONTENT **old = shard->buckets;
+  size_t oldCapacity = shard->capacity;
+  shard->capacity = oldCapacity ? oldCapacity * 2 : FS_STORE_MIN_BUCKETS;
+  shard->buckets = calloc(shard->capacity, sizeof(FIL_CONTENT *));
+  assert(shard->buckets);
+  for (size_t i = 0; i < oldCapacity; i++) {
+    for (FIL_CONTENT *c = old[i], *next; c; c = next) {
+      next = c->next;
+      FIL_CONTENT **bucket = FsStoreBucket(shard, c->hash);
+      c->next = *bucket;
+      *bucket = c;
+    }
+  }
+  free(old);
+}
+
+/// 开启或关闭 fs 的去重。关闭后新写入的内容不再进入存储，
+/// 已经共享的内容不受影响
+/// \param fs 快照时设置所属的文件系统
+/// \param enable
+void FsDedupEnable(Fs fs, bool enable) {
+  if (fs->live)
+    fs = fs->live;
+  __atomic_store_n(&fs->dedup, enable, __ATOMIC_RELAXED);
+}
+
+/// fs 是否开启了去重
+/// \param fs 可以为 NULL，此时返回 false
+/// \return
+bool FsDedupEnabled(Fs fs) {
+  if (fs && fs->live)
+    fs = fs->live;
+  return fs && __atomic_load_n(&fs->dedup, __ATOMIC_RELAXED);
+}
+
+/// 获取与 data 相同的共享内容，存储中没有时新建一份放入存储。
+/// fs 没有开启去重或者需要分块存储时返回私有的内容
+/// \param fs 写入的文件所属的文件系统，可以为 NULL
+/// \param data
+/// \param length
+/// \return 持有一个引用，用 FsContentFree 释放
+FIL_CONTENT *FsContentIntern(Fs fs, const char *data, size_t length) {
+  if (!length || length > FS_CHUNK_THRESHOLD || !FsDedupEnabled(fs))
+    return FsContentNew(data, length, length);
+  pthread_once(&fsStoreOnce, FsStoreInit);
+  uint64_t hash = FsHash64(data, length);
+  FsStoreShard *shard = FsStoreShardOf(hash);
+  pthread_mutex_lock(&shard->lock);
+  if (shard->capacity) {
+    for (FIL_CONTENT *c = *FsStoreBucket(shard, hash); c; c = c->next) {
+      if (c->hash == hash && c->length == length &&
+          memcmp(c->data, data, length) == 0) {
+        __atomic_add_fetch(&c->refs, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&shard->lock);
+        return c;
+      }
+    }
+  }
+  FIL_CONTENT *content = FsContentNew(data, length, length);
+  content->refs = 1;
+  content->hash = hash;
+  if (shard->count >= shard->capacity)
+    FsStoreGrow(shard);
+  FIL_CONTENT **bucket = FsStoreBucket(shard, hash);
+  content->next = *bucket;
+  *bucket = content;
+  shard->count++;
+  shard->bytes += length;
+  pthread_mutex_unlock(&shard->lock);
+  return content;
+}
+
+/// 释放共享内容的一个引用，最后一个引用从存储中移除。
+/// 引用只能在持有分片的锁时归零，查找到的内容一定仍然有效
+/// \param content 在存储中的内容
+/// \return 是否是最后一个引用，此时由调用者释放内存
+bool FsContentRelease(FIL_CONTENT *content) {
+  FsStoreShard *shard = FsStoreShardOf(content->hash);
+  pthread_mutex_lock(&shard->lock);
+  bool last = __atomic_sub_fetch(&content->refs, 1, __ATOMIC_ACQ_REL) == 0;
+  if (last) {
+    FIL_CONTENT **p = FsStoreBucket(shard, content->hash);
+    while (*p != content)
+      p = &(*p)->next;
+    *p = content->next;
+    shard->count--;
+    shard->bytes -= content->length;
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return last;
+}
+
+// 统计时已经计入的内容和块，按指针去重
+typedef struct {
+  FsStatsInfo *stats;
+  const void **seen;
+  size_t capacity;
+  size_t count;
+} FsStatsState;
+
+/// 记录一个指针
+/// \param state
+/// \param ptr
+/// \return 之前没有记录过时返回 true
+static bool FsStatsSeen(FsStatsState *state, const void *ptr) {
+  if (state->count * 2 >= state->capacity) {
+    const void **old = state->seen;
+    size_t oldCapacity = state->capacity;
+    state->capacity = oldCapacity ? oldCapacity * 2 : 64;
+    state->seen = calloc(state->capacity, sizeof(void *));
+    assert(state->seen);
+    state->count = 0;
+    for (size_t i = 0; i < oldCapacity; i++) {
+      if (old[i])
+        FsStatsSeen(state, old[i]);
+    }
+    free(old);
+  }
+  size_t i = ((uintptr_t)ptr >> 4) * FS_PRIME64_1 >> 7;
+  for (i &= state->capacity - 1; state->seen[i];
+       i = (i + 1) & (state->capacity - 1)) {
+    if (state->seen[i] == ptr)
+      return false;
+  }
+  state->seen[i] = ptr;
+  state->count++;
+  return true;
+}
+
+/// FsStatsGet 的访问者
+/// \param entry
+/// \param ctx FsStatsState
+/// \return
+static FsWalkAction FsStatsVisit(const FsWalkEntry *entry, void *ctx) {
+  FsStatsState *state = ctx;
+  FsStatsInfo *stats = state->stats;
+  if (entry->file->type == DIRECTORY) {
+    stats->directories++;
+    return FS_WALK_CONTINUE;
+  }
+  stats->files++;
+  size_t length;
+  FIL_CONTENT *content = FsFilContent(FsFilTarget(entry->file), &length);
+  stats->bytes += length;
+  if (!content || !length)
+    return FS_WALK_CONTINUE;
+  // 溢出的内容也可能是压缩的，先检查
+  if (content->spill) {
+    stats->spilledFiles++;
+    stats->spilledBytes += content->capacity;
+    return FS_WALK_CONTINUE;
+  }
+  if (content->compressed) {
+    stats->compressedFiles++;
+    stats->compressedSaved += length - content->compressed;
+    stats->storedBytes += content->compressed;
+    return FS_WALK_CONTINUE;
+  }
+  if (!content->chunks) {
+    if (FsStatsSeen(state, content))
+      stats->storedBytes += length;
+    return FS_WALK_CONTINUE;
+  }
+  for (size_t offset = 0; offset < length; offset += FS_CHUNK_SIZE) {
+    FIL_CHUNK *chunk = FS_LOAD(content->chunks[offset / FS_CHUNK_SIZE]);
+    if (chunk && FsStatsSeen(state, chunk))
+      stats->storedBytes += length - offset < FS_CHUNK_SIZE
+                                ? length - offset
+                                : FS_CHUNK_SIZE;
+  }
+  return FS_WALK_CONTINUE;
+}
+
+/// 统计 pathStr 下的文件数量、内容字节数和去重后实际占用的字节数
+/// \param fs
+/// \param pathStr 为 NULL 时从当前目录开始
+/// \param stats
+/// \return
+FsErrors FsStatsGet(Fs fs, const char *pathStr, FsStatsInfo *stats) {
+  memset(stats, 0, sizeof(FsStatsInfo));
+  FsStatsState state = {stats, NULL, 0, 0};
+  FsErrors res = FsWalk(fs, pathStr, FsStatsVisit, &state, FS_WALK_ORDERED);
+  free(state.seen);
+  pthread_once(&fsStoreOnce, FsStoreInit);
+  for (int i = 0; i < FS_STORE_SHARDS; i++) {
+    pthread_mutex_lock(&fsStore[i].lock);
+    stats->storeEntries += fsStore[i].count;
+    stats->storeBytes += fsStore[i].bytes;
+    pthread_mutex_unlock(&fsStore[i].lock);
+  }
+  stats->dedup = FsDedupEnabled(fs);
+  FsDecompressStats(&stats->decompressions, &stats->decompressNs);
+  stats->residentBytes = FsContentResident();
+  FsSpillStats(&stats->spills, &stats->faults, &stats->faultNs);
+  return res;
+}
+
+// 该函数输出 pathStr 下的文件数量、内容大小、去重比例、压缩和溢出情况
+void FsStats(Fs fs, char *pathStr) {
+  FsStatsInfo stats;
+  FsErrors res = FsStatsGet(fs, pathStr, &stats);
+  if (res) {
+    PERRORD(res, "stats: '%s'", pathStr);
+    return;
+  }
+  printf("files: %zu, directories: %zu\n", stats.files, stats.directories);
+  printf("content: %zu bytes, stored: %zu bytes, dedup ratio: %.2f\n",
+         stats.bytes, stats.storedBytes,
+         stats.storedBytes ? (double)stats.bytes / stats.storedBytes : 1.0);
+  printf("store: %zu entries, %zu bytes, dedup %s\n", stats.storeEntries,
+         stats.storeBytes, stats.dedup ? "on" : "off");
+  printf("compressed: %zu files, %zu bytes saved, %zu decompressions, "
+         "%.1f us average\n",
+         stats.compressedFiles, stats.compressedSaved, stats.decompressions,
+         stats.decompressions
+             ? stats.decompressNs / 1000.0 / stats.decompressions
+             : 0.0);
+  printf("memory: %zu bytes resident, spilled: %zu files, %zu bytes, "
+         "%zu spills, %zu faults, %.1f us average\n",
+         stats.residentBytes, stats.spilledFiles, stats.spilledBytes,
+         stats.spills, stats.faults,
+         stats.faults ? stats.faultNs / 1000.0 / stats.faults : 0.0);
+}
+
+// 该函数对应 shell 中的 dedup [on|off] 命令：开启或关闭当前文件系统的去重，
+// 没有参数时打印当前的状态
+void FsDedup(Fs fs, char *arg) {
+  if (arg && strcmp(arg, "on") == 0) {
+    FsDedupEnable(fs, true);
+  } else if (arg && strcmp(arg, "off") == 0) {
+    FsDedupEnable(fs, false);
+  } else if (arg) {
+    printf("dedup: unknown argument '%s'\n", arg);
+    return;
+  }
+  printf("dedup %s\n", FsDedupEnabled(fs) ? "on" : "off");
+}
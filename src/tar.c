@@ -0,0 +1,1064 @@
+// tar 归档的导出和导入
+//
+// FsTarWrite 把一棵子树以 ustar 格式流式写出，FsTarRead 流式读入，
+// 都不在内存中拼出整个归档。
+// 导出在一个临时快照上进行，得到某一时刻一致的归档而不阻塞写者：快照中的
+// 子文件列表和节点在快照释放之前一直有效，只有文件内容需要处于 epoch
+// 临界区。头部写在一块固定的缓冲区中，头部、内容的各段（连续存储时为一段，
+// 分块存储时每块一段）和填充依次排成 iovec，攒满后一次 writev，内容不复制；
+// 写出之后离开并重新进入临界区，快照中临时解压的内容随之释放。
+// 导入时逐个解析头部，内容用 FsContentFromFd 直接读入内容的缓冲区，填充与
+// 下一个头部一次读出。新的节点先挂在不属于任何文件系统的暂存树上，用路径到
+// 节点的哈希表查找上层文件夹，子文件先追加到数组中；读完之后每个文件夹排序
+// 一次、一次分配好子文件列表，再在整棵树的写锁下一次插入目标文件夹。
+// 名字超过 ustar 的长度限制时写出 GNU 的 `././@LongLink` 项；读入时还支持
+// pax 扩展头部中的 path、linkpath、size。同一个文件的多个硬链接导出为一个
+// 文件和若干硬链接项，导入时恢复为硬链接。
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "utility.h"
+
+// 归档中块的字节数，头部占一块，内容补齐到整块
+#define FS_TAR_BLOCK 512
+// 每次 writev 最多的 iovec 数量，不超过 IOV_MAX
+#define FS_TAR_IOV 1024
+// 头部缓冲区的块数
+#define FS_TAR_BLOCKS 1024
+// 写完一项之后 iovec 超过这个数量时写出，并重新进入 epoch 临界区
+#define FS_TAR_FLUSH (FS_TAR_IOV / 2)
+// pax 扩展头部和 GNU 长名字的最大字节数，超过时视为损坏的归档
+#define FS_TAR_META_MAX (1024 * 1024)
+// 跳过不支持的项时每次读取的字节数
+#define FS_TAR_SKIP (64 * 1024)
+
+// ustar 头部中各个字段的位置和长度
+#define FS_TAR_NAME 0
+#define FS_TAR_MODE 100
+#define FS_TAR_UID 108
+#define FS_TAR_GID 116
+#define FS_TAR_SIZE 124
+#define FS_TAR_MTIME 136
+#define FS_TAR_CHKSUM 148
+#define FS_TAR_TYPE 156
+#define FS_TAR_LINKNAME 157
+#define FS_TAR_MAGIC 257
+#define FS_TAR_PREFIX 345
+#define FS_TAR_NAME_LENGTH 100
+#define FS_TAR_PREFIX_LENGTH 155
+
+// 填充和归档末尾的全 0 块
+static const char FsTarZeros[2 * FS_TAR_BLOCK];
+
+// 哈希表中的一项，key 为空表示空位
+typedef struct {
+  char *key;
+  size_t length;
+  uint64_t hash;
+  void *value;
+} FsTarSlot;
+
+// 以字节串为键的开放寻址哈希表，只在一个线程中使用
+typedef struct {
+  FsTarSlot *slots;
+  // 容量为 2 的幂，最多装一半
+  size_t capacity;
+  size_t size;
+} FsTarMap;
+
+// 导出时的状态
+typedef struct {
+  int fd;
+  Fs fs;
+  FsImportStats *stats;
+  // 尚未写出的 iovec
+  struct iovec iov[FS_TAR_IOV];
+  size_t count;
+  // 头部和长名字所在的块，写出之后重新使用
+  char *blocks;
+  size_t used;
+  // 写出失败时的 errno
+  int err;
+  // 所有项的修改时间
+  time_t mtime;
+  // 当前项在归档中的名字
+  char *path;
+  size_t capacity;
+  // 已经写出的硬链接目标 -> 归档中的名字
+  FsTarMap links;
+} FsTarWriter;
+
+// 暂存树中的一个节点，文件夹的子文件先追加到 children 中
+typedef struct {
+  FIL *file;
+  FIL **children;
+  size_t count;
+  size_t capacity;
+} FsTarNode;
+
+// 导入时的状态
+typedef struct {
+  int fd;
+  FsImportStats stats;
+  // 归档中的路径 -> FsTarNode
+  FsTarMap nodes;
+  // 暂存树的根，file 为 NULL，children 插入目标文件夹
+  FsTarNode root;
+  // pax 扩展头部或 GNU 长名字给出的下一项的字段
+  char *name;
+  char *link;
+  bool hasSize;
+  uint64_t size;
+} FsTarReader;
+
+/// FNV-1a
+/// \param key
+/// \param length
+/// \return
+static uint64_t FsTarHash(const void *key, size_t length) {
+  const unsigned char *p = key;
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++)
+    hash = (hash ^ p[i]) * 1099511628211ULL;
+  return hash;
+}
+
+/// 查找键所在的位置
+/// \param map
+/// \param key
+/// \param length
+/// \param hash
+/// \return 找到的项或者应当插入的空位
+static FsTarSlot *FsTarMapSlot(FsTarMap *map, const void *key, size_t length,
+                               uint64_t hash) {
+  size_t mask = map->capacity - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    FsTarSlot *slot = &map->slots[i];
+    if (!slot->key || (slot->hash == hash && slot->length == length &&
+                       memcmp(slot->key, key, length) == 0))
+      return slot;
+  }
+}
+
+/// 查找
+/// \param map
+/// \param key
+/// \param length
+/// \return 不存在时返回 NULL
+static void *FsTarMapGet(FsTarMap *map, const void *key, size_t length) {
+  if (!map->size)
+    return NULL;
+  FsTarSlot *slot = FsTarMapSlot(map, key, length, FsTarHash(key, length));
+  return slot->key ? slot->value : NULL;
+}
+
+/// 插入一个不存在的键，键被复制
+/// \param map
+/// \param key
+/// \param length
+/// \param value
+static void FsTarMapPut(FsTarMap *map, const void *key, size_t length,
+                        void *value) {
+  if ((map->size + 1) * 2 > map->capacity) {
+    FsTarMap grown = {NULL, map->capacity ? map->capacity * 2 : 64, 0};
+    grown.slots = calloc(grown.capacity, sizeof(FsTarSlot));
+    assert(grown.slots);
+    for (size_t i = 0; i < map->capacity; i++) {
+      FsTarSlot *slot = &map->slots[i];
+      if (slot->key)
+        *FsTarMapSlot(&grown, slot->key, slot->length, slot->hash) = *slot;
+    }
+    grown.size = map->size;
+    free(map->slots);
+    *map = grown;
+  }
+  uint64_t hash = FsTarHash(key, length);
+  FsTarSlot *slot = FsTarMapSlot(map, key, length, hash);
+  slot->key = malloc(length + 1);
+  assert(slot->key);
+  memcpy(slot->key, key, length);
+  slot->key[length] = '\0';
+  slot->length = length;
+  slot->hash = hash;
+  slot->value = value;
+  map->size++;
+}
+
+/// 释放哈希表和所有的值
+/// \param map
+/// \param freeFn 释放值，为 NULL 时不释放
+static void FsTarMapFree(FsTarMap *map, void (*freeFn)(void *)) {
+  for (size_t i = 0; i < map->capacity; i++) {
+    if (!map->slots[i].key)
+      continue;
+    free(map->slots[i].key);
+    if (freeFn)
+      freeFn(map->slots[i].value);
+  }
+  free(map->slots);
+  memset(map, 0, sizeof(FsTarMap));
+}
+
+/// 写出所有攒下的 iovec，部分写出时从断开的位置继续
+/// \param w
+static void FsTarFlush(FsTarWriter *w) {
+  size_t i = 0;
+  while (i < w->count && !w->err) {
+    int n = (int)(w->count - i);
+    ssize_t written = writev(w->fd, w->iov + i, n);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written < 0) {
+      w->err = errno;
+      break;
+    }
+    while (i < w->count && (size_t)written >= w->iov[i].iov_len) {
+      written -= (ssize_t)w->iov[i].iov_len;
+      i++;
+    }
+    if (i < w->count) {
+      w->iov[i].iov_base = (char *)w->iov[i].iov_base + written;
+      w->iov[i].iov_len -= written;
+    }
+  }
+  w->count = 0;
+  w->used = 0;
+}
+
+/// 追加一段要写出的数据，data 在下一次写出之前必须保持有效
+/// \param w
+/// \param data
+/// \param length
+static void FsTarPush(FsTarWriter *w, const void *data, size_t length) {
+  if (!length)
+    return;
+  if (w->count == FS_TAR_IOV)
+    FsTarFlush(w);
+  w->iov[w->count++] = (struct iovec){(void *)data, length};
+}
+
+/// 从头部缓冲区中取出连续的 n 个全 0 块，取出之后应立即 FsTarPush
+/// \param w
+/// \param n 不超过 FS_TAR_BLOCKS
+/// \return
+static char *FsTarBlocks(FsTarWriter *w, size_t n) {
+  // 之后的 FsTarPush 不能再写出，否则这些块会被下一次取出覆盖
+  if (w->used + n > FS_TAR_BLOCKS || w->count == FS_TAR_IOV)
+    FsTarFlush(w);
+  char *blocks = w->blocks + w->used * FS_TAR_BLOCK;
+  memset(blocks, 0, n * FS_TAR_BLOCK);
+  w->used += n;
+  return blocks;
+}
+
+/// 以八进制写入数字字段，末尾为 '\0'
+/// \param field
+/// \param width 字段的字节数
+/// \param value
+static void FsTarOctal(char *field, size_t width, uint64_t value) {
+  snprintf(field, width, "%0*llo", (int)(width - 1),
+           (unsigned long long)value);
+}
+
+/// 填写 ustar 头部
+/// \param h 全 0 的块
+/// \param name 名字字段，超过长度的部分被截断
+/// \param length
+/// \param prefix 前缀字段，可以为 NULL
+/// \param prefixLength
+/// \param type
+/// \param size 八进制放不下时使用 GNU 的 base-256 编码
+/// \param link 链接字段，可以为 NULL
+/// \param mtime
+static void FsTarFill(char *h, const char *name, size_t length,
+                      const char *prefix, size_t prefixLength, char type,
+                      uint64_t size, const char *link, time_t mtime) {
+  memcpy(h + FS_TAR_NAME, name,
+         length < FS_TAR_NAME_LENGTH ? length : FS_TAR_NAME_LENGTH);
+  if (prefix)
+    memcpy(h + FS_TAR_PREFIX, prefix, prefixLength);
+  if (link) {
+    size_t n = strlen(link);
+    memcpy(h + FS_TAR_LINKNAME, link,
+           n < FS_TAR_NAME_LENGTH ? n : FS_TAR_NAME_LENGTH);
+  }
+  unsigned mode = type == '5' ? 0755 : type == '2' ? 0777 : 0644;
+  FsTarOctal(h + FS_TAR_MODE, 8, mode);
+  FsTarOctal(h + FS_TAR_UID, 8, 0);
+  FsTarOctal(h + FS_TAR_GID, 8, 0);
+  if (size < (1ULL << 33)) {
+    FsTarOctal(h + FS_TAR_SIZE, 12, size);
+  } else {
+    h[FS_TAR_SIZE] = (char)0x80;
+    for (int i = 11; i > 0; i--, size >>= 8)
+      h[FS_TAR_SIZE + i] = (char)(size & 0xff);
+  }
+  FsTarOctal(h + FS_TAR_MTIME, 12, (uint64_t)mtime);
+  h[FS_TAR_TYPE] = type;
+  memcpy(h + FS_TAR_MAGIC, "ustar\0" "00", 8);
+  // 计算校验和时校验和字段视为空格
+  memset(h + FS_TAR_CHKSUM, ' ', 8);
+  unsigned sum = 0;
+  for (int i = 0; i < FS_TAR_BLOCK; i++)
+    sum += (unsigned char)h[i];
+  FsTarOctal(h + FS_TAR_CHKSUM, 7, sum);
+}
+
+/// 写出 GNU 的长名字项，数据为以 '\0' 结尾的名字
+/// \param w
+/// \param type 'L' 为下一项的名字，'K' 为下一项的链接
+/// \param data
+/// \param length
+/// \return 名字太长时返回 false
+static bool FsTarLong(FsTarWriter *w, char type, const char *data,
+                      size_t length) {
+  size_t n = (length + FS_TAR_BLOCK) / FS_TAR_BLOCK;
+  if (n + 1 > FS_TAR_BLOCKS) {
+    w->err = ENAMETOOLONG;
+    return false;
+  }
+  char *h = FsTarBlocks(w, n + 1);
+  const char *longLink = "././@LongLink";
+  FsTarFill(h, longLink, strlen(longLink), NULL, 0, type, length + 1, NULL,
+            w->mtime);
+  memcpy(h + FS_TAR_BLOCK, data, length);
+  FsTarPush(w, h, (n + 1) * FS_TAR_BLOCK);
+  return true;
+}
+
+/// 写出一项的头部，名字放不下时先写出长名字项
+/// \param w
+/// \param name 归档中的名字，文件夹以 '/' 结尾
+/// \param length
+/// \param type
+/// \param size
+/// \param link 链接指向的名字，可以为 NULL
+static void FsTarHeader(FsTarWriter *w, const char *name, size_t length,
+                        char type, uint64_t size, const char *link) {
+  if (link && strlen(link) > FS_TAR_NAME_LENGTH &&
+      !FsTarLong(w, 'K', link, strlen(link)))
+    return;
+  const char *prefix = NULL;
+  size_t prefixLength = 0;
+  if (length > FS_TAR_NAME_LENGTH) {
+    // 在某个 '/' 处分成前缀和名字两部分，都不超过各自的长度
+    // 文件夹以 '/' 结尾，不能在最后一个字符处分开
+    size_t i = length - 2 < FS_TAR_PREFIX_LENGTH ? length - 2
+                                                 : FS_TAR_PREFIX_LENGTH;
+    while (i > 0 && (name[i] != '/' || length - i - 1 > FS_TAR_NAME_LENGTH))
+      i--;
+    if (i > 0) {
+      prefix = name;
+      prefixLength = i;
+      name += i + 1;
+      length -= i + 1;
+    } else if (!FsTarLong(w, 'L', name, length)) {
+      return;
+    }
+  }
+  char *h = FsTarBlocks(w, 1);
+  FsTarFill(h, name, length, prefix, prefixLength, type, size, link,
+            w->mtime);
+  FsTarPush(w, h, FS_TAR_BLOCK);
+}
+
+/// 在当前项的名字后面接上一个名字
+/// \param w
+/// \param length 当前项名字的字节数
+/// \param name
+/// \return 新的名字的字节数
+static size_t FsTarAppend(FsTarWriter *w, size_t length, const char *name) {
+  size_t n = strlen(name);
+  if (length + n + 2 > w->capacity) {
+    w->capacity = (length + n + 2) * 2;
+    w->path = realloc(w->path, w->capacity);
+    assert(w->path);
+  }
+  if (length)
+    w->path[length++] = '/';
+  memcpy(w->path + length, name, n + 1);
+  return length + n;
+}
+
+/// 写出一个文件或者符号链接。调用者需处于 epoch 临界区
+/// \param w
+/// \param file
+/// \param length 名字的字节数
+static void FsTarWriteFile(FsTarWriter *w, FIL *file, size_t length) {
+  if (file->symlink) {
+    FsTarHeader(w, w->path, length, '2', 0, file->symlink);
+    w->stats->symlinks++;
+    return;
+  }
+  FIL *target = FsFilTarget(file);
+  w->stats->files++;
+  // 同一个文件的其他名字写成指向第一个名字的硬链接
+  if (__atomic_load_n(&target->links, __ATOMIC_RELAXED) > 1) {
+    const char *first = FsTarMapGet(&w->links, &target, sizeof(target));
+    if (first) {
+      FsTarHeader(w, w->path, length, '1', 0, first);
+      return;
+    }
+    char *name = strdup(w->path);
+    assert(name);
+    FsTarMapPut(&w->links, &target, sizeof(target), name);
+  }
+  size_t size;
+  FIL_CONTENT *content = FsFilContentLoad(w->fs, target, &size);
+  if (!content)
+    size = 0;
+  FsTarHeader(w, w->path, length, '0', size, NULL);
+  for (size_t offset = 0; offset < size;) {
+    const char *data;
+    size_t n = FsContentSegment(content, size, offset, &data);
+    FsTarPush(w, data, n);
+    offset += n;
+  }
+  FsTarPush(w, FsTarZeros, (FS_TAR_BLOCK - size % FS_TAR_BLOCK) % FS_TAR_BLOCK);
+  w->stats->bytes += size;
+}
+
+/// 依次写出 file 及其中的所有文件。在快照中读取，子文件列表和节点在
+/// 快照释放之前不会改变，写出之后可以离开 epoch 临界区
+/// \param w
+/// \param file
+/// \param length 名字的字节数，为 0 时是导出的根目录，不写出本身
+static void FsTarWriteTree(FsTarWriter *w, FIL *file, size_t length) {
+  if (w->err)
+    return;
+  if (w->count >= FS_TAR_FLUSH) {
+    FsTarFlush(w);
+    FsEpochExit();
+    FsEpochEnter();
+  }
+  if (file->type != DIRECTORY) {
+    FsTarWriteFile(w, file, length);
+    return;
+  }
+  if (length) {
+    FsTarAppend(w, length, "");
+    FsTarHeader(w, w->path, length + 1, '5', 0, NULL);
+    w->path[length] = '\0';
+    w->stats->directories++;
+  }
+  FIL_LIST *children = FsFilChildren(file);
+  for (size_t i = 0; i < children->size && !w->err; i++) {
+    FIL *child = children->items[i].file;
+    if (FS_IS_DOT(child))
+      continue;
+    size_t n = FsTarAppend(w, length, children->items[i].name);
+    FsTarWriteTree(w, child, n);
+    w->path[length] = '\0';
+  }
+}
+
+/// 把 pathStr 及其中的所有文件以 ustar 格式写到 fd，归档中的名字以
+/// pathStr 的最后一个名字开头；pathStr 是根目录时为根目录中的名字。
+/// 在调用时刻的快照上读取，其他线程可以同时修改
+/// \param fs
+/// \param pathStr
+/// \param fd 按顺序写出，可以是管道或者套接字
+/// \param stats 写出的文件、文件夹、符号链接数量和内容的字节数，
+/// 硬链接计入文件；可以为 NULL
+/// \return 写出失败时返回 FS_ERROR
+FsErrors FsTarWrite(Fs fs, const char *pathStr, int fd, FsImportStats *stats) {
+  FsImportStats local;
+  if (!stats)
+    stats = &local;
+  memset(stats, 0, sizeof(FsImportStats));
+  if (!fs || !pathStr || fd < 0)
+    return FS_ERROR;
+  // 先在当前的文件系统中得到绝对路径，快照有自己的工作目录
+  PATH *path = NULL;
+  char *pathAbs = NULL;
+  FsEpochEnter();
+  FsErrors res = FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path);
+  if (res == FS_OK)
+    pathAbs = FsPathGetStr(path);
+  FsEpochExit();
+  FsPathFree(path);
+  path = NULL;
+  if (res)
+    return res;
+  Fs view = fs->live ? fs : FsSnapshot(fs);
+  FsTarWriter *w = calloc(1, sizeof(FsTarWriter));
+  assert(w);
+  w->fd = fd;
+  w->fs = view;
+  w->stats = stats;
+  w->mtime = time(NULL);
+  w->blocks = malloc(FS_TAR_BLOCKS * FS_TAR_BLOCK);
+  assert(w->blocks);
+  w->path = FsPathStrGetName(pathAbs);
+  w->capacity = strlen(w->path) + 1;
+  FsEpochEnter();
+  res = FsPathParse(FsCwdGet(view)->pathRoot, pathAbs, &path);
+  if (res == FS_OK) {
+    FsTarWriteTree(w, FsPathGetTail(path)->file, strlen(w->path));
+    FsTarPush(w, FsTarZeros, sizeof(FsTarZeros));
+    FsTarFlush(w);
+  }
+  FsEpochExit();
+  FsPathFree(path);
+  if (res == FS_OK && w->err)
+    res = FS_ERROR;
+  FsTarMapFree(&w->links, free);
+  free(w->path);
+  free(w->blocks);
+  free(w);
+  free(pathAbs);
+  if (view != fs)
+    FsFree(view);
+  FsViewSet(FsViewOf(fs));
+  return res;
+}
+
+/// 读满 size 个字节
+/// \param fd
+/// \param buf
+/// \param size
+/// \return 读到的字节数，到达末尾时小于 size；读取失败时返回 -1
+static ssize_t FsTarReadFull(int fd, void *buf, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = read(fd, (char *)buf + done, size - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    if (!n)
+      break;
+    done += n;
+  }
+  return (ssize_t)done;
+}
+
+/// 跳过 size 个字节，不能 lseek 时读出后丢弃
+/// \param fd
+/// \param size
+/// \return 归档在中途结束或者读取失败时返回 false
+static bool FsTarSkip(int fd, uint64_t size) {
+  if (!size || lseek(fd, (off_t)size, SEEK_CUR) >= 0)
+    return true;
+  char *buf = malloc(FS_TAR_SKIP);
+  assert(buf);
+  while (size) {
+    size_t n = size < FS_TAR_SKIP ? size : FS_TAR_SKIP;
+    if (FsTarReadFull(fd, buf, n) != (ssize_t)n)
+      break;
+    size -= n;
+  }
+  free(buf);
+  return !size;
+}
+
+/// 读出一项的全部数据，以 '\0' 结尾
+/// \param fd
+/// \param size
+/// \return 太长、归档在中途结束或者读取失败时返回 NULL
+static char *FsTarReadData(int fd, uint64_t size) {
+  if (size > FS_TAR_META_MAX)
+    return NULL;
+  char *data = malloc(size + 1);
+  assert(data);
+  if (FsTarReadFull(fd, data, size) != (ssize_t)size) {
+    free(data);
+    return NULL;
+  }
+  data[size] = '\0';
+  return data;
+}
+
+/// 解析数字字段：八进制，或者最高位为 1 时的 GNU base-256
+/// \param field
+/// \param width
+/// \param value
+/// \return 格式错误时返回 false
+static bool FsTarNumber(const char *field, size_t width, uint64_t *value) {
+  const unsigned char *p = (const unsigned char *)field;
+  *value = 0;
+  if (p[0] & 0x80) {
+    // 负数和超过 64 位的数都不是合法的大小
+    if (p[0] != 0x80)
+      return false;
+    for (size_t i = 1; i < width; i++) {
+      if (*value >> 56)
+        return false;
+      *value = *value << 8 | p[i];
+    }
+    return true;
+  }
+  size_t i = 0;
+  while (i < width && p[i] == ' ')
+    i++;
+  for (; i < width && p[i] >= '0' && p[i] <= '7'; i++)
+    *value = *value << 3 | (p[i] - '0');
+  return i == width || p[i] == '\0' || p[i] == ' ';
+}
+
+/// 检查头部的校验和，也接受早期实现按有符号字节计算的结果
+/// \param h
+/// \return
+static bool FsTarChecksum(const char *h) {
+  uint64_t stored;
+  if (!FsTarNumber(h + FS_TAR_CHKSUM, 8, &stored))
+    return false;
+  unsigned sum = 0;
+  int signedSum = 0;
+  for (int i = 0; i < FS_TAR_BLOCK; i++) {
+    bool chksum = i >= FS_TAR_CHKSUM && i < FS_TAR_CHKSUM + 8;
+    sum += chksum ? ' ' : (unsigned char)h[i];
+    signedSum += chksum ? ' ' : (signed char)h[i];
+  }
+  return stored == sum || (int64_t)stored == signedSum;
+}
+
+/// 解析 pax 扩展头部中的 path、linkpath、size，其他记录忽略
+/// \param r
+/// \param data 每条记录为 "长度 键=值\n"
+/// \param size
+/// \return 格式错误时返回 false
+static bool FsTarPax(FsTarReader *r, char *data, size_t size) {
+  for (size_t off = 0; off < size;) {
+    char *end;
+    unsigned long length = strtoul(data + off, &end, 10);
+    if (*end != ' ' || !length || length > size - off)
+      return false;
+    char *key = end + 1;
+    char *last = data + off + length - 1;
+    char *eq = memchr(key, '=', last - key);
+    if (!eq || *last != '\n')
+      return false;
+    *eq = '\0';
+    *last = '\0';
+    char *value = eq + 1;
+    if (strcmp(key, "path") == 0 || strcmp(key, "linkpath") == 0) {
+      char **field = key[0] == 'p' ? &r->name : &r->link;
+      free(*field);
+      *field = strdup(value);
+      assert(*field);
+    } else if (strcmp(key, "size") == 0) {
+      r->hasSize = true;
+      r->size = strtoull(value, NULL, 10);
+    }
+    off += length;
+  }
+  return true;
+}
+
+/// 规范化归档中的名字：去掉开头的 '/'、空的名字和 `.`，
+/// 结果为以 '/' 分隔的相对路径，根目录为空字符串
+/// \param path 原地修改
+/// \return 含有 `..` 时返回 false，这样的项不导入
+static bool FsTarClean(char *path) {
+  char *out = path;
+  for (char *p = path; *p;) {
+    char *end = strchr(p, '/');
+    size_t n = end ? (size_t)(end - p) : strlen(p);
+    if (n == 2 && p[0] == '.' && p[1] == '.')
+      return false;
+    if (n && !(n == 1 && p[0] == '.')) {
+      if (out != path)
+        *out++ = '/';
+      memmove(out, p, n);
+      out += n;
+    }
+    p += n;
+    while (*p == '/')
+      p++;
+  }
+  *out = '\0';
+  return true;
+}
+
+/// 在暂存树的 dir 中新建一个节点
+/// \param r
+/// \param dir
+/// \param key 归档中的路径
+/// \param length
+/// \param name 最后一个名字
+/// \param isDir
+/// \return
+static FsTarNode *FsTarNodeNew(FsTarReader *r, FsTarNode *dir, const char *key,
+                               size_t length, const char *name, bool isDir) {
+  FsTarNode *node = calloc(1, sizeof(FsTarNode));
+  assert(node);
+  if (isDir) {
+    FsInitDir(dir->file, &node->file, name);
+    // 第一层的 `..` 在插入之前先指向自身，插入失败时可以直接 FsFilFree
+    if (!dir->file)
+      node->file->children->items[1].file->link = node->file;
+    r->stats.directories++;
+  } else {
+    FsInitFile(dir->file, &node->file, name);
+  }
+  if (dir->count == dir->capacity) {
+    dir->capacity = dir->capacity ? dir->capacity * 2 : 8;
+    dir->children = realloc(dir->children, sizeof(FIL *) * dir->capacity);
+    assert(dir->children);
+  }
+  dir->children[dir->count++] = node->file;
+  FsTarMapPut(&r->nodes, key, length, node);
+  return node;
+}
+
+/// 找到 path 的上层文件夹，不存在的文件夹按需创建
+/// \param r
+/// \param path 非空的规范化路径，期间被临时修改
+/// \return 路径上有不是文件夹的文件时返回 NULL
+static FsTarNode *FsTarParent(FsTarReader *r, char *path) {
+  FsTarNode *dir = &r->root;
+  char *name = path;
+  for (char *p = strchr(path, '/'); p; p = strchr(p + 1, '/')) {
+    *p = '\0';
+    FsTarNode *node = FsTarMapGet(&r->nodes, path, p - path);
+    if (!node)
+      node = FsTarNodeNew(r, dir, path, p - path, name, true);
+    *p = '/';
+    if (node->file->type != DIRECTORY)
+      return NULL;
+    dir = node;
+    name = p + 1;
+  }
+  return dir;
+}
+
+/// 为归档中的一项找到或者新建暂存树中的节点。文件夹已经存在时直接使用；
+/// 文件已经存在时后出现的一项覆盖之前的内容
+/// \param r
+/// \param path 规范化路径
+/// \param isDir
+/// \return 与已有的文件类型冲突或者不能覆盖时返回 NULL
+static FsTarNode *FsTarPlace(FsTarReader *r, char *path, bool isDir) {
+  if (!*path)
+    return isDir ? &r->root : NULL;
+  FsTarNode *dir = FsTarParent(r, path);
+  if (!dir)
+    return NULL;
+  size_t length = strlen(path);
+  FsTarNode *node = FsTarMapGet(&r->nodes, path, length);
+  if (!node) {
+    const char *name = strrchr(path, '/');
+    return FsTarNodeNew(r, dir, path, length, name ? name + 1 : path, isDir);
+  }
+  FIL *file = node->file;
+  if (isDir || file->type == DIRECTORY)
+    return isDir && file->type == DIRECTORY ? node : NULL;
+  // 硬链接和有其他硬链接的文件不覆盖
+  if (file->link || file->links > 1)
+    return NULL;
+  FsContentFree(file->content);
+  free(file->symlink);
+  file->content = NULL;
+  file->symlink = NULL;
+  return node;
+}
+
+/// 按名字排序
+/// \param a
+/// \param b
+/// \return
+static int FsTarCompare(const void *a, const void *b) {
+  return strcmp((*(FIL *const *)a)->name, (*(FIL *const *)b)->name);
+}
+
+/// 把暂存的子文件排序后一次填入文件夹的子文件列表
+/// \param node
+static void FsTarFinish(FsTarNode *node) {
+  qsort(node->children, node->count, sizeof(FIL *), FsTarCompare);
+  FIL *dir = node->file;
+  if (!dir || dir->type != DIRECTORY)
+    return;
+  FIL_LIST *list = FsFilListNew(2 + node->count);
+  // `.`、`..` 在列表开头
+  list->items[0] = dir->children->items[0];
+  list->items[1] = dir->children->items[1];
+  for (size_t i = 0; i < node->count; i++)
+    list->items[2 + i] = (FIL_ENTRY){node->children[i]->name,
+                                     node->children[i]};
+  free(dir->children);
+  dir->children = list;
+}
+
+/// 释放暂存树的节点，不释放文件
+/// \param node
+static void FsTarNodeFree(void *node) {
+  free(((FsTarNode *)node)->children);
+  free(node);
+}
+
+/// 读入归档中的一项
+/// \param r
+/// \param h 校验过的头部
+/// \param dataSize 这一项之后的数据的字节数，用于计算填充
+/// \return 损坏的归档或者读取失败时返回 FS_ERROR
+static FsErrors FsTarEntry(FsTarReader *r, const char *h, uint64_t *dataSize) {
+  char type = h[FS_TAR_TYPE];
+  bool meta = type == 'x' || type == 'g' || type == 'L' || type == 'K';
+  uint64_t size;
+  if (!FsTarNumber(h + FS_TAR_SIZE, 12, &size))
+    return FS_ERROR;
+  if (r->hasSize && !meta)
+    size = r->size;
+  *dataSize = size;
+  if (type == 'g')
+    return FsTarSkip(r->fd, size) ? FS_OK : FS_ERROR;
+  if (meta) {
+    char *data = FsTarReadData(r->fd, size);
+    if (!data)
+      return FS_ERROR;
+    bool ok = true;
+    if (type == 'x') {
+      ok = FsTarPax(r, data, size);
+      free(data);
+    } else {
+      char **field = type == 'L' ? &r->name : &r->link;
+      free(*field);
+      *field = data;
+    }
+    return ok ? FS_OK : FS_ERROR;
+  }
+  // 下一项的头部之前的字段都已经用到这一项上
+  char *name = r->name;
+  char *link = r->link;
+  r->name = NULL;
+  r->link = NULL;
+  r->hasSize = false;
+  if (!name) {
+    // ustar 的名字为前缀加名字，GNU 格式不使用前缀
+    char prefix[FS_TAR_PREFIX_LENGTH + 1] = "";
+    if (memcmp(h + FS_TAR_MAGIC, "ustar\0", 6) == 0)
+      memcpy(prefix, h + FS_TAR_PREFIX, FS_TAR_PREFIX_LENGTH);
+    name = malloc(FS_TAR_PREFIX_LENGTH + FS_TAR_NAME_LENGTH + 2);
+    assert(name);
+    sprintf(name, "%s%s%.*s", prefix, *prefix ? "/" : "", FS_TAR_NAME_LENGTH,
+            h + FS_TAR_NAME);
+  }
+  if (!link) {
+    link = malloc(FS_TAR_NAME_LENGTH + 1);
+    assert(link);
+    sprintf(link, "%.*s", FS_TAR_NAME_LENGTH, h + FS_TAR_LINKNAME);
+  }
+  bool regular = type == '0' || type == '\0' || type == '7';
+  FsTarNode *node = NULL;
+  FIL *target = NULL;
+  if (type == '1' && FsTarClean(link)) {
+    // 硬链接只能指向归档中之前出现的文件
+    FsTarNode *first = FsTarMapGet(&r->nodes, link, strlen(link));
+    if (first && first->file->type != DIRECTORY && !first->file->symlink)
+      target = FsFilTarget(first->file);
+  }
+  if (FsTarClean(name) && (regular || type == '5' || (type == '2' && *link) ||
+                           (target && strcmp(name, link) != 0)))
+    node = FsTarPlace(r, name, type == '5');
+  FsErrors res = FS_OK;
+  if (node && regular) {
+    FIL_CONTENT *content = NULL;
+    if (size)
+      content = FsContentFromFd(r->fd, size);
+    if (size && (!content || content->length != size)) {
+      FsContentFree(content);
+      res = FS_ERROR;
+    } else {
+      node->file->content = content;
+      r->stats.files++;
+      r->stats.bytes += size;
+    }
+    size = 0;
+  } else if (node && type == '2') {
+    node->file->symlink = strdup(link);
+    assert(node->file->symlink);
+    r->stats.symlinks++;
+  } else if (node && type == '1') {
+    node->file->link = target;
+    __atomic_add_fetch(&target->refs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&target->links, 1, __ATOMIC_RELAXED);
+    r->stats.files++;
+  } else if (!node) {
+    // 设备、管道等特殊文件，以及冲突或者不安全的名字
+    r->stats.skipped++;
+  }
+  if (res == FS_OK && !FsTarSkip(r->fd, size))
+    res = FS_ERROR;
+  free(name);
+  free(link);
+  return res;
+}
+
+/// 从 fd 读入 tar 归档，插入已经存在的文件夹 pathStr，相当于
+/// tar -x -C pathStr。支持 ustar、GNU 和 pax 格式中的普通文件、文件夹、
+/// 符号链接和硬链接；特殊文件、含有 `..` 的名字和与已有的项冲突的项跳过。
+/// 归档中的第一层名字与 pathStr 中已有的文件重名时不导入任何文件
+/// \param fs
+/// \param fd 按顺序读取，可以是管道或者套接字
+/// \param pathStr
+/// \param stats 可以为 NULL
+/// \return 归档损坏或者读取失败时返回 FS_ERROR
+FsErrors FsTarRead(Fs fs, int fd, const char *pathStr, FsImportStats *stats) {
+  if (stats)
+    memset(stats, 0, sizeof(FsImportStats));
+  if (!fs || fd < 0 || !pathStr)
+    return FS_ERROR;
+  if (fs->snapshot)
+    return FS_READ_ONLY;
+  // 先检查目标文件夹，不存在时不读取归档
+  PATH *path = NULL;
+  FsTreeRdlock(fs);
+  FsErrors res = FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path);
+  if (res == FS_OK &&
+      FsFilTarget(FsPathGetTail(path)->file)->type != DIRECTORY)
+    res = FS_NOT_A_DIRECTORY;
+  FsTreeUnlock(fs);
+  FsPathFree(path);
+  path = NULL;
+  if (res)
+    return res;
+  FsTarReader *r = calloc(1, sizeof(FsTarReader));
+  assert(r);
+  r->fd = fd;
+  // 上一项的内容之后的填充与下一个头部一起读出
+  char buf[2 * FS_TAR_BLOCK];
+  size_t pad = 0;
+  while (res == FS_OK) {
+    ssize_t n = FsTarReadFull(fd, buf, pad + FS_TAR_BLOCK);
+    // 没有末尾的全 0 块时也在这里结束
+    if (n == (ssize_t)pad)
+      break;
+    if (n != (ssize_t)(pad + FS_TAR_BLOCK)) {
+      res = FS_ERROR;
+      break;
+    }
+    const char *h = buf + pad;
+    if (memcmp(h, FsTarZeros, FS_TAR_BLOCK) == 0)
+      break;
+    uint64_t size = 0;
+    res = FsTarChecksum(h) ? FsTarEntry(r, h, &size) : FS_ERROR;
+    pad = (FS_TAR_BLOCK - size % FS_TAR_BLOCK) % FS_TAR_BLOCK;
+  }
+  free(r->name);
+  free(r->link);
+  // 整理暂存树，之后每个文件夹都是可以直接发布的文件夹
+  for (size_t i = 0; i < r->nodes.capacity; i++) {
+    if (r->nodes.slots[i].key)
+      FsTarFinish(r->nodes.slots[i].value);
+  }
+  FsTarFinish(&r->root);
+  FIL **files = r->root.children;
+  size_t count = r->root.count;
+  FIL *dir = NULL;
+  FsTreeWrlock(fs);
+  if (res == FS_OK)
+    res = FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path);
+  if (res == FS_OK) {
+    dir = FsFilTarget(FsPathGetTail(path)->file);
+    if (dir->type != DIRECTORY)
+      res = FS_NOT_A_DIRECTORY;
+  }
+  for (size_t i = 0; res == FS_OK && i < count; i++) {
+    if (FsFilFindByName(dir, files[i]->name))
+      res = FS_FILE_EXISTS;
+  }
+  if (res == FS_OK) {
+    for (size_t i = 0; i < count; i++) {
+      FIL *file = files[i];
+      file->parent = dir;
+      file->fs = fs;
+      file->born = fs->snapClock;
+      if (file->type == DIRECTORY) {
+        // `..` 在列表的第二项
+        file->children->items[1].file->link = dir;
+        FsImportAdopt(file, fs);
+      }
+    }
+    FsFilAddChildren(dir, files, count);
+  }
+  FsTreeUnlock(fs);
+  FsPathFree(path);
+  if (res) {
+    for (size_t i = 0; i < count; i++)
+      FsFilFree(files[i]);
+  }
+  if (stats && res == FS_OK)
+    *stats = r->stats;
+  FsTarMapFree(&r->nodes, FsTarNodeFree);
+  free(r->root.children);
+  free(r);
+  return res;
+}
+
+// 该函数对应 shell 中的 export 命令：
+// export PATH OUT.tar 把 PATH 导出为宿主机上的 tar 归档
+void FsExport(Fs fs, char *arg) {
+  char *pathStr = arg ? strtok(arg, " ") : NULL;
+  char *out = pathStr ? strtok(NULL, " ") : NULL;
+  if (!out) {
+    printf("export: missing operand\n");
+    return;
+  }
+  int fd = open(out, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    printf("export: cannot create '%s': %s\n", out, strerror(errno));
+    return;
+  }
+  FsImportStats stats;
+  struct timespec start;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  FsErrors res = FsTarWrite(fs, pathStr, fd, &stats);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (close(fd) < 0 && !res)
+    res = FS_ERROR;
+  if (res) {
+    PERRORD(res, "export: cannot export '%s' to '%s'", pathStr, out);
+    return;
+  }
+  FsImportReport("exported", &stats,
+                 (end.tv_sec - start.tv_sec) +
+                     (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+// 该函数对应 shell 中的 import-tar 命令：
+// import-tar IN.tar PATH 把宿主机上的 tar 归档解开到文件夹 PATH 中
+void FsImportTar(Fs fs, char *arg) {
+  char *in = arg ? strtok(arg, " ") : NULL;
+  char *pathStr = in ? strtok(NULL, " ") : NULL;
+  if (!pathStr) {
+    printf("import-tar: missing operand\n");
+    return;
+  }
+  int fd = open(in, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    printf("import-tar: cannot open '%s': %s\n", in, strerror(errno));
+    return;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  FsImportStats stats;
+  struct timespec start;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  FsErrors res = FsTarRead(fs, fd, pathStr, &stats);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  close(fd);
+  if (res) {
+    PERRORD(res, "import-tar: cannot import '%s' to '%s'", in, pathStr);
+    return;
+  }
+  FsImportReport("imported", &stats,
+                 (end.tv_sec - start.tv_sec) +
+                     (end.tv_nsec - start.tv_nsec) / 1e9);
+}
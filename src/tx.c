@@ -0,0 +1,199 @@
+// 事务
+//
+// FsTxBegin 之后当前线程的所有修改组成一个事务，FsTxCommit 之后一起生效，
+// FsTxAbort 按撤销日志逆序撤销。事务期间当前线程独占整棵树的写锁，
+// 其他线程的修改等到事务结束；其他线程的读者读取事务开始时的快照，
+// 提交之前看不到事务中的任何修改，见 FsViewOf。
+// 撤销日志只记录结构和内容的变化：删除的文件树、改名之前的名字和
+// 修改之前的内容保留到提交，撤销的代价只与修改的数量有关。
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "utility.h"
+
+// 撤销日志的一条记录
+typedef struct FsTxRecord_t {
+  FsTxKind kind;
+  FIL *file;
+  // FS_TX_ADD、FS_TX_REMOVE 为所在的文件夹，FS_TX_MOVE 为移动之前的文件夹
+  FIL *dir;
+  // FS_TX_MOVE 改名之前的名字，没有改名时为 NULL
+  const char *name;
+  // FS_TX_CONTENT 修改之前的内容
+  FIL_CONTENT *content;
+} FsTxRecord;
+
+// 当前线程持有事务的文件系统
+static __thread Fs fsTx;
+
+/// 加整棵树的读锁，当前线程持有事务时已经持有写锁，不再加锁
+/// \param fs
+void FsTreeRdlock(Fs fs) {
+  if (fsTx != fs)
+    pthread_rwlock_rdlock(&fs->lock);
+}
+
+/// 加整棵树的写锁，当前线程持有事务时已经持有写锁，不再加锁
+/// \param fs
+void FsTreeWrlock(Fs fs) {
+  if (fsTx != fs)
+    pthread_rwlock_wrlock(&fs->lock);
+}
+
+/// 释放 FsTreeRdlock、FsTreeWrlock 加的锁
+/// \param fs
+void FsTreeUnlock(Fs fs) {
+  if (fsTx != fs)
+    pthread_rwlock_unlock(&fs->lock);
+}
+
+/// 当前线程读取 fs 时使用的视图：快照的编号；其他线程正在进行事务时为
+/// 事务开始时的快照；否则为 0
+/// \param fs
+/// \return
+uint64_t FsViewOf(Fs fs) {
+  if (fs->snapshot)
+    return fs->snapshot;
+  return fsTx == fs ? 0 : FS_LOAD(fs->txView);
+}
+
+/// 开始事务，之后当前线程对 fs 的修改在 FsTxCommit 之后才对其他线程可见。
+/// 一个线程同时只能有一个事务
+/// \param fs
+/// \return
+FsErrors FsTxBegin(Fs fs) {
+  if (!fs)
+    return FS_ERROR;
+  if (fs->snapshot)
+    return FS_READ_ONLY;
+  if (fsTx)
+    return FS_ERROR;
+  // 等待正在进行的修改完成，之后其他线程的修改等到事务结束
+  pthread_rwlock_wrlock(&fs->lock);
+  fsTx = fs;
+  fs->txSnapshot = FsSnapshot(fs);
+  fs->txSeq++;
+  FS_STORE(fs->txView, fs->txSnapshot->snapshot);
+  return FS_OK;
+}
+
+/// 当前线程的事务中修改 file 时调用，记录撤销需要的信息。
+/// 事务中新建的文件撤销时整个删除，不需要记录它的内容
+/// \param kind
+/// \param file
+/// \param dir 见 FsTxRecord
+/// \param name 见 FsTxRecord
+/// \return 是否记录，FS_TX_REMOVE 记录时删除的文件树保留到提交
+bool FsTxLog(FsTxKind kind, FIL *file, FIL *dir, const char *name) {
+  Fs fs = file->fs;
+  if (!fs || fsTx != fs || fs->txUndoing)
+    return false;
+  FIL_CONTENT *content = NULL;
+  if (kind == FS_TX_CONTENT) {
+    if (file->born >= fs->txView || file->txSaved == fs->txSeq)
+      return false;
+    file->txSaved = fs->txSeq;
+    content = FsContentClone(fs, file->content);
+  }
+  if (fs->txSize == fs->txCapacity) {
+    fs->txCapacity = fs->txCapacity ? fs->txCapacity * 2 : 16;
+    fs->txLog = realloc(fs->txLog, sizeof(FsTxRecord) * fs->txCapacity);
+    assert(fs->txLog);
+  }
+  fs->txLog[fs->txSize++] = (FsTxRecord){kind, file, dir, name, content};
+  return true;
+}
+
+/// 结束事务：其他线程改为读取当前的文件系统，释放整棵树的写锁，
+/// 等正在读取快照的读者离开之后释放快照。
+/// 读者可能在临界区中等待整棵树的锁，先释放锁再等待
+/// \param fs
+static void FsTxEnd(Fs fs) {
+  Fs snapshot = fs->txSnapshot;
+  fs->txSnapshot = NULL;
+  fs->txSize = 0;
+  FS_STORE(fs->txView, 0);
+  fsTx = NULL;
+  pthread_rwlock_unlock(&fs->lock);
+  FsEpochSynchronize();
+  FsFree(snapshot);
+}
+
+/// 提交当前线程的事务，释放删除的文件树和修改之前的内容
+/// \param fs
+/// \return 当前线程没有 fs 的事务时返回 FS_ERROR
+FsErrors FsTxCommit(Fs fs) {
+  if (!fs || fsTx != fs)
+    return FS_ERROR;
+  for (size_t i = 0; i < fs->txSize; i++) {
+    FsTxRecord *r = &fs->txLog[i];
+    if (r->kind == FS_TX_REMOVE)
+      FsFilRetire(r->file);
+    else if (r->kind == FS_TX_CONTENT)
+      FsContentFree(r->content);
+  }
+  FsTxEnd(fs);
+  return FS_OK;
+}
+
+/// 撤销当前线程的事务：按相反的顺序撤销每一条记录，
+/// 撤销之后的名字、位置和内容与事务开始时相同
+/// \param fs
+/// \return 当前线程没有 fs 的事务时返回 FS_ERROR
+FsErrors FsTxAbort(Fs fs) {
+  if (!fs || fsTx != fs)
+    return FS_ERROR;
+  fs->txUndoing = true;
+  for (size_t i = fs->txSize; i > 0; i--) {
+    FsTxRecord *r = &fs->txLog[i - 1];
+    switch (r->kind) {
+    case FS_TX_ADD:
+      FsFilDlTree(r->file);
+      break;
+    case FS_TX_REMOVE:
+      // 持有整棵树的写锁，与 FsFilCopy 相同不需要锁住文件夹
+      FsFilAddChild(r->dir, r->file);
+      break;
+    case FS_TX_MOVE:
+      FsFilMoveAs(r->file, r->dir, r->name);
+      break;
+    case FS_TX_CONTENT:
+      pthread_rwlock_wrlock(&r->file->lock);
+      FsFilRestore(r->file, r->content);
+      pthread_rwlock_unlock(&r->file->lock);
+      break;
+    }
+  }
+  fs->txUndoing = false;
+  FsTxEnd(fs);
+  return FS_OK;
+}
+
+// 该函数对应 shell 中的 tx 命令：
+// tx begin 开始事务；tx commit 提交；tx abort 撤销
+void FsTx(Fs fs, char *arg) {
+  FsErrors res;
+  if (arg && strcmp(arg, "begin") == 0) {
+    res = FsTxBegin(fs);
+  } else if (arg && strcmp(arg, "commit") == 0) {
+    res = FsTxCommit(fs);
+  } else if (arg && strcmp(arg, "abort") == 0) {
+    res = FsTxAbort(fs);
+  } else {
+    printf("tx: unknown command '%s'\n", arg ? arg : "");
+    return;
+  }
+  if (res)
+    PERRORD(res, "tx %s", arg);
+}
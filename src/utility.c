@@ -3,56 +3,83 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "pool.h"
 #include "utility.h"
 
 // implement the functions declared in utility.h here
 
-/// 从文件名查找文件夹内的文件
+/// 从文件名查找文件夹内的文件，其余文件按名字二分查找。
+/// 不加锁，调用者需处于 epoch 临界区、持有 dir 的锁或整棵树的锁
 /// \param dir
 /// \param name
 /// \return
 FIL *FsFilFindByName(FIL *dir, const char *name) {
-  // TODO: 优化查找算法
-  // 先用线性查找
-  for (size_t i = 0; i < dir->size_children; i++) {
-    if (strcmp(dir->children[i]->name, name) == 0) {
-      return dir->children[i];
-    }
+  FIL_LIST *children = FsFilChildren(dir);
+  // `.`、`..` 在列表开头，不参与排序
+  for (size_t i = 0; i < children->size; i++) {
+    FIL_ENTRY *entry = &children->items[i];
+    if (!FS_IS_DOT(entry->file))
+      break;
+    if (strcmp(entry->name, name) == 0)
+      return entry->file;
   }
+  size_t i = FsFilLowerBound(children, name);
+  if (i < children->size && strcmp(children->items[i].name, name) == 0)
+    return children->items[i].file;
   // 找不到文件
   return NULL;
 }
 
-/// 按照字典序排序文件夹中的文件排列顺序
-/// \param dir
-/// \param reverse
-void FsFilSort(FIL *dir, int reverse) {
-  if (!dir || dir->size_children == 0 || dir->type == REGULAR_FILE || dir->link)
-    return;
-  FIL *tmp = NULL;
-  // 使用简单的冒泡排序
-  for (int i = 0; i < dir->size_children; i++) {
-    if (dir->children[i]->link)
-      continue;
-    for (int j = i + 1; j < dir->size_children; j++) {
-      if (dir->children[j]->link)
-        continue;
-      if ((strcmp(dir->children[i]->name, dir->children[j]->name) *
-           (reverse ? -1 : 1)) > 0) {
-        // printf("%s <==> %s\n", dir->children[i]->name,
-        // dir->children[j]->name);
-        tmp = dir->children[i];
-        dir->children[i] = dir->children[j];
-        dir->children[j] = tmp;
-      }
-    }
+/// 二分查找第一个名字不小于 name 的子文件，跳过开头的 `.`、`..`
+/// \param children
+/// \param name
+/// \return 下标，所有名字都小于 name 时返回 children->size
+size_t FsFilLowerBound(FIL_LIST *children, const char *name) {
+  size_t low = 0;
+  size_t high = children->size;
+  while (low < high && FS_IS_DOT(children->items[low].file))
+    low++;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (strcmp(children->items[mid].name, name) < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+/// 以 prefix 开头的子文件在有序列表中是连续的一段，二分查找它的范围，
+/// 时间复杂度 O(log n)
+/// \param children
+/// \param prefix
+/// \param end 范围的结束下标（不包含）
+/// \return 范围的开始下标
+size_t FsFilPrefixRange(FIL_LIST *children, const char *prefix, size_t *end) {
+  size_t begin = FsFilLowerBound(children, prefix);
+  size_t length = strlen(prefix);
+  size_t low = begin;
+  size_t high = children->size;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (strncmp(children->items[mid].name, prefix, length) == 0)
+      low = mid + 1;
+    else
+      high = mid;
   }
+  *end = low;
+  return begin;
 }
 
 /// DEBUG: 打印一个文件的信息
@@ -62,19 +89,27 @@ void FsFilPrint(FIL *file) {
     printf("[EMPTY FILE]\n");
     return;
   }
-  if (file->link) {
+  if (FS_IS_DOT(file)) {
     printf("[link] %s -> %s\n", file->name, file->link->name);
     return;
   }
+  if (file->symlink) {
+    printf("[symlink] %s -> %s\n", file->name, file->symlink);
+    return;
+  }
   if (file->type == DIRECTORY) {
     printf("[dir ] %s: ", file->name);
-    FsFilSort(file, 0);
-    for (int i = 0; i < file->size_children; i++) {
-      printf("%s%s", file->children[i]->name,
-             i + 1 == file->size_children ? "\n" : ", ");
+    FIL_LIST *children = FsFilChildren(file);
+    for (size_t i = 0; i < children->size; i++) {
+      printf("%s%s", children->items[i].name,
+             i + 1 == children->size ? "\n" : ", ");
     }
   } else {
-    printf("[file] %s\n", file->name);
+    size_t links = __atomic_load_n(&FsFilTarget(file)->links, __ATOMIC_RELAXED);
+    if (links > 1)
+      printf("[file] %s (links: %zu)\n", file->name, links);
+    else
+      printf("[file] %s\n", file->name);
   }
 }
 
@@ -87,29 +122,72 @@ PATH *FsPathGetTail(PATH *path) {
   return path;
 }
 
-/// 清理文件内存
+/// 清理文件内存，file 必须已经不可能被其他线程访问。
+/// 对文件只释放文件树持有的名字和引用，还有打开的句柄或硬链接时
+/// 由最后一个引用释放
 /// \param file
 void FsFilFree(FIL *file) {
   if (!file)
     return;
   if (file->link) {
-    // Link 文件只释放本身
+    // Link 文件只释放本身，硬链接还要释放链接到的文件的名字和引用
+    if (file->type == REGULAR_FILE) {
+      __atomic_sub_fetch(&file->link->links, 1, __ATOMIC_RELAXED);
+      FsFilRelease(file->link);
+    }
+    pthread_rwlock_destroy(&file->lock);
+    free(file->name);
     free(file);
     return;
   }
   if (file->type == DIRECTORY) {
-    for (int i = 0; i < file->size_children; i++) {
-      FsFilFree(file->children[i]);
+    for (size_t i = 0; i < file->children->size; i++) {
+      FsFilFree(file->children->items[i].file);
     }
     free(file->children);
   } else {
-    if (file->content)
-      free(file->content);
+    __atomic_sub_fetch(&file->links, 1, __ATOMIC_RELAXED);
+    FsFilRelease(file);
+    return;
   }
+  pthread_rwlock_destroy(&file->lock);
   free(file->name);
   free(file);
 }
 
+/// 释放文件的一个引用，最后一个引用释放文件及其内容
+/// \param file 普通文件
+void FsFilRelease(FIL *file) {
+  if (__atomic_sub_fetch(&file->refs, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+  FsContentFree(file->content);
+  free(file->symlink);
+  pthread_rwlock_destroy(&file->lock);
+  free(file->name);
+  free(file);
+}
+
+/// 硬链接 -> 链接到的文件，读写文件内容时使用；其他文件返回自身
+/// \param file
+/// \return
+FIL *FsFilTarget(FIL *file) {
+  return file->type == REGULAR_FILE && file->link ? file->link : file;
+}
+
+/// 作为 FsEpochRetire 的回调释放整棵文件树
+/// \param file
+void FsFilFreeRetired(void *file) { FsFilFree(file); }
+
+/// 分配子文件列表
+/// \param size 子文件数量
+/// \return
+FIL_LIST *FsFilListNew(size_t size) {
+  FIL_LIST *list = malloc(sizeof(FIL_LIST) + sizeof(FIL_ENTRY) * size);
+  assert(list);
+  list->size = size;
+  return list;
+}
+
 /// 清理路径内存
 /// \param path
 void FsPathFree(PATH *path) {
@@ -154,9 +232,17 @@ void FsFilInit(FIL *parent, FIL **file, const char *name) {
   strcpy((*file)->name, name);
   (*file)->parent = parent;
   (*file)->type = REGULAR_FILE;
+  (*file)->refs = 1;
+  (*file)->links = 1;
+  // 调用者持有整棵树的锁，快照编号不会同时改变
+  if (parent && parent->fs) {
+    (*file)->fs = parent->fs;
+    (*file)->born = parent->fs->snapClock;
+  }
+  pthread_rwlock_init(&(*file)->lock, NULL);
 }
 
-/// 新建文件链接
+/// 新建文件链接，只在 FsInitDir 中对尚未发布的文件夹调用
 /// \param parent
 /// \param name
 void FsMkLink(FIL *parent, FIL *link_to, const char *name) {
@@ -164,28 +250,36 @@ void FsMkLink(FIL *parent, FIL *link_to, const char *name) {
   FsFilInit(parent, &file, name);
   file->link = link_to;
   file->type = DIRECTORY;
-  parent->children[parent->size_children++] = file;
-  if (parent->size_children == FS_MAX_CHILDREN) {
-    PERROR(FS_ERROR, "Children pool full!")
-  }
+  parent->children->items[parent->children->size++] =
+      (FIL_ENTRY){file->name, file};
 }
 
 /// 初始化文件夹结构
 /// \param file
 void FsInitDir(FIL *parent, FIL **file, const char *name) {
+  FsInitDirSized(parent, file, name, 0);
+}
+
+/// 初始化文件夹结构，子文件列表预留 capacity 个子文件的位置。
+/// 发布之前由调用者依次填入，见 FsBuildFromPaths
+/// \param parent
+/// \param file
+/// \param name
+/// \param capacity
+void FsInitDirSized(FIL *parent, FIL **file, const char *name,
+                    size_t capacity) {
   FsFilInit(parent, file, name);
   (*file)->type = DIRECTORY;
-  // 初始化文件列表空间
-  (*file)->children = malloc(sizeof(FIL *) * FS_MAX_CHILDREN);
-  assert((*file)->children);
-  memset((*file)->children, 0, sizeof(FIL *) * FS_MAX_CHILDREN);
+  // 初始化文件列表空间，先留出 `.`、`..` 的位置
+  (*file)->children = FsFilListNew(2 + capacity);
+  (*file)->children->size = 0;
   // 新建两个文件夹：.和..，指向自己或者上层
   FsMkLink(*file, *file, ".");
   FsMkLink(*file, parent, "..");
   // 关于"."和".."文件夹：
   // 1. FileType 为 目录
   // 2. name == "." or ".."
-  // 3. size_children == 0 and children == NULL
+  // 3. children == NULL
   // 4. link == parent or self
 }
 
@@ -219,25 +313,30 @@ PATH *FsPathClone(PATH *src) {
 /// \param path
 /// \return
 char *FsPathGetStr(PATH *path) {
+  // 其他线程可能同时在读锁下改名，每个名字只读取一次；
+  // 旧名字在临界区结束之前不会释放
+  FsEpochEnter();
+  size_t capacity = 64;
   size_t length = 0;
-  PATH *p = path;
-  while (p) {
-    length += p->file->name_length + 1;
-    p = p->next;
-  }
-  char *pathStr = malloc(sizeof(char) * (length + 1));
-  char *str = pathStr;
-  p = path;
-  while (p) {
-    strcpy(str, p->file->name);
-    str += p->file->name_length;
-    if (strcmp(p->file->name, FS_SPLIT_STR) != 0 &&
-        p->file->type == DIRECTORY && p->next) {
-      *(str++) = FS_SPLIT;
+  char *pathStr = malloc(sizeof(char) * capacity);
+  assert(pathStr);
+  for (PATH *p = path; p; p = p->next) {
+    const char *name = FS_LOAD(p->file->name);
+    size_t n = strlen(name);
+    if (length + n + 2 > capacity) {
+      capacity = (length + n + 2) * 2;
+      pathStr = realloc(pathStr, sizeof(char) * capacity);
+      assert(pathStr);
+    }
+    memcpy(pathStr + length, name, n);
+    length += n;
+    if (strcmp(name, FS_SPLIT_STR) != 0 && p->file->type == DIRECTORY &&
+        p->next) {
+      pathStr[length++] = FS_SPLIT;
     }
-    p = p->next;
   }
-  *str = '\0';
+  pathStr[length] = '\0';
+  FsEpochExit();
   return pathStr;
 }
 
@@ -250,10 +349,10 @@ void FsPathSimplify(PATH **path) {
     return;
   // Path 最顶层一定不是 link
   while (p && p->next) {
-    if (p->next->file->link) {
+    FIL *link = FS_IS_DOT(p->next->file) ? FS_LOAD(p->next->file->link) : NULL;
+    if (link) {
       // 遇到 link，则开始收缩
-      if (p->next->file->link == p->file &&
-          p->next->file->link != (*path)->file) {
+      if (link == p->file && link != (*path)->file) {
         // "." 路径
         // 直接跳过这个 Node
         PATH *tmp = p->next;
@@ -289,14 +388,26 @@ void FsPathSimplify(PATH **path) {
   }
 }
 
-/// 解析路径字符串到路径结构
+/// 解析路径字符串到路径结构，展开所有符号链接
 /// \param pathRoot
 /// \param pathStr
 /// \param path
 /// \return
 FsErrors FsPathParse(PATH *pathRoot, const char *pathStr, PATH **path) {
-  if (!path)
-    return FS_ERROR;
+  return FsPathParseLocked(pathRoot, pathStr, path, FS_LOCK_NONE);
+}
+
+/// 在 epoch 临界区中解析路径，不加锁。
+/// 路径中间的符号链接总是相对于它所在的文件夹展开，
+/// 末尾的符号链接只在 follow 为 true 时展开
+/// \param pathRoot
+/// \param pathStr
+/// \param path 失败时可能已经分配，由调用者释放
+/// \param follow
+/// \param links 已经展开的符号链接数量，超过 FS_SYMLINK_MAX 时失败
+/// \return
+static FsErrors FsPathParseAt(PATH *pathRoot, const char *pathStr,
+                              PATH **path, bool follow, int *links) {
   const char *p = pathStr;
   if (!pathStr || !*pathStr) {
     // 空串，返回 pwd
@@ -343,17 +454,32 @@ FsErrors FsPathParse(PATH *pathRoot, const char *pathStr, PATH **path) {
       *p2 = '\0';
       // 查找对应文件是否存在
       FIL *target = FsFilFindByName(pathTail->file, buf);
-      if (!target) {
+      if (!target)
         return FS_NO_SUCH_FILE;
-      }
-      // path 尾部处理：判断有无 '/' 结尾
-      if (target->type == REGULAR_FILE) {
+      bool last = (*p == FS_SPLIT && *(p + 1) == '\0') || *p == '\0';
+      if (target->symlink && (follow || !last)) {
+        // 展开符号链接，用展开后的路径替换当前路径
+        if (++*links > FS_SYMLINK_MAX)
+          return FS_TOO_MANY_LINKS;
+        PATH *resolved = NULL;
+        FsErrors res =
+            FsPathParseAt(*path, target->symlink, &resolved, true, links);
+        FsPathFree(*path);
+        *path = resolved;
+        if (res)
+          return res;
+        pathTail = FsPathGetTail(*path);
+        if (last)
+          return FS_OK;
+        if (pathTail->file->type != DIRECTORY)
+          return FS_NOT_A_DIRECTORY;
+      } else if (target->type == REGULAR_FILE) {
+        // path 尾部处理：判断有无 '/' 结尾
         // 找到文件的话，如果 pathStr 后面已经没有东西了
         // 那么就是正确的，否则是错误 FS_NOT_A_DIRECTORY
-        if ((*p == FS_SPLIT && *(p + 1) == '\0') || *p == '\0') {
+        if (last) {
           pathTail = FsPathInsert(pathTail, target);
           FsPathSimplify(path);
-          pathTail = FsPathGetTail(*path);
           return FS_OK;
         } else {
           return FS_NOT_A_DIRECTORY;
@@ -372,6 +498,57 @@ FsErrors FsPathParse(PATH *pathRoot, const char *pathStr, PATH **path) {
   return FS_OK;
 }
 
+/// 解析路径字符串到路径结构，成功时按 mode 锁住路径末尾的文件
+/// \param pathRoot
+/// \param pathStr
+/// \param path
+/// \param mode
+/// \param follow 是否展开末尾的符号链接
+/// \return
+static FsErrors FsPathParseMode(PATH *pathRoot, const char *pathStr,
+                                PATH **path, FsLockMode mode, bool follow) {
+  if (!path)
+    return FS_ERROR;
+  int links = 0;
+  FsEpochEnter();
+  FsErrors res = FsPathParseAt(pathRoot, pathStr, path, follow, &links);
+  if (res == FS_OK && mode != FS_LOCK_NONE) {
+    // 硬链接锁住链接到的文件，与其他名字的读写互斥
+    FIL *file = FsFilTarget(FsPathGetTail(*path)->file);
+    if (mode == FS_LOCK_READ)
+      pthread_rwlock_rdlock(&file->lock);
+    else
+      pthread_rwlock_wrlock(&file->lock);
+  }
+  FsEpochExit();
+  return res;
+}
+
+/// 解析路径字符串到路径结构。
+/// 逐层查找时不加锁，只在 epoch 临界区中读取各个文件夹的子文件列表，
+/// 最后按 mode 锁住路径末尾的文件，末尾是硬链接时锁住链接到的文件。
+/// 路径上的节点在返回之后仍然有效，调用者需持有整棵树的读锁，
+/// 或者自己处于 epoch 临界区中。
+/// \param pathRoot
+/// \param pathStr
+/// \param path
+/// \param mode 成功时对路径末尾文件持有的锁，失败时不持有任何锁
+/// \return
+FsErrors FsPathParseLocked(PATH *pathRoot, const char *pathStr, PATH **path,
+                           FsLockMode mode) {
+  return FsPathParseMode(pathRoot, pathStr, path, mode, true);
+}
+
+/// 解析路径字符串到路径结构，不展开末尾的符号链接，
+/// 用于删除、移动符号链接本身
+/// \param pathRoot
+/// \param pathStr
+/// \param path
+/// \return
+FsErrors FsPathParseLink(PATH *pathRoot, const char *pathStr, PATH **path) {
+  return FsPathParseMode(pathRoot, pathStr, path, FS_LOCK_NONE, false);
+}
+
 /// 缩减路径得到文件名
 /// \param pathStr
 /// \return
@@ -379,12 +556,16 @@ char *FsPathStrGetName(char *pathStr) {
   size_t length = strlen(pathStr);
   char *newName = malloc(sizeof(char) * (length + 1));
   strcpy(newName, pathStr);
+  // 空路径的文件名为空
+  if (!length)
+    return newName;
   char *p = newName + length - 1;
-  while (*p == '/' && *p) {
+  // 先检查边界，不含 '/' 的名字不能读到 newName 之前
+  while (p >= newName && *p == '/') {
     *p = '\0';
     p--;
   }
-  while (*p && p >= newName) {
+  while (p >= newName && *p) {
     if (*p == FS_SPLIT && p != newName + length - 1) {
       size_t length2 = strlen(p + 1);
       char *newNewName = malloc(sizeof(char) * (length2 + 1));
@@ -394,11 +575,6 @@ char *FsPathStrGetName(char *pathStr) {
     }
     p--;
   }
-  if (!*p) {
-    // return p;
-    // return "";
-    *p = '\0';
-  }
   return newName;
 }
 
@@ -409,6 +585,9 @@ char *FsPathStrShift(char *pathStr) {
   size_t length = strlen(pathStr);
   char *dst = malloc(sizeof(char) * (length + 1));
   strcpy(dst, pathStr);
+  // 空路径的上层路径也为空
+  if (!length)
+    return dst;
   char *p = dst + length - 1;
   while (*p && p > dst) {
     if (*p == FS_SPLIT && p != dst + length - 1) {
@@ -417,93 +596,33 @@ char *FsPathStrShift(char *pathStr) {
     }
     p--;
   }
+  // 根目录下的文件，上层路径为 "/"
   if (p == dst)
-    *p = '\0';
+    p[*p == FS_SPLIT] = '\0';
   return dst;
 }
 
-/// FsTree 的内层循环
-/// \param file
-/// \param layer
-/// \param pathStrInput
-/// \return
-FsErrors FsTreeInner(FIL *file, int layer, char *pathStrInput) {
-  if (!file)
-    return FS_OK;
-  // printf("Tree: [%d] %s\n", layer, file->name);
-  if (file->type == REGULAR_FILE) {
-    return FS_NOT_A_DIRECTORY;
-  }
-  // printf("FsTreeInner: %s\n", file->name);
-  // FsFilPrint(file);
-  FsFilSort(file, 0);
-  if (layer == 0)
-    // printf("%s\n", file->name);
-    printf("%s\n", pathStrInput);
-  for (size_t i = 0; i < file->size_children; i++) {
-    FIL *f = file->children[i];
-    if (f->link)
-      continue;
-    for (int j = 0; j < layer + 1; j++)
-      printf("    ");
-#ifdef COLORED
-    printf("%s%s%s", (f->type == REGULAR_FILE ? RESET_COLOR : BLUE), f->name,
-           RESET_COLOR);
-#else
-    printf("%s", f->name);
-#endif
-#ifdef FS_SHOW_DIR_SPLIT
-    if (f->type == DIRECTORY)
-      puts(FS_SPLIT_STR);
-    else
-      puts("");
-#else
-    puts("");
-#endif
-    if (f->type == DIRECTORY) {
-      FsErrors res = FsTreeInner(f, layer + 1, pathStrInput);
-      if (res) {
-        return res;
-      }
-    }
-  }
-  return FS_OK;
-}
-
-/// 删除文件树
+/// 删除文件树：从上层文件夹摘除后交给 EBR，
+/// 等正在无锁读取它的线程都离开临界区后再释放
 /// \param file
 void FsFilDlTree(FIL *file) {
-  FIL *parent = file->parent;
-  int found = -1;
-  for (int i = 0; i < parent->size_children; i++) {
-    FIL *f = parent->children[i];
-    if (f == file) {
-      found = i;
-      break;
-    }
-  }
-  if (found < 0) {
+  if (FsFilRemoveChild(file->parent, file) != FS_OK) {
     PERROR(FS_ERROR, "Internal Error!");
     exit(1);
   }
-  FsFilFree(file);
-  if (parent->size_children == 1) {
-    parent->size_children = 0;
-  } else {
-    parent->children[found] = parent->children[parent->size_children - 1];
-    parent->size_children--;
-    FsFilSort(parent, 0);
-  }
+  // 事务撤销时重新插入；快照可能仍然能看到这棵树
+  if (!FsTxLog(FS_TX_REMOVE, file, file->parent, NULL))
+    FsFilRetire(file);
 }
 
-/// 复制文件结构信息
+/// 复制文件结构信息，整棵副本建好之后才插入 dst
 /// \param src
 /// \param dst
 /// \return
 FsErrors FsFilCopy(FIL *src, FIL *dst) {
   if (!src || !dst)
     return FS_ERROR;
-  if (src->link)
+  if (FS_IS_DOT(src))
     return FS_OK;
   if (dst->type != DIRECTORY) {
     return FS_NOT_A_DIRECTORY;
@@ -515,25 +634,182 @@ FsErrors FsFilCopy(FIL *src, FIL *dst) {
     // return FS_FILE_EXISTS;
     FsFilDlTree(found);
   }
+  // 默认递归复制
+  FsFilAddChild(dst, FsFilClone(src, dst, src->name));
+  return FS_OK;
+}
+
+// 并行复制一个文件夹的任务
+typedef struct {
+  // 被复制的文件夹
+  FIL *src;
+  // 尚未发布的副本，只有 `.`、`..`
+  FIL *dst;
+} FsFilCloneTask;
+
+/// 复制单个文件或者空文件夹，不复制子文件。
+/// 硬链接复制为内容相同的普通文件，符号链接复制为指向相同路径的符号链接
+/// \param src
+/// \param parent
+/// \param name
+/// \return
+static FIL *FsFilCloneNode(FIL *src, FIL *parent, const char *name) {
   FIL *data = NULL;
   if (src->type == DIRECTORY) {
-    FsInitDir(dst, &data, src->name);
+    FsInitDir(parent, &data, name);
   } else {
-    FsInitFile(dst, &data, src->name);
+    FsInitFile(parent, &data, name);
+    if (src->symlink) {
+      data->symlink = strdup(src->symlink);
+      assert(data->symlink);
+    } else {
+      data->content = FsContentClone(src->fs, FsFilTarget(src)->content);
+    }
   }
-  dst->children[dst->size_children++] = data;
-  // 整理顺序
-  FsFilSort(dst, 0);
-  // 默认递归复制
-  if (src->type == DIRECTORY) {
-    for (int i = 0; i < src->size_children; i++) {
-      FsFilCopy(src->children[i], data);
+  return data;
+}
+
+/// 复制文件夹的所有子文件，子文件夹派生为新的任务，可被其他线程窃取
+/// \param pool
+/// \param worker
+/// \param arg FsFilCloneTask
+static void FsFilCloneDir(FsPool *pool, int worker, void *arg) {
+  FsFilCloneTask *task = arg;
+  FIL_LIST *children = task->src->children;
+  // src 的子文件有序，一次分配好整个列表，按顺序填入即可
+  FIL_LIST *list = FsFilListNew(children->size);
+  list->size = 0;
+  for (size_t i = 0; i < task->dst->children->size; i++)
+    list->items[list->size++] = task->dst->children->items[i];
+  free(task->dst->children);
+  task->dst->children = list;
+  for (size_t i = 0; i < children->size; i++) {
+    FIL *f = children->items[i].file;
+    if (FS_IS_DOT(f))
+      continue;
+    FIL *data = FsFilCloneNode(f, task->dst, f->name);
+    list->items[list->size++] = (FIL_ENTRY){data->name, data};
+    if (f->type == DIRECTORY) {
+      FsFilCloneTask *sub = malloc(sizeof(FsFilCloneTask));
+      assert(sub);
+      sub->src = f;
+      sub->dst = data;
+      FsPoolSpawn(pool, worker, FsFilCloneDir, sub);
     }
-  } else {
-    data->size_file = src->size_file;
-    data->content = malloc(sizeof(char) * src->size_file);
-    memcpy(data->content, src->content, src->size_file);
   }
+  free(task);
+}
+
+/// 统计文件树中的文件数量，达到 limit 后停止
+/// \param dir
+/// \param limit
+/// \return
+static size_t FsFilCountUpTo(FIL *dir, size_t limit) {
+  size_t count = 0;
+  for (size_t i = 0; i < dir->children->size && count < limit; i++) {
+    FIL *f = dir->children->items[i].file;
+    if (FS_IS_DOT(f))
+      continue;
+    count++;
+    if (f->type == DIRECTORY)
+      count += FsFilCountUpTo(f, limit - count);
+  }
+  return count;
+}
+
+/// 复制整棵文件树，返回尚未插入 parent 的副本。
+/// 较大的文件夹按子文件夹拆分成任务，由线程池并行复制。
+/// 调用者需保证 src 在复制期间不被修改
+/// \param src
+/// \param parent 副本的上层文件夹
+/// \param name 副本的文件名
+/// \return
+FIL *FsFilClone(FIL *src, FIL *parent, const char *name) {
+  FIL *data = FsFilCloneNode(src, parent, name);
+  if (src->type != DIRECTORY)
+    return data;
+  FsFilCloneTask *task = malloc(sizeof(FsFilCloneTask));
+  assert(task);
+  task->src = src;
+  task->dst = data;
+  // 小文件树直接在当前线程复制，省去创建线程的开销
+  int nthreads = 1;
+  if (FsFilCountUpTo(src, FS_COPY_PARALLEL_MIN) >= FS_COPY_PARALLEL_MIN)
+    nthreads = FsPoolThreads();
+  FsPoolRun(nthreads, FsFilCloneDir, task);
+  return data;
+}
+
+/// 发布文件夹新的子文件列表，旧列表延迟释放或者留给快照。
+/// 调用者需持有 dir 的写锁或整棵树的写锁
+/// \param dir
+/// \param list
+static void FsFilPublishChildren(FIL *dir, FIL_LIST *list) {
+  FIL_LIST *old = dir->children;
+  // 快照需要时先保存旧列表，读者看到新列表时一定能找到它
+  bool keep = FsSnapNeeded(dir);
+  if (keep)
+    FsSnapSave(dir, old, NULL, 0);
+  FS_STORE(dir->children, list);
+  if (!keep)
+    FsEpochRetire(old, free);
+}
+
+/// 把文件按名字顺序插入文件夹，调用者需持有 dir 的写锁。
+/// 复制出新的子文件列表后整体发布，旧列表延迟释放或者留给快照
+/// \param dir
+/// \param file
+static void FsFilInsert(FIL *dir, FIL *file) {
+  FIL_LIST *old = dir->children;
+  FIL_LIST *list = FsFilListNew(old->size + 1);
+  size_t i = FsFilLowerBound(old, file->name);
+  memcpy(list->items, old->items, sizeof(FIL_ENTRY) * i);
+  list->items[i] = (FIL_ENTRY){file->name, file};
+  memcpy(list->items + i + 1, old->items + i,
+         sizeof(FIL_ENTRY) * (old->size - i));
+  FsFilPublishChildren(dir, list);
+}
+
+/// 在所在的文件夹中把文件改名为 name，调用者需持有 dir 的写锁。
+/// 只复制一次子文件列表：整体复制后用一次 memmove 把这一项移到新名字的
+/// 位置，比先摘除再插入少一次分配和发布。
+/// 已经发布的名字可能正在被无锁查找读取，新名字总是重新分配
+/// \param dir file 所在的文件夹
+/// \param file
+/// \param name
+/// \return file 不在 dir 中时返回 FS_ERROR，已有同名文件时返回
+/// FS_FILE_EXISTS
+FsErrors FsFilRename(FIL *dir, FIL *file, const char *name) {
+  FIL_LIST *old = dir->children;
+  size_t from = FsFilLowerBound(old, file->name);
+  if (from == old->size || old->items[from].file != file)
+    return FS_ERROR;
+  if (strcmp(file->name, name) == 0)
+    return FS_OK;
+  if (!*name || FsFilFindByName(dir, name))
+    return FS_FILE_EXISTS;
+  // 新名字在原列表中的位置，排在 file 之后时去掉 file 本身占的一项
+  size_t to = FsFilLowerBound(old, name);
+  if (to > from)
+    to--;
+  FIL_LIST *list = FsFilListNew(old->size);
+  memcpy(list->items, old->items, sizeof(FIL_ENTRY) * old->size);
+  if (to > from)
+    memmove(list->items + from, list->items + from + 1,
+            sizeof(FIL_ENTRY) * (to - from));
+  else
+    memmove(list->items + to + 1, list->items + to,
+            sizeof(FIL_ENTRY) * (from - to));
+  char *oldName = file->name;
+  char *newName = strdup(name);
+  assert(newName);
+  list->items[to] = (FIL_ENTRY){newName, file};
+  FsTxLog(FS_TX_MOVE, file, dir, oldName);
+  file->name_length = strlen(newName);
+  FS_STORE(file->name, newName);
+  FsFilPublishChildren(dir, list);
+  // 旧名字可能正在被无锁查找读取，也可能是快照中列表的键，延迟释放
+  FsSnapRetire(file, oldName, free);
   return FS_OK;
 }
 
@@ -541,30 +817,375 @@ FsErrors FsFilCopy(FIL *src, FIL *dst) {
 /// \param src
 /// \param dst
 /// \return
-FsErrors FsFilMove(FIL *src, FIL *dst) {
+FsErrors FsFilMove(FIL *src, FIL *dst) { return FsFilMoveAs(src, dst, NULL); }
+
+/// 把文件移动到 dst 中，同时改名为 name。
+/// 先从原文件夹摘除再改名、插入，已经发布的列表中的键保持不变
+/// \param src
+/// \param dst
+/// \param name 为 NULL 时不改名
+/// \return
+FsErrors FsFilMoveAs(FIL *src, FIL *dst, const char *name) {
   if (!src || !dst)
     return FS_ERROR;
   if (dst->type != DIRECTORY)
     return FS_NOT_A_DIRECTORY;
-  int parentIndex = -1;
-  for (int i = 0; i < src->parent->size_children; i++) {
-    if (src->parent->children[i] == src) {
-      parentIndex = i;
-      break;
+  if (FS_IS_DOT(src) || !src->parent)
+    return FS_ERROR;
+  // 调用者需持有 renameLock 或整棵树的写锁，此时 parent 关系不会改变
+  FIL *parent = src->parent;
+  // 不能把文件夹移动到自己里面
+  if (src == dst || FsFilIsAncestor(src, dst))
+    return FS_ERROR;
+  FsFilLockPair(parent, dst);
+  FsErrors res = FS_OK;
+  if (parent == dst && name) {
+    // 同一个文件夹中改名，只复制一次子文件列表
+    res = FsFilRename(dst, src, name);
+    FsFilUnlockPair(parent, dst);
+    return res;
+  }
+  FIL *found = FsFilFindByName(dst, name ? name : src->name);
+  if (found && found != src) {
+    res = FS_FILE_EXISTS;
+  } else {
+    res = FsFilRemoveChild(parent, src);
+    if (res == FS_OK) {
+      // 事务撤销时移回 parent，改名时还原旧名字
+      FsTxLog(FS_TX_MOVE, src, parent, name ? src->name : NULL);
+      src->parent = dst;
+      // 更新 `..` 链接，src 在 parent 之下，加锁顺序仍然是自上而下
+      if (src->type == DIRECTORY) {
+        pthread_rwlock_wrlock(&src->lock);
+        FS_STORE(src->children->items[1].file->link, dst);
+        pthread_rwlock_unlock(&src->lock);
+      }
+      if (name) {
+        // 旧名字可能正在被无锁查找读取，也可能是快照中列表的键，延迟释放
+        char *oldName = src->name;
+        char *newName = strdup(name);
+        assert(newName);
+        src->name_length = strlen(newName);
+        FS_STORE(src->name, newName);
+        FsSnapRetire(src, oldName, free);
+      }
+      FsFilInsert(dst, src);
+    }
+  }
+  FsFilUnlockPair(parent, dst);
+  return res;
+}
+
+/// 把新的文件插入文件夹，调用者需持有 dir 的写锁。
+/// 事务撤销时删除这个文件
+/// \param dir
+/// \param file
+void FsFilAddChild(FIL *dir, FIL *file) {
+  FsFilInsert(dir, file);
+  FsTxLog(FS_TX_ADD, file, dir, NULL);
+}
+
+// FsFilMoveBatch、FsFilCopyBatch 中的一个文件
+typedef struct {
+  FIL *file;
+  // 在参数中的下标，同名时按参数的顺序处理
+  size_t index;
+} FsFilBatchItem;
+
+/// 按名字排序，同名时按参数的顺序
+/// \param a
+/// \param b
+/// \return
+static int FsFilBatchByName(const void *a, const void *b) {
+  const FsFilBatchItem *x = a;
+  const FsFilBatchItem *y = b;
+  int c = strcmp(x->file->name, y->file->name);
+  if (c)
+    return c;
+  return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/// 按上层文件夹分组，组内按名字排序
+/// \param a
+/// \param b
+/// \return
+static int FsFilBatchByParent(const void *a, const void *b) {
+  const FsFilBatchItem *x = a;
+  const FsFilBatchItem *y = b;
+  if (x->file->parent != y->file->parent)
+    return x->file->parent < y->file->parent ? -1 : 1;
+  return FsFilBatchByName(a, b);
+}
+
+/// 从文件夹中一次摘除多个文件，只复制一次子文件列表
+/// \param dir
+/// \param items 都在 dir 中，按名字排好序
+/// \param n
+static void FsFilDetach(FIL *dir, FsFilBatchItem *items, size_t n) {
+  FIL_LIST *old = dir->children;
+  FIL_LIST *list = FsFilListNew(old->size - n);
+  size_t size = 0;
+  size_t j = 0;
+  // 子文件列表也按名字排序，一趟归并即可跳过所有要摘除的文件
+  for (size_t i = 0; i < old->size; i++) {
+    if (j < n && old->items[i].file == items[j].file)
+      j++;
+    else
+      list->items[size++] = old->items[i];
+  }
+  assert(j == n && size == list->size);
+  FsFilPublishChildren(dir, list);
+}
+
+/// 把多个文件一次合并进文件夹的子文件列表，dir 中同名的文件被替换
+/// \param dir
+/// \param items 按名字排好序，没有重名
+/// \param n
+static void FsFilMerge(FIL *dir, FsFilBatchItem *items, size_t n) {
+  FIL_LIST *old = dir->children;
+  FIL_LIST *list = FsFilListNew(old->size + n);
+  size_t size = 0;
+  size_t i = 0;
+  size_t j = 0;
+  // `.`、`..` 在列表开头
+  while (i < old->size && FS_IS_DOT(old->items[i].file))
+    list->items[size++] = old->items[i++];
+  while (i < old->size || j < n) {
+    int c = i == old->size ? 1
+            : j == n       ? -1
+                           : strcmp(old->items[i].name, items[j].file->name);
+    if (c < 0) {
+      list->items[size++] = old->items[i++];
+    } else {
+      if (c == 0)
+        i++;
+      FIL *file = items[j++].file;
+      list->items[size++] = (FIL_ENTRY){file->name, file};
     }
   }
-  if (parentIndex < 0)
+  list->size = size;
+  FsFilPublishChildren(dir, list);
+}
+
+/// 把多个新文件一次插入文件夹，只复制一次子文件列表。
+/// 调用者需持有整棵树的写锁。事务撤销时删除这些文件
+/// \param dir
+/// \param files 按名字排好序，与 dir 中的文件都不重名
+/// \param n
+void FsFilAddChildren(FIL *dir, FIL **files, size_t n) {
+  if (!n)
+    return;
+  FsFilBatchItem *items = malloc(sizeof(FsFilBatchItem) * n);
+  assert(items);
+  for (size_t i = 0; i < n; i++)
+    items[i] = (FsFilBatchItem){files[i], i};
+  FsFilMerge(dir, items, n);
+  free(items);
+  for (size_t i = 0; i < n; i++)
+    FsTxLog(FS_TX_ADD, files[i], dir, NULL);
+}
+
+/// 把多个文件一起移动到 dst 中，调用者需持有整棵树的写锁。
+/// 按上层文件夹分组，每个文件夹只摘除一次；移动的文件排好序后与 dst 的
+/// 子文件列表一次归并。依次 FsFilMove 每次都要复制 dst 的整个列表，
+/// 移动 k 个文件的代价为 O(k·m)，这里为 O(m + k log k)
+/// \param files
+/// \param n
+/// \param dst 文件夹
+/// \param results 每个文件的结果，与 FsFilMove 相同；
+/// 已经在 dst 中的文件什么也不做，同名的文件只移动第一个
+void FsFilMoveBatch(FIL **files, size_t n, FIL *dst, FsErrors *results) {
+  FsFilBatchItem *items = malloc(sizeof(FsFilBatchItem) * (n ? n : 1));
+  assert(items);
+  size_t k = 0;
+  for (size_t i = 0; i < n; i++) {
+    FIL *file = files[i];
+    results[i] = FS_OK;
+    if (FS_IS_DOT(file) || !file->parent || file == dst ||
+        FsFilIsAncestor(file, dst))
+      results[i] = FS_ERROR;
+    else if (file->parent != dst)
+      items[k++] = (FsFilBatchItem){file, i};
+  }
+  qsort(items, k, sizeof(FsFilBatchItem), FsFilBatchByName);
+  size_t m = 0;
+  for (size_t i = 0; i < k; i++) {
+    FsFilBatchItem *item = &items[i];
+    if (m && strcmp(items[m - 1].file->name, item->file->name) == 0) {
+      // 同一个文件出现两次时第二次什么也不做
+      if (items[m - 1].file != item->file)
+        results[item->index] = FS_FILE_EXISTS;
+    } else if (FsFilFindByName(dst, item->file->name)) {
+      results[item->index] = FS_FILE_EXISTS;
+    } else {
+      items[m++] = *item;
+    }
+  }
+  FsFilBatchItem *groups = malloc(sizeof(FsFilBatchItem) * (m ? m : 1));
+  assert(groups);
+  memcpy(groups, items, sizeof(FsFilBatchItem) * m);
+  qsort(groups, m, sizeof(FsFilBatchItem), FsFilBatchByParent);
+  for (size_t i = 0, j; i < m; i = j) {
+    for (j = i + 1; j < m && groups[j].file->parent == groups[i].file->parent;)
+      j++;
+    FsFilDetach(groups[i].file->parent, groups + i, j - i);
+  }
+  free(groups);
+  for (size_t i = 0; i < m; i++) {
+    FIL *file = items[i].file;
+    // 事务撤销时逐个移回原来的文件夹
+    FsTxLog(FS_TX_MOVE, file, file->parent, NULL);
+    file->parent = dst;
+    if (file->type == DIRECTORY)
+      FS_STORE(file->children->items[1].file->link, dst);
+  }
+  FsFilMerge(dst, items, m);
+  free(items);
+}
+
+/// 把多个文件的副本一起放进 dst 中，调用者需持有整棵树的写锁。
+/// 与依次 FsFilCopy 的结果相同：dst 中同名的文件被替换，
+/// 同名的源文件后面的覆盖前面的；所有副本建好之后与 dst 的子文件列表一次归并
+/// \param files
+/// \param n
+/// \param dst 文件夹
+/// \param results 每个文件的结果，与 FsFilCopy 相同
+void FsFilCopyBatch(FIL **files, size_t n, FIL *dst, FsErrors *results) {
+  FsFilBatchItem *items = malloc(sizeof(FsFilBatchItem) * (n ? n : 1));
+  assert(items);
+  size_t k = 0;
+  for (size_t i = 0; i < n; i++) {
+    results[i] = FS_OK;
+    if (!FS_IS_DOT(files[i]))
+      items[k++] =
+          (FsFilBatchItem){FsFilClone(files[i], dst, files[i]->name), i};
+  }
+  qsort(items, k, sizeof(FsFilBatchItem), FsFilBatchByName);
+  // 被替换的文件在发布新列表之后删除
+  FIL **replaced = malloc(sizeof(FIL *) * (k ? k : 1));
+  assert(replaced);
+  size_t m = 0;
+  size_t r = 0;
+  for (size_t i = 0; i < k; i++) {
+    FIL *file = items[i].file;
+    if (i + 1 < k && strcmp(file->name, items[i + 1].file->name) == 0) {
+      // 尚未发布，直接释放
+      FsFilFree(file);
+      continue;
+    }
+    FIL *found = FsFilFindByName(dst, file->name);
+    if (found)
+      replaced[r++] = found;
+    items[m++] = items[i];
+  }
+  FsFilMerge(dst, items, m);
+  // 事务撤销时先删除副本，再放回被替换的文件
+  for (size_t i = 0; i < r; i++) {
+    if (!FsTxLog(FS_TX_REMOVE, replaced[i], dst, NULL))
+      FsFilRetire(replaced[i]);
+  }
+  for (size_t i = 0; i < m; i++)
+    FsTxLog(FS_TX_ADD, items[i].file, dst, NULL);
+  free(replaced);
+  free(items);
+}
+
+/// 从文件夹中移除文件（不释放），保持其余文件的顺序，调用者需持有 dir 的写锁
+/// \param dir
+/// \param file
+/// \return
+FsErrors FsFilRemoveChild(FIL *dir, FIL *file) {
+  FIL_LIST *old = dir->children;
+  size_t i = FsFilLowerBound(old, file->name);
+  if (i == old->size || old->items[i].file != file)
+    return FS_ERROR;
+  FIL_LIST *list = FsFilListNew(old->size - 1);
+  memcpy(list->items, old->items, sizeof(FIL_ENTRY) * i);
+  memcpy(list->items + i, old->items + i + 1,
+         sizeof(FIL_ENTRY) * (old->size - i - 1));
+  FsFilPublishChildren(dir, list);
+  return FS_OK;
+}
+
+/// 判断 ancestor 是否是 file 的上层文件夹
+/// \param ancestor
+/// \param file
+/// \return
+bool FsFilIsAncestor(FIL *ancestor, FIL *file) {
+  for (FIL *f = file->parent; f; f = f->parent) {
+    if (f == ancestor)
+      return true;
+  }
+  return false;
+}
+
+/// 给两个文件夹加写锁：有祖先关系时先锁上层，否则按地址顺序，
+/// 与 FsPathParseLocked 自上而下的加锁顺序一致，不会死锁
+/// \param a
+/// \param b
+void FsFilLockPair(FIL *a, FIL *b) {
+  if (a == b) {
+    pthread_rwlock_wrlock(&a->lock);
+    return;
+  }
+  if (FsFilIsAncestor(b, a) || (!FsFilIsAncestor(a, b) && b < a)) {
+    FIL *tmp = a;
+    a = b;
+    b = tmp;
+  }
+  pthread_rwlock_wrlock(&a->lock);
+  pthread_rwlock_wrlock(&b->lock);
+}
+
+/// 释放 FsFilLockPair 加的锁
+/// \param a
+/// \param b
+void FsFilUnlockPair(FIL *a, FIL *b) {
+  pthread_rwlock_unlock(&a->lock);
+  if (a != b)
+    pthread_rwlock_unlock(&b->lock);
+}
+
+/// DEBUG: 检查文件树结构是否一致：
+/// parent 指向所在文件夹，`.`、`..` 链接正确，children 有序且没有重名
+/// \param dir
+/// \param count 累加树中的文件数量，可为 NULL
+/// \return
+FsErrors FsFilCheck(FIL *dir, size_t *count) {
+  if (dir->type != DIRECTORY || FS_IS_DOT(dir))
+    return FS_NOT_A_DIRECTORY;
+  FIL_LIST *children = dir->children;
+  if (children->size < 2 || children->items[0].file->link != dir ||
+      children->items[1].file->link != (dir->parent ? dir->parent : dir)) {
+    printf("check: '%s': bad links\n", dir->name);
     return FS_ERROR;
-  if (src->parent->size_children == 1) {
-    src->parent->size_children = 0;
-  } else {
-    src->parent->children[parentIndex] =
-        src->parent->children[--src->parent->size_children];
-    FsFilSort(src->parent, 0);
   }
-  src->parent = dst;
-  dst->children[dst->size_children++] = src;
-  FsFilSort(dst, 0);
+  for (size_t i = 2; i < children->size; i++) {
+    FIL *f = children->items[i].file;
+    if (FS_IS_DOT(f) || f->parent != dir ||
+        children->items[i].name != f->name) {
+      printf("check: '%s': bad parent of '%s'\n", dir->name, f->name);
+      return FS_ERROR;
+    }
+    // 硬链接直接指向共享内容的普通文件
+    FIL *target = FsFilTarget(f);
+    if (target != f && (target->link || target->type != REGULAR_FILE)) {
+      printf("check: '%s': bad hard link '%s'\n", dir->name, f->name);
+      return FS_ERROR;
+    }
+    if (i > 2 && strcmp(children->items[i - 1].name, f->name) >= 0) {
+      printf("check: '%s': children out of order at '%s'\n", dir->name,
+             f->name);
+      return FS_ERROR;
+    }
+    if (count)
+      (*count)++;
+    if (f->type == DIRECTORY) {
+      FsErrors res = FsFilCheck(f, count);
+      if (res)
+        return res;
+    }
+  }
   return FS_OK;
 }
 
@@ -573,7 +1194,157 @@ FsErrors FsFilMove(FIL *src, FIL *dst) {
 /// \param pathStr
 void FsPrint(Fs fs, char *pathStr) {
   PATH *path = NULL;
-  FsPathParse(fs->pathRoot, pathStr, &path);
-  FsFilPrint(FsPathGetTail(path)->file);
+  FsTreeRdlock(fs);
+  if (FsPathParseLocked(FsCwdGet(fs)->pathRoot, pathStr, &path,
+                        FS_LOCK_READ) == FS_OK) {
+    FIL *file = FsPathGetTail(path)->file;
+    FsFilPrint(file);
+    pthread_rwlock_unlock(&FsFilTarget(file)->lock);
+  }
+  FsTreeUnlock(fs);
   FsPathFree(path);
 }
+
+// 当前线程在各个文件系统中的工作目录，用 threadNext 连成链表。
+// 所有文件系统共用一个 key，只用于线程退出时释放链表，
+// 快照和事务再多也不会用完 PTHREAD_KEYS_MAX 个 key
+static __thread FsCwd *threadCwds = NULL;
+static pthread_key_t cwdKey;
+static pthread_once_t cwdKeyOnce = PTHREAD_ONCE_INIT;
+// 保护所有文件系统的 cwds 链表，以及其中工作目录的 fs、pathRoot
+static pthread_mutex_t cwdLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void FsCwdKeyInit(void) {
+  int res = pthread_key_create(&cwdKey, FsCwdFree);
+  assert(res == 0);
+  (void)res;
+}
+
+/// 从当前线程的链表中摘除并释放所属文件系统已经释放的工作目录
+static void FsCwdPrune(void) {
+  for (FsCwd **p = &threadCwds; *p;) {
+    FsCwd *cwd = *p;
+    if (FS_LOAD(cwd->fs)) {
+      p = &cwd->threadNext;
+      continue;
+    }
+    *p = cwd->threadNext;
+    free(cwd);
+  }
+  pthread_setspecific(cwdKey, threadCwds);
+}
+
+/// 只含根目录的路径
+static PATH *FsCwdRootPath(Fs fs) {
+  PATH *path = malloc(sizeof(PATH));
+  assert(path);
+  memset(path, 0, sizeof(PATH));
+  path->file = fs->root;
+  return path;
+}
+
+/// 修改当前线程的工作目录，与 FsFilRetire 的检查互斥
+/// \param cwd
+/// \param path 新的路径，由工作目录接管；NULL 表示根目录
+void FsCwdSet(FsCwd *cwd, PATH *path) {
+  if (!path)
+    path = FsCwdRootPath(cwd->fs);
+  pthread_mutex_lock(&cwdLock);
+  PATH *old = cwd->pathRoot;
+  cwd->pathRoot = path;
+  cwd->current = FsPathGetTail(path);
+  FS_STORE(cwd->stale, false);
+  pthread_mutex_unlock(&cwdLock);
+  FsPathFree(old);
+}
+
+/// 删除文件树之后调用：把位于树中的工作目录标记为失效，再交给 EBR 回收。
+/// 只比较路径上的指针，不访问其中的文件
+/// \param file 已经从上层文件夹摘除的文件树
+void FsFilRetire(FIL *file) {
+  if (file->fs) {
+    pthread_mutex_lock(&cwdLock);
+    for (FsCwd *cwd = file->fs->cwds; cwd; cwd = cwd->next) {
+      for (PATH *p = cwd->pathRoot; p && !cwd->stale; p = p->next) {
+        if (p->file == file)
+          __atomic_store_n(&cwd->stale, true, __ATOMIC_SEQ_CST);
+      }
+    }
+    pthread_mutex_unlock(&cwdLock);
+  }
+  FsSnapRetire(file, file, FsFilFreeRetired);
+}
+
+/// 获取当前线程的工作目录，第一次访问时初始化为根目录。
+/// 同时把当前线程切换到 fs 的视图，之后的读取按 fs 进行
+/// \param fs
+/// \return
+FsCwd *FsCwdGet(Fs fs) {
+  FsViewSet(FsViewOf(fs));
+  // 一个线程通常只访问少数几个文件系统，顺序查找即可
+  for (FsCwd *cwd = threadCwds; cwd; cwd = cwd->threadNext) {
+    if (FS_LOAD(cwd->fs) != fs)
+      continue;
+    // 工作目录所在的树已经删除，回到根目录。
+    // 删除的线程先标记再回收，调用者已经进入临界区或持有锁，
+    // 这里读到 false 时路径上的文件还没有释放
+    if (__atomic_load_n(&cwd->stale, __ATOMIC_SEQ_CST))
+      FsCwdSet(cwd, NULL);
+    return cwd;
+  }
+  pthread_once(&cwdKeyOnce, FsCwdKeyInit);
+  FsCwdPrune();
+  FsCwd *cwd = malloc(sizeof(FsCwd));
+  assert(cwd);
+  memset(cwd, 0, sizeof(FsCwd));
+  cwd->pathRoot = FsCwdRootPath(fs);
+  cwd->current = cwd->pathRoot;
+  cwd->fs = fs;
+  pthread_mutex_lock(&cwdLock);
+  cwd->next = fs->cwds;
+  if (fs->cwds)
+    fs->cwds->forward = cwd;
+  fs->cwds = cwd;
+  pthread_mutex_unlock(&cwdLock);
+  cwd->threadNext = threadCwds;
+  threadCwds = cwd;
+  pthread_setspecific(cwdKey, threadCwds);
+  return cwd;
+}
+
+/// 释放一个线程的所有工作目录，线程退出时由 pthread_key 自动调用
+/// \param cwds 线程的工作目录链表
+void FsCwdFree(void *cwds) {
+  pthread_mutex_lock(&cwdLock);
+  for (FsCwd *c = cwds; c;) {
+    FsCwd *next = c->threadNext;
+    if (c->fs) {
+      if (c->forward)
+        c->forward->next = c->next;
+      else
+        c->fs->cwds = c->next;
+      if (c->next)
+        c->next->forward = c->forward;
+      FsPathFree(c->pathRoot);
+    }
+    free(c);
+    c = next;
+  }
+  pthread_mutex_unlock(&cwdLock);
+}
+
+/// 释放文件系统时调用：释放它在各个线程中的工作目录的路径，并把工作目录
+/// 标记为已释放。工作目录本身属于各自的线程，由线程摘除后释放
+/// \param fs
+void FsCwdDetach(Fs fs) {
+  pthread_mutex_lock(&cwdLock);
+  for (FsCwd *cwd = fs->cwds; cwd; cwd = cwd->next) {
+    FsPathFree(cwd->pathRoot);
+    cwd->pathRoot = NULL;
+    cwd->current = NULL;
+    FS_STORE(cwd->fs, NULL);
+  }
+  fs->cwds = NULL;
+  pthread_mutex_unlock(&cwdLock);
+  FsCwdPrune();
+}
@@ -8,9 +8,20 @@
 // function prototypes here
 
 // Written by:
+#include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "epoch.h"
+
+// 文件内容缓冲区扩容时的最小容量
+#define FS_CONTENT_MIN_CAPACITY 64
+// 大文件分块存储时每一块的字节数
+#define FS_CHUNK_SIZE (64 * 1024)
+// 文件内容超过这个字节数时改为分块存储
+#define FS_CHUNK_THRESHOLD (16 * FS_CHUNK_SIZE)
+
 typedef enum {
   FS_OK = 0,
   FS_ERROR,
@@ -18,9 +29,97 @@ typedef enum {
   FS_NO_SUCH_FILE,
   FS_IS_A_DIRECTORY,
   FS_NOT_A_DIRECTORY,
-  FS_DIRECTORY_NOT_EMPTY
+  FS_DIRECTORY_NOT_EMPTY,
+  FS_BAD_FILE_DESCRIPTOR,
+  FS_TOO_MANY_LINKS,
+  FS_READ_ONLY
 } FsErrors;
 
+// 子文件列表中的一项。name 是插入时的文件名，作为有序索引的键：
+// 改名时发布新的列表，已经发布的列表中的键不会改变
+struct FIL_ENTRY_t {
+  const char *name;
+  struct FIL_t *file;
+};
+
+typedef struct FIL_ENTRY_t FIL_ENTRY;
+
+// 文件夹的子文件列表。开头是 `.`、`..`，其余按文件名的字典序排列。
+// 发布之后不再修改：写者复制一份修改后整体替换，
+// 旧列表交给 FsEpochRetire 延迟释放，读者无需加锁即可遍历、二分查找
+struct FIL_LIST_t {
+  // 子文件数量
+  size_t size;
+  FIL_ENTRY items[];
+};
+
+typedef struct FIL_LIST_t FIL_LIST;
+
+// 大文件内容中固定大小的一块，可以被多个文件共享，修改前先复制
+struct FIL_CHUNK_t {
+  // 引用这一块的文件内容数量
+  size_t refs;
+  char data[FS_CHUNK_SIZE];
+};
+
+typedef struct FIL_CHUNK_t FIL_CHUNK;
+
+// 文件内容，超过 FS_CHUNK_THRESHOLD 时分块存储。
+// 读者先后用 FS_LOAD 读取 content 和 length，只访问前 length 个字节；
+// 写者可以在 length 之后原地追加，写好后再发布新的 length，
+// 覆盖已经发布的字节时复制出新的缓冲区或新的块，见 content.c。
+// 去重存储中的内容被多个文件共享，不再修改，见 store.c。
+// 压缩的内容和溢出到文件的内容不能直接读取，读者先用 FsFilContentLoad
+// 解压、读回内存
+struct FIL_CONTENT_t {
+  // 有效字节数
+  size_t length;
+  // 连续存储时为 data 的字节数，不包括末尾的 '\0'；
+  // 分块存储时为 chunks 的项数
+  size_t capacity;
+  // 分块存储时为块索引，第 i 项保存 [i * FS_CHUNK_SIZE, (i + 1) *
+  // FS_CHUNK_SIZE) 的内容，NULL 表示全 0，用 FS_LOAD 读取；
+  // 连续存储时为 NULL
+  FIL_CHUNK **chunks;
+  // 在去重存储中时为共享这份内容的文件数量，否则为 0
+  size_t refs;
+  // 在去重存储中时为内容的哈希值和同一个哈希桶中的下一项
+  uint64_t hash;
+  struct FIL_CONTENT_t *next;
+  // 压缩存储时为 data 中压缩后的字节数，否则为 0
+  size_t compressed;
+  // 溢出到文件时为所在的溢出文件和偏移，data 为空，capacity 为文件中的
+  // 字节数；在内存中时为 NULL
+  struct FsSpill_t *spill;
+  uint64_t offset;
+  // 连续存储时在 length 处以 '\0' 结尾；分块存储时用作 chunks 的空间
+  char data[];
+};
+
+typedef struct FIL_CONTENT_t FIL_CONTENT;
+
+// 溢出文件，见 spill.c
+typedef struct FsSpill_t FsSpill;
+
+// 快照之后第一次修改节点之前保存的旧版本，保存后不再修改，见 snapshot.c。
+// 编号不小于快照编号的版本中最旧的一个就是该快照看到的节点
+struct FsVersion_t {
+  // 保存时最新的快照编号
+  uint64_t gen;
+  // 文件夹的子文件列表
+  FIL_LIST *children;
+  // 文件的内容及其字节数，内容总是可以直接读取
+  FIL_CONTENT *content;
+  size_t length;
+  // 同一个节点更早的版本
+  struct FsVersion_t *next;
+  // 所属的节点和同一个文件系统中的下一个版本，释放所有快照时使用
+  struct FIL_t *file;
+  struct FsVersion_t *all;
+};
+
+typedef struct FsVersion_t FsVersion;
+
 struct FIL_t {
   // 文件类型：文件夹 / 文件
   FileType type;
@@ -28,22 +127,47 @@ struct FIL_t {
   char *name;
   // 文件名长度
   size_t name_length;
-  // 当 link != NULL 的时候表示这个文件是某文件的链接
+  // 当 link != NULL 的时候表示这个文件是某文件的链接：
+  // 文件夹中的 `.`、`..` 指向文件夹自身或上层，用 FS_IS_DOT 判断；
+  // 硬链接是普通文件，指向共享内容的文件，读写都转到那个文件上
   struct FIL_t *link;
+  // 符号链接指向的路径，解析路径时展开；其他文件为 NULL
+  char *symlink;
   // 上层文件
   struct FIL_t *parent;
-  // 子文件列表
-  struct FIL_t **children;
-  // 子文件数量大小
-  size_t size_children;
-  // 文件大小
-  size_t size_file;
-  // 文件内容
-  char *content;
+  // 子文件列表，用 FS_LOAD 读取，用 FS_STORE 发布
+  FIL_LIST *children;
+  // 文件内容，空文件为 NULL
+  FIL_CONTENT *content;
+  // 读写锁：文件夹串行化对 children 的修改，文件串行化对 content 的修改；
+  // 读 children、content 不加锁
+  pthread_rwlock_t lock;
+  // 文件的引用计数：文件树中的一份加上每个打开的句柄和每个硬链接，
+  // 归零时才释放
+  size_t refs;
+  // 文件树中指向这个文件的名字数量，包括自身和每个硬链接，用原子操作读写
+  size_t links;
+  // 最后一次读写的时间（毫秒，FsClockMs），用原子操作读写
+  uint64_t accessed;
+  // 后台压缩上一次处理这个文件时的 accessed + 1，之后没有读写过就不再尝试
+  uint64_t compacted;
+  // 所属的文件系统，根目录的 `.`、`..` 为 NULL
+  struct FsRep *fs;
+  // 创建时文件系统的快照编号，只有编号更大的快照能看到这个文件
+  uint64_t born;
+  // 上一次保存旧版本时的快照编号，调用者需持有文件的写锁
+  uint64_t saved;
+  // 为快照保存的旧版本，从新到旧，用 FS_LOAD 读取
+  FsVersion *versions;
+  // 上一次在事务中保存旧内容时的事务序号，见 tx.c
+  uint64_t txSaved;
 };
 
 typedef struct FIL_t FIL;
 
+// 是否是文件夹开头的 `.`、`..`
+#define FS_IS_DOT(file) ((file)->type == DIRECTORY && FS_LOAD((file)->link))
+
 struct PATH_t {
   struct FIL_t *file;
   struct PATH_t *forward;
@@ -52,20 +176,240 @@ struct PATH_t {
 
 typedef struct PATH_t PATH;
 
-// 储存文件系统相关信息
-struct FsRep {
-  // 根文件目录
-  FIL *root;
+// FsPathParseLocked 返回时对路径末尾文件持有的锁
+typedef enum {
+  FS_LOCK_NONE = 0,
+  FS_LOCK_READ,
+  FS_LOCK_WRITE
+} FsLockMode;
+
+// 事务的撤销日志记录的修改，见 tx.c
+typedef enum {
+  // 插入新的文件
+  FS_TX_ADD,
+  // 删除文件树，提交之前不释放
+  FS_TX_REMOVE,
+  // 移动或改名
+  FS_TX_MOVE,
+  // 修改文件内容
+  FS_TX_CONTENT
+} FsTxKind;
+
+// 每个线程独立的工作目录
+struct FsCwd_t {
   // 当前目录（双向链表尾部）
   PATH *current;
   // 当前路径（双向链表头部）
   PATH *pathRoot;
+  // 所属文件系统
+  struct FsRep *fs;
+  // 同一文件系统下的所有工作目录组成链表，便于 FsFree 统一释放
+  struct FsCwd_t *forward;
+  struct FsCwd_t *next;
+  // 同一线程在其他文件系统中的工作目录
+  struct FsCwd_t *threadNext;
+  // 路径上的某个文件夹已经删除，下次访问时回到根目录
+  bool stale;
+};
+
+typedef struct FsCwd_t FsCwd;
+
+// 储存文件系统相关信息
+struct FsRep {
+  // 根文件目录
+  FIL *root;
+  // 整棵树的读写锁：不释放节点的操作加读锁，再按需要锁住各自的文件夹；
+  // 删除节点、改名等操作加写锁独占整棵树
+  pthread_rwlock_t lock;
+  // 跨文件夹移动时持有，保证祖先关系在加锁期间不变
+  pthread_mutex_t renameLock;
+  // 各个线程在这个文件系统中的工作目录，由 utility.c 中的 cwdLock 保护
+  FsCwd *cwds;
+  // 后台压缩线程，compacting 为 false 时退出，见 compact.c
+  pthread_t compactor;
+  bool compacting;
+  // 多长时间没有读写的文件被压缩（毫秒）
+  unsigned int compactIdle;
+  pthread_mutex_t compactLock;
+  pthread_cond_t compactCond;
+  // 内存预算和溢出文件，没有设置预算时为 NULL，见 spill.c
+  FsSpill *spill;
+  pthread_mutex_t spillLock;
+  // 写入的内容是否进入去重存储，默认关闭，见 store.c
+  bool dedup;
+  // 快照的编号，当前的文件系统为 0；快照的 live 指向所属的文件系统，
+  // 同一个文件系统的快照按编号从大到小组成链表，见 snapshot.c
+  uint64_t snapshot;
+  struct FsRep *live;
+  struct FsRep *snapNext;
+  // 当前的文件系统：所有快照、最后分配的快照编号、仍然存在的最新快照编号，
+  // 后两者只在持有整棵树的写锁时修改
+  struct FsRep *snapshots;
+  uint64_t snapClock;
+  uint64_t snapLatest;
+  // 所有旧版本和所有快照释放之后才能释放的内存
+  FsVersion *versions;
+  struct FsSnapGarbage_t *garbage;
+  pthread_mutex_t snapLock;
+  // 事务：开始时创建的快照，其他线程在事务期间读取它，txView 为它的编号，
+  // 没有事务时为 0。其余字段只由持有事务的线程读写，见 tx.c
+  struct FsRep *txSnapshot;
+  uint64_t txView;
+  uint64_t txSeq;
+  bool txUndoing;
+  struct FsTxRecord_t *txLog;
+  size_t txSize;
+  size_t txCapacity;
 };
 
 #ifndef Fs
 typedef struct FsRep *Fs;
 #endif
 
+// FsWalk 访问者的返回值
+typedef enum {
+  // 继续遍历
+  FS_WALK_CONTINUE = 0,
+  // 不进入这个文件夹
+  FS_WALK_PRUNE,
+  // 结束整个遍历
+  FS_WALK_STOP
+} FsWalkAction;
+
+// FsWalk 访问到的文件
+typedef struct {
+  FIL *file;
+  // 文件路径，以遍历起点的路径开头，只在访问者返回之前有效
+  const char *path;
+  // 遍历起点的深度为 0
+  int depth;
+  // 执行访问者的线程编号，小于 nthreads，可用于按线程分别统计
+  int worker;
+} FsWalkEntry;
+
+// 无序模式下访问者会在多个线程中同时执行
+typedef FsWalkAction (*FsWalkVisitor)(const FsWalkEntry *entry, void *ctx);
+
+// FsWalk 的 nthreads 为此值时在当前线程中按先序、字典序遍历
+#define FS_WALK_ORDERED 0
+
+// FsFind 不限文件类型
+#define FS_FIND_ANY_TYPE -1
+
+// FsFind 的过滤条件
+typedef struct {
+  // REGULAR_FILE、DIRECTORY 或者 FS_FIND_ANY_TYPE
+  int type;
+  // 最大深度，起点为 0，小于 0 时不限
+  int maxDepth;
+  // 文件内容字节数范围（包含两端），设置后只匹配文件
+  size_t minSize;
+  size_t maxSize;
+} FsFindFlags;
+
+#define FS_FIND_FLAGS_ANY                                                      \
+  { FS_FIND_ANY_TYPE, -1, 0, SIZE_MAX }
+
+// 每个匹配的文件调用一次
+typedef void (*FsFindCallback)(const FsWalkEntry *entry, void *ctx);
+
+// FsPrefix 对每个匹配的文件调用一次，name 为列表中的文件名
+typedef void (*FsPrefixCallback)(FIL *file, const char *name, void *ctx);
+
+// 静默接口的错误详情，调用者可以传入 NULL
+typedef struct {
+  // 出错的路径，指向调用者传入的路径之一；没有出错或与路径无关时为 NULL
+  const char *path;
+  // 上层文件夹已经找到，错误发生在最后一个名字上
+  bool last;
+  // 由调用者分配，每个源路径一项，FsCpQuiet、FsMvQuiet 填入每个源路径的
+  // 结果；为 NULL 时不填写
+  FsErrors *results;
+} FsErrorInfo;
+
+// FsImportDir、FsTarRead、FsTarWrite 的统计结果
+typedef struct {
+  size_t files;
+  size_t directories;
+  size_t symlinks;
+  // 普通文件内容的总字节数
+  uint64_t bytes;
+  // 导入时跳过的特殊文件、读取失败的文件和文件夹，
+  // 以及归档中冲突或者含有 `..` 的项
+  size_t skipped;
+} FsImportStats;
+
+// FsCatQuiet 逐段调用，data 不以 '\0' 结尾
+typedef void (*FsDataCallback)(const char *data, size_t length, void *ctx);
+
+// FsGrep 每个匹配的行调用一次，text 不以 '\0' 结尾
+typedef void (*FsGrepCallback)(const char *path, size_t line,
+                               const char *text, size_t length, void *ctx);
+
+// FsStatsGet 的统计结果
+typedef struct {
+  // 文件和文件夹的数量，包括起点本身
+  size_t files;
+  size_t directories;
+  // 文件内容的字节数之和
+  size_t bytes;
+  // 去重、共享之后实际占用的字节数
+  size_t storedBytes;
+  // 整个进程的去重存储中的内容数量及其字节数
+  size_t storeEntries;
+  size_t storeBytes;
+  // 统计的文件系统是否开启了去重
+  bool dedup;
+  // 压缩存储的文件数量和压缩节省的字节数
+  size_t compressedFiles;
+  size_t compressedSaved;
+  // 整个进程中解压的次数和总耗时（纳秒）
+  size_t decompressions;
+  uint64_t decompressNs;
+  // 整个进程中文件内容占用的内存
+  size_t residentBytes;
+  // 溢出到文件的文件数量及其在文件中的字节数
+  size_t spilledFiles;
+  size_t spilledBytes;
+  // 整个进程中溢出和读回的次数，读回的总耗时（纳秒）
+  size_t spills;
+  size_t faults;
+  uint64_t faultNs;
+} FsStatsInfo;
+
+// FsOpen 的打开方式，可以组合使用
+typedef enum {
+  FS_OPEN_READ = 1,
+  FS_OPEN_WRITE = 2,
+  // 文件不存在时创建，需要 FS_OPEN_WRITE
+  FS_OPEN_CREATE = 4,
+  // 打开时清空内容，需要 FS_OPEN_WRITE
+  FS_OPEN_TRUNCATE = 8,
+  // 忽略 FsWriteAt 的 offset，总是写到文件末尾
+  FS_OPEN_APPEND = 16
+} FsOpenFlags;
+
+// 打开的文件，直接绑定到 FIL，读写时不再解析路径
+typedef struct FsHandle_t FsHandle;
+
+// FsReaddir 读到的一项
+typedef struct {
+  // 文件名，也是游标：传给 FsOpendir 的 after 时从这一项之后继续
+  const char *name;
+  FileType type;
+  // 是否是符号链接，硬链接与普通文件相同
+  bool symlink;
+  // 普通文件为内容的字节数，符号链接为指向的路径的长度，
+  // 文件夹为子文件的数量
+  size_t size;
+} FsDirent;
+
+// 打开的文件夹，见 FsOpendir
+typedef struct FsDir_t FsDir;
+
+// 通过 Unix 域套接字共享文件系统的服务端，见 serve.c
+typedef struct FsServer_t FsServer;
+
 // 分隔符
 #define FS_SPLIT '/'
 #define FS_SPLIT_STR "/"
@@ -74,7 +418,7 @@ typedef struct FsRep *Fs;
 #define RESET_COLOR "\033[0m"
 
 /// 错误码 -> 错误描述
-extern const char FsErrorMessages[8][64];
+extern const char FsErrorMessages[10][64];
 
 // #define DEBUG
 
@@ -92,14 +436,18 @@ extern const char FsErrorMessages[8][64];
   printf(prefix ": %s\n", __VA_ARGS__, FsErrorMessages[code]);
 #endif
 
-// 文件夹最大文件数量大小
-#define FS_MAX_CHILDREN 64
+// 解析一个路径时最多展开的符号链接数量，超过时认为符号链接成环
+#define FS_SYMLINK_MAX 40
+// 文件树中的文件数量达到这个值时才并行复制
+#define FS_COPY_PARALLEL_MIN 1024
 // 是否在列出文件时在文件夹末尾加上分隔符
 // #define FS_SHOW_DIR_SPLIT
 
 FIL *FsFilFindByName(FIL *dir, const char *name);
 
-void FsFilSort(FIL *dir, int reverse);
+size_t FsFilLowerBound(FIL_LIST *children, const char *name);
+
+size_t FsFilPrefixRange(FIL_LIST *children, const char *prefix, size_t *end);
 
 void FsFilPrint(FIL *file);
 
@@ -107,6 +455,12 @@ PATH *FsPathGetTail(PATH *path);
 
 void FsFilFree(FIL *file);
 
+void FsFilRelease(FIL *file);
+
+FIL *FsFilTarget(FIL *file);
+
+FIL_LIST *FsFilListNew(size_t size);
+
 void FsPathFree(PATH *path);
 
 PATH *FsPathInsert(PATH *tail, FIL *file);
@@ -117,6 +471,9 @@ void FsMkLink(FIL *parent, FIL *link_to, const char *name);
 
 void FsInitDir(FIL *parent, FIL **file, const char *name);
 
+void FsInitDirSized(FIL *parent, FIL **file, const char *name,
+                    size_t capacity);
+
 void FsInitFile(FIL *parent, FIL **file, const char *name);
 
 PATH *FsPathClone(PATH *src);
@@ -127,18 +484,291 @@ void FsPathSimplify(PATH **path);
 
 FsErrors FsPathParse(PATH *pathRoot, const char *pathStr, PATH **path);
 
+FsErrors FsPathParseLocked(PATH *pathRoot, const char *pathStr, PATH **path,
+                           FsLockMode mode);
+
+FsErrors FsPathParseLink(PATH *pathRoot, const char *pathStr, PATH **path);
+
 char *FsPathStrGetName(char *pathStr);
 
 char *FsPathStrShift(char *pathStr);
 
-FsErrors FsTreeInner(FIL *file, int layer, char *pathStrInput);
-
 void FsFilDlTree(FIL *file);
 
 FsErrors FsFilCopy(FIL *src, FIL *dst);
 
+FIL *FsFilClone(FIL *src, FIL *parent, const char *name);
+
 FsErrors FsFilMove(FIL *src, FIL *dst);
 
+FsErrors FsFilMoveAs(FIL *src, FIL *dst, const char *name);
+
+FsErrors FsFilRename(FIL *dir, FIL *file, const char *name);
+
+void FsFilAddChild(FIL *dir, FIL *file);
+
+FsErrors FsFilRemoveChild(FIL *dir, FIL *file);
+
+bool FsFilIsAncestor(FIL *ancestor, FIL *file);
+
+void FsFilLockPair(FIL *a, FIL *b);
+
+void FsFilUnlockPair(FIL *a, FIL *b);
+
+FsErrors FsFilCheck(FIL *dir, size_t *count);
+
 void FsPrint(Fs fs, char *pathStr);
 
+FsErrors FsWalkFil(FIL *root, const char *pathStr, FsWalkVisitor visitor,
+                   void *ctx, int nthreads);
+
+FsErrors FsWalk(Fs fs, const char *pathStr, FsWalkVisitor visitor, void *ctx,
+                int nthreads);
+
+bool FsGlobMatch(const char *pattern, const char *name);
+
+size_t FsFilSize(FIL *file);
+
+FsErrors FsFind(Fs fs, const char *pathStr, const char *pattern,
+                const FsFindFlags *flags, FsFindCallback callback, void *ctx);
+
+FsErrors FsPrefix(Fs fs, const char *pathStr, const char *prefix,
+                  FsPrefixCallback callback, void *ctx);
+
+void FsLsPrefix(Fs fs, char *pathStr, const char *prefix);
+
+void FsLsPage(Fs fs, char *arg);
+
+const char *FsMemFind(const char *haystack, size_t n, const char *needle,
+                      size_t m);
+
+FsErrors FsGrep(Fs fs, const char *pathStr, const char *pattern,
+                FsGrepCallback callback, void *ctx, int nthreads);
+
+FsErrors FsOpen(Fs fs, const char *pathStr, int flags, FsHandle **handle);
+
+FsErrors FsReadAt(FsHandle *handle, void *buf, size_t size, size_t offset,
+                  size_t *bytes);
+
+FsErrors FsWriteAt(FsHandle *handle, const void *buf, size_t size,
+                   size_t offset);
+
+FsErrors FsTruncate(FsHandle *handle, size_t size);
+
+void FsClose(FsHandle *handle);
+
+void FsAppend(Fs fs, char *pathStr, const char *data, size_t length);
+
+FIL_CONTENT *FsContentNew(const char *data, size_t length, size_t capacity);
+
+FIL_CONTENT *FsContentClone(Fs fs, FIL_CONTENT *src);
+
+FIL_CONTENT *FsContentFromFd(int fd, size_t length);
+
+void FsContentFree(void *content);
+
+FIL_CONTENT *FsFilContent(FIL *file, size_t *length);
+
+FIL_CONTENT *FsFilContentLoad(Fs fs, FIL *file, size_t *length);
+
+uint64_t FsClockMs(void);
+
+void FsFilTouch(FIL *file);
+
+bool FsFilCompress(FIL *file);
+
+void FsDecompressStats(size_t *count, uint64_t *ns);
+
+size_t FsContentResident(void);
+
+size_t FsFilSpill(FIL *file, FsSpill *spill);
+
+size_t FsContentSegment(FIL_CONTENT *content, size_t length, size_t offset,
+                        const char **data);
+
+size_t FsContentRead(FIL_CONTENT *content, size_t length, size_t offset,
+                     void *buf, size_t size);
+
+void FsFilReplace(FIL *file, const char *data, size_t length);
+
+void FsFilWrite(FIL *file, const void *data, size_t size, size_t offset);
+
+void FsFilResize(FIL *file, size_t length);
+
+void FsDedupEnable(Fs fs, bool enable);
+
+bool FsDedupEnabled(Fs fs);
+
+void FsDedup(Fs fs, char *arg);
+
+FIL_CONTENT *FsContentIntern(Fs fs, const char *data, size_t length);
+
+bool FsContentRelease(FIL_CONTENT *content);
+
+FsErrors FsStatsGet(Fs fs, const char *pathStr, FsStatsInfo *stats);
+
+void FsStats(Fs fs, char *pathStr);
+
+size_t FsCompactRun(Fs fs, unsigned int idle);
+
+void FsCompactStart(Fs fs, unsigned int idle);
+
+void FsCompactStop(Fs fs);
+
+void FsCompress(Fs fs, char *arg);
+
+FsErrors FsBudgetSet(Fs fs, size_t budget, const char *dir);
+
+size_t FsSpillRun(Fs fs);
+
+uint64_t FsSpillAlloc(FsSpill *spill, size_t size);
+
+bool FsSpillWrite(FsSpill *spill, const void *data, size_t size,
+                  uint64_t offset);
+
+bool FsSpillRead(FsSpill *spill, void *data, size_t size, uint64_t offset);
+
+FsSpill *FsSpillRef(FsSpill *spill);
+
+void FsSpillRelease(FsSpill *spill, uint64_t offset, size_t size);
+
+void FsSpillStats(size_t *spills, size_t *faults, uint64_t *faultNs);
+
+void FsSpillFault(uint64_t ns);
+
+void FsBudget(Fs fs, char *arg);
+
+FsErrors FsLink(Fs fs, const char *target, const char *linkPath,
+                bool symbolic);
+
+void FsLn(Fs fs, char *arg);
+
+void FsInitRep(Fs fs);
+
+Fs FsSnapshot(Fs fs);
+
+void FsSnapshotDrop(Fs snapshot);
+
+Fs FsSnap(Fs fs, char *arg);
+
+void FsViewSet(uint64_t view);
+
+uint64_t FsViewGet(void);
+
+FsVersion *FsVersionGet(FIL *file);
+
+FIL_LIST *FsFilChildren(FIL *dir);
+
+bool FsSnapNeeded(FIL *file);
+
+void FsSnapSave(FIL *file, FIL_LIST *children, FIL_CONTENT *content,
+                size_t length);
+
+void FsSnapRetire(FIL *file, void *ptr, void (*freeFn)(void *));
+
+void FsTreeRdlock(Fs fs);
+
+void FsTreeWrlock(Fs fs);
+
+void FsTreeUnlock(Fs fs);
+
+uint64_t FsViewOf(Fs fs);
+
+FsErrors FsTxBegin(Fs fs);
+
+FsErrors FsTxCommit(Fs fs);
+
+FsErrors FsTxAbort(Fs fs);
+
+bool FsTxLog(FsTxKind kind, FIL *file, FIL *dir, const char *name);
+
+void FsTx(Fs fs, char *arg);
+
+void FsFilFreeRetired(void *file);
+
+void FsFilRestore(FIL *file, FIL_CONTENT *content);
+
+void FsFilMoveBatch(FIL **files, size_t n, FIL *dst, FsErrors *results);
+
+void FsFilCopyBatch(FIL **files, size_t n, FIL *dst, FsErrors *results);
+
+void FsFilAddChildren(FIL *dir, FIL **files, size_t n);
+
+FsErrors FsOpendir(Fs fs, const char *pathStr, const char *after,
+                   FsDir **dir);
+
+FsErrors FsReaddir(FsDir *dir, const FsDirent **entry);
+
+void FsClosedir(FsDir *dir);
+
+FsErrors FsMkdirQuiet(Fs fs, const char *pathStr, FsErrorInfo *info);
+
+FsErrors FsMkfileQuiet(Fs fs, const char *pathStr, FsErrorInfo *info);
+
+FsErrors FsCdQuiet(Fs fs, const char *pathStr, FsErrorInfo *info);
+
+FsErrors FsLsQuiet(Fs fs, const char *pathStr, FsPrefixCallback callback,
+                   void *ctx, FsErrorInfo *info);
+
+FsErrors FsTreeQuiet(Fs fs, const char *pathStr, FsWalkVisitor visitor,
+                     void *ctx, FsErrorInfo *info);
+
+FsErrors FsPutQuiet(Fs fs, const char *pathStr, const char *content,
+                    size_t length, FsErrorInfo *info);
+
+FsErrors FsCatQuiet(Fs fs, const char *pathStr, FsDataCallback callback,
+                    void *ctx, FsErrorInfo *info);
+
+FsErrors FsDldirQuiet(Fs fs, const char *pathStr, FsErrorInfo *info);
+
+FsErrors FsDlQuiet(Fs fs, bool recursive, const char *pathStr,
+                   FsErrorInfo *info);
+
+FsErrors FsCpQuiet(Fs fs, bool recursive, char *src[], const char *dest,
+                   FsErrorInfo *info);
+
+FsErrors FsMvQuiet(Fs fs, char *src[], const char *dest, FsErrorInfo *info);
+
+FsErrors FsMkdirP(Fs fs, const char *pathStr);
+
+FsErrors FsBuildFromPaths(Fs fs, const char *paths[], size_t n,
+                          FsErrorInfo *info);
+
+void FsBuild(Fs fs, char *arg);
+
+FsErrors FsImportDir(Fs fs, const char *hostDir, const char *pathStr,
+                     FsImportStats *stats);
+
+void FsImport(Fs fs, char *arg);
+
+void FsImportAdopt(FIL *dir, Fs fs);
+
+void FsImportReport(const char *verb, const FsImportStats *stats,
+                    double seconds);
+
+FsErrors FsTarWrite(Fs fs, const char *pathStr, int fd, FsImportStats *stats);
+
+FsErrors FsTarRead(Fs fs, int fd, const char *pathStr, FsImportStats *stats);
+
+void FsExport(Fs fs, char *arg);
+
+void FsImportTar(Fs fs, char *arg);
+
+FsErrors FsServerStart(Fs fs, const char *sockPath, int nthreads,
+                       FsServer **server);
+
+void FsServerStop(FsServer *server);
+
+int FsServe(Fs fs, const char *sockPath, int nthreads);
+
+FsCwd *FsCwdGet(Fs fs);
+
+void FsCwdFree(void *cwds);
+
+void FsCwdDetach(Fs fs);
+
+void FsCwdSet(FsCwd *cwd, PATH *path);
+
+void FsFilRetire(FIL *file);
+
 #endif
@@ -0,0 +1,172 @@
+// 文件树遍历
+//
+// 有序模式在当前线程中按先序、字典序递归访问；无序模式把每个文件夹作为
+// 一个任务交给线程池，线程之间互相窃取尚未访问的文件夹。
+// 两种模式共用 FsWalkDir 访问文件夹内容。
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FileType.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include "pool.h"
+#include "utility.h"
+
+typedef struct {
+  FsWalkVisitor visitor;
+  void *ctx;
+  bool ordered;
+  // 发起遍历的线程的视图，线程池中的线程按同一个视图读取
+  uint64_t view;
+  // 访问者返回 FS_WALK_STOP 后，其他线程尽快停止
+  atomic_bool stop;
+} FsWalkState;
+
+// 无序模式下访问一个文件夹的任务
+typedef struct {
+  FsWalkState *state;
+  FIL *dir;
+  char *path;
+  int depth;
+} FsWalkTask;
+
+static void FsWalkRun(FsPool *pool, int worker, void *arg);
+
+/// 访问文件夹中的所有文件，有序模式下递归进入子文件夹，
+/// 无序模式下把子文件夹派生为新的任务
+/// \param state
+/// \param dir
+/// \param path dir 的路径
+/// \param depth dir 的深度
+/// \param pool 有序模式下为 NULL
+/// \param worker
+static void FsWalkDir(FsWalkState *state, FIL *dir, const char *path,
+                      int depth, FsPool *pool, int worker) {
+  size_t length = strlen(path);
+  size_t capacity = length + 64;
+  char *buf = malloc(sizeof(char) * capacity);
+  assert(buf);
+  memcpy(buf, path, length);
+  if (length == 0 || buf[length - 1] != FS_SPLIT)
+    buf[length++] = FS_SPLIT;
+  FsEpochEnter();
+  FsViewSet(state->view);
+  FIL_LIST *children = FsFilChildren(dir);
+  for (size_t i = 0; i < children->size; i++) {
+    if (atomic_load_explicit(&state->stop, memory_order_relaxed))
+      break;
+    FIL *f = children->items[i].file;
+    if (FS_IS_DOT(f))
+      continue;
+    // 子文件的路径：path + '/' + name
+    const char *name = children->items[i].name;
+    size_t nameLength = strlen(name);
+    if (length + nameLength + 1 > capacity) {
+      capacity = (length + nameLength + 1) * 2;
+      buf = realloc(buf, sizeof(char) * capacity);
+      assert(buf);
+    }
+    memcpy(buf + length, name, nameLength + 1);
+    FsWalkEntry entry = {f, buf, depth + 1, worker};
+    FsWalkAction action = state->visitor(&entry, state->ctx);
+    // 访问者可能访问了其他文件系统
+    FsViewSet(state->view);
+    if (action == FS_WALK_STOP) {
+      atomic_store(&state->stop, true);
+      break;
+    }
+    if (action == FS_WALK_PRUNE || f->type != DIRECTORY)
+      continue;
+    if (state->ordered) {
+      FsWalkDir(state, f, buf, depth + 1, NULL, worker);
+    } else {
+      FsWalkTask *task = malloc(sizeof(FsWalkTask));
+      assert(task);
+      task->state = state;
+      task->dir = f;
+      task->path = strdup(buf);
+      assert(task->path);
+      task->depth = depth + 1;
+      FsPoolSpawn(pool, worker, FsWalkRun, task);
+    }
+  }
+  FsEpochExit();
+  free(buf);
+}
+
+/// 线程池任务：访问一个文件夹
+/// \param pool
+/// \param worker
+/// \param arg FsWalkTask
+static void FsWalkRun(FsPool *pool, int worker, void *arg) {
+  FsWalkTask *task = arg;
+  if (!atomic_load_explicit(&task->state->stop, memory_order_relaxed))
+    FsWalkDir(task->state, task->dir, task->path, task->depth, pool, worker);
+  free(task->path);
+  free(task);
+}
+
+/// 从 root 开始遍历文件树，先访问 root 自身（深度为 0）。
+/// 调用者需持有整棵树的读锁，保证遍历期间节点不会被释放
+/// \param root
+/// \param pathStr root 的路径，访问者得到的路径都以它开头
+/// \param visitor
+/// \param ctx 传给 visitor
+/// \param nthreads FS_WALK_ORDERED 表示有序模式，否则为无序模式的线程数
+/// \return
+FsErrors FsWalkFil(FIL *root, const char *pathStr, FsWalkVisitor visitor,
+                   void *ctx, int nthreads) {
+  if (!root || !visitor)
+    return FS_ERROR;
+  FsWalkState state;
+  state.visitor = visitor;
+  state.ctx = ctx;
+  state.ordered = nthreads == FS_WALK_ORDERED;
+  state.view = FsViewGet();
+  atomic_init(&state.stop, false);
+  FsWalkEntry entry = {root, pathStr, 0, 0};
+  FsWalkAction action = visitor(&entry, ctx);
+  if (action != FS_WALK_CONTINUE || root->type != DIRECTORY)
+    return FS_OK;
+  if (state.ordered) {
+    FsWalkDir(&state, root, pathStr, 0, NULL, 0);
+    return FS_OK;
+  }
+  FsWalkTask *task = malloc(sizeof(FsWalkTask));
+  assert(task);
+  task->state = &state;
+  task->dir = root;
+  task->path = strdup(pathStr);
+  assert(task->path);
+  task->depth = 0;
+  FsPoolRun(nthreads, FsWalkRun, task);
+  return FS_OK;
+}
+
+/// 遍历 pathStr 下的文件树，见 FsWalkFil
+/// \param fs
+/// \param pathStr 为空时从当前目录开始
+/// \param visitor
+/// \param ctx
+/// \param nthreads
+/// \return
+FsErrors FsWalk(Fs fs, const char *pathStr, FsWalkVisitor visitor, void *ctx,
+                int nthreads) {
+  if (!pathStr || !*pathStr)
+    pathStr = ".";
+  PATH *path = NULL;
+  FsTreeRdlock(fs);
+  FsErrors res = FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path);
+  if (res == FS_OK)
+    res = FsWalkFil(FsPathGetTail(path)->file, pathStr, visitor, ctx,
+                    nthreads);
+  FsTreeUnlock(fs);
+  FsPathFree(path);
+  return res;
+}
@@ -0,0 +1,309 @@
+//
+// 文件内容：句柄读写、分块存储、去重、压缩和溢出
+//
+
+#include "test.h"
+#include <stdlib.h>
+
+// 可以压缩的内容
+static char *TestText(size_t size, int seed) {
+  char *text = malloc(size + 1);
+  for (size_t i = 0; i < size; i++)
+    text[i] = i % 64 == 63 ? '\n' : 'a' + (i / 64 + seed) % 26;
+  text[size] = '\0';
+  return text;
+}
+
+void TestHandle(void) {
+  Fs fs = FsNew();
+  FsHandle *handle = NULL;
+  CHECK_EQ(FsOpen(fs, "/f", FS_OPEN_READ, &handle), FS_NO_SUCH_FILE);
+  CHECK_EQ(FsOpen(fs, "/f", FS_OPEN_READ | FS_OPEN_CREATE, &handle), FS_ERROR);
+  CHECK_EQ(FsOpen(fs, "/", FS_OPEN_READ, &handle), FS_IS_A_DIRECTORY);
+  CHECK_EQ(FsOpen(fs, "/f", FS_OPEN_WRITE | FS_OPEN_CREATE, &handle), FS_OK);
+  CHECK_EQ(FsWriteAt(handle, "hello", 5, 0), FS_OK);
+  char buf[16] = "";
+  size_t bytes = 1;
+  CHECK_EQ(FsReadAt(handle, buf, 5, 0, &bytes), FS_BAD_FILE_DESCRIPTOR);
+  FsClose(handle);
+  FsHandle *reader = NULL;
+  CHECK_EQ(FsOpen(fs, "/f", FS_OPEN_READ, &reader), FS_OK);
+  CHECK_EQ(FsWriteAt(reader, "x", 1, 0), FS_BAD_FILE_DESCRIPTOR);
+  CHECK_EQ(FsReadAt(reader, buf, sizeof(buf) - 1, 1, &bytes), FS_OK);
+  CHECK_EQ(bytes, 4);
+  CHECK_STR(buf, "ello");
+  CHECK_EQ(FsReadAt(reader, buf, sizeof(buf), 100, &bytes), FS_OK);
+  CHECK_EQ(bytes, 0);
+  // 句柄绑定到文件本身：移动、删除之后仍然可以读取
+  FsMkdir(fs, "/d");
+  char *src[] = {"/f", NULL};
+  FsMv(fs, src, "/d");
+  CHECK(TestFile(fs, "/d/f") != NULL);
+  FsDl(fs, false, "/d/f");
+  CHECK(TestFile(fs, "/d/f") == NULL);
+  memset(buf, 0, sizeof(buf));
+  CHECK_EQ(FsReadAt(reader, buf, sizeof(buf) - 1, 0, &bytes), FS_OK);
+  CHECK_STR(buf, "hello");
+  FsClose(reader);
+  // 打开时清空
+  FsMkfile(fs, "/g");
+  TestPut(fs, "/g", "old content");
+  CHECK_EQ(FsOpen(fs, "/g", FS_OPEN_WRITE | FS_OPEN_TRUNCATE, &handle), FS_OK);
+  FsClose(handle);
+  char *content = TestCat(fs, "/g", NULL);
+  CHECK_STR(content, "");
+  free(content);
+  FsFree(fs);
+}
+
+void TestWrite(void) {
+  Fs fs = FsNew();
+  FsHandle *handle = NULL;
+  CHECK_EQ(FsOpen(fs, "/f", FS_OPEN_READ | FS_OPEN_WRITE | FS_OPEN_CREATE,
+                  &handle),
+           FS_OK);
+  // 超过末尾写入时空洞补 0
+  CHECK_EQ(FsWriteAt(handle, "end", 3, 5), FS_OK);
+  CHECK_EQ(FsWriteAt(handle, "ab", 2, 0), FS_OK);
+  size_t length = 0;
+  char *content = TestCat(fs, "/f", &length);
+  CHECK_EQ(length, 8);
+  CHECK(content && memcmp(content, "ab\0\0\0end", 8) == 0);
+  free(content);
+  // 覆盖中间的字节
+  CHECK_EQ(FsWriteAt(handle, "XYZ", 3, 3), FS_OK);
+  content = TestCat(fs, "/f", NULL);
+  CHECK(content && memcmp(content, "ab\0XYZnd", 8) == 0);
+  free(content);
+  CHECK_EQ(FsTruncate(handle, 2), FS_OK);
+  content = TestCat(fs, "/f", &length);
+  CHECK_STR(content, "ab");
+  free(content);
+  CHECK_EQ(FsTruncate(handle, 4), FS_OK);
+  content = TestCat(fs, "/f", &length);
+  CHECK_EQ(length, 4);
+  CHECK(content && memcmp(content, "ab\0\0", 4) == 0);
+  free(content);
+  FsClose(handle);
+  // 追加模式忽略 offset；多次追加的容量按倍数增长
+  CHECK_EQ(FsOpen(fs, "/log", FS_OPEN_WRITE | FS_OPEN_CREATE | FS_OPEN_APPEND,
+                  &handle),
+           FS_OK);
+  for (int i = 0; i < 1000; i++)
+    CHECK_EQ(FsWriteAt(handle, "0123456789", 10, 0), FS_OK);
+  FsClose(handle);
+  FIL *file = TestFile(fs, "/log");
+  CHECK(file && file->content);
+  if (file && file->content) {
+    CHECK_EQ(file->content->length, 10000);
+    CHECK(file->content->capacity < 2 * 10000 + FS_CONTENT_MIN_CAPACITY);
+  }
+  content = TestCat(fs, "/log", &length);
+  CHECK_EQ(length, 10000);
+  CHECK(content && memcmp(content + 9990, "0123456789", 10) == 0);
+  free(content);
+  FsAppend(fs, "/log", "!", 1);
+  content = TestCat(fs, "/log", &length);
+  CHECK(content && length == 10001 && content[10000] == '!');
+  free(content);
+  FsFree(fs);
+}
+
+void TestChunks(void) {
+  Fs fs = FsNew();
+  size_t size = FS_CHUNK_THRESHOLD + FS_CHUNK_SIZE / 2;
+  char *text = TestText(size, 0);
+  FsMkfile(fs, "/big");
+  TestPut(fs, "/big", text);
+  FIL *big = TestFile(fs, "/big");
+  CHECK(big && big->content && big->content->chunks);
+  // 复制时共享所有的块，修改副本时只复制修改的块
+  char *src[] = {"/big", NULL};
+  FsCp(fs, false, src, "/copy");
+  FIL *copy = TestFile(fs, "/copy");
+  CHECK(copy && copy->content && copy->content->chunks);
+  if (big && copy && big->content->chunks && copy->content->chunks) {
+    CHECK(big->content->chunks[1] == copy->content->chunks[1]);
+    CHECK_EQ(big->content->chunks[1]->refs, 2);
+  }
+  FsHandle *handle = NULL;
+  CHECK_EQ(FsOpen(fs, "/copy", FS_OPEN_WRITE, &handle), FS_OK);
+  CHECK_EQ(FsWriteAt(handle, "CHANGED", 7, FS_CHUNK_SIZE + 10), FS_OK);
+  // 跨越块边界的写入
+  CHECK_EQ(FsWriteAt(handle, "BOUNDARY", 8, 3 * FS_CHUNK_SIZE - 4), FS_OK);
+  FsClose(handle);
+  if (big && copy && big->content->chunks && copy->content->chunks) {
+    CHECK(big->content->chunks[1] != copy->content->chunks[1]);
+    CHECK(big->content->chunks[0] == copy->content->chunks[0]);
+  }
+  size_t length = 0;
+  char *content = TestCat(fs, "/big", &length);
+  CHECK_EQ(length, size);
+  CHECK(content && memcmp(content, text, size) == 0);
+  free(content);
+  memcpy(text + FS_CHUNK_SIZE + 10, "CHANGED", 7);
+  memcpy(text + 3 * FS_CHUNK_SIZE - 4, "BOUNDARY", 8);
+  content = TestCat(fs, "/copy", &length);
+  CHECK_EQ(length, size);
+  CHECK(content && memcmp(content, text, size) == 0);
+  free(content);
+  // 扩展出的空洞读出为 0
+  CHECK_EQ(FsOpen(fs, "/copy", FS_OPEN_READ | FS_OPEN_WRITE, &handle), FS_OK);
+  CHECK_EQ(FsTruncate(handle, size + 3 * FS_CHUNK_SIZE), FS_OK);
+  char buf[16];
+  size_t bytes = 0;
+  memset(buf, 1, sizeof(buf));
+  CHECK_EQ(FsReadAt(handle, buf, sizeof(buf), size + 2 * FS_CHUNK_SIZE,
+                    &bytes),
+           FS_OK);
+  CHECK_EQ(bytes, sizeof(buf));
+  CHECK(buf[0] == 0 && buf[15] == 0);
+  FsClose(handle);
+  free(text);
+  FsFree(fs);
+}
+
+void TestDedup(void) {
+  Fs on = FsNew(), off = FsNew();
+  // 默认关闭，按 Fs 开启，快照跟随所属的文件系统
+  CHECK(!FsDedupEnabled(on));
+  FsDedupEnable(on, true);
+  CHECK(FsDedupEnabled(on));
+  CHECK(!FsDedupEnabled(off));
+  Fs snapshot = FsSnapshot(on);
+  CHECK(FsDedupEnabled(snapshot));
+  FsFree(snapshot);
+  char *text = TestText(1000, 1);
+  Fs both[] = {on, off};
+  for (int i = 0; i < 2; i++) {
+    FsMkfileQuiet(both[i], "/a", NULL);
+    FsMkfileQuiet(both[i], "/b", NULL);
+    TestPut(both[i], "/a", text);
+    TestPut(both[i], "/b", text);
+  }
+  FsStatsInfo stats;
+  // 统计包括起点本身
+  CHECK_EQ(FsStatsGet(on, "/", &stats), FS_OK);
+  CHECK_EQ(stats.directories, 1);
+  CHECK_EQ(stats.files, 2);
+  CHECK(stats.dedup);
+  CHECK_EQ(stats.bytes, 2000);
+  CHECK_EQ(stats.storedBytes, 1000);
+  CHECK_EQ(FsStatsGet(off, "/", &stats), FS_OK);
+  CHECK(!stats.dedup);
+  CHECK_EQ(stats.storedBytes, 2000);
+  // 修改共享的内容时复制出私有的缓冲区
+  FsHandle *handle = NULL;
+  CHECK_EQ(FsOpen(on, "/a", FS_OPEN_WRITE, &handle), FS_OK);
+  CHECK_EQ(FsWriteAt(handle, "!", 1, 0), FS_OK);
+  FsClose(handle);
+  char *content = TestCat(on, "/b", NULL);
+  CHECK_STR(content, text);
+  free(content);
+  content = TestCat(on, "/a", NULL);
+  CHECK(content && content[0] == '!' && strcmp(content + 1, text + 1) == 0);
+  free(content);
+  CHECK_EQ(FsStatsGet(on, "/", &stats), FS_OK);
+  CHECK_EQ(stats.storedBytes, 2000);
+  // 关闭之后新写入的内容不再共享
+  FsDedupEnable(on, false);
+  CHECK(!FsDedupEnabled(on));
+  FsMkfileQuiet(on, "/c", NULL);
+  TestPut(on, "/c", text);
+  CHECK_EQ(FsStatsGet(on, "/", &stats), FS_OK);
+  CHECK_EQ(stats.storedBytes, 3000);
+  free(text);
+  FsFree(on);
+  FsFree(off);
+}
+
+void TestCompress(void) {
+  Fs fs = FsNew();
+  // 内容各不相同，去重存储共享的内容不会被压缩
+  char *text[8];
+  char path[32];
+  for (int i = 0; i < 8; i++) {
+    text[i] = TestText(8192, i);
+    sprintf(path, "/f%d", i);
+    FsMkfile(fs, path);
+    TestPut(fs, path, text[i]);
+  }
+  FsMkfile(fs, "/empty");
+  CHECK_EQ(FsCompactRun(fs, 0), 8);
+  FsStatsInfo stats;
+  CHECK_EQ(FsStatsGet(fs, "/", &stats), FS_OK);
+  CHECK_EQ(stats.compressedFiles, 8);
+  CHECK(stats.compressedSaved > 8 * 4096);
+  CHECK_EQ(stats.bytes, 8 * 8192);
+  // 读取时解压，内容不变
+  size_t before = stats.decompressions;
+  size_t length = 0;
+  char *content = TestCat(fs, "/f0", &length);
+  CHECK_EQ(length, 8192);
+  CHECK_STR(content, text[0]);
+  free(content);
+  CHECK_EQ(FsStatsGet(fs, "/", &stats), FS_OK);
+  CHECK(stats.decompressions > before);
+  // 修改压缩的文件
+  FsHandle *handle = NULL;
+  CHECK_EQ(FsOpen(fs, "/f1", FS_OPEN_WRITE, &handle), FS_OK);
+  CHECK_EQ(FsWriteAt(handle, "xyz", 3, 8190), FS_OK);
+  FsClose(handle);
+  content = TestCat(fs, "/f1", &length);
+  CHECK_EQ(length, 8193);
+  CHECK(content && memcmp(content, text[1], 8190) == 0 &&
+        strcmp(content + 8190, "xyz") == 0);
+  free(content);
+  // 刚读写过的文件不满足空闲时间
+  CHECK_EQ(FsCompactRun(fs, 60 * 1000), 0);
+  for (int i = 0; i < 8; i++)
+    free(text[i]);
+  FsFree(fs);
+}
+
+void TestSpill(void) {
+  Fs fs = FsNew();
+  char *texts[16];
+  char path[32];
+  for (int i = 0; i < 16; i++) {
+    texts[i] = TestText(8192 + i, i);
+    sprintf(path, "/f%d", i);
+    FsMkfile(fs, path);
+    TestPut(fs, path, texts[i]);
+  }
+  // 很小的预算使所有内容溢出到文件
+  CHECK_EQ(FsBudgetSet(fs, 1, NULL), FS_OK);
+  FsSpillRun(fs);
+  FsStatsInfo stats;
+  CHECK_EQ(FsStatsGet(fs, "/", &stats), FS_OK);
+  CHECK(stats.spilledFiles > 0);
+  CHECK(stats.spilledBytes > 0);
+  size_t faults = stats.faults;
+  // 读回的内容不变
+  for (int i = 0; i < 16; i++) {
+    sprintf(path, "/f%d", i);
+    char *content = TestCat(fs, path, NULL);
+    CHECK_STR(content, texts[i]);
+    free(content);
+  }
+  CHECK_EQ(FsStatsGet(fs, "/", &stats), FS_OK);
+  CHECK(stats.faults > faults);
+  // 关闭预算之后已经溢出的内容仍然可以读写
+  FsSpillRun(fs);
+  CHECK_EQ(FsBudgetSet(fs, 0, NULL), FS_OK);
+  TestPut(fs, "/f0", "new");
+  char *content = TestCat(fs, "/f0", NULL);
+  CHECK_STR(content, "new");
+  free(content);
+  for (int i = 1; i < 16; i++) {
+    sprintf(path, "/f%d", i);
+    content = TestCat(fs, path, NULL);
+    CHECK_STR(content, texts[i]);
+    free(content);
+  }
+  // 设置的文件夹不存在时无法创建溢出文件
+  CHECK_EQ(FsBudgetSet(fs, 1, "/nonexistent/dir"), FS_ERROR);
+  for (int i = 0; i < 16; i++)
+    free(texts[i]);
+  FsFree(fs);
+}
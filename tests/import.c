@@ -0,0 +1,152 @@
+//
+// 导入宿主机的文件夹，tar 归档的导出和导入
+//
+
+#include "test.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// 在宿主机上创建文件并写入 content
+static void TestHostFile(const char *dir, const char *name,
+                         const char *content, size_t length) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  CHECK(fd >= 0);
+  if (fd < 0)
+    return;
+  CHECK_EQ(write(fd, content, length), length);
+  close(fd);
+}
+
+void TestImport(void) {
+  char *host = TestTempDir();
+  CHECK(host != NULL);
+  if (!host)
+    return;
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/sub", host);
+  mkdir(path, 0755);
+  snprintf(path, sizeof(path), "%s/sub/empty", host);
+  mkdir(path, 0755);
+  TestHostFile(host, "a", "alpha", 5);
+  TestHostFile(host, "sub/b", "", 0);
+  // 分块存储的大文件
+  size_t size = FS_CHUNK_THRESHOLD + 123;
+  char *big = malloc(size);
+  for (size_t i = 0; i < size; i++)
+    big[i] = 'a' + i % 23;
+  TestHostFile(host, "sub/big", big, size);
+  snprintf(path, sizeof(path), "%s/link", host);
+  CHECK_EQ(symlink("sub/b", path), 0);
+  // 特殊文件跳过
+  snprintf(path, sizeof(path), "%s/fifo", host);
+  CHECK_EQ(mkfifo(path, 0644), 0);
+  Fs fs = FsNew();
+  FsImportStats stats = {0};
+  CHECK_EQ(FsImportDir(fs, host, "/imp", &stats), FS_OK);
+  CHECK_EQ(stats.files, 3);
+  CHECK_EQ(stats.directories, 3);
+  CHECK_EQ(stats.symlinks, 1);
+  CHECK_EQ(stats.bytes, 5 + size);
+  CHECK_EQ(stats.skipped, 1);
+  size_t length = 0;
+  char *content = TestCat(fs, "/imp/sub/big", &length);
+  CHECK_EQ(length, size);
+  CHECK(content && memcmp(content, big, size) == 0);
+  free(content);
+  CHECK(TestFile(fs, "/imp/link") != NULL);
+  FsDl(fs, false, "/imp/sub/big");
+  char *dump = TestDump(fs, "/imp");
+  CHECK_STR(dump, "f /a = alpha\nl /link -> sub/b\nd /sub\nf /sub/b = \n"
+                  "d /sub/empty\n");
+  free(dump);
+  // 导入到已经存在的文件夹时使用宿主机上的名字
+  FsMkdir(fs, "/into");
+  CHECK_EQ(FsImportDir(fs, host, "/into", NULL), FS_OK);
+  const char *name = strrchr(host, '/') + 1;
+  snprintf(path, sizeof(path), "/into/%s/a", name);
+  content = TestCat(fs, path, NULL);
+  CHECK_STR(content, "alpha");
+  free(content);
+  snprintf(path, sizeof(path), "%s/a", host);
+  CHECK_EQ(FsImportDir(fs, path, "/x", NULL), FS_NOT_A_DIRECTORY);
+  CHECK_EQ(FsImportDir(fs, "/nonexistent/dir", "/x", NULL), FS_NO_SUCH_FILE);
+  CHECK_EQ(FsFilCheck(fs->root, NULL), FS_OK);
+  FsFree(fs);
+  free(big);
+  TestRemoveHost(host);
+  free(host);
+}
+
+void TestTar(void) {
+  char *host = TestTempDir();
+  CHECK(host != NULL);
+  if (!host)
+    return;
+  char archive[PATH_MAX];
+  snprintf(archive, sizeof(archive), "%s/out.tar", host);
+  Fs fs = FsNew();
+  // 名字超过 ustar 的 100 字节时需要拆分或者使用扩展头
+  char longName[160];
+  memset(longName, 'n', sizeof(longName) - 1);
+  longName[sizeof(longName) - 1] = '\0';
+  char longPath[256];
+  snprintf(longPath, sizeof(longPath), "/t/deep/%s", longName);
+  const char *paths[] = {"/t/a", "/t/empty/", "/t/deep/b", longPath};
+  CHECK_EQ(FsBuildFromPaths(fs, paths, 4, NULL), FS_OK);
+  TestPut(fs, "/t/a", "alpha");
+  TestPut(fs, longPath, "long");
+  size_t size = FS_CHUNK_THRESHOLD + 7;
+  char *big = malloc(size);
+  for (size_t i = 0; i < size; i++)
+    big[i] = (char)(i * 31);
+  FsMkfileQuiet(fs, "/t/big", NULL);
+  FsPutQuiet(fs, "/t/big", big, size, NULL);
+  FsLink(fs, "a", "/t/sym", true);
+  FsLink(fs, "/t/a", "/t/deep/hard", false);
+  int fd = open(archive, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  CHECK(fd >= 0);
+  FsImportStats written = {0};
+  CHECK_EQ(FsTarWrite(fs, "/t", fd, &written), FS_OK);
+  CHECK_EQ(written.files, 5);
+  CHECK_EQ(written.directories, 3);
+  CHECK_EQ(written.symlinks, 1);
+  // 导出再导入，两棵树相同
+  lseek(fd, 0, SEEK_SET);
+  FsMkdirQuiet(fs, "/restore", NULL);
+  FsImportStats read = {0};
+  CHECK_EQ(FsTarRead(fs, fd, "/restore", &read), FS_OK);
+  CHECK_EQ(read.files, written.files);
+  CHECK_EQ(read.directories, written.directories);
+  CHECK_EQ(read.symlinks, written.symlinks);
+  CHECK_EQ(read.bytes, written.bytes);
+  CHECK_EQ(read.skipped, 0);
+  char *a = TestDump(fs, "/t"), *b = TestDump(fs, "/restore/t");
+  CHECK(a && strlen(a) > 0);
+  CHECK_STR(a, b);
+  free(a);
+  free(b);
+  // 归档中的硬链接导入后仍然共享内容
+  TestPut(fs, "/restore/t/a", "shared");
+  char *content = TestCat(fs, "/restore/t/deep/hard", NULL);
+  CHECK_STR(content, "shared");
+  free(content);
+  // 第一层名字冲突时不导入
+  lseek(fd, 0, SEEK_SET);
+  CHECK(FsTarRead(fs, fd, "/restore", &read) != FS_OK ||
+        read.skipped > 0);
+  // 损坏的归档
+  CHECK_EQ(ftruncate(fd, 700), 0);
+  lseek(fd, 0, SEEK_SET);
+  FsMkdirQuiet(fs, "/broken", NULL);
+  CHECK_EQ(FsTarRead(fs, fd, "/broken", NULL), FS_ERROR);
+  close(fd);
+  CHECK_EQ(FsFilCheck(fs->root, NULL), FS_OK);
+  FsFree(fs);
+  free(big);
+  TestRemoveHost(host);
+  free(host);
+}
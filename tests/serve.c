@@ -0,0 +1,178 @@
+//
+// fs --serve 的服务端：对运行中的服务端发送格式错误的请求
+//
+
+#include "test.h"
+#include "serve.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/// 发送一个请求并等待它的响应
+/// \return 响应的状态，连接断开时返回 -1
+static int TestServeCall(FsClient *client, FsServeOp op, const char *argv[],
+                         const size_t lengths[], uint16_t argc) {
+  FsReply reply;
+  if (FsClientSend(client, op, 0, argv, lengths, argc, NULL) ||
+      FsClientRecv(client, &reply))
+    return -1;
+  return reply.status;
+}
+
+/// 用原始的套接字发送 data，然后读到服务端关闭连接为止
+/// \return 关闭之前收到的字节数，两秒内没有关闭时返回 -1
+static long TestServeRaw(const char *sockPath, const void *data,
+                         size_t length) {
+  struct sockaddr_un addr = {AF_UNIX};
+  strcpy(addr.sun_path, sockPath);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  struct timeval timeout = {2, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  long received = send(fd, data, length, MSG_NOSIGNAL) == (ssize_t)length
+                      ? 0
+                      : -1;
+  char buf[256];
+  ssize_t n;
+  while (received >= 0 && (n = recv(fd, buf, sizeof(buf), 0)) != 0) {
+    if (n < 0)
+      received = -1;
+    else
+      received += n;
+  }
+  close(fd);
+  return received;
+}
+
+/// 拼出一个请求：长度、编号、操作、标志、参数个数，之后是 body
+/// \return 请求的字节数
+static size_t TestServeFrame(char *frame, uint32_t length, uint8_t op,
+                             uint16_t argc, const void *body,
+                             size_t bodyLength) {
+  uint32_t id = 1;
+  uint8_t flags = 0;
+  memcpy(frame, &length, 4);
+  memcpy(frame + 4, &id, 4);
+  memcpy(frame + 8, &op, 1);
+  memcpy(frame + 9, &flags, 1);
+  memcpy(frame + 10, &argc, 2);
+  memcpy(frame + 12, body, bodyLength);
+  return 12 + bodyLength;
+}
+
+void TestServe(void) {
+  char *host = TestTempDir();
+  CHECK(host != NULL);
+  if (!host)
+    return;
+  char sockPath[PATH_MAX];
+  snprintf(sockPath, sizeof(sockPath), "%s/fs.sock", host);
+  Fs fs = FsNew();
+  FsServer *server = NULL;
+  CHECK_EQ(FsServerStart(fs, sockPath, 2, &server), FS_OK);
+  FsClient *client = server ? FsClientConnect(sockPath) : NULL;
+  CHECK(client != NULL);
+  if (!client) {
+    FsServerStop(server);
+    FsFree(fs);
+    TestRemoveHost(host);
+    free(host);
+    return;
+  }
+  CHECK_EQ(FsClientMkdir(client, "/d"), FS_OK);
+  CHECK_EQ(FsClientMkfile(client, "/d/f"), FS_OK);
+  // 空的路径参数
+  const char *empty[] = {"", "", ""};
+  const size_t zero[] = {0, 0, 0};
+  CHECK_EQ(TestServeCall(client, FS_SERVE_MKDIR, empty, zero, 1),
+           FS_NO_SUCH_FILE);
+  CHECK_EQ(TestServeCall(client, FS_SERVE_MKFILE, empty, zero, 1),
+           FS_NO_SUCH_FILE);
+  CHECK_EQ(TestServeCall(client, FS_SERVE_CAT, empty, zero, 1),
+           FS_NO_SUCH_FILE);
+  CHECK_EQ(TestServeCall(client, FS_SERVE_DLDIR, empty, zero, 1),
+           FS_NO_SUCH_FILE);
+  CHECK_EQ(TestServeCall(client, FS_SERVE_DL, empty, zero, 1),
+           FS_NO_SUCH_FILE);
+  const char *put[] = {"", "content"};
+  const size_t putLengths[] = {0, 7};
+  CHECK_EQ(TestServeCall(client, FS_SERVE_PUT, put, putLengths, 2),
+           FS_NO_SUCH_FILE);
+  // PUT 的内容可以为空
+  put[0] = "/d/f";
+  const size_t putEmpty[] = {4, 0};
+  CHECK_EQ(TestServeCall(client, FS_SERVE_PUT, put, putEmpty, 2), FS_OK);
+  const char *cp[] = {"/d/f", ""};
+  const size_t cpLengths[] = {4, 0};
+  CHECK_EQ(TestServeCall(client, FS_SERVE_CP, cp, cpLengths, 2),
+           FS_NO_SUCH_FILE);
+  CHECK_EQ(TestServeCall(client, FS_SERVE_MV, empty, zero, 3),
+           FS_NO_SUCH_FILE);
+  // CD、LS、TREE 的空参数与省略相同
+  CHECK_EQ(FsClientCd(client, "/d"), FS_OK);
+  CHECK_EQ(TestServeCall(client, FS_SERVE_LS, empty, zero, 1), FS_OK);
+  CHECK_EQ(TestServeCall(client, FS_SERVE_TREE, empty, zero, 1), FS_OK);
+  CHECK_EQ(TestServeCall(client, FS_SERVE_CD, empty, zero, 1), FS_OK);
+  char *cwd = FsClientPwd(client);
+  CHECK_STR(cwd, "/");
+  free(cwd);
+  // 参数个数不对
+  CHECK_EQ(TestServeCall(client, FS_SERVE_MKDIR, NULL, NULL, 0), FS_ERROR);
+  CHECK_EQ(TestServeCall(client, FS_SERVE_PUT, NULL, NULL, 0), FS_ERROR);
+  CHECK_EQ(TestServeCall(client, FS_SERVE_PUT, put, NULL, 1), FS_ERROR);
+  CHECK_EQ(TestServeCall(client, FS_SERVE_CAT, cp, NULL, 2), FS_ERROR);
+  CHECK_EQ(TestServeCall(client, FS_SERVE_PWD, cp, NULL, 1), FS_ERROR);
+  CHECK_EQ(TestServeCall(client, FS_SERVE_CP, cp, NULL, 1), FS_ERROR);
+  CHECK_EQ(TestServeCall(client, FS_SERVE_LS, cp, NULL, 2), FS_ERROR);
+  CHECK_EQ(TestServeCall(client, (FsServeOp)99, NULL, NULL, 0), FS_ERROR);
+  // 参数中含有 '\0'
+  const char *nul[] = {"/d/a\0b"};
+  const size_t nulLength[] = {6};
+  CHECK_EQ(TestServeCall(client, FS_SERVE_MKDIR, nul, nulLength, 1),
+           FS_ERROR);
+  CHECK_EQ(TestServeCall(client, FS_SERVE_CD, nul, nulLength, 1), FS_ERROR);
+  // 格式错误的请求：服务端不回复，直接关闭连接
+  char frame[64];
+  uint32_t argLength = 1;
+  char body[8];
+  memcpy(body, &argLength, 4);
+  body[4] = 'a';
+  // 参数个数比实际的多
+  size_t n = TestServeFrame(frame, 8 + 5, FS_SERVE_MKDIR, 2, body, 5);
+  CHECK_EQ(TestServeRaw(sockPath, frame, n), 0);
+  // 参数长度超出请求
+  argLength = 100;
+  memcpy(body, &argLength, 4);
+  n = TestServeFrame(frame, 8 + 5, FS_SERVE_MKDIR, 1, body, 5);
+  CHECK_EQ(TestServeRaw(sockPath, frame, n), 0);
+  // 请求中多出的字节
+  n = TestServeFrame(frame, 8 + 3, FS_SERVE_PWD, 0, "xyz", 3);
+  CHECK_EQ(TestServeRaw(sockPath, frame, n), 0);
+  // 长度比固定部分短、超过 FS_SERVE_MAX_FRAME
+  n = TestServeFrame(frame, 3, FS_SERVE_PWD, 0, "", 0);
+  CHECK_EQ(TestServeRaw(sockPath, frame, n), 0);
+  n = TestServeFrame(frame, FS_SERVE_MAX_FRAME + 1, FS_SERVE_PWD, 0, "", 0);
+  CHECK_EQ(TestServeRaw(sockPath, frame, n), 0);
+  // 服务端仍然正常工作，文件树没有被破坏
+  CHECK_EQ(FsClientMkdir(client, "/after"), FS_OK);
+  FsClient *other = FsClientConnect(sockPath);
+  CHECK(other != NULL);
+  CHECK_EQ(FsClientCd(other, "/after"), FS_OK);
+  FsClientClose(other);
+  CHECK_EQ(FsFilCheck(fs->root, NULL), FS_OK);
+  char *dump = TestDump(fs, "/");
+  CHECK_STR(dump, "d after\nd d\nf d/f = \n");
+  free(dump);
+  FsClientClose(client);
+  FsServerStop(server);
+  FsFree(fs);
+  TestRemoveHost(host);
+  free(host);
+}
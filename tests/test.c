@@ -0,0 +1,264 @@
+//
+// fs_test：按名字运行一个功能的测试，没有参数时运行所有测试
+//
+// 用法：fs_test [NAME]
+//
+
+#include "test.h"
+#include <dirent.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int testFailures;
+
+static const struct {
+  const char *name;
+  void (*run)(void);
+} testCases[] = {
+    {"cwd", TestCwd},
+    {"locking", TestLocking},
+    {"epoch", TestEpoch},
+    {"copy", TestCopy},
+    {"walk", TestWalk},
+    {"find", TestFind},
+    {"grep", TestGrep},
+    {"prefix", TestPrefix},
+    {"handle", TestHandle},
+    {"write", TestWrite},
+    {"chunks", TestChunks},
+    {"dedup", TestDedup},
+    {"compress", TestCompress},
+    {"spill", TestSpill},
+    {"links", TestLinks},
+    {"snapshot", TestSnapshot},
+    {"tx", TestTx},
+    {"rename", TestRename},
+    {"batch", TestBatch},
+    {"readdir", TestReaddir},
+    {"quiet", TestQuiet},
+    {"build", TestBuild},
+    {"import", TestImport},
+    {"tar", TestTar},
+    {"serve", TestServe},
+};
+
+/// 找到路径上的普通文件
+/// \return 不存在或者是文件夹时返回 NULL
+FIL *TestFile(Fs fs, const char *pathStr) {
+  FIL *file = NULL;
+  PATH *path = NULL;
+  if (FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path) == FS_OK)
+    file = FsPathGetTail(path)->file;
+  FsPathFree(path);
+  return file && file->type == REGULAR_FILE ? file : NULL;
+}
+
+static bool TestExists(Fs fs, const char *pathStr) {
+  PATH *path = NULL;
+  FsErrors res = FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path);
+  FsPathFree(path);
+  return res == FS_OK;
+}
+
+/// 按路径列表创建文件，以 '/' 结尾的路径创建文件夹，
+/// 缺少的上层文件夹一并创建
+void TestMake(Fs fs, const char *paths[], size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    char *path = strdup(paths[i]);
+    size_t length = strlen(path);
+    bool dir = length > 1 && path[length - 1] == FS_SPLIT;
+    if (dir)
+      path[--length] = '\0';
+    for (char *p = strchr(path + 1, FS_SPLIT); p; p = strchr(p + 1, FS_SPLIT)) {
+      *p = '\0';
+      if (!TestExists(fs, path))
+        FsMkdir(fs, path);
+      *p = FS_SPLIT;
+    }
+    if (dir)
+      FsMkdir(fs, path);
+    else
+      FsMkfile(fs, path);
+    free(path);
+  }
+}
+
+/// 与 FsCat 一样在 epoch 临界区中不加锁地读出文件的全部内容，
+/// 事务进行时其他线程也可以读取
+/// \param fs
+/// \param pathStr
+/// \param length 内容的字节数，可以为 NULL
+/// \return 以 '\0' 结尾，由调用者释放；出错时返回 NULL
+char *TestCat(Fs fs, const char *pathStr, size_t *length) {
+  char *data = NULL;
+  size_t total = 0;
+  PATH *path = NULL;
+  FsEpochEnter();
+  if (FsPathParse(FsCwdGet(fs)->pathRoot, pathStr, &path) == FS_OK &&
+      FsPathGetTail(path)->file->type == REGULAR_FILE) {
+    FIL *file = FsFilTarget(FsPathGetTail(path)->file);
+    FIL_CONTENT *content = FsFilContentLoad(fs, file, &total);
+    if (!content)
+      total = 0;
+    data = malloc(total + 1);
+    for (size_t offset = 0; offset < total;) {
+      const char *segment;
+      size_t n = FsContentSegment(content, total, offset, &segment);
+      memcpy(data + offset, segment, n);
+      offset += n;
+    }
+    data[total] = '\0';
+  }
+  FsPathFree(path);
+  FsEpochExit();
+  if (length)
+    *length = total;
+  return data;
+}
+
+/// 把文件的内容替换为字符串 content
+void TestPut(Fs fs, const char *pathStr, const char *content) {
+  FsPut(fs, (char *)pathStr, (char *)content);
+}
+
+void TestIgnoreData(const char *data, size_t length, void *ctx) {}
+
+// TestDump 拼接输出
+typedef struct {
+  char *data;
+  size_t length;
+} TestBuffer;
+
+static void TestAppend(TestBuffer *buf, const char *data, size_t length) {
+  buf->data = realloc(buf->data, buf->length + length + 1);
+  memcpy(buf->data + buf->length, data, length);
+  buf->length += length;
+  buf->data[buf->length] = '\0';
+}
+
+typedef struct {
+  size_t skip;
+  size_t count;
+  char **paths;
+  char *kinds;
+  char **symlinks;
+} TestDumpList;
+
+static FsWalkAction TestDumpVisit(const FsWalkEntry *entry, void *ctx) {
+  TestDumpList *list = ctx;
+  if (entry->depth == 0)
+    return FS_WALK_CONTINUE;
+  size_t i = list->count++;
+  list->paths = realloc(list->paths, sizeof(char *) * list->count);
+  list->kinds = realloc(list->kinds, list->count);
+  list->symlinks = realloc(list->symlinks, sizeof(char *) * list->count);
+  list->paths[i] = strdup(entry->path + list->skip);
+  list->symlinks[i] = NULL;
+  if (entry->file->type == DIRECTORY) {
+    list->kinds[i] = 'd';
+  } else if (entry->file->symlink) {
+    list->kinds[i] = 'l';
+    list->symlinks[i] = strdup(entry->file->symlink);
+  } else {
+    list->kinds[i] = 'f';
+  }
+  return FS_WALK_CONTINUE;
+}
+
+/// 把文件夹中的文件树按先序、字典序写成文本，用于比较两棵树：
+/// 每项一行，为类型、相对路径和文件内容或者符号链接指向的路径
+/// \param fs
+/// \param pathStr
+/// \return 由调用者释放；出错时返回 NULL
+char *TestDump(Fs fs, const char *pathStr) {
+  TestDumpList list = {strlen(pathStr)};
+  if (FsWalk(fs, pathStr, TestDumpVisit, &list, FS_WALK_ORDERED))
+    return NULL;
+  TestBuffer buf = {NULL, 0};
+  TestAppend(&buf, "", 0);
+  for (size_t i = 0; i < list.count; i++) {
+    char head[4] = {list.kinds[i], ' ', '\0'};
+    TestAppend(&buf, head, 2);
+    TestAppend(&buf, list.paths[i], strlen(list.paths[i]));
+    if (list.kinds[i] == 'l') {
+      TestAppend(&buf, " -> ", 4);
+      TestAppend(&buf, list.symlinks[i], strlen(list.symlinks[i]));
+    } else if (list.kinds[i] == 'f') {
+      char *path = malloc(strlen(pathStr) + strlen(list.paths[i]) + 1);
+      sprintf(path, "%s%s", pathStr, list.paths[i]);
+      size_t length = 0;
+      char *content = TestCat(fs, path, &length);
+      TestAppend(&buf, " = ", 3);
+      if (content)
+        TestAppend(&buf, content, length);
+      free(content);
+      free(path);
+    }
+    TestAppend(&buf, "\n", 1);
+    free(list.paths[i]);
+    free(list.symlinks[i]);
+  }
+  free(list.paths);
+  free(list.kinds);
+  free(list.symlinks);
+  return buf.data;
+}
+
+/// 在宿主机的临时文件夹中创建一个新的文件夹
+/// \return 由调用者释放，用 TestRemoveHost 删除
+char *TestTempDir(void) {
+  const char *tmp = getenv("TMPDIR");
+  char *path = malloc(PATH_MAX);
+  snprintf(path, PATH_MAX, "%s/fs_test.XXXXXX", tmp ? tmp : "/tmp");
+  if (!mkdtemp(path)) {
+    free(path);
+    return NULL;
+  }
+  return path;
+}
+
+/// 删除宿主机上的文件或者整个文件夹，不跟随符号链接
+void TestRemoveHost(const char *hostPath) {
+  struct stat st;
+  if (lstat(hostPath, &st))
+    return;
+  if (S_ISDIR(st.st_mode)) {
+    DIR *dir = opendir(hostPath);
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir))) {
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        continue;
+      char *child = malloc(strlen(hostPath) + strlen(entry->d_name) + 2);
+      sprintf(child, "%s/%s", hostPath, entry->d_name);
+      TestRemoveHost(child);
+      free(child);
+    }
+    if (dir)
+      closedir(dir);
+    rmdir(hostPath);
+  } else {
+    unlink(hostPath);
+  }
+}
+
+int main(int argc, char **argv) {
+  bool found = false;
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(testCases) / sizeof(testCases[0]); i++) {
+    if (argc > 1 && strcmp(argv[1], testCases[i].name) != 0)
+      continue;
+    found = true;
+    testFailures = 0;
+    testCases[i].run();
+    printf("%-10s %s\n", testCases[i].name, testFailures ? "FAILED" : "OK");
+    fflush(stdout);
+    if (testFailures)
+      failed++;
+  }
+  if (!found) {
+    printf("fs_test: '%s': no such test\n", argv[1]);
+    return 1;
+  }
+  return failed ? 1 : 0;
+}
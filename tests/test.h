@@ -0,0 +1,102 @@
+// 按功能划分的测试，所有测试编译为 fs_test，见 test.c。
+// ctest 对每个功能运行一次 fs_test NAME，失败的断言打印位置后继续执行
+
+#ifndef TEST_H
+#define TEST_H
+
+#include "FileType.h"
+#include "utility.h"
+#ifdef PATH_MAX
+#undef PATH_MAX
+#endif
+#include "Fs.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// 当前测试中失败的断言数量
+extern int testFailures;
+
+#define CHECK(expr)                                                            \
+  do {                                                                         \
+    if (!(expr)) {                                                             \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr);          \
+      testFailures++;                                                          \
+    }                                                                          \
+  } while (0)
+
+// 比较两个整数，失败时打印两边的值
+#define CHECK_EQ(a, b)                                                         \
+  do {                                                                         \
+    long long testA = (long long)(a), testB = (long long)(b);                  \
+    if (testA != testB) {                                                      \
+      printf("%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__,       \
+             __LINE__, #a, #b, testA, testB);                                  \
+      testFailures++;                                                          \
+    }                                                                          \
+  } while (0)
+
+// 比较两个字符串，NULL 与任何字符串都不相等
+#define CHECK_STR(a, b)                                                        \
+  do {                                                                         \
+    const char *testA = (a), *testB = (b);                                     \
+    if (!testA || !testB || strcmp(testA, testB) != 0) {                       \
+      printf("%s:%d: CHECK_STR(%s, %s) failed: '%s' != '%s'\n", __FILE__,      \
+             __LINE__, #a, #b, testA ? testA : "(null)",                       \
+             testB ? testB : "(null)");                                        \
+      testFailures++;                                                          \
+    }                                                                          \
+  } while (0)
+
+char *TestCat(Fs fs, const char *pathStr, size_t *length);
+
+void TestPut(Fs fs, const char *pathStr, const char *content);
+
+void TestIgnoreData(const char *data, size_t length, void *ctx);
+
+FIL *TestFile(Fs fs, const char *pathStr);
+
+void TestMake(Fs fs, const char *paths[], size_t n);
+
+char *TestDump(Fs fs, const char *pathStr);
+
+char *TestTempDir(void);
+
+void TestRemoveHost(const char *hostPath);
+
+// tree.c
+void TestCwd(void);
+void TestLocking(void);
+void TestEpoch(void);
+void TestCopy(void);
+void TestWalk(void);
+void TestFind(void);
+void TestGrep(void);
+void TestPrefix(void);
+void TestRename(void);
+void TestBatch(void);
+void TestReaddir(void);
+void TestQuiet(void);
+void TestBuild(void);
+
+// content.c
+void TestHandle(void);
+void TestWrite(void);
+void TestChunks(void);
+void TestDedup(void);
+void TestCompress(void);
+void TestSpill(void);
+
+// version.c
+void TestLinks(void);
+void TestSnapshot(void);
+void TestTx(void);
+
+// import.c
+void TestImport(void);
+void TestTar(void);
+
+// serve.c
+void TestServe(void);
+
+#endif
@@ -0,0 +1,729 @@
+//
+// 文件树的并发修改、遍历、查找和批量操作
+//
+
+#include "test.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+// 并发测试的线程数和每个线程的操作次数
+#define TEST_THREADS 8
+#define TEST_ROUNDS 200
+// 并发读写的文件内容的字节数
+#define TEST_EPOCH_SIZE 4096
+
+typedef struct {
+  Fs fs;
+  int id;
+  atomic_bool *running;
+  // 读到的不一致的内容数量
+  atomic_int *torn;
+} TestWorker;
+
+// 进入自己的文件夹，用相对路径创建、写入文件，同时检查工作目录不变
+static void *TestCwdRun(void *arg) {
+  TestWorker *w = arg;
+  char dir[64], path[64], cwd[PATH_MAX + 1];
+  sprintf(dir, "/c%d", w->id);
+  FsCd(w->fs, dir);
+  for (int i = 0; i < TEST_ROUNDS; i++) {
+    sprintf(path, "f%d", i);
+    FsMkfile(w->fs, path);
+    TestPut(w->fs, path, path);
+    FsGetCwd(w->fs, cwd);
+    if (strcmp(cwd, dir) != 0)
+      atomic_fetch_add(w->torn, 1);
+  }
+  return NULL;
+}
+
+typedef struct {
+  Fs fs;
+  pthread_barrier_t *barrier;
+  char cwd[PATH_MAX + 1];
+} TestGone;
+
+// 进入 /gone/sub，等另一个线程删除 /gone 后检查工作目录
+static void *TestCwdGoneRun(void *arg) {
+  TestGone *g = arg;
+  FsCd(g->fs, "/gone/sub");
+  pthread_barrier_wait(g->barrier);
+  pthread_barrier_wait(g->barrier);
+  FsGetCwd(g->fs, g->cwd);
+  FsMkfile(g->fs, "rel");
+  return NULL;
+}
+
+void TestCwd(void) {
+  Fs fs = FsNew();
+  atomic_int torn = 0;
+  pthread_t tids[TEST_THREADS];
+  TestWorker workers[TEST_THREADS];
+  for (int i = 0; i < TEST_THREADS; i++) {
+    char path[64];
+    sprintf(path, "/c%d", i);
+    FsMkdir(fs, path);
+  }
+  for (int i = 0; i < TEST_THREADS; i++) {
+    workers[i] = (TestWorker){fs, i, NULL, &torn};
+    pthread_create(&tids[i], NULL, TestCwdRun, &workers[i]);
+  }
+  for (int i = 0; i < TEST_THREADS; i++)
+    pthread_join(tids[i], NULL);
+  CHECK_EQ(atomic_load(&torn), 0);
+  // 其他线程的 cd 不影响这个线程
+  char cwd[PATH_MAX + 1];
+  FsGetCwd(fs, cwd);
+  CHECK_STR(cwd, "/");
+  for (int i = 0; i < TEST_THREADS; i++) {
+    for (int j = 0; j < TEST_ROUNDS; j++) {
+      char path[64];
+      sprintf(path, "/c%d/f%d", i, j);
+      char *content = TestCat(fs, path, NULL);
+      CHECK_STR(content, path + strlen("/c0/"));
+      free(content);
+    }
+  }
+  CHECK(TestFile(fs, "/f0") == NULL);
+  FsCd(fs, "/c1");
+  FsGetCwd(fs, cwd);
+  CHECK_STR(cwd, "/c1");
+  // 绝对路径不受工作目录影响
+  FsMkfile(fs, "/top");
+  CHECK(TestFile(fs, "/top") != NULL);
+  CHECK(TestFile(fs, "top") == NULL);
+  // 取路径的最后一个名字
+  const char *names[][2] = {{"name", "name"}, {"/d/name/", "name"}, {"/", ""}};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    char *name = FsPathStrGetName((char *)names[i][0]);
+    CHECK_STR(name, names[i][1]);
+    free(name);
+  }
+  // 工作目录所在的文件夹被其他线程删除后回到根目录
+  FsMkdirP(fs, "/gone/sub");
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, 2);
+  TestGone gone = {fs, &barrier, ""};
+  pthread_t tid;
+  pthread_create(&tid, NULL, TestCwdGoneRun, &gone);
+  pthread_barrier_wait(&barrier);
+  FsDl(fs, true, "/gone");
+  FsEpochFlush();
+  pthread_barrier_wait(&barrier);
+  pthread_join(tid, NULL);
+  pthread_barrier_destroy(&barrier);
+  CHECK_STR(gone.cwd, "/");
+  CHECK(TestFile(fs, "/rel") != NULL);
+  FsGetCwd(fs, cwd);
+  CHECK_STR(cwd, "/c1");
+  // 删除自己的工作目录也一样
+  FsMkdir(fs, "/c1/in");
+  FsCd(fs, "/c1/in");
+  FsDl(fs, true, "/c1");
+  FsEpochFlush();
+  FsGetCwd(fs, cwd);
+  CHECK_STR(cwd, "/");
+  FsMkdirP(fs, "/c1");
+  FsCd(fs, "/c1");
+  // 工作目录不再按文件系统各占一个 pthread key，
+  // 同时存在超过 PTHREAD_KEYS_MAX 个文件系统和快照也能各自 cd
+  FsMkdir(fs, "/c1/s");
+  enum { MANY = 1200 };
+  Fs *snaps = malloc(sizeof(Fs) * MANY);
+  for (int i = 0; i < MANY; i++) {
+    snaps[i] = i % 2 ? FsSnapshot(fs) : FsNew();
+    if (i % 2 == 0)
+      FsMkdirP(snaps[i], "/c1/s");
+    CHECK_EQ(FsCdQuiet(snaps[i], "/c1/s", NULL), FS_OK);
+  }
+  for (int i = 0; i < MANY; i++) {
+    FsGetCwd(snaps[i], cwd);
+    CHECK_STR(cwd, "/c1/s");
+    FsFree(snaps[i]);
+  }
+  free(snaps);
+  FsGetCwd(fs, cwd);
+  CHECK_STR(cwd, "/c1");
+  FsFree(fs);
+}
+
+// 各自在自己的文件夹中创建、写入、删除，同时在两个共享文件夹之间移动
+static void *TestLockingRun(void *arg) {
+  TestWorker *w = arg;
+  char path[64], dest[64];
+  for (int i = 0; i < TEST_ROUNDS; i++) {
+    sprintf(path, "/t%d/f%d", w->id, i);
+    FsMkfile(w->fs, path);
+    TestPut(w->fs, path, path);
+    if (i % 3 == 0)
+      FsDl(w->fs, false, path);
+    sprintf(path, "/%s/m%d", i % 2 ? "x" : "y", w->id);
+    sprintf(dest, "/%s", i % 2 ? "y" : "x");
+    char *src[] = {path, NULL};
+    FsMv(w->fs, src, dest);
+  }
+  return NULL;
+}
+
+void TestLocking(void) {
+  Fs fs = FsNew();
+  pthread_t tids[TEST_THREADS];
+  TestWorker workers[TEST_THREADS];
+  FsMkdir(fs, "/x");
+  FsMkdir(fs, "/y");
+  for (int i = 0; i < TEST_THREADS; i++) {
+    char path[64];
+    sprintf(path, "/t%d", i);
+    FsMkdir(fs, path);
+    sprintf(path, "/y/m%d", i);
+    FsMkfile(fs, path);
+    workers[i] = (TestWorker){fs, i};
+    pthread_create(&tids[i], NULL, TestLockingRun, &workers[i]);
+  }
+  for (int i = 0; i < TEST_THREADS; i++)
+    pthread_join(tids[i], NULL);
+  // 每个线程留下三分之二的文件，移动的文件每个只在一个文件夹中
+  size_t count = 0;
+  CHECK_EQ(FsFilCheck(fs->root, &count), FS_OK);
+  CHECK_EQ(count, TEST_THREADS + 2 +
+                      TEST_THREADS * (TEST_ROUNDS - (TEST_ROUNDS + 2) / 3) +
+                      TEST_THREADS);
+  for (int i = 0; i < TEST_THREADS; i++) {
+    char x[64], y[64];
+    sprintf(x, "/x/m%d", i);
+    sprintf(y, "/y/m%d", i);
+    CHECK((TestFile(fs, x) != NULL) != (TestFile(fs, y) != NULL));
+  }
+  char *content = TestCat(fs, "/t0/f1", NULL);
+  CHECK_STR(content, "/t0/f1");
+  free(content);
+  // 移动到已有同名文件的文件夹时失败，两个文件都不变
+  FsMkfile(fs, "/x/same");
+  TestPut(fs, "/x/same", "x");
+  FsMkfile(fs, "/y/same");
+  TestPut(fs, "/y/same", "y");
+  char *src[] = {"/x/same", NULL};
+  FsMv(fs, src, "/y");
+  content = TestCat(fs, "/x/same", NULL);
+  CHECK_STR(content, "x");
+  free(content);
+  content = TestCat(fs, "/y/same", NULL);
+  CHECK_STR(content, "y");
+  free(content);
+  // 移动到自己时什么也不做
+  FsMv(fs, src, "/x/same");
+  content = TestCat(fs, "/x/same", NULL);
+  CHECK_STR(content, "x");
+  free(content);
+  // 覆盖其他文件夹中的文件时使用被覆盖的文件的名字
+  FsMkfile(fs, "/y/other");
+  FsMv(fs, src, "/y/other");
+  CHECK(TestFile(fs, "/x/same") == NULL);
+  CHECK(TestFile(fs, "/y/same") != NULL);
+  content = TestCat(fs, "/y/other", NULL);
+  CHECK_STR(content, "x");
+  free(content);
+  CHECK_EQ(FsFilCheck(fs->root, NULL), FS_OK);
+  FsFree(fs);
+}
+
+static void TestEpochCheck(const char *data, size_t length, TestWorker *w) {
+  for (size_t i = 1; i < length; i++) {
+    if (data[i] != data[0]) {
+      atomic_fetch_add(w->torn, 1);
+      return;
+    }
+  }
+}
+
+static void TestEpochName(FIL *file, const char *name, void *ctx) {
+  TestWorker *w = ctx;
+  if (name[0] != 'a' && name[0] != 'b' && name[0] != 'n')
+    atomic_fetch_add(w->torn, 1);
+}
+
+// 无锁读者：内容总是整块相同的字节，文件名总是写者用过的名字
+static void *TestEpochRead(void *arg) {
+  TestWorker *w = arg;
+  while (atomic_load(w->running)) {
+    size_t length = 0;
+    char *content = TestCat(w->fs, "/d/a", &length);
+    if (content) {
+      TestEpochCheck(content, length, w);
+      if (length != 0 && length != TEST_EPOCH_SIZE)
+        atomic_fetch_add(w->torn, 1);
+    }
+    free(content);
+    FsPrefix(w->fs, "/d", "", TestEpochName, w);
+  }
+  return NULL;
+}
+
+void TestEpoch(void) {
+  Fs fs = FsNew();
+  FsMkdir(fs, "/d");
+  FsMkfile(fs, "/d/a");
+  atomic_bool running = true;
+  atomic_int torn = 0;
+  pthread_t tids[TEST_THREADS];
+  TestWorker readers[TEST_THREADS];
+  for (int i = 0; i < TEST_THREADS; i++) {
+    readers[i] = (TestWorker){fs, i, &running, &torn};
+    pthread_create(&tids[i], NULL, TestEpochRead, &readers[i]);
+  }
+  char content[TEST_EPOCH_SIZE + 1];
+  content[TEST_EPOCH_SIZE] = '\0';
+  for (int i = 0; i < TEST_ROUNDS * 10; i++) {
+    memset(content, 'a' + i % 26, TEST_EPOCH_SIZE);
+    TestPut(fs, "/d/a", content);
+    char name[16];
+    sprintf(name, "/d/n%d", i % 16);
+    if (i % 32 < 16)
+      FsMkfile(fs, name);
+    else
+      FsDl(fs, false, name);
+    char *src[] = {"/d/a", NULL};
+    FsMv(fs, src, "/d/b");
+    src[0] = "/d/b";
+    FsMv(fs, src, "/d/a");
+  }
+  atomic_store(&running, false);
+  for (int i = 0; i < TEST_THREADS; i++)
+    pthread_join(tids[i], NULL);
+  CHECK_EQ(atomic_load(&torn), 0);
+  CHECK_EQ(FsFilCheck(fs->root, NULL), FS_OK);
+  FsFree(fs);
+}
+
+/// 创建有 n 个文件的文件树 root/dI/sJ/fK，每三个文件中的一个写入自己的路径
+static void TestBuildTree(Fs fs, const char *root, size_t n) {
+  char path[128];
+  FsMkdir(fs, (char *)root);
+  for (size_t i = 0; i < 7; i++) {
+    sprintf(path, "%s/d%zu", root, i);
+    FsMkdir(fs, path);
+    for (size_t j = 0; j < 5; j++) {
+      sprintf(path, "%s/d%zu/s%zu", root, i, j);
+      FsMkdir(fs, path);
+    }
+  }
+  for (size_t i = 0; i < n; i++) {
+    sprintf(path, "%s/d%zu/s%zu/f%zu", root, i % 7, i % 5, i);
+    FsMkfile(fs, path);
+    if (i % 3 == 0)
+      TestPut(fs, path, path + strlen(root));
+  }
+}
+
+/// 比较两棵 TestBuildTree 创建的树
+/// \return 内容不同或者缺少的文件数量
+static size_t TestBuildTreeDiff(Fs fs, const char *a, const char *b, size_t n) {
+  size_t diff = 0;
+  char path[128];
+  for (size_t i = 0; i < n; i++) {
+    sprintf(path, "%s/d%zu/s%zu/f%zu", a, i % 7, i % 5, i);
+    char *x = TestCat(fs, path, NULL);
+    sprintf(path, "%s/d%zu/s%zu/f%zu", b, i % 7, i % 5, i);
+    char *y = TestCat(fs, path, NULL);
+    if (!x || !y || strcmp(x, y) != 0)
+      diff++;
+    free(x);
+    free(y);
+  }
+  return diff;
+}
+
+void TestCopy(void) {
+  Fs fs = FsNew();
+  // 超过 FS_COPY_PARALLEL_MIN 时并行复制
+  size_t n = FS_COPY_PARALLEL_MIN * 2;
+  TestBuildTree(fs, "/src", n);
+  char *src[] = {"/src", NULL};
+  FsCp(fs, true, src, "/dst");
+  size_t count = 0;
+  CHECK_EQ(FsFilCheck(fs->root, &count), FS_OK);
+  CHECK_EQ(count, 2 * (1 + 7 + 7 * 5 + n));
+  CHECK_EQ(TestBuildTreeDiff(fs, "/src", "/dst", n), 0);
+  // 复制之后互不影响
+  TestPut(fs, "/dst/d0/s0/f0", "changed");
+  char *content = TestCat(fs, "/src/d0/s0/f0", NULL);
+  CHECK_STR(content, "/d0/s0/f0");
+  free(content);
+  CHECK_EQ(TestBuildTreeDiff(fs, "/src", "/dst", n), 1);
+  // 复制到自己里面时复制的是插入之前的整棵树
+  FsCp(fs, true, src, "/src/d0");
+  CHECK(TestFile(fs, "/src/d0/src/d0/s0/f0") != NULL);
+  CHECK(TestFile(fs, "/src/d0/src/d0/src/d0/s0/f0") == NULL);
+  CHECK_EQ(FsFilCheck(fs->root, NULL), FS_OK);
+  // 复制单个文件到新名字时带上内容
+  char *file[] = {"/src/d0/s0/f0", NULL};
+  FsCp(fs, false, file, "/copy");
+  content = TestCat(fs, "/copy", NULL);
+  CHECK_STR(content, "/d0/s0/f0");
+  free(content);
+  FsFree(fs);
+}
+
+typedef struct {
+  atomic_size_t files;
+  atomic_size_t dirs;
+  const char *prune;
+} TestWalkCount;
+
+static FsWalkAction TestWalkVisit(const FsWalkEntry *entry, void *ctx) {
+  TestWalkCount *count = ctx;
+  if (entry->file->type == DIRECTORY) {
+    atomic_fetch_add(&count->dirs, 1);
+    if (count->prune && strcmp(entry->path, count->prune) == 0)
+      return FS_WALK_PRUNE;
+  } else {
+    atomic_fetch_add(&count->files, 1);
+  }
+  return FS_WALK_CONTINUE;
+}
+
+static FsWalkAction TestWalkStop(const FsWalkEntry *entry, void *ctx) {
+  (*(size_t *)ctx)++;
+  return FS_WALK_STOP;
+}
+
+void TestWalk(void) {
+  Fs fs = FsNew();
+  TestBuildTree(fs, "/w", 700);
+  // 有序模式和多线程的无序模式访问到的文件相同
+  TestWalkCount ordered = {0}, parallel = {0};
+  CHECK_EQ(FsWalk(fs, "/w", TestWalkVisit, &ordered, FS_WALK_ORDERED), FS_OK);
+  CHECK_EQ(FsWalk(fs, "/w", TestWalkVisit, &parallel, 4), FS_OK);
+  CHECK_EQ(ordered.files, 700);
+  CHECK_EQ(ordered.dirs, 1 + 7 + 7 * 5);
+  CHECK_EQ(parallel.files, ordered.files);
+  CHECK_EQ(parallel.dirs, ordered.dirs);
+  // 剪掉的文件夹本身被访问，其中的文件不被访问
+  TestWalkCount pruned = {0, 0, "/w/d0"};
+  CHECK_EQ(FsWalk(fs, "/w", TestWalkVisit, &pruned, 4), FS_OK);
+  CHECK_EQ(pruned.files, 600);
+  CHECK_EQ(pruned.dirs, 1 + 7 + 6 * 5);
+  size_t visited = 0;
+  CHECK_EQ(FsWalk(fs, "/w", TestWalkStop, &visited, FS_WALK_ORDERED), FS_OK);
+  CHECK_EQ(visited, 1);
+  CHECK_EQ(FsWalk(fs, "/missing", TestWalkVisit, &ordered, 4),
+           FS_NO_SUCH_FILE);
+  FsFree(fs);
+}
+
+// 按顺序拼接找到的路径
+static void TestFindCollect(const FsWalkEntry *entry, void *ctx) {
+  char *out = ctx;
+  strcat(out, entry->path);
+  strcat(out, " ");
+}
+
+void TestFind(void) {
+  Fs fs = FsNew();
+  const char *paths[] = {"/p/a.c", "/p/b.h", "/p/sub/c.c", "/p/sub/deep/d.c",
+                         "/p/x.c/"};
+  TestMake(fs, paths, 5);
+  TestPut(fs, "/p/a.c", "0123456789");
+  char out[256] = "";
+  CHECK_EQ(FsFind(fs, "/p", "*.c", NULL, TestFindCollect, out), FS_OK);
+  CHECK_STR(out, "/p/a.c /p/sub/c.c /p/sub/deep/d.c /p/x.c ");
+  FsFindFlags flags = FS_FIND_FLAGS_ANY;
+  flags.type = REGULAR_FILE;
+  flags.maxDepth = 2;
+  out[0] = '\0';
+  CHECK_EQ(FsFind(fs, "/p", "*.c", &flags, TestFindCollect, out), FS_OK);
+  CHECK_STR(out, "/p/a.c /p/sub/c.c ");
+  flags = (FsFindFlags)FS_FIND_FLAGS_ANY;
+  flags.minSize = 5;
+  out[0] = '\0';
+  CHECK_EQ(FsFind(fs, "/p", NULL, &flags, TestFindCollect, out), FS_OK);
+  CHECK_STR(out, "/p/a.c ");
+  CHECK(FsGlobMatch("[a-c]?.\\*", "b1.*"));
+  CHECK(!FsGlobMatch("[!a-c]*", "b1"));
+  CHECK(FsGlobMatch("*a*b*c", "xxaxxbxxc"));
+  FsFree(fs);
+}
+
+static void TestGrepCollect(const char *path, size_t line, const char *text,
+                            size_t length, void *ctx) {
+  char *out = ctx;
+  sprintf(out + strlen(out), "%s:%zu:%.*s|", path, line, (int)length, text);
+}
+
+void TestGrep(void) {
+  Fs fs = FsNew();
+  FsMkdir(fs, "/g");
+  FsMkfile(fs, "/g/a");
+  FsMkfile(fs, "/g/b");
+  FsMkfile(fs, "/g/big");
+  TestPut(fs, "/g/a", "one needle\ntwo\nneedle three");
+  TestPut(fs, "/g/b", "nothing here\n");
+  // 匹配的行跨越分块存储的块边界
+  size_t size = FS_CHUNK_THRESHOLD + FS_CHUNK_SIZE;
+  char *big = malloc(size + 1);
+  memset(big, 'x', size);
+  big[size] = '\0';
+  for (size_t i = 99; i < size; i += 100)
+    big[i] = '\n';
+  memcpy(big + FS_CHUNK_THRESHOLD - 3, "needle", 6);
+  TestPut(fs, "/g/big", big);
+  free(big);
+  char out[4096] = "";
+  CHECK_EQ(FsGrep(fs, "/g", "needle", TestGrepCollect, out, 4), FS_OK);
+  char expect[4096];
+  char line[128];
+  memset(line, 'x', 99);
+  line[99] = '\0';
+  size_t start = (FS_CHUNK_THRESHOLD - 3) / 100 * 100;
+  memcpy(line + FS_CHUNK_THRESHOLD - 3 - start, "needle", 6);
+  sprintf(expect, "/g/a:1:one needle|/g/a:3:needle three|/g/big:%zu:%s|",
+          start / 100 + 1, line);
+  CHECK_STR(out, expect);
+  // 各种长度的子串和不对齐的位置
+  char hay[300];
+  for (size_t i = 0; i < sizeof(hay); i++)
+    hay[i] = 'a' + i % 7;
+  for (size_t m = 1; m < 40; m++) {
+    for (size_t at = 0; at + m <= sizeof(hay); at += 13) {
+      const char *found = FsMemFind(hay, sizeof(hay), hay + at, m);
+      CHECK(found && found <= hay + at && memcmp(found, hay + at, m) == 0);
+    }
+  }
+  CHECK(FsMemFind(hay, sizeof(hay), "zz", 2) == NULL);
+  FsFree(fs);
+}
+
+static void TestPrefixCollect(FIL *file, const char *name, void *ctx) {
+  char *out = ctx;
+  strcat(out, name);
+  strcat(out, " ");
+}
+
+void TestPrefix(void) {
+  Fs fs = FsNew();
+  const char *paths[] = {"/r/apple", "/r/apply", "/r/apt/", "/r/b",
+                         "/r/ap",    "/r/a"};
+  TestMake(fs, paths, 6);
+  char out[256] = "";
+  CHECK_EQ(FsPrefix(fs, "/r", "ap", TestPrefixCollect, out), FS_OK);
+  CHECK_STR(out, "ap apple apply apt ");
+  out[0] = '\0';
+  CHECK_EQ(FsPrefix(fs, "/r", "appl", TestPrefixCollect, out), FS_OK);
+  CHECK_STR(out, "apple apply ");
+  out[0] = '\0';
+  CHECK_EQ(FsPrefix(fs, "/r", "c", TestPrefixCollect, out), FS_OK);
+  CHECK_STR(out, "");
+  out[0] = '\0';
+  CHECK_EQ(FsPrefix(fs, "/r", "", TestPrefixCollect, out), FS_OK);
+  CHECK_STR(out, "a ap apple apply apt b ");
+  FsFree(fs);
+}
+
+void TestRename(void) {
+  Fs fs = FsNew();
+  FsMkdir(fs, "/d");
+  FsMkfile(fs, "/d/a");
+  TestPut(fs, "/d/a", "content");
+  FsHandle *handle = NULL;
+  CHECK_EQ(FsOpen(fs, "/d/a", FS_OPEN_READ, &handle), FS_OK);
+  FIL *file = TestFile(fs, "/d/a");
+  // 同一个文件夹中改名时原地修改，节点和打开的句柄不变
+  char *src[] = {"/d/a", NULL};
+  FsMv(fs, src, "/d/z");
+  CHECK(TestFile(fs, "/d/a") == NULL);
+  CHECK(TestFile(fs, "/d/z") == file);
+  char buf[16] = "";
+  size_t bytes = 0;
+  CHECK_EQ(FsReadAt(handle, buf, sizeof(buf) - 1, 0, &bytes), FS_OK);
+  CHECK_STR(buf, "content");
+  FsClose(handle);
+  // 目标是已经存在的文件时覆盖它
+  FsMkfile(fs, "/d/y");
+  TestPut(fs, "/d/y", "old");
+  src[0] = "/d/z";
+  FsMv(fs, src, "/d/y");
+  char out[64] = "";
+  FsPrefix(fs, "/d", "", TestPrefixCollect, out);
+  CHECK_STR(out, "y ");
+  char *content = TestCat(fs, "/d/y", NULL);
+  CHECK_STR(content, "content");
+  free(content);
+  CHECK_EQ(FsFilCheck(fs->root, NULL), FS_OK);
+  FsFree(fs);
+}
+
+void TestBatch(void) {
+  Fs fs = FsNew();
+  const char *paths[] = {"/s/a", "/s/b", "/s/c/", "/s/c/d", "/t/"};
+  TestMake(fs, paths, 5);
+  TestPut(fs, "/s/c/d", "d");
+  // 一次移动多个源，找不到的源打印错误后跳过
+  char *src[] = {"/s/a", "/s/missing", "/s/c", NULL};
+  FsMv(fs, src, "/t");
+  char out[64] = "";
+  FsPrefix(fs, "/t", "", TestPrefixCollect, out);
+  CHECK_STR(out, "a c ");
+  out[0] = '\0';
+  FsPrefix(fs, "/s", "", TestPrefixCollect, out);
+  CHECK_STR(out, "b ");
+  char *content = TestCat(fs, "/t/c/d", NULL);
+  CHECK_STR(content, "d");
+  free(content);
+  // 批量复制，目标中同名的文件被替换
+  TestPut(fs, "/t/a", "new a");
+  FsMkfile(fs, "/s/a");
+  TestPut(fs, "/s/a", "old a");
+  char *copy[] = {"/t/a", "/s/missing", "/t/c", NULL};
+  FsCp(fs, true, copy, "/s");
+  out[0] = '\0';
+  FsPrefix(fs, "/s", "", TestPrefixCollect, out);
+  CHECK_STR(out, "a b c ");
+  content = TestCat(fs, "/s/a", NULL);
+  CHECK_STR(content, "new a");
+  free(content);
+  content = TestCat(fs, "/s/c/d", NULL);
+  CHECK_STR(content, "d");
+  free(content);
+  // 同名的多个源：mv 保留第一个，cp 保留最后一个
+  FsMkdir(fs, "/u");
+  FsMkdir(fs, "/v");
+  char *same[] = {"/s/a", "/t/a", NULL};
+  FsCp(fs, false, same, "/u");
+  content = TestCat(fs, "/u/a", NULL);
+  CHECK_STR(content, "new a");
+  free(content);
+  TestPut(fs, "/s/a", "first");
+  FsMv(fs, same, "/v");
+  content = TestCat(fs, "/v/a", NULL);
+  CHECK_STR(content, "first");
+  free(content);
+  CHECK(TestFile(fs, "/s/a") == NULL);
+  CHECK(TestFile(fs, "/t/a") != NULL);
+  CHECK_EQ(FsFilCheck(fs->root, NULL), FS_OK);
+  FsFree(fs);
+}
+
+void TestReaddir(void) {
+  Fs fs = FsNew();
+  const char *paths[100];
+  char names[100][16];
+  for (int i = 0; i < 100; i++) {
+    sprintf(names[i], "/r/f%02d", i);
+    paths[i] = names[i];
+  }
+  TestMake(fs, paths, 100);
+  // 每页 10 项，翻页之间删除上一页的最后一项，游标仍然有效
+  char cursor[16] = "";
+  int seen = 0;
+  for (int page = 0; page < 10; page++) {
+    FsDir *dir = NULL;
+    CHECK_EQ(FsOpendir(fs, "/r", page ? cursor : NULL, &dir), FS_OK);
+    if (!dir)
+      break;
+    const FsDirent *entry = NULL;
+    for (int i = 0; i < 10; i++) {
+      CHECK_EQ(FsReaddir(dir, &entry), FS_OK);
+      if (!entry)
+        break;
+      char expect[16];
+      sprintf(expect, "f%02d", seen++);
+      CHECK_STR(entry->name, expect);
+      CHECK_EQ(entry->type, REGULAR_FILE);
+      strcpy(cursor, entry->name);
+    }
+    FsClosedir(dir);
+    char path[32];
+    sprintf(path, "/r/%s", cursor);
+    FsDl(fs, false, path);
+  }
+  CHECK_EQ(seen, 100);
+  FsDir *dir = NULL;
+  const FsDirent *entry = NULL;
+  CHECK_EQ(FsOpendir(fs, "/r", cursor, &dir), FS_OK);
+  CHECK_EQ(FsReaddir(dir, &entry), FS_OK);
+  CHECK(entry == NULL);
+  FsClosedir(dir);
+  CHECK_EQ(FsOpendir(fs, "/r/f00", NULL, &dir), FS_NOT_A_DIRECTORY);
+  CHECK_EQ(FsOpendir(fs, "/missing", NULL, &dir), FS_NO_SUCH_FILE);
+  FsFree(fs);
+}
+
+void TestQuiet(void) {
+  Fs fs = FsNew();
+  // 空路径不指向任何文件
+  CHECK_EQ(FsMkdirQuiet(fs, "", NULL), FS_NO_SUCH_FILE);
+  CHECK_EQ(FsMkfileQuiet(fs, "", NULL), FS_NO_SUCH_FILE);
+  CHECK_EQ(FsCdQuiet(fs, "", NULL), FS_NO_SUCH_FILE);
+  CHECK_EQ(FsLsQuiet(fs, "", NULL, NULL, NULL), FS_NO_SUCH_FILE);
+  CHECK_EQ(FsTreeQuiet(fs, "", TestWalkStop, NULL, NULL), FS_NO_SUCH_FILE);
+  CHECK_EQ(FsPutQuiet(fs, "", "x", 1, NULL), FS_NO_SUCH_FILE);
+  CHECK_EQ(FsCatQuiet(fs, "", TestIgnoreData, NULL, NULL), FS_NO_SUCH_FILE);
+  CHECK_EQ(FsDldirQuiet(fs, "", NULL), FS_NO_SUCH_FILE);
+  CHECK_EQ(FsDlQuiet(fs, true, "", NULL), FS_NO_SUCH_FILE);
+  FsMkfileQuiet(fs, "/a", NULL);
+  // 多个源时每个源有自己的结果
+  FsErrors results[2];
+  FsErrorInfo info = {.results = results};
+  char *src[] = {"/a", "/missing", NULL};
+  FsMkdirQuiet(fs, "/t", NULL);
+  CHECK_EQ(FsCpQuiet(fs, false, src, "/t", &info), FS_NO_SUCH_FILE);
+  CHECK_EQ(results[0], FS_OK);
+  CHECK_EQ(results[1], FS_NO_SUCH_FILE);
+  CHECK(TestFile(fs, "/t/a") != NULL);
+  src[1] = "";
+  CHECK_EQ(FsCpQuiet(fs, false, src, "/b", &info), FS_NO_SUCH_FILE);
+  CHECK_EQ(results[1], FS_NO_SUCH_FILE);
+  CHECK_EQ(FsMvQuiet(fs, src, "", NULL), FS_NO_SUCH_FILE);
+  // 错误详情指向出错的路径
+  CHECK_EQ(FsMkdirQuiet(fs, "/a/b", &info), FS_NOT_A_DIRECTORY);
+  CHECK_STR(info.path, "/a/b");
+  CHECK_EQ(FsMkdirQuiet(fs, "/x/y", &info), FS_NO_SUCH_FILE);
+  CHECK(!info.last);
+  CHECK_EQ(FsMkdirQuiet(fs, "/a", &info), FS_FILE_EXISTS);
+  CHECK(info.last);
+  CHECK_EQ(FsCatQuiet(fs, "/", TestIgnoreData, NULL, &info),
+           FS_IS_A_DIRECTORY);
+  CHECK_EQ(FsMkdirQuiet(NULL, "/a", NULL), FS_ERROR);
+  // 静默接口不打印，cd 之后相对路径从新的工作目录开始
+  CHECK_EQ(FsMkdirQuiet(fs, "/d", NULL), FS_OK);
+  CHECK_EQ(FsCdQuiet(fs, "/d", NULL), FS_OK);
+  CHECK_EQ(FsMkfileQuiet(fs, "f", NULL), FS_OK);
+  CHECK(TestFile(fs, "/d/f") != NULL);
+  char cwd[PATH_MAX + 1];
+  FsGetCwd(fs, cwd);
+  CHECK_STR(cwd, "/d");
+  CHECK_EQ(FsCdQuiet(fs, NULL, NULL), FS_OK);
+  FsGetCwd(fs, cwd);
+  CHECK_STR(cwd, "/");
+  FsFree(fs);
+}
+
+void TestBuild(void) {
+  Fs fs = FsNew();
+  CHECK_EQ(FsMkdirP(fs, "/a/b/c"), FS_OK);
+  CHECK_EQ(FsMkdirP(fs, "/a/b/c"), FS_OK);
+  CHECK_EQ(FsMkdirP(fs, "/a/b/c/d/e"), FS_OK);
+  FsMkfileQuiet(fs, "/a/file", NULL);
+  CHECK_EQ(FsMkdirP(fs, "/a/file"), FS_FILE_EXISTS);
+  CHECK_EQ(FsMkdirP(fs, "/a/file/x"), FS_NOT_A_DIRECTORY);
+  // 已有的文件夹直接使用，冲突的路径单独失败
+  const char *paths[] = {"/a/b/n1", "/a/b/c/", "/x/y/z/", "/a/file",
+                         "/a/file/q", "/x/y/z/f", "/a/b/n1"};
+  FsErrors results[7];
+  FsErrorInfo info = {.results = results};
+  CHECK(FsBuildFromPaths(fs, paths, 7, &info) != FS_OK);
+  CHECK_EQ(results[0], FS_OK);
+  CHECK_EQ(results[1], FS_OK);
+  CHECK_EQ(results[2], FS_OK);
+  CHECK_EQ(results[3], FS_FILE_EXISTS);
+  CHECK_EQ(results[4], FS_NOT_A_DIRECTORY);
+  CHECK_EQ(results[5], FS_OK);
+  CHECK_EQ(results[6], FS_FILE_EXISTS);
+  char *dump = TestDump(fs, "/");
+  CHECK_STR(dump, "d a\nd a/b\nd a/b/c\nd a/b/c/d\nd a/b/c/d/e\nf a/b/n1 = \n"
+                  "f a/file = \nd x\nd x/y\nd x/y/z\nf x/y/z/f = \n");
+  free(dump);
+  CHECK_EQ(FsFilCheck(fs->root, NULL), FS_OK);
+  FsFree(fs);
+}
@@ -0,0 +1,216 @@
+//
+// 链接、快照和事务
+//
+
+#include "test.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+void TestLinks(void) {
+  Fs fs = FsNew();
+  FsMkdir(fs, "/d");
+  FsMkfile(fs, "/d/a");
+  TestPut(fs, "/d/a", "shared");
+  FIL *a = TestFile(fs, "/d/a");
+  CHECK(a != NULL);
+  if (!a) {
+    FsFree(fs);
+    return;
+  }
+  CHECK_EQ(a->links, 1);
+  // 硬链接只增加名字数量和引用，读写都转到同一个文件
+  CHECK_EQ(FsLink(fs, "/d/a", "/h1", false), FS_OK);
+  CHECK_EQ(FsLink(fs, "/d/a", "/d", false), FS_FILE_EXISTS);
+  FsMkdir(fs, "/e");
+  CHECK_EQ(FsLink(fs, "/d/a", "/e", false), FS_OK);
+  CHECK_EQ(a->links, 3);
+  CHECK_EQ(a->refs, 3);
+  CHECK(FsFilTarget(TestFile(fs, "/e/a")) == a);
+  TestPut(fs, "/h1", "changed");
+  char *content = TestCat(fs, "/d/a", NULL);
+  CHECK_STR(content, "changed");
+  free(content);
+  CHECK_EQ(FsLink(fs, "/d", "/h2", false), FS_IS_A_DIRECTORY);
+  // 删除原来的名字，其他名字仍然可以读写。删除的名字在读者离开之后
+  // 才释放，之后才减少名字数量
+  FsDl(fs, false, "/d/a");
+  FsEpochFlush();
+  CHECK_EQ(a->links, 2);
+  content = TestCat(fs, "/e/a", NULL);
+  CHECK_STR(content, "changed");
+  free(content);
+  FsDl(fs, false, "/h1");
+  FsEpochFlush();
+  CHECK_EQ(a->links, 1);
+  CHECK_EQ(a->refs, 1);
+  // 符号链接解析时展开，相对路径从链接所在的文件夹开始
+  CHECK_EQ(FsLink(fs, "a", "/e/s", true), FS_OK);
+  CHECK_EQ(FsLink(fs, "/e", "/se", true), FS_OK);
+  content = TestCat(fs, "/e/s", NULL);
+  CHECK_STR(content, "changed");
+  free(content);
+  content = TestCat(fs, "/se/s", NULL);
+  CHECK_STR(content, "changed");
+  free(content);
+  CHECK_EQ(FsLink(fs, "missing", "/e/dangling", true), FS_OK);
+  FsHandle *handle = NULL;
+  CHECK_EQ(FsOpen(fs, "/e/dangling", FS_OPEN_READ, &handle), FS_NO_SUCH_FILE);
+  // 成环的符号链接
+  CHECK_EQ(FsLink(fs, "/loop2", "/loop1", true), FS_OK);
+  CHECK_EQ(FsLink(fs, "/loop1", "/loop2", true), FS_OK);
+  CHECK_EQ(FsOpen(fs, "/loop1", FS_OPEN_READ, &handle), FS_TOO_MANY_LINKS);
+  // 删除符号链接本身不影响指向的文件
+  FsDl(fs, false, "/e/s");
+  CHECK(TestFile(fs, "/e/a") != NULL);
+  char *dump = TestDump(fs, "/");
+  CHECK_STR(dump, "d d\nd e\nf e/a = changed\nl e/dangling -> missing\n"
+                  "l loop1 -> /loop2\nl loop2 -> /loop1\nl se -> /e\n");
+  free(dump);
+  CHECK_EQ(FsFilCheck(fs->root, NULL), FS_OK);
+  FsFree(fs);
+}
+
+void TestSnapshot(void) {
+  Fs fs = FsNew();
+  const char *paths[] = {"/a/x", "/a/y", "/b/"};
+  TestMake(fs, paths, 3);
+  TestPut(fs, "/a/x", "old");
+  Fs snapshot = FsSnapshot(fs);
+  CHECK(snapshot != NULL);
+  if (!snapshot) {
+    FsFree(fs);
+    return;
+  }
+  CHECK(FsSnapshot(snapshot) == NULL);
+  char *before = TestDump(fs, "/");
+  // 快照之后的修改对快照不可见
+  TestPut(fs, "/a/x", "new");
+  FsHandle *handle = NULL;
+  CHECK_EQ(FsOpen(fs, "/a/y", FS_OPEN_WRITE, &handle), FS_OK);
+  CHECK_EQ(FsWriteAt(handle, "written", 7, 0), FS_OK);
+  FsClose(handle);
+  FsMkfile(fs, "/b/new");
+  FsDl(fs, false, "/a/x");
+  char *src[] = {"/a", NULL};
+  FsMv(fs, src, "/b");
+  char *after = TestDump(snapshot, "/");
+  CHECK_STR(after, before);
+  free(after);
+  char *content = TestCat(snapshot, "/a/x", NULL);
+  CHECK_STR(content, "old");
+  free(content);
+  content = TestCat(fs, "/b/a/y", NULL);
+  CHECK_STR(content, "written");
+  free(content);
+  // 快照是只读的，修改时打印错误，什么也不做
+  FsMkdir(snapshot, "/c");
+  TestPut(snapshot, "/a/x", "x");
+  FsDl(snapshot, true, "/a");
+  after = TestDump(snapshot, "/");
+  CHECK_STR(after, before);
+  free(after);
+  CHECK_EQ(FsOpen(snapshot, "/a/x", FS_OPEN_WRITE, &handle), FS_READ_ONLY);
+  CHECK_EQ(FsOpen(snapshot, "/a/x", FS_OPEN_READ, &handle), FS_OK);
+  char buf[8] = "";
+  size_t bytes = 0;
+  CHECK_EQ(FsReadAt(handle, buf, sizeof(buf) - 1, 0, &bytes), FS_OK);
+  CHECK_STR(buf, "old");
+  FsClose(handle);
+  // 两个快照各自看到自己的时刻
+  Fs second = FsSnapshot(fs);
+  TestPut(fs, "/b/a/y", "third");
+  content = TestCat(second, "/b/a/y", NULL);
+  CHECK_STR(content, "written");
+  free(content);
+  FsFree(snapshot);
+  content = TestCat(second, "/b/a/y", NULL);
+  CHECK_STR(content, "written");
+  free(content);
+  FsFree(second);
+  free(before);
+  CHECK_EQ(FsFilCheck(fs->root, NULL), FS_OK);
+  FsFree(fs);
+}
+
+typedef struct {
+  Fs fs;
+  char names[64];
+  char *content;
+} TestTxRead;
+
+static void TestTxName(FIL *file, const char *name, void *ctx) {
+  strcat(ctx, name);
+  strcat(ctx, " ");
+}
+
+// 在另一个线程中不加锁地读取，得到事务之外看到的文件树。
+// 加树的读锁的操作（FsOpen、cp 等）要等到事务结束
+static void *TestTxReader(void *arg) {
+  TestTxRead *read = arg;
+  read->names[0] = '\0';
+  FsPrefix(read->fs, "/", "", TestTxName, read->names);
+  read->content = TestCat(read->fs, "/a/x", NULL);
+  return NULL;
+}
+
+void TestTx(void) {
+  Fs fs = FsNew();
+  const char *paths[] = {"/a/x", "/a/y", "/b/z", "/c/"};
+  TestMake(fs, paths, 4);
+  TestPut(fs, "/a/x", "x0");
+  TestPut(fs, "/b/z", "z0");
+  char *before = TestDump(fs, "/");
+  CHECK_EQ(FsTxCommit(fs), FS_ERROR);
+  CHECK_EQ(FsTxAbort(fs), FS_ERROR);
+  // 撤销之后的名字、位置和内容与事务开始时相同
+  CHECK_EQ(FsTxBegin(fs), FS_OK);
+  CHECK_EQ(FsTxBegin(fs), FS_ERROR);
+  TestPut(fs, "/a/x", "x1");
+  FsMkdir(fs, "/a/new");
+  FsMkfile(fs, "/a/new/f");
+  TestPut(fs, "/a/new/f", "f");
+  char *src[] = {"/a/y", "/b", NULL};
+  FsMv(fs, src, "/c");
+  src[0] = "/c/y";
+  src[1] = NULL;
+  FsMv(fs, src, "/c/renamed");
+  FsDl(fs, true, "/c/b");
+  char *cp[] = {"/a", NULL};
+  FsCp(fs, true, cp, "/copy");
+  FsHandle *handle = NULL;
+  CHECK_EQ(FsOpen(fs, "/a/x", FS_OPEN_WRITE | FS_OPEN_APPEND, &handle), FS_OK);
+  CHECK_EQ(FsWriteAt(handle, "+", 1, 0), FS_OK);
+  FsClose(handle);
+  char *content = TestCat(fs, "/a/x", NULL);
+  CHECK_STR(content, "x1+");
+  free(content);
+  // 其他线程提交之前看不到事务中的修改
+  TestTxRead read = {fs};
+  pthread_t tid;
+  pthread_create(&tid, NULL, TestTxReader, &read);
+  pthread_join(tid, NULL);
+  CHECK_STR(read.names, "a b c ");
+  CHECK_STR(read.content, "x0");
+  free(read.content);
+  CHECK_EQ(FsTxAbort(fs), FS_OK);
+  char *after = TestDump(fs, "/");
+  CHECK_STR(after, before);
+  free(after);
+  CHECK_EQ(FsFilCheck(fs->root, NULL), FS_OK);
+  // 提交之后修改对所有线程可见
+  CHECK_EQ(FsTxBegin(fs), FS_OK);
+  TestPut(fs, "/a/x", "committed");
+  FsDl(fs, true, "/b");
+  CHECK_EQ(FsTxCommit(fs), FS_OK);
+  pthread_create(&tid, NULL, TestTxReader, &read);
+  pthread_join(tid, NULL);
+  CHECK_STR(read.names, "a c ");
+  CHECK_STR(read.content, "committed");
+  free(read.content);
+  after = TestDump(fs, "/");
+  CHECK_STR(after, "d a\nf a/x = committed\nf a/y = \nd c\n");
+  free(after);
+  free(before);
+  CHECK_EQ(FsFilCheck(fs->root, NULL), FS_OK);
+  FsFree(fs);
+}